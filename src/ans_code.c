@@ -0,0 +1,408 @@
+#include "ans_code.h"
+
+#include <string.h>
+#include <math.h>
+
+
+/* Compilers turn this into a single load on little endian machines, which
+ * the calls into io_util.c on the hot paths would prevent. */
+uint64_t _ans_code_load(const uint8_t* buffer) {
+    uint64_t value = 0;
+    for (int i = 7; i >= 0; i--) value = (value << 8) | buffer[i];
+
+    return value;
+}
+
+void _ans_code_store(uint8_t* buffer, uint64_t value) {
+    for (int i = 0; i < 8; i++) buffer[i] = (uint8_t)(value >> (8 * i));
+}
+
+int _ans_code_highest_bit(uint32_t value) {
+    int bit = 0;
+    while (value >>= 1) bit++;
+
+    return bit;
+}
+
+/* Small inputs cannot make use of a fine resolution, and every byte that
+ * occurs needs a count of its own. */
+int _ans_code_table_log(uint64_t total, int symbol_count) {
+    int table_log = ANS_CODE_DEFAULT_LOG;
+    while (table_log > ANS_CODE_MIN_LOG && ((uint64_t)1 << (table_log - 1)) >= total) {
+        table_log--;
+    }
+    while (table_log < ANS_CODE_MAX_LOG && (1 << table_log) < 2 * symbol_count) {
+        table_log++;
+    }
+
+    return table_log;
+}
+
+/* Scales the frequencies to counts adding up to 1 << <table_log>, giving
+ * every byte that occurs a count of at least 1. The rounding error is taken
+ * from, or given to, the bytes whose coded size changes least by it, which
+ * are those with the fewest occurrences per count. */
+void _ans_code_normalize(const uint64_t* frequencies, uint64_t total,
+        int table_log, uint16_t* counts) {
+    int64_t size = (int64_t)1 << table_log;
+    int64_t sum = 0;
+    for (int i = 0; i < 256; i++) {
+        counts[i] = 0;
+        if (!frequencies[i]) continue;
+
+        int64_t count = (int64_t)((double)frequencies[i] * (double)size
+            / (double)total + 0.5);
+        counts[i] = (uint16_t)(count > 0 ? count : 1);
+        sum += counts[i];
+    }
+
+    while (sum != size) {
+        int best = -1;
+        double best_weight = 0;
+        for (int i = 0; i < 256; i++) {
+            if (counts[i] < (sum > size ? 2 : 1)) continue;
+
+            double weight = (double)frequencies[i] / counts[i];
+            if (best < 0 || (sum > size ? weight < best_weight : weight > best_weight)) {
+                best = i;
+                best_weight = weight;
+            }
+        }
+
+        if (sum > size) {
+            counts[best]--;
+            sum--;
+        } else {
+            counts[best]++;
+            sum++;
+        }
+    }
+}
+
+/* Spreads the bytes over the states, each as often as its count, stepping
+ * through the table so that the states of a byte are scattered evenly. The
+ * step is odd, so every state is visited once. */
+void _ans_code_spread(const uint16_t* counts, int last_symbol, int table_log,
+        uint8_t* spread) {
+    uint32_t size = 1u << table_log;
+    uint32_t mask = size - 1;
+    uint32_t step = (size >> 1) + (size >> 3) + 3;
+    uint32_t position = 0;
+    for (int i = 0; i <= last_symbol; i++) {
+        for (uint32_t j = 0; j < counts[i]; j++) {
+            spread[position] = (uint8_t)i;
+            position = (position + step) & mask;
+        }
+    }
+}
+
+int _ans_code_build(struct ans_code* code) {
+    uint32_t size = 1u << code->table_log;
+    code->states = malloc(size * sizeof(uint16_t));
+    if (!code->states) {
+        errno = ERR_MEM_ERROR;
+        return 1;
+    }
+
+    uint8_t spread[1u << ANS_CODE_MAX_LOG];
+    _ans_code_spread(code->counts, code->last_symbol, code->table_log, spread);
+
+    uint32_t next[256];
+    uint32_t total = 0;
+    for (int i = 0; i < 256; i++) {
+        next[i] = total;
+        total += code->counts[i];
+    }
+    for (uint32_t state = 0; state < size; state++) {
+        code->states[next[spread[state]]++] = (uint16_t)(size + state);
+    }
+
+    /* A state x of a byte of count c emits enough bits to bring it into
+     * [c, 2c), which is either max_bits or one bit less. The upper 16 bits
+     * of x + delta_bits are that number. */
+    total = 0;
+    for (int i = 0; i < 256; i++) {
+        uint32_t count = code->counts[i];
+        if (count == 0) {
+            code->symbols[i].delta_bits = 0;
+            code->symbols[i].delta_state = 0;
+            continue;
+        }
+
+        int max_bits = count == 1 ? code->table_log
+            : code->table_log - _ans_code_highest_bit(count - 1);
+        uint32_t min_state = count == 1 ? size : count << max_bits;
+        code->symbols[i].delta_bits = ((uint32_t)max_bits << 16) - min_state;
+        code->symbols[i].delta_state = (int32_t)total - (int32_t)count;
+        total += count;
+    }
+
+    return 0;
+}
+
+struct ans_code* ans_code_create_from_frequencies(const uint64_t* frequencies) {
+    uint64_t total = 0;
+    int symbol_count = 0;
+    int last_symbol = -1;
+    for (int i = 0; i < 256; i++) {
+        if (!frequencies[i]) continue;
+        total += frequencies[i];
+        symbol_count++;
+        last_symbol = i;
+    }
+    if (symbol_count == 0) {
+        errno = ERR_ILLEGAL_ARG;
+        return NULL;
+    }
+
+    struct ans_code* code = malloc(sizeof(struct ans_code));
+    if (!code) {
+        errno = ERR_MEM_ERROR;
+        return NULL;
+    }
+
+    code->table_log = _ans_code_table_log(total, symbol_count);
+    code->last_symbol = last_symbol;
+    code->states = NULL;
+    _ans_code_normalize(frequencies, total, code->table_log, code->counts);
+
+    if (_ans_code_build(code)) {
+        ans_code_free(code);
+        return NULL;
+    }
+
+    return code;
+}
+
+void ans_code_free(struct ans_code* code) {
+    free(code->states);
+    free(code);
+}
+
+
+uint64_t ans_code_encoded_bits(struct ans_code* code, const uint64_t* frequencies) {
+    double bits = 0;
+    for (int i = 0; i < 256; i++) {
+        if (!frequencies[i]) continue;
+        if (!code->counts[i]) return UINT64_MAX;
+        bits += (double)frequencies[i]
+            * (code->table_log - log2((double)code->counts[i]));
+    }
+
+    return (uint64_t)ceil(bits) + (uint64_t)code->table_log + 1;
+}
+
+
+size_t ans_code_serialized_size(struct ans_code* code) {
+    return ANS_CODE_HEADER_SIZE + (size_t)(code->last_symbol + 1) * 2;
+}
+
+size_t ans_code_write_to_buffer(struct ans_code* code, uint8_t* buffer) {
+    buffer[0] = (uint8_t)code->table_log;
+    buffer[1] = (uint8_t)code->last_symbol;
+
+    size_t position = ANS_CODE_HEADER_SIZE;
+    for (int i = 0; i <= code->last_symbol; i++) {
+        buffer[position++] = (uint8_t)code->counts[i];
+        buffer[position++] = (uint8_t)(code->counts[i] >> 8);
+    }
+
+    return position;
+}
+
+size_t ans_code_table_size(const uint8_t* header) {
+    if (header[0] < ANS_CODE_MIN_LOG || header[0] > ANS_CODE_MAX_LOG) return 0;
+
+    return ANS_CODE_HEADER_SIZE + ((size_t)header[1] + 1) * 2;
+}
+
+
+size_t ans_code_encode_buffer(struct ans_code* code, const uint8_t* in_buffer,
+        size_t in_size, uint8_t* out_buffer, size_t out_capacity) {
+    const struct ans_code_symbol* symbols = code->symbols;
+    const uint16_t* states = code->states;
+    uint32_t state = 1u << code->table_log;
+
+    uint64_t bits = 0;
+    int bit_count = 0;
+    size_t position = 0;
+    size_t i = in_size;
+    while (i > 0) {
+        /* At most 4 * ANS_CODE_MAX_LOG bits are added to the 7 left over
+         * from the last flush before the next one. */
+        size_t stop = i > 4 ? i - 4 : 0;
+        while (i > stop) {
+            const struct ans_code_symbol* symbol = &symbols[in_buffer[--i]];
+            int length = (int)((state + symbol->delta_bits) >> 16);
+            bits |= (uint64_t)(state & ((1u << length) - 1)) << bit_count;
+            bit_count += length;
+            state = states[(state >> length) + symbol->delta_state];
+        }
+
+        if (position + 8 > out_capacity) return 0;
+        _ans_code_store(out_buffer + position, bits);
+        position += (size_t)(bit_count >> 3);
+        bits >>= bit_count & ~7;
+        bit_count &= 7;
+    }
+
+    /* The final state, without its implicit top bit, and the marker. */
+    bits |= (uint64_t)(state - (1u << code->table_log)) << bit_count;
+    bit_count += code->table_log;
+    bits |= (uint64_t)1 << bit_count;
+    bit_count++;
+
+    for (; bit_count > 0; bit_count -= 8) {
+        if (position >= out_capacity) return 0;
+        out_buffer[position++] = (uint8_t)bits;
+        bits >>= 8;
+    }
+
+    return position;
+}
+
+
+struct ans_code_table* ans_code_read_table(const uint8_t* buffer, size_t size) {
+    size_t table_size;
+    if (size < ANS_CODE_HEADER_SIZE
+            || (table_size = ans_code_table_size(buffer)) == 0
+            || table_size > size) {
+        errno = ERR_PARSE_ERROR;
+        return NULL;
+    }
+
+    int table_log = buffer[0];
+    int last_symbol = buffer[1];
+    uint32_t state_count = 1u << table_log;
+    uint16_t counts[256];
+    uint32_t sum = 0;
+    memset(counts, 0, sizeof(counts));
+    for (int i = 0; i <= last_symbol; i++) {
+        counts[i] = (uint16_t)(buffer[ANS_CODE_HEADER_SIZE + 2 * i]
+            | (buffer[ANS_CODE_HEADER_SIZE + 2 * i + 1] << 8));
+        sum += counts[i];
+    }
+    if (sum != state_count) {
+        errno = ERR_PARSE_ERROR;
+        return NULL;
+    }
+
+    struct ans_code_table* table = malloc(sizeof(struct ans_code_table));
+    if (!table) {
+        errno = ERR_MEM_ERROR;
+        return NULL;
+    }
+    table->table_log = table_log;
+    table->entries = malloc(state_count * sizeof(struct ans_code_entry));
+    if (!table->entries) {
+        free(table);
+        errno = ERR_MEM_ERROR;
+        return NULL;
+    }
+
+    uint8_t spread[1u << ANS_CODE_MAX_LOG];
+    _ans_code_spread(counts, last_symbol, table_log, spread);
+
+    /* The k-th state of a byte of count c, counted from c, is the one the
+     * encoder reduced its state to; the bits it emitted restore the rest. */
+    uint32_t next[256];
+    for (int i = 0; i < 256; i++) next[i] = counts[i];
+    for (uint32_t state = 0; state < state_count; state++) {
+        struct ans_code_entry* entry = &table->entries[state];
+        uint32_t reduced = next[spread[state]]++;
+        int bits = table_log - _ans_code_highest_bit(reduced);
+        entry->symbol = spread[state];
+        entry->bits = (uint8_t)bits;
+        entry->next_state = (uint16_t)((reduced << bits) - state_count);
+    }
+
+    return table;
+}
+
+void ans_code_table_free(struct ans_code_table* table) {
+    free(table->entries);
+    free(table);
+}
+
+
+/**
+ * @brief Reads a bit stream backwards from its end. The next bits are the
+ * most significant ones of <bits> not consumed yet, which holds the 8 bytes
+ * starting at <position>.
+ */
+struct _ans_code_reader {
+    const uint8_t* start;
+    const uint8_t* position;
+    uint64_t bits;
+    int consumed;
+};
+
+/* Moves the window back by the bytes consumed, but never in front of the
+ * start of the stream. Streams shorter than 8 bytes are never moved. */
+void _ans_code_refill(struct _ans_code_reader* reader) {
+    size_t step = (size_t)(reader->consumed >> 3);
+    size_t available = (size_t)(reader->position - reader->start);
+    step = step < available ? step : available;
+
+    reader->position -= step;
+    reader->consumed -= (int)step * 8;
+    if (step) reader->bits = _ans_code_load(reader->position);
+}
+
+/* Shifting by 1 and then by 63 - count leaves 0 for a count of 0 without
+ * shifting by 64. Past the start of a corrupt stream, bits read wrap around
+ * and the reader ends up having consumed more than 64 bits. */
+#define _ANS_CODE_READ(reader, count) \
+    ((((reader).bits << ((reader).consumed & 63)) >> 1) >> ((63 - (count)) & 63))
+
+int ans_code_decode_buffer(struct ans_code_table* table,
+        const uint8_t* in_buffer, size_t in_size,
+        uint8_t* out_buffer, size_t out_size) {
+    if (in_size == 0 || in_buffer[in_size - 1] == 0) {
+        errno = ERR_PARSE_ERROR;
+        return 1;
+    }
+
+    struct _ans_code_reader reader;
+    reader.start = in_buffer;
+    if (in_size >= 8) {
+        reader.position = in_buffer + in_size - 8;
+        reader.bits = _ans_code_load(reader.position);
+        reader.consumed = 0;
+    } else {
+        reader.position = in_buffer;
+        reader.bits = 0;
+        for (size_t i = 0; i < in_size; i++) {
+            reader.bits |= (uint64_t)in_buffer[i] << (8 * i);
+        }
+        reader.consumed = (int)(8 - in_size) * 8;
+    }
+    reader.consumed += 8 - _ans_code_highest_bit(in_buffer[in_size - 1]);
+
+    const struct ans_code_entry* entries = table->entries;
+    int table_log = table->table_log;
+    uint32_t state = (uint32_t)_ANS_CODE_READ(reader, table_log);
+    reader.consumed += table_log;
+
+    /* No more than 4 * ANS_CODE_MAX_LOG bits are read between refills. */
+    size_t i = 0;
+    while (i < out_size) {
+        _ans_code_refill(&reader);
+
+        size_t stop = out_size - i > 4 ? i + 4 : out_size;
+        for (; i < stop; i++) {
+            struct ans_code_entry entry = entries[state];
+            out_buffer[i] = entry.symbol;
+            state = entry.next_state + (uint32_t)_ANS_CODE_READ(reader, entry.bits);
+            reader.consumed += entry.bits;
+        }
+    }
+
+    /* The encoder started in the first state, whose top bit is implicit. */
+    if (reader.position != reader.start || reader.consumed != 64 || state != 0) {
+        errno = ERR_PARSE_ERROR;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,190 @@
+#ifndef ANS_CODE_H
+#define ANS_CODE_H
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "error.h"
+
+
+/*
+ * Table-based asymmetric numeral systems (tANS) over bytes. Unlike a
+ * Huffman code, which spends a whole number of bits on every symbol, tANS
+ * spends close to the information content of a symbol, which matters when a
+ * few bytes make up most of a block. A code is described completely by the
+ * frequencies of the bytes normalized to a power of two:
+ *
+ * table := table_log:u8 last_symbol:u8 count:u16*
+ *
+ * The <last_symbol> + 1 counts belong to the bytes 0 to <last_symbol> and add
+ * up to 1 << <table_log>. Bytes with a count of 0 cannot be encoded.
+ *
+ * The encoder walks its input backwards and writes the bits it emits from
+ * the first byte of its output on, least significant bit first. Its final
+ * state follows, then a single 1 bit marking the end of the stream. The
+ * decoder starts at that marker and reads the bits backwards, so it emits
+ * the bytes in their original order.
+ */
+
+#define ANS_CODE_HEADER_SIZE 2
+#define ANS_CODE_MAX_SIZE (ANS_CODE_HEADER_SIZE + 256 * 2)
+#define ANS_CODE_MIN_LOG 5
+#define ANS_CODE_DEFAULT_LOG 11
+#define ANS_CODE_MAX_LOG 12
+
+/** Number of bytes the output of the encoder may need beyond its payload. */
+#define ANS_CODE_SLACK 8
+
+
+/**
+ * @brief How a byte is encoded: the number of bits a state emits and where
+ * the states it moves to start in the state table.
+ */
+struct ans_code_symbol {
+    /** Added to the state, the upper 16 bits are the number of bits emitted. */
+    uint32_t delta_bits;
+    /** Added to the reduced state to find the next state. */
+    int32_t delta_state;
+};
+
+/**
+ * @brief A tANS code of bytes, ready to encode.
+ */
+struct ans_code {
+    int table_log;
+    /** The highest byte with a non-zero count. */
+    int last_symbol;
+    /** The normalized frequency of every byte. */
+    uint16_t counts[256];
+    struct ans_code_symbol symbols[256];
+    /** The next state of every reduced state, 1 << <table_log> entries. */
+    uint16_t* states;
+};
+
+/**
+ * @brief An entry of a decoding table: the byte a state decodes to and how
+ * the next state is formed from the following bits.
+ */
+struct ans_code_entry {
+    uint16_t next_state;
+    uint8_t symbol;
+    uint8_t bits;
+};
+
+/**
+ * @brief The table decoding a tANS code, indexed by the state.
+ */
+struct ans_code_table {
+    int table_log;
+    struct ans_code_entry* entries;
+};
+
+
+/**
+ * @brief Creates a tANS code from the frequencies of the bytes. The size of
+ * its table is chosen from the number of bytes and of distinct bytes.
+ *
+ * @param frequencies the frequency of every byte.
+ * @return struct ans_code* the created code, NULL if no byte occurs or an
+ * error occurred. Must be freed with a call to ans_code_free().
+ */
+struct ans_code* ans_code_create_from_frequencies(const uint64_t* frequencies);
+
+/**
+ * @brief Frees a tANS code.
+ *
+ * @param code the code to be freed.
+ */
+void ans_code_free(struct ans_code* code);
+
+/**
+ * @brief Estimates the number of bits a sequence of bytes is encoded to
+ * from the information content of its bytes under the code. The actual
+ * size differs by a few bits.
+ *
+ * @param code the code to encode the bytes with.
+ * @param frequencies how often every byte occurs.
+ * @return uint64_t the number of bits including the final state and
+ * marker, or UINT64_MAX if a byte that occurs cannot be encoded.
+ */
+uint64_t ans_code_encoded_bits(struct ans_code* code, const uint64_t* frequencies);
+
+/**
+ * @brief Returns the number of bytes of the serialized form of a code.
+ *
+ * @param code the code to be serialized.
+ * @return size_t the number of bytes written by ans_code_write_to_buffer().
+ */
+size_t ans_code_serialized_size(struct ans_code* code);
+
+/**
+ * @brief Serializes a code.
+ *
+ * @param code the code to be serialized.
+ * @param buffer the buffer of at least ans_code_serialized_size() bytes.
+ * @return size_t the number of bytes written.
+ */
+size_t ans_code_write_to_buffer(struct ans_code* code, uint8_t* buffer);
+
+/**
+ * @brief Returns the size of a serialized code from its header.
+ *
+ * @param header the first ANS_CODE_HEADER_SIZE bytes of the code.
+ * @return size_t the size of the code including the header, or 0 if the
+ * header is invalid.
+ */
+size_t ans_code_table_size(const uint8_t* header);
+
+/**
+ * @brief Encodes bytes.
+ *
+ * @param code the code to encode the bytes with, which must be able to
+ * encode all of them.
+ * @param in_buffer the bytes to be encoded.
+ * @param in_size the number of bytes in <in_buffer>.
+ * @param out_buffer the buffer the encoded bits are written to.
+ * @param out_capacity the number of bytes of <out_buffer>. Up to
+ * ANS_CODE_SLACK bytes behind the encoded bits may be overwritten.
+ * @return size_t the number of bytes of the encoded bits, or 0 if they do
+ * not fit into <out_buffer>.
+ */
+size_t ans_code_encode_buffer(struct ans_code* code, const uint8_t* in_buffer,
+    size_t in_size, uint8_t* out_buffer, size_t out_capacity);
+
+/**
+ * @brief Reads a serialized code and creates the table decoding it.
+ *
+ * @param buffer the serialized code.
+ * @param size the number of bytes in <buffer>.
+ * @return struct ans_code_table* the created table, NULL if the code is
+ * invalid or an error occurred. Must be freed with a call to
+ * ans_code_table_free().
+ */
+struct ans_code_table* ans_code_read_table(const uint8_t* buffer, size_t size);
+
+/**
+ * @brief Frees a decoding table.
+ *
+ * @param table the table to be freed.
+ */
+void ans_code_table_free(struct ans_code_table* table);
+
+/**
+ * @brief Decodes bytes encoded by ans_code_encode_buffer().
+ *
+ * @param table the table of the code the bytes are encoded with.
+ * @param in_buffer the encoded bits.
+ * @param in_size the number of bytes in <in_buffer>.
+ * @param out_buffer the buffer the decoded bytes are written to.
+ * @param out_size the number of bytes to be decoded.
+ * @return int non-zero if <in_buffer> does not decode to exactly <out_size>
+ * bytes, zero otherwise.
+ */
+int ans_code_decode_buffer(struct ans_code_table* table,
+    const uint8_t* in_buffer, size_t in_size,
+    uint8_t* out_buffer, size_t out_size);
+
+
+#endif
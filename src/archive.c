@@ -0,0 +1,524 @@
+#include "archive.h"
+
+#include <math.h>
+#include <string.h>
+
+
+/**
+ * @brief The members sharing a tree while an archive is created.
+ */
+struct _archive_group {
+    /** The frequencies of all members of the group. */
+    struct freq_dict* dict;
+    struct frame_shared_code shared;
+};
+
+
+/* Estimates the bits needed to code a member with a tree built from the
+ * group it is added to. */
+double _archive_group_cost(const struct freq_dict* group,
+        const struct freq_dict* member, const uint8_t* symbols,
+        size_t symbol_count, uint64_t group_total, uint64_t member_total) {
+    double total = (double)(group_total + member_total);
+    double bits = 0;
+    for (size_t i = 0; i < symbol_count; i++) {
+        uint64_t frequency = member->frequencies[symbols[i]];
+        bits += (double)frequency * log2(total
+            / (double)(group->frequencies[symbols[i]] + frequency));
+    }
+
+    return bits;
+}
+
+/* Adds a member to the group whose tree suits it best. A new group is only
+ * started if coding the member with any existing tree costs more than a
+ * tree of its own would. Empty members are given ARCHIVE_NO_TABLE. */
+int _archive_assign(struct _archive_group* groups, uint32_t* group_count,
+        uint64_t* group_totals, struct freq_dict* member, uint32_t* table) {
+    *table = ARCHIVE_NO_TABLE;
+
+    uint8_t symbols[FREQ_DICT_BYTE_ALPHABET];
+    size_t symbol_count = 0;
+    for (size_t i = 0; i < FREQ_DICT_BYTE_ALPHABET; i++) {
+        if (member->frequencies[i]) symbols[symbol_count++] = (uint8_t)i;
+    }
+    if (symbol_count == 0) return 0;
+
+    uint64_t member_total = freq_dict_total(member);
+    double own_cost = freq_dict_entropy_bits(member)
+        + 8.0 * (1 + 4 * (double)symbol_count);
+
+    uint32_t best = ARCHIVE_NO_TABLE;
+    double best_cost = 0;
+    for (uint32_t i = 0; i < *group_count; i++) {
+        double cost = _archive_group_cost(groups[i].dict, member, symbols,
+            symbol_count, group_totals[i], member_total);
+        if (best == ARCHIVE_NO_TABLE || cost < best_cost) {
+            best = i;
+            best_cost = cost;
+        }
+    }
+
+    if (best == ARCHIVE_NO_TABLE
+            || (best_cost > own_cost && *group_count < ARCHIVE_MAX_TABLES)) {
+        groups[*group_count].dict = freq_dict_create();
+        if (!groups[*group_count].dict) return 1;
+        best = (*group_count)++;
+    }
+
+    for (size_t i = 0; i < symbol_count; i++) {
+        groups[best].dict->frequencies[symbols[i]]
+            += member->frequencies[symbols[i]];
+    }
+    group_totals[best] += member_total;
+    *table = best;
+
+    return 0;
+}
+
+int archive_is_member_name(const char* name) {
+    if (name[0] == '\0' || name[0] == '/' || name[0] == '\\'
+            || strchr(name, ':')) {
+        return 0;
+    }
+    for (const char* part = name; part; part = strpbrk(part, "/\\")) {
+        if (part != name) part++;
+        if (part[0] == '.' && part[1] == '.'
+                && (part[2] == '\0' || part[2] == '/' || part[2] == '\\')) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/* Reads all files once and builds the shared trees of the archive. */
+int _archive_plan(const struct frame_params* params, char* const* paths,
+        size_t count, struct archive_entry* entries,
+        struct _archive_group* groups, uint32_t* group_count) {
+    struct freq_dict* member = freq_dict_create();
+    if (!member) return 1;
+
+    uint64_t group_totals[ARCHIVE_MAX_TABLES] = { 0 };
+    struct freq_dict_filter filter = { transform_filter, &params->transform };
+
+    int error_code = 0;
+    for (size_t i = 0; i < count && !error_code; i++) {
+        if (strlen(paths[i]) > ARCHIVE_MAX_NAME_SIZE
+                || !archive_is_member_name(paths[i])) {
+            errno = ERR_ILLEGAL_ARG;
+            error_code = 1;
+            break;
+        }
+
+        FILE* stream = fopen(paths[i], "rb");
+        if (!stream) {
+            error_code = 1;
+            break;
+        }
+
+        freq_dict_clear(member);
+        error_code = freq_dict_add_stream(member, stream,
+            params->transform.type != TRANSFORM_NONE ? &filter : NULL);
+        fclose(stream);
+
+        entries[i].name = paths[i];
+        entries[i].raw_size = freq_dict_total(member);
+        error_code = error_code || _archive_assign(groups, group_count,
+            group_totals, member, &entries[i].table);
+    }
+    freq_dict_free(member);
+
+    for (uint32_t i = 0; i < *group_count && !error_code; i++) {
+        struct frame_shared_code* shared = &groups[i].shared;
+        shared->tree = frame_create_tree(params, groups[i].dict);
+        if (shared->tree) shared->mapping = mapping_dict_create_mapping(shared->tree);
+        error_code = !shared->mapping
+            || (freq_dict_total(groups[i].dict) >= MAPPING_DICT_PAIR_MIN_SIZE
+                && mapping_dict_create_pairs(shared->mapping));
+    }
+
+    return error_code;
+}
+
+int _archive_write_header(struct async_writer* writer, int flags,
+        const struct _archive_group* groups, uint32_t group_count) {
+    uint8_t header[ARCHIVE_HEADER_SIZE];
+    memcpy(header, ARCHIVE_MAGIC, ARCHIVE_MAGIC_SIZE);
+    header[ARCHIVE_MAGIC_SIZE] = (uint8_t)flags;
+    io_put_u32(header + ARCHIVE_MAGIC_SIZE + 1, group_count);
+    if (async_writer_write(writer, header, ARCHIVE_HEADER_SIZE)) return 1;
+
+    uint8_t tree[FRAME_MAX_TREE_SIZE];
+    for (uint32_t i = 0; i < group_count; i++) {
+        size_t size = huffman_tree_write_to_buffer(groups[i].shared.tree, tree);
+        if (async_writer_write(writer, tree, size)) return 1;
+    }
+
+    return 0;
+}
+
+int _archive_write_member(const struct frame_params* params,
+        const struct frame_shared_code* shared, struct archive_entry* entry,
+        struct async_writer* writer) {
+    FILE* stream = fopen(entry->name, "rb");
+    if (!stream) return 1;
+
+    /* Setting up a ring of buffers costs more than reading a small file. */
+    struct async_reader* reader = async_reader_create(stream,
+        entry->raw_size < params->block_size ? ASYNC_IO_SYNC : params->io_backend,
+        ASYNC_IO_DEFAULT_CHUNK_SIZE, ASYNC_IO_DEFAULT_DEPTH);
+    if (!reader) {
+        fclose(stream);
+        return 1;
+    }
+
+    entry->offset = (uint64_t)async_writer_position(writer);
+    uint32_t checksum = 0;
+    int error_code = frame_compress_blocks(params, shared, reader, writer,
+        NULL, &checksum);
+
+    /* The file may have changed since it was analyzed. */
+    entry->raw_size = (uint64_t)reader->base.transferred;
+    async_reader_free(reader);
+    fclose(stream);
+
+    uint8_t end_block[FRAME_BLOCK_HEADER_SIZE] = { FRAME_BLOCK_END };
+    io_put_u32(end_block + 1, checksum);
+    io_put_u32(end_block + 5, 0);
+    if (!error_code) {
+        error_code = async_writer_write(writer, end_block, FRAME_BLOCK_HEADER_SIZE);
+    }
+    entry->stored_size = (uint64_t)async_writer_position(writer) - entry->offset;
+
+    return error_code;
+}
+
+int _archive_write_directory(struct async_writer* writer,
+        const struct archive_entry* entries, size_t count) {
+    uint64_t directory_offset = (uint64_t)async_writer_position(writer);
+    uint32_t checksum = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        const struct archive_entry* entry = &entries[i];
+        size_t name_size = strlen(entry->name);
+        uint8_t buffer[ARCHIVE_ENTRY_SIZE];
+
+        buffer[0] = (uint8_t)name_size;
+        buffer[1] = (uint8_t)(name_size >> 8);
+        checksum = crc32c_update(checksum, buffer, 2);
+        checksum = crc32c_update(checksum, (const uint8_t*)entry->name, name_size);
+        io_put_u64(buffer + 2, entry->offset);
+        io_put_u64(buffer + 10, entry->raw_size);
+        io_put_u64(buffer + 18, entry->stored_size);
+        io_put_u32(buffer + 26, entry->table);
+        checksum = crc32c_update(checksum, buffer + 2, ARCHIVE_ENTRY_SIZE - 2);
+
+        if (async_writer_write(writer, buffer, 2)
+                || async_writer_write(writer, entry->name, name_size)
+                || async_writer_write(writer, buffer + 2, ARCHIVE_ENTRY_SIZE - 2)) {
+            return 1;
+        }
+    }
+
+    uint8_t trailer[ARCHIVE_TRAILER_SIZE];
+    io_put_u64(trailer, directory_offset);
+    io_put_u32(trailer + 8, (uint32_t)count);
+    io_put_u32(trailer + 12, checksum);
+    memcpy(trailer + 16, ARCHIVE_MAGIC, ARCHIVE_MAGIC_SIZE);
+
+    return async_writer_write(writer, trailer, ARCHIVE_TRAILER_SIZE);
+}
+
+int archive_create(const struct frame_params* params, char* const* paths,
+        size_t count, FILE* out_stream) {
+    if (params->wide || params->block_size == 0
+            || params->block_size > FRAME_MAX_BLOCK_SIZE || count > UINT32_MAX) {
+        errno = ERR_ILLEGAL_ARG;
+        return 1;
+    }
+
+    struct archive_entry* entries = calloc(count ? count : 1,
+        sizeof(struct archive_entry));
+    struct _archive_group groups[ARCHIVE_MAX_TABLES];
+    memset(groups, 0, sizeof(groups));
+    uint32_t group_count = 0;
+    if (!entries) {
+        errno = ERR_MEM_ERROR;
+        return 1;
+    }
+
+    int error_code = _archive_plan(params, paths, count, entries,
+        groups, &group_count);
+
+    struct async_writer* writer = NULL;
+    if (!error_code) {
+        writer = async_writer_create(out_stream, params->io_backend,
+            ASYNC_IO_DEFAULT_CHUNK_SIZE, ASYNC_IO_DEFAULT_DEPTH);
+        error_code = !writer || _archive_write_header(writer,
+            (params->checksum ? FRAME_FLAG_CHECKSUM : 0)
+            | (params->transform.type != TRANSFORM_NONE ? FRAME_FLAG_TRANSFORM : 0),
+            groups, group_count);
+    }
+
+    struct frame_shared_code none;
+    memset(&none, 0, sizeof(none));
+    for (size_t i = 0; i < count && !error_code; i++) {
+        uint32_t table = entries[i].table;
+        error_code = _archive_write_member(params,
+            table == ARCHIVE_NO_TABLE ? &none : &groups[table].shared,
+            &entries[i], writer);
+    }
+
+    if (!error_code) {
+        error_code = _archive_write_directory(writer, entries, count)
+            || async_writer_finish(writer);
+    }
+
+    if (writer) async_writer_free(writer);
+    for (uint32_t i = 0; i < group_count; i++) {
+        frame_shared_code_free(&groups[i].shared);
+        freq_dict_free(groups[i].dict);
+    }
+    free(entries);
+
+    return error_code;
+}
+
+
+int _archive_read_tables(struct archive* archive, uint64_t end) {
+    archive->tables = calloc(archive->table_count ? archive->table_count : 1,
+        sizeof(struct archive_table));
+    if (!archive->tables) {
+        errno = ERR_MEM_ERROR;
+        return 1;
+    }
+
+    int64_t offset = ARCHIVE_HEADER_SIZE;
+    for (uint32_t i = 0; i < archive->table_count; i++) {
+        uint8_t size_byte;
+        size_t size;
+        if (io_read_at(archive->stream, &size_byte, 1, offset) != 1
+                || (size = frame_code_size(0, &size_byte)) == 0
+                || (uint64_t)offset + size > end) {
+            errno = ERR_PARSE_ERROR;
+            return 1;
+        }
+        archive->tables[i].offset = offset;
+        archive->tables[i].size = size;
+        offset += (int64_t)size;
+    }
+
+    return 0;
+}
+
+int _archive_read_directory(struct archive* archive, const uint8_t* directory,
+        size_t size, uint64_t directory_offset) {
+    archive->names = malloc(size + 1);
+    if (!archive->names) {
+        errno = ERR_MEM_ERROR;
+        return 1;
+    }
+
+    size_t position = 0;
+    char* name = archive->names;
+    for (size_t i = 0; i < archive->entry_count; i++) {
+        struct archive_entry* entry = &archive->entries[i];
+        if (size - position < ARCHIVE_ENTRY_SIZE) {
+            errno = ERR_PARSE_ERROR;
+            return 1;
+        }
+        size_t name_size = directory[position]
+            | (size_t)directory[position + 1] << 8;
+        if (size - position - ARCHIVE_ENTRY_SIZE < name_size) {
+            errno = ERR_PARSE_ERROR;
+            return 1;
+        }
+
+        memcpy(name, directory + position + 2, name_size);
+        name[name_size] = '\0';
+        entry->name = name;
+        name += name_size + 1;
+
+        const uint8_t* fields = directory + position + 2 + name_size;
+        entry->offset = io_get_u64(fields);
+        entry->raw_size = io_get_u64(fields + 8);
+        entry->stored_size = io_get_u64(fields + 16);
+        entry->table = io_get_u32(fields + 24);
+        position += ARCHIVE_ENTRY_SIZE + name_size;
+
+        if (entry->offset < ARCHIVE_HEADER_SIZE || entry->offset > directory_offset
+                || entry->stored_size > directory_offset - entry->offset
+                || (entry->table != ARCHIVE_NO_TABLE
+                    && entry->table >= archive->table_count)) {
+            errno = ERR_PARSE_ERROR;
+            return 1;
+        }
+    }
+
+    if (position != size) {
+        errno = ERR_PARSE_ERROR;
+        return 1;
+    }
+
+    return 0;
+}
+
+struct archive* archive_open(FILE* stream) {
+    int64_t size = io_stream_size(stream);
+    uint8_t header[ARCHIVE_HEADER_SIZE];
+    uint8_t trailer[ARCHIVE_TRAILER_SIZE];
+    if (size < ARCHIVE_HEADER_SIZE + ARCHIVE_TRAILER_SIZE
+            || io_read_at(stream, header, ARCHIVE_HEADER_SIZE, 0)
+                != ARCHIVE_HEADER_SIZE
+            || io_read_at(stream, trailer, ARCHIVE_TRAILER_SIZE,
+                size - ARCHIVE_TRAILER_SIZE) != ARCHIVE_TRAILER_SIZE
+            || memcmp(header, ARCHIVE_MAGIC, ARCHIVE_MAGIC_SIZE)
+            || memcmp(trailer + 16, ARCHIVE_MAGIC, ARCHIVE_MAGIC_SIZE)
+            || (header[ARCHIVE_MAGIC_SIZE] & ~ARCHIVE_FLAGS)) {
+        errno = ERR_PARSE_ERROR;
+        return NULL;
+    }
+
+    uint64_t directory_offset = io_get_u64(trailer);
+    uint64_t directory_end = (uint64_t)size - ARCHIVE_TRAILER_SIZE;
+    uint32_t entry_count = io_get_u32(trailer + 8);
+    if (directory_offset < ARCHIVE_HEADER_SIZE || directory_offset > directory_end
+            || directory_end - directory_offset > SIZE_MAX - 1
+            || (directory_end - directory_offset) / ARCHIVE_ENTRY_SIZE < entry_count) {
+        errno = ERR_PARSE_ERROR;
+        return NULL;
+    }
+
+    struct archive* archive = calloc(1, sizeof(struct archive));
+    size_t directory_size = (size_t)(directory_end - directory_offset);
+    uint8_t* directory = malloc(directory_size ? directory_size : 1);
+    if (archive) {
+        archive->entries = calloc(entry_count ? entry_count : 1,
+            sizeof(struct archive_entry));
+    }
+    if (!archive || !directory || !archive->entries) {
+        free(directory);
+        if (archive) archive_free(archive);
+        errno = ERR_MEM_ERROR;
+        return NULL;
+    }
+    archive->stream = stream;
+    archive->flags = header[ARCHIVE_MAGIC_SIZE];
+    archive->table_count = io_get_u32(header + ARCHIVE_MAGIC_SIZE + 1);
+    archive->entry_count = entry_count;
+
+    /* No tree is smaller than the header of a canonical code. */
+    if (archive->table_count > (directory_offset - ARCHIVE_HEADER_SIZE)
+            / FRAME_CODE_HEADER_SIZE) {
+        free(directory);
+        archive_free(archive);
+        errno = ERR_PARSE_ERROR;
+        return NULL;
+    }
+
+    int error_code = io_read_at(stream, directory, directory_size,
+        (int64_t)directory_offset) != directory_size;
+    if (error_code) {
+        errno = ERR_PARSE_ERROR;
+    } else if (crc32c_update(0, directory, directory_size)
+            != io_get_u32(trailer + 12)) {
+        errno = ERR_CHECKSUM_ERROR;
+        error_code = 1;
+    }
+
+    error_code = error_code
+        || _archive_read_tables(archive, directory_offset)
+        || _archive_read_directory(archive, directory, directory_size,
+            directory_offset);
+    free(directory);
+
+    if (error_code) {
+        int error = errno;
+        archive_free(archive);
+        errno = error;
+        return NULL;
+    }
+
+    return archive;
+}
+
+size_t archive_find(const struct archive* archive, const char* name) {
+    for (size_t i = 0; i < archive->entry_count; i++) {
+        if (!strcmp(archive->entries[i].name, name)) return i;
+    }
+
+    return archive->entry_count;
+}
+
+int _archive_load_table(struct archive* archive, uint32_t table) {
+    struct archive_table* entry = &archive->tables[table];
+    if (entry->tree) return 0;
+
+    uint8_t buffer[FRAME_MAX_TREE_SIZE];
+    if (entry->size > sizeof(buffer) || io_read_at(archive->stream, buffer,
+            entry->size, entry->offset) != entry->size) {
+        errno = ERR_PARSE_ERROR;
+        return 1;
+    }
+
+    struct canonical_code_table* unused;
+    return frame_read_code(0, buffer, entry->size, &entry->tree, &unused);
+}
+
+int archive_extract(struct archive* archive, size_t entry, FILE* out_stream,
+        int io_backend) {
+    if (entry >= archive->entry_count) {
+        errno = ERR_ILLEGAL_ARG;
+        return 1;
+    }
+
+    struct archive_entry* member = &archive->entries[entry];
+    if (member->table != ARCHIVE_NO_TABLE
+            && _archive_load_table(archive, member->table)) {
+        return 1;
+    }
+    if (io_seek(archive->stream, (int64_t)member->offset, SEEK_SET)) {
+        errno = ERR_IO_ERROR;
+        return 1;
+    }
+
+    /* Only the blocks of the member are read, at most a chunk beyond. */
+    size_t chunk_size = member->stored_size < ASYNC_IO_DEFAULT_CHUNK_SIZE
+        ? (size_t)member->stored_size + 1 : ASYNC_IO_DEFAULT_CHUNK_SIZE;
+    int small = member->raw_size < FRAME_DEFAULT_BLOCK_SIZE;
+    struct async_reader* reader = async_reader_create(archive->stream,
+        small ? ASYNC_IO_SYNC : io_backend, chunk_size, ASYNC_IO_DEFAULT_DEPTH);
+    struct async_writer* writer = async_writer_create(out_stream,
+        small ? ASYNC_IO_SYNC : io_backend, ASYNC_IO_DEFAULT_CHUNK_SIZE,
+        ASYNC_IO_DEFAULT_DEPTH);
+
+    int error_code = !reader || !writer
+        || frame_decompress_blocks(archive->flags,
+            member->table != ARCHIVE_NO_TABLE
+                ? archive->tables[member->table].tree : NULL,
+            NULL, reader, writer);
+
+    if (!error_code && (uint64_t)async_writer_position(writer) != member->raw_size) {
+        errno = ERR_PARSE_ERROR;
+        error_code = 1;
+    }
+    if (!error_code) error_code = async_writer_finish(writer);
+
+    if (writer) async_writer_free(writer);
+    if (reader) async_reader_free(reader);
+
+    return error_code;
+}
+
+void archive_free(struct archive* archive) {
+    if (archive->tables) {
+        for (uint32_t i = 0; i < archive->table_count; i++) {
+            if (archive->tables[i].tree) huffman_tree_free(archive->tables[i].tree);
+        }
+    }
+    free(archive->tables);
+    free(archive->entries);
+    free(archive->names);
+    free(archive);
+}
@@ -0,0 +1,165 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "error.h"
+#include "io_util.h"
+#include "frame.h"
+
+
+/*
+ * An archive packs many files into one, sharing a few trees between all of
+ * them so that small files do not each pay for a tree of their own. All
+ * integers are stored in little endian order.
+ *
+ * archive   := magic flags:u8 table_count:u32 tree* member* directory trailer
+ * magic     := 'H' 'U' 'F' 'A'
+ * member    := block* end_block
+ * directory := entry*
+ * entry     := name_size:u16 name offset:u64 raw_size:u64 stored_size:u64
+ *              table:u32
+ * trailer   := directory_offset:u64 member_count:u32 directory_checksum:u32
+ *              magic
+ *
+ * <flags> are FRAME_FLAG_CHECKSUM and FRAME_FLAG_TRANSFORM, which apply to
+ * the blocks of all members. Blocks and end blocks have the layout of the
+ * framed format, see frame.h, except that end blocks store no index size.
+ * Blocks of type FRAME_BLOCK_SHARED_TREE are encoded with the tree numbered
+ * <table> of the archive, starting at 0, and a member without a tree has a
+ * <table> of ARCHIVE_NO_TABLE.
+ *
+ * <offset> is the position of the first block of a member in the archive
+ * and <stored_size> the number of bytes up to and including its end block.
+ * <directory_checksum> is the CRC-32C of the directory. The trailer is
+ * found at the end of the archive, so a member is extracted by reading the
+ * directory, its tree and its own blocks only.
+ */
+
+#define ARCHIVE_MAGIC "HUFA"
+#define ARCHIVE_MAGIC_SIZE 4
+#define ARCHIVE_HEADER_SIZE 9
+#define ARCHIVE_ENTRY_SIZE 30
+#define ARCHIVE_TRAILER_SIZE 20
+#define ARCHIVE_FLAGS (FRAME_FLAG_CHECKSUM | FRAME_FLAG_TRANSFORM)
+#define ARCHIVE_NO_TABLE UINT32_MAX
+#define ARCHIVE_MAX_NAME_SIZE UINT16_MAX
+
+/** Maximum number of trees shared by the members of an archive. */
+#define ARCHIVE_MAX_TABLES 16
+
+
+/**
+ * @brief A member as listed in the directory of an archive.
+ */
+struct archive_entry {
+    /** The name the member was added with. */
+    char* name;
+    /** Position of the first block of the member in the archive. */
+    uint64_t offset;
+    /** Number of bytes the member decodes to. */
+    uint64_t raw_size;
+    /** Number of bytes of the blocks of the member in the archive. */
+    uint64_t stored_size;
+    /** Number of the shared tree of the member, or ARCHIVE_NO_TABLE. */
+    uint32_t table;
+};
+
+/**
+ * @brief A shared tree of an archive, read once it is first needed.
+ */
+struct archive_table {
+    int64_t offset;
+    size_t size;
+    struct huffman_tree* tree;
+};
+
+/**
+ * @brief An archive opened for reading.
+ */
+struct archive {
+    FILE* stream;
+    /** The FRAME_FLAG_* flags of the blocks of all members. */
+    int flags;
+    struct archive_table* tables;
+    uint32_t table_count;
+    struct archive_entry* entries;
+    size_t entry_count;
+    /** The names of all entries, each terminated by a null byte. */
+    char* names;
+};
+
+
+/**
+ * @brief Tells whether a name may be stored in an archive. Members are
+ * extracted below the working directory, so names that are absolute,
+ * name a drive or lead out of it through ".." are refused.
+ *
+ * @param name the name of the member.
+ * @return int non-zero if <name> is a relative path below the working
+ * directory, zero otherwise.
+ */
+int archive_is_member_name(const char* name);
+
+/**
+ * @brief Packs files into an archive. Every file is read twice: once to
+ * group files of similar contents under a shared tree, and once to encode
+ * them.
+ *
+ * @param params the parameters for compression. 16 bit words are not
+ * supported by archives, and all of every file is analyzed.
+ * @param paths the files to be packed, which are stored under these names.
+ * Every name must pass archive_is_member_name(), otherwise errno is set to
+ * ERR_ILLEGAL_ARG.
+ * @param count the number of files.
+ * @param out_stream the stream to which the archive should be written.
+ * @return int non-zero if an error occurred, zero otherwise.
+ */
+int archive_create(const struct frame_params* params, char* const* paths,
+    size_t count, FILE* out_stream);
+
+/**
+ * @brief Reads the directory of an archive.
+ *
+ * @param stream the seekable stream holding the archive, which must stay
+ * open until the archive is freed.
+ * @return struct archive* the opened archive, or NULL if <stream> is not
+ * a valid archive. Must be freed with a call to archive_free().
+ */
+struct archive* archive_open(FILE* stream);
+
+/**
+ * @brief Looks a member up by its name.
+ *
+ * @param archive the archive to be searched.
+ * @param name the name of the member.
+ * @return size_t the position of the first member of that name in the
+ * entries of <archive>, or <archive->entry_count> if there is none.
+ */
+size_t archive_find(const struct archive* archive, const char* name);
+
+/**
+ * @brief Decodes a single member of an archive.
+ *
+ * @param archive the archive holding the member.
+ * @param entry the position of the member in the entries of <archive>.
+ * @param out_stream the stream the contents of the member are written to.
+ * @param io_backend the ASYNC_IO_* backend used to write the output.
+ * @return int non-zero if an error occurred or a checksum does not match,
+ * zero otherwise.
+ */
+int archive_extract(struct archive* archive, size_t entry, FILE* out_stream,
+    int io_backend);
+
+/**
+ * @brief Frees an archive. Its stream is not closed.
+ *
+ * @param archive the archive to be freed.
+ */
+void archive_free(struct archive* archive);
+
+
+#endif
@@ -0,0 +1,730 @@
+#include "async_io.h"
+#include "trace.h"
+
+#include <string.h>
+
+#ifdef HUF_HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+
+int async_io_backend_from_name(const char* name) {
+    if (!strcmp(name, "auto")) return ASYNC_IO_AUTO;
+    if (!strcmp(name, "uring")) return ASYNC_IO_URING;
+    if (!strcmp(name, "threads")) return ASYNC_IO_THREADS;
+    if (!strcmp(name, "sync")) return ASYNC_IO_SYNC;
+
+    return -1;
+}
+
+
+#ifdef HUF_HAVE_IO_URING
+
+/**
+ * @brief A minimal io_uring instance driven through the raw system calls,
+ * so that no liburing is required.
+ */
+struct async_uring {
+    int fd;
+    int file_fd;
+
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_sqe* sqes;
+    struct io_uring_cqe* cqes;
+
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+
+    struct iovec* iovecs;
+    int in_flight;
+};
+
+void _async_uring_free(struct async_uring* ring) {
+    if (ring->sqes) munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring && ring->cq_ring != ring->sq_ring) {
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+    if (ring->sq_ring) munmap(ring->sq_ring, ring->sq_ring_size);
+    if (ring->fd >= 0) close(ring->fd);
+    free(ring->iovecs);
+    free(ring);
+}
+
+struct async_uring* _async_uring_create(FILE* stream, int depth) {
+#ifdef __NR_io_uring_setup
+    struct stat file_stat;
+    int file_fd = fileno(stream);
+    if (file_fd < 0 || fstat(file_fd, &file_stat) || !S_ISREG(file_stat.st_mode)) {
+        return NULL;
+    }
+
+    struct async_uring* ring = calloc(1, sizeof(struct async_uring));
+    if (!ring) return NULL;
+    ring->file_fd = file_fd;
+    ring->iovecs = calloc(depth, sizeof(struct iovec));
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(struct io_uring_params));
+    ring->fd = (int)syscall(__NR_io_uring_setup, (unsigned)depth, &params);
+    if (ring->fd < 0 || !ring->iovecs) {
+        _async_uring_free(ring);
+        return NULL;
+    }
+
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes
+        + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_ring_size > ring->sq_ring_size) {
+            ring->sq_ring_size = ring->cq_ring_size;
+        }
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED) {
+        ring->sq_ring = NULL;
+        _async_uring_free(ring);
+        return NULL;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ring = ring->sq_ring;
+    } else {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ring == MAP_FAILED) {
+            ring->cq_ring = NULL;
+            _async_uring_free(ring);
+            return NULL;
+        }
+    }
+
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        _async_uring_free(ring);
+        return NULL;
+    }
+
+    uint8_t* sq = ring->sq_ring;
+    uint8_t* cq = ring->cq_ring;
+    ring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned*)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    return ring;
+#else
+    return NULL;
+#endif
+}
+
+int _async_uring_submit(struct async_uring* ring, int opcode, int index,
+        uint8_t* data, size_t size, int64_t offset) {
+    ring->iovecs[index].iov_base = data;
+    ring->iovecs[index].iov_len = size;
+
+    unsigned tail = *ring->sq_tail;
+    unsigned sqe_index = tail & *ring->sq_mask;
+    struct io_uring_sqe* sqe = ring->sqes + sqe_index;
+
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode = (uint8_t)opcode;
+    sqe->fd = ring->file_fd;
+    sqe->addr = (uint64_t)(uintptr_t)(ring->iovecs + index);
+    sqe->len = 1;
+    sqe->off = (uint64_t)offset;
+    sqe->user_data = (uint64_t)index;
+
+    ring->sq_array[sqe_index] = sqe_index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    if (syscall(__NR_io_uring_enter, ring->fd, 1, 0, 0, NULL, 0) != 1) {
+        errno = ERR_IO_ERROR;
+        return 1;
+    }
+    ring->in_flight++;
+
+    return 0;
+}
+
+void _async_uring_wait(struct async_uring* ring, int* index, int32_t* result) {
+    unsigned head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        TRACE_BEGIN(wait_start);
+        while (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+            syscall(__NR_io_uring_enter, ring->fd, 0, 1,
+                IORING_ENTER_GETEVENTS, NULL, 0);
+        }
+        TRACE_END(wait_start, "queue wait", 0);
+    }
+
+    struct io_uring_cqe* cqe = ring->cqes + (head & *ring->cq_mask);
+    *index = (int)cqe->user_data;
+    *result = cqe->res;
+    __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+    ring->in_flight--;
+}
+
+/* Short transfers are rare on regular files, the remainder is simply
+ * transferred synchronously. */
+int _async_uring_complete(struct async_stream* s, int index, int32_t result,
+        int writing) {
+    struct async_slot* slot = s->slots + index;
+    if (result < 0) {
+        s->error = 1;
+        result = 0;
+    }
+
+    size_t done = (size_t)result;
+    while (!s->error && done < slot->size) {
+        ssize_t transferred = writing
+            ? pwrite(s->ring->file_fd, slot->data + done, slot->size - done,
+                slot->offset + done)
+            : pread(s->ring->file_fd, slot->data + done, slot->size - done,
+                slot->offset + done);
+        if (transferred < 0) s->error = 1;
+        if (transferred <= 0) break;
+        done += (size_t)transferred;
+    }
+
+    if (writing) {
+        slot->state = ASYNC_SLOT_FREE;
+        slot->size = 0;
+    } else {
+        if (done < slot->size) s->eof = 1;
+        slot->size = done;
+        slot->state = ASYNC_SLOT_READY;
+    }
+
+    return s->error;
+}
+
+void _async_uring_drain(struct async_stream* s, int writing) {
+    while (s->ring->in_flight > 0) {
+        int index;
+        int32_t result;
+        _async_uring_wait(s->ring, &index, &result);
+        _async_uring_complete(s, index, result, writing);
+    }
+}
+
+#endif
+
+
+int _async_stream_init(struct async_stream* s, FILE* stream,
+        size_t chunk_size, int depth) {
+    memset(s, 0, sizeof(struct async_stream));
+    s->stream = stream;
+    s->chunk_size = chunk_size;
+    s->depth = depth;
+    s->start_offset = io_tell(stream);
+
+    /* The synchronous backend transfers straight from and to the caller. */
+    if (depth == 0) return 0;
+
+    s->slots = calloc(depth, sizeof(struct async_slot));
+    if (!s->slots) {
+        errno = ERR_MEM_ERROR;
+        return 1;
+    }
+    for (int i = 0; i < depth; i++) {
+        s->slots[i].data = malloc(chunk_size);
+        if (!s->slots[i].data) {
+            errno = ERR_MEM_ERROR;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+void _async_stream_release(struct async_stream* s) {
+    if (s->slots) {
+        for (int i = 0; i < s->depth; i++) {
+            free(s->slots[i].data);
+        }
+        free(s->slots);
+    }
+#ifdef HUF_HAVE_IO_URING
+    if (s->ring) _async_uring_free(s->ring);
+#endif
+#ifdef HUF_HAVE_PTHREAD
+    if (s->backend == ASYNC_IO_THREADS) {
+        pthread_cond_destroy(&s->cond);
+        pthread_mutex_destroy(&s->mutex);
+    }
+#endif
+}
+
+int _async_stream_start_thread(struct async_stream* s, void* (*worker)(void*)) {
+#ifdef HUF_HAVE_PTHREAD
+    if (pthread_mutex_init(&s->mutex, NULL)) return 1;
+    if (pthread_cond_init(&s->cond, NULL)) {
+        pthread_mutex_destroy(&s->mutex);
+        return 1;
+    }
+    if (pthread_create(&s->thread, NULL, worker, s)) {
+        pthread_cond_destroy(&s->cond);
+        pthread_mutex_destroy(&s->mutex);
+        return 1;
+    }
+    s->backend = ASYNC_IO_THREADS;
+
+    return 0;
+#else
+    (void)s;
+    (void)worker;
+    return 1;
+#endif
+}
+
+void _async_stream_stop_thread(struct async_stream* s) {
+#ifdef HUF_HAVE_PTHREAD
+    if (s->backend != ASYNC_IO_THREADS || s->closing) return;
+
+    pthread_mutex_lock(&s->mutex);
+    s->closing = 1;
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->mutex);
+
+    pthread_join(s->thread, NULL);
+#else
+    (void)s;
+#endif
+}
+
+int _async_stream_wait_state(struct async_stream* s, struct async_slot* slot,
+        int state) {
+#ifdef HUF_HAVE_PTHREAD
+    pthread_mutex_lock(&s->mutex);
+    if (slot->state != state) {
+        TRACE_BEGIN(wait_start);
+        while (slot->state != state) {
+            pthread_cond_wait(&s->cond, &s->mutex);
+        }
+        TRACE_END(wait_start, "queue wait", 0);
+    }
+    pthread_mutex_unlock(&s->mutex);
+#else
+    (void)s;
+    (void)slot;
+    (void)state;
+#endif
+    return 0;
+}
+
+void _async_stream_set_state(struct async_stream* s, struct async_slot* slot,
+        int state) {
+#ifdef HUF_HAVE_PTHREAD
+    pthread_mutex_lock(&s->mutex);
+    slot->state = state;
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->mutex);
+#else
+    (void)s;
+    slot->state = state;
+#endif
+}
+
+
+void* _async_reader_thread(void* arg) {
+    struct async_stream* s = arg;
+    trace_set_thread_name("reader");
+
+#ifdef HUF_HAVE_PTHREAD
+    for (int i = 0; ; i = (i + 1) % s->depth) {
+        struct async_slot* slot = s->slots + i;
+
+        pthread_mutex_lock(&s->mutex);
+        while (slot->state != ASYNC_SLOT_FREE && !s->closing) {
+            pthread_cond_wait(&s->cond, &s->mutex);
+        }
+        int closing = s->closing;
+        pthread_mutex_unlock(&s->mutex);
+        if (closing) break;
+
+        TRACE_BEGIN(read_start);
+        size_t read = fread(slot->data, 1, s->chunk_size, s->stream);
+        TRACE_END(read_start, "read", read);
+
+        pthread_mutex_lock(&s->mutex);
+        slot->size = read;
+        slot->position = 0;
+        slot->state = ASYNC_SLOT_READY;
+        if (read < s->chunk_size && ferror(s->stream)) s->error = 1;
+        pthread_cond_broadcast(&s->cond);
+        pthread_mutex_unlock(&s->mutex);
+
+        if (read < s->chunk_size) break;
+    }
+#endif
+
+    return NULL;
+}
+
+#ifdef HUF_HAVE_IO_URING
+int _async_reader_issue(struct async_stream* s, int index) {
+    struct async_slot* slot = s->slots + index;
+    slot->position = 0;
+    slot->size = 0;
+
+    if (s->next_offset >= s->end_offset) {
+        slot->state = ASYNC_SLOT_FREE;
+        return 0;
+    }
+
+    int64_t remaining = s->end_offset - s->next_offset;
+    slot->size = remaining < (int64_t)s->chunk_size
+        ? (size_t)remaining : s->chunk_size;
+    slot->offset = s->next_offset;
+    slot->state = ASYNC_SLOT_PENDING;
+    s->next_offset += slot->size;
+
+    if (_async_uring_submit(s->ring, IORING_OP_READV, index,
+            slot->data, slot->size, slot->offset)) {
+        s->error = 1;
+        slot->state = ASYNC_SLOT_FREE;
+        return 1;
+    }
+
+    return 0;
+}
+#endif
+
+int _async_reader_start_uring(struct async_stream* s) {
+#ifdef HUF_HAVE_IO_URING
+    int64_t size = io_stream_size(s->stream);
+    if (s->start_offset < 0 || size < 0) return 1;
+
+    s->ring = _async_uring_create(s->stream, s->depth);
+    if (!s->ring) return 1;
+
+    s->backend = ASYNC_IO_URING;
+    s->next_offset = s->start_offset;
+    s->end_offset = size;
+    for (int i = 0; i < s->depth; i++) {
+        if (_async_reader_issue(s, i)) break;
+    }
+
+    return 0;
+#else
+    (void)s;
+    return 1;
+#endif
+}
+
+struct async_reader* async_reader_create(FILE* stream, int backend,
+        size_t chunk_size, int depth) {
+    struct async_reader* reader = malloc(sizeof(struct async_reader));
+    if (!reader) {
+        errno = ERR_MEM_ERROR;
+        return NULL;
+    }
+
+    struct async_stream* s = &reader->base;
+    if (_async_stream_init(s, stream, chunk_size,
+            backend == ASYNC_IO_SYNC ? 0 : depth)) {
+        _async_stream_release(s);
+        free(reader);
+        return NULL;
+    }
+
+    s->backend = ASYNC_IO_SYNC;
+    if ((backend == ASYNC_IO_AUTO || backend == ASYNC_IO_URING)
+            && !_async_reader_start_uring(s)) {
+        return reader;
+    }
+    if (backend != ASYNC_IO_SYNC) {
+        _async_stream_start_thread(s, _async_reader_thread);
+    }
+
+    return reader;
+}
+
+size_t async_reader_read(struct async_reader* reader, void* buffer, size_t size) {
+    struct async_stream* s = &reader->base;
+    uint8_t* out = buffer;
+    size_t total = 0;
+
+    if (s->backend == ASYNC_IO_SYNC) {
+        while (total < size) {
+            size_t read = fread(out + total, 1, size - total, s->stream);
+            if (read == 0) break;
+            total += read;
+        }
+        if (total < size && ferror(s->stream)) s->error = 1;
+        s->transferred += total;
+        return total;
+    }
+
+    while (total < size && !s->error) {
+        struct async_slot* slot = s->slots + s->current;
+
+#ifdef HUF_HAVE_IO_URING
+        if (s->backend == ASYNC_IO_URING) {
+            if (slot->state == ASYNC_SLOT_FREE) break;
+            while (slot->state == ASYNC_SLOT_PENDING) {
+                int index;
+                int32_t result;
+                _async_uring_wait(s->ring, &index, &result);
+                _async_uring_complete(s, index, result, 0);
+            }
+            if (s->error) break;
+        }
+#endif
+        if (s->backend == ASYNC_IO_THREADS) {
+            _async_stream_wait_state(s, slot, ASYNC_SLOT_READY);
+        }
+
+        size_t available = slot->size - slot->position;
+        size_t chunk = size - total < available ? size - total : available;
+        memcpy(out + total, slot->data + slot->position, chunk);
+        slot->position += chunk;
+        total += chunk;
+
+        if (slot->position < slot->size) continue;
+
+        /* A chunk shorter than the others is the last one of the stream. */
+        if (slot->size < s->chunk_size && s->backend == ASYNC_IO_THREADS) {
+            s->eof = 1;
+            break;
+        }
+
+#ifdef HUF_HAVE_IO_URING
+        if (s->backend == ASYNC_IO_URING) _async_reader_issue(s, s->current);
+#endif
+        if (s->backend == ASYNC_IO_THREADS) {
+            _async_stream_set_state(s, slot, ASYNC_SLOT_FREE);
+        }
+        s->current = (s->current + 1) % s->depth;
+    }
+
+    s->transferred += total;
+    return total;
+}
+
+int async_reader_error(struct async_reader* reader) {
+    return reader->base.error;
+}
+
+void async_reader_free(struct async_reader* reader) {
+    struct async_stream* s = &reader->base;
+
+#ifdef HUF_HAVE_IO_URING
+    if (s->backend == ASYNC_IO_URING) _async_uring_drain(s, 0);
+#endif
+    _async_stream_stop_thread(s);
+
+    if (s->backend != ASYNC_IO_SYNC && s->start_offset >= 0) {
+        io_seek(s->stream, s->start_offset + s->transferred, SEEK_SET);
+    }
+
+    _async_stream_release(s);
+    free(reader);
+}
+
+
+void* _async_writer_thread(void* arg) {
+    struct async_stream* s = arg;
+    trace_set_thread_name("writer");
+
+#ifdef HUF_HAVE_PTHREAD
+    for (int i = 0; ; i = (i + 1) % s->depth) {
+        struct async_slot* slot = s->slots + i;
+
+        /* Slots are handed over in order, so once the writer is closing
+         * and the next slot holds nothing, everything has been written. */
+        pthread_mutex_lock(&s->mutex);
+        while (slot->state != ASYNC_SLOT_READY && !s->closing) {
+            pthread_cond_wait(&s->cond, &s->mutex);
+        }
+        int ready = slot->state == ASYNC_SLOT_READY;
+        pthread_mutex_unlock(&s->mutex);
+        if (!ready) break;
+
+        TRACE_BEGIN(write_start);
+        int failed = fwrite(slot->data, 1, slot->size, s->stream) != slot->size;
+        TRACE_END(write_start, "write", slot->size);
+
+        pthread_mutex_lock(&s->mutex);
+        if (failed) s->error = 1;
+        slot->size = 0;
+        slot->state = ASYNC_SLOT_FREE;
+        pthread_cond_broadcast(&s->cond);
+        pthread_mutex_unlock(&s->mutex);
+    }
+#endif
+
+    return NULL;
+}
+
+int _async_writer_start_uring(struct async_stream* s) {
+#ifdef HUF_HAVE_IO_URING
+    if (s->start_offset < 0 || fflush(s->stream)) return 1;
+
+    s->ring = _async_uring_create(s->stream, s->depth);
+    if (!s->ring) return 1;
+
+    s->backend = ASYNC_IO_URING;
+    s->next_offset = s->start_offset;
+
+    return 0;
+#else
+    (void)s;
+    return 1;
+#endif
+}
+
+struct async_writer* async_writer_create(FILE* stream, int backend,
+        size_t chunk_size, int depth) {
+    struct async_writer* writer = malloc(sizeof(struct async_writer));
+    if (!writer) {
+        errno = ERR_MEM_ERROR;
+        return NULL;
+    }
+
+    struct async_stream* s = &writer->base;
+    if (_async_stream_init(s, stream, chunk_size,
+            backend == ASYNC_IO_SYNC ? 0 : depth)) {
+        _async_stream_release(s);
+        free(writer);
+        return NULL;
+    }
+
+    s->backend = ASYNC_IO_SYNC;
+    if ((backend == ASYNC_IO_AUTO || backend == ASYNC_IO_URING)
+            && !_async_writer_start_uring(s)) {
+        return writer;
+    }
+    if (backend != ASYNC_IO_SYNC) {
+        _async_stream_start_thread(s, _async_writer_thread);
+    }
+
+    return writer;
+}
+
+int _async_writer_submit(struct async_stream* s) {
+    struct async_slot* slot = s->slots + s->current;
+
+#ifdef HUF_HAVE_IO_URING
+    if (s->backend == ASYNC_IO_URING) {
+        slot->offset = s->next_offset;
+        slot->state = ASYNC_SLOT_PENDING;
+        s->next_offset += slot->size;
+
+        if (_async_uring_submit(s->ring, IORING_OP_WRITEV, s->current,
+                slot->data, slot->size, slot->offset)) {
+            s->error = 1;
+            slot->state = ASYNC_SLOT_FREE;
+        }
+    }
+#endif
+    if (s->backend == ASYNC_IO_THREADS) {
+        _async_stream_set_state(s, slot, ASYNC_SLOT_READY);
+    }
+
+    s->current = (s->current + 1) % s->depth;
+    return s->error;
+}
+
+int async_writer_write(struct async_writer* writer, const void* data, size_t size) {
+    struct async_stream* s = &writer->base;
+    const uint8_t* in = data;
+
+    if (s->backend == ASYNC_IO_SYNC) {
+        if (fwrite(data, 1, size, s->stream) != size) s->error = 1;
+        s->transferred += size;
+        if (s->error) errno = ERR_IO_ERROR;
+        return s->error;
+    }
+
+    while (size > 0 && !s->error) {
+        struct async_slot* slot = s->slots + s->current;
+
+#ifdef HUF_HAVE_IO_URING
+        if (s->backend == ASYNC_IO_URING) {
+            while (slot->state == ASYNC_SLOT_PENDING) {
+                int index;
+                int32_t result;
+                _async_uring_wait(s->ring, &index, &result);
+                _async_uring_complete(s, index, result, 1);
+            }
+        }
+#endif
+        if (s->backend == ASYNC_IO_THREADS) {
+            _async_stream_wait_state(s, slot, ASYNC_SLOT_FREE);
+        }
+
+        size_t space = s->chunk_size - slot->size;
+        size_t chunk = size < space ? size : space;
+        memcpy(slot->data + slot->size, in, chunk);
+        slot->size += chunk;
+        in += chunk;
+        size -= chunk;
+        s->transferred += chunk;
+
+        if (slot->size == s->chunk_size) _async_writer_submit(s);
+    }
+
+    if (s->error) errno = ERR_IO_ERROR;
+    return s->error;
+}
+
+int64_t async_writer_position(struct async_writer* writer) {
+    return writer->base.transferred;
+}
+
+int async_writer_finish(struct async_writer* writer) {
+    struct async_stream* s = &writer->base;
+
+    if (s->backend != ASYNC_IO_SYNC && s->slots[s->current].size > 0
+            && s->slots[s->current].state == ASYNC_SLOT_FREE) {
+        _async_writer_submit(s);
+    }
+
+#ifdef HUF_HAVE_IO_URING
+    if (s->backend == ASYNC_IO_URING) {
+        _async_uring_drain(s, 1);
+        if (io_seek(s->stream, s->next_offset, SEEK_SET)) s->error = 1;
+    }
+#endif
+    _async_stream_stop_thread(s);
+
+    if (fflush(s->stream)) s->error = 1;
+    if (s->error) errno = ERR_IO_ERROR;
+
+    return s->error;
+}
+
+void async_writer_free(struct async_writer* writer) {
+    struct async_stream* s = &writer->base;
+
+#ifdef HUF_HAVE_IO_URING
+    if (s->backend == ASYNC_IO_URING) _async_uring_drain(s, 1);
+#endif
+    _async_stream_stop_thread(s);
+
+    _async_stream_release(s);
+    free(writer);
+}
@@ -0,0 +1,209 @@
+#ifndef ASYNC_IO_H
+#define ASYNC_IO_H
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "error.h"
+#include "io_util.h"
+
+#ifdef HUF_HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+
+/*
+ * Asynchronous readers and writers keep a ring of buffers between a stream
+ * and the code using it, so that reading the next input and writing the
+ * previous output overlap with encoding or decoding. Reads are issued ahead
+ * of the consumer and writes are drained behind the producer, either through
+ * io_uring for regular files on Linux or by a helper thread per stream.
+ * The synchronous backend calls fread() and fwrite() directly and is used
+ * where neither is available.
+ */
+
+#define ASYNC_IO_AUTO 0
+#define ASYNC_IO_URING 1
+#define ASYNC_IO_THREADS 2
+#define ASYNC_IO_SYNC 3
+
+#define ASYNC_IO_DEFAULT_CHUNK_SIZE (1u << 20)
+#define ASYNC_IO_DEFAULT_DEPTH 4
+
+#define ASYNC_SLOT_FREE 0
+#define ASYNC_SLOT_PENDING 1
+#define ASYNC_SLOT_READY 2
+
+
+/**
+ * @brief A buffer of the ring together with its state.
+ */
+struct async_slot {
+    uint8_t* data;
+    /** Number of valid bytes in <data>. */
+    size_t size;
+    /** Number of bytes of <data> the reader has handed out already. */
+    size_t position;
+    /** One of the ASYNC_SLOT_* states. */
+    int state;
+    /** Offset in the file this slot is read from or written to. */
+    int64_t offset;
+};
+
+struct async_uring;
+
+/**
+ * @brief The state shared by asynchronous readers and writers.
+ */
+struct async_stream {
+    FILE* stream;
+    /** The ASYNC_IO_* backend in use. */
+    int backend;
+    size_t chunk_size;
+    int depth;
+    struct async_slot* slots;
+    /** The slot currently consumed by the reader or filled by the writer. */
+    int current;
+    /** Set once an error occurred, never cleared. */
+    int error;
+    /** Offset of the next read or write that is issued. */
+    int64_t next_offset;
+    /** Offset after which there is nothing left to read. */
+    int64_t end_offset;
+    /** Number of bytes handed to or received from the user. */
+    int64_t transferred;
+    /** Position of <stream> before the first transfer, -1 if unknown. */
+    int64_t start_offset;
+    /** Non-zero once the end of the input has been seen. */
+    int eof;
+
+    struct async_uring* ring;
+#ifdef HUF_HAVE_PTHREAD
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int closing;
+#endif
+};
+
+/**
+ * @brief Reads a stream ahead of its consumer.
+ */
+struct async_reader {
+    struct async_stream base;
+};
+
+/**
+ * @brief Writes to a stream behind its producer.
+ */
+struct async_writer {
+    struct async_stream base;
+};
+
+
+/**
+ * @brief Creates an asynchronous reader. The stream must not be used
+ * directly until the reader is freed. Afterwards, seekable streams are
+ * positioned right after the last byte handed out by the reader.
+ *
+ * @param stream the stream to be read from.
+ * @param backend the ASYNC_IO_* backend to be used. ASYNC_IO_AUTO picks
+ * io_uring if possible and falls back to threads otherwise.
+ * @param chunk_size the number of bytes read at once.
+ * @param depth the number of chunks that are read ahead.
+ * @return struct async_reader* the created reader.
+ * Must be freed with a call to async_reader_free().
+ */
+struct async_reader* async_reader_create(FILE* stream, int backend,
+    size_t chunk_size, int depth);
+
+/**
+ * @brief Reads bytes from an asynchronous reader, waiting for them to
+ * arrive if they have not been read yet.
+ *
+ * @param reader the reader to read from.
+ * @param buffer the buffer to be filled.
+ * @param size the number of bytes that should be read.
+ * @return size_t the number of bytes read, less than <size> only at the
+ * end of the stream or if an error occurred.
+ */
+size_t async_reader_read(struct async_reader* reader, void* buffer, size_t size);
+
+/**
+ * @brief Checks whether an error occurred while reading.
+ *
+ * @param reader the reader to be checked.
+ * @return int non-zero if a read failed, zero otherwise.
+ */
+int async_reader_error(struct async_reader* reader);
+
+/**
+ * @brief Stops an asynchronous reader and frees it.
+ *
+ * @param reader the reader to be freed.
+ */
+void async_reader_free(struct async_reader* reader);
+
+
+/**
+ * @brief Creates an asynchronous writer. The stream must not be used
+ * directly until async_writer_finish() has been called.
+ *
+ * @param stream the stream to be written to.
+ * @param backend the ASYNC_IO_* backend to be used. ASYNC_IO_AUTO picks
+ * io_uring if possible and falls back to threads otherwise.
+ * @param chunk_size the number of bytes written at once.
+ * @param depth the number of chunks that may be waiting to be written.
+ * @return struct async_writer* the created writer.
+ * Must be freed with a call to async_writer_free().
+ */
+struct async_writer* async_writer_create(FILE* stream, int backend,
+    size_t chunk_size, int depth);
+
+/**
+ * @brief Queues bytes to be written. Only waits if all chunks of the ring
+ * are still waiting to be written.
+ *
+ * @param writer the writer to write to.
+ * @param data the bytes to be written.
+ * @param size the number of bytes in <data>.
+ * @return int non-zero if an error occurred, zero otherwise.
+ */
+int async_writer_write(struct async_writer* writer, const void* data, size_t size);
+
+/**
+ * @brief Returns the number of bytes queued through a writer so far.
+ *
+ * @param writer the writer to be queried.
+ * @return int64_t the number of bytes passed to async_writer_write().
+ */
+int64_t async_writer_position(struct async_writer* writer);
+
+/**
+ * @brief Writes all queued bytes and waits for them to reach the stream.
+ *
+ * @param writer the writer to be finished.
+ * @return int non-zero if any write failed, zero otherwise.
+ */
+int async_writer_finish(struct async_writer* writer);
+
+/**
+ * @brief Frees an asynchronous writer. Without a prior call to
+ * async_writer_finish(), queued bytes may or may not reach the stream.
+ *
+ * @param writer the writer to be freed.
+ */
+void async_writer_free(struct async_writer* writer);
+
+/**
+ * @brief Parses the name of an ASYNC_IO_* backend.
+ *
+ * @param name one of "auto", "uring", "threads" or "sync".
+ * @return int the backend, or -1 if <name> is unknown.
+ */
+int async_io_backend_from_name(const char* name);
+
+
+#endif
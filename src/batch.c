@@ -0,0 +1,416 @@
+#include "batch.h"
+#include "table_cache.h"
+
+#include <string.h>
+
+
+struct huf_batch* huf_batch_create(const struct frame_params* params) {
+    if (params->wide || params->block_size == 0
+            || params->block_size > FRAME_MAX_BLOCK_SIZE) {
+        errno = ERR_ILLEGAL_ARG;
+        return NULL;
+    }
+
+    struct huf_batch* batch = calloc(1, sizeof(struct huf_batch));
+    if (!batch) {
+        errno = ERR_MEM_ERROR;
+        return NULL;
+    }
+
+    batch->params = *params;
+    batch->block_dict = freq_dict_create();
+    batch->spare_dict = freq_dict_create();
+    batch->batch_dict = freq_dict_create();
+    if (!batch->block_dict || !batch->spare_dict || !batch->batch_dict) {
+        huf_batch_free(batch);
+        errno = ERR_MEM_ERROR;
+        return NULL;
+    }
+
+    return batch;
+}
+
+void huf_batch_free(struct huf_batch* batch) {
+    if (batch->block_dict) freq_dict_free(batch->block_dict);
+    if (batch->spare_dict) freq_dict_free(batch->spare_dict);
+    if (batch->batch_dict) freq_dict_free(batch->batch_dict);
+    free(batch->transformed);
+    free(batch);
+}
+
+void huf_batch_output_free(struct huf_batch_output* output) {
+    free(output->data);
+    free(output->offsets);
+    memset(output, 0, sizeof(struct huf_batch_output));
+}
+
+
+/* Appends the header of a frame to the output. */
+int _huf_batch_write_header(struct huf_batch_output* output, int flags,
+        const struct frame_shared_code* shared) {
+    size_t size = frame_header_size(shared);
+    if (frame_reserve(&output->data, &output->capacity, output->size + size)) {
+        return 1;
+    }
+
+    uint8_t* header = output->data + output->size;
+    memcpy(header, FRAME_MAGIC, FRAME_MAGIC_SIZE);
+    header[FRAME_MAGIC_SIZE] = (uint8_t)flags;
+    if (shared->tree) {
+        huffman_tree_write_to_buffer(shared->tree, header + FRAME_MAGIC_SIZE + 1);
+    }
+    output->size += size;
+
+    return 0;
+}
+
+/* Appends an end block without an index to the output. */
+int _huf_batch_write_end(struct huf_batch_output* output, uint32_t checksum) {
+    if (frame_reserve(&output->data, &output->capacity,
+            output->size + FRAME_BLOCK_HEADER_SIZE)) {
+        return 1;
+    }
+
+    uint8_t* end_block = output->data + output->size;
+    end_block[0] = FRAME_BLOCK_END;
+    io_put_u32(end_block + 1, checksum);
+    io_put_u32(end_block + 5, 0);
+    output->size += FRAME_BLOCK_HEADER_SIZE;
+
+    return 0;
+}
+
+/* Plans and encodes a block straight into the output. */
+int _huf_batch_write_block(struct huf_batch* batch,
+        const struct frame_shared_code* shared, const uint8_t* block,
+        size_t size, uint32_t* checksum, struct huf_batch_output* output) {
+    const struct frame_params* params = &batch->params;
+    int transformed = params->transform.type != TRANSFORM_NONE;
+    if (transformed && frame_reserve(&batch->transformed,
+            &batch->transformed_capacity, size)) {
+        return 1;
+    }
+
+    struct transform transform;
+    const uint8_t* symbols = frame_analyze_block(params, block, size,
+        batch->transformed, &batch->block_dict, &batch->spare_dict, &transform);
+
+    struct frame_block_plan plan;
+    if (frame_plan_block(params, shared, batch->block_dict, size, &plan)) {
+        return 1;
+    }
+
+    /* The payload of a block never exceeds its bytes, or it is stored. */
+    if (frame_reserve(&output->data, &output->capacity, output->size
+            + plan.header_size + size + ANS_CODE_SLACK)) {
+        frame_block_plan_free(&plan);
+        return 1;
+    }
+
+    uint8_t* header = output->data + output->size;
+    const uint8_t* payload = frame_encode_block(params, &plan, symbols, size,
+        header + plan.header_size);
+    if (payload != header + plan.header_size) {
+        memcpy(header + plan.header_size, payload, plan.payload_size);
+    }
+
+    uint32_t block_checksum = 0;
+    if (params->checksum) {
+        block_checksum = crc32c_update(0, block, size);
+        *checksum = crc32c_combine(*checksum, block_checksum, size);
+    }
+    frame_put_block_header(&plan, size,
+        params->checksum ? &block_checksum : NULL,
+        transformed ? &transform : NULL, header);
+    output->size += plan.header_size + plan.payload_size;
+    frame_block_plan_free(&plan);
+
+    return 0;
+}
+
+/* Builds the tree shared by all buffers of a batch from their bytes. */
+int _huf_batch_create_shared(struct huf_batch* batch,
+        const uint8_t* const* inputs, const size_t* sizes, size_t count,
+        struct frame_shared_code* shared) {
+    freq_dict_clear(batch->batch_dict);
+    for (size_t i = 0; i < count; i++) {
+        freq_dict_add_buffer(batch->batch_dict, inputs[i], sizes[i]);
+    }
+    if (freq_dict_total(batch->batch_dict) == 0) return 0;
+
+    shared->tree = frame_create_tree(&batch->params, batch->batch_dict);
+    if (shared->tree) shared->mapping = mapping_dict_create_mapping(shared->tree);
+
+    return !shared->mapping
+        || (freq_dict_total(batch->batch_dict) >= MAPPING_DICT_PAIR_MIN_SIZE
+            && mapping_dict_create_pairs(shared->mapping));
+}
+
+/* Takes the tree of a buffer compressed into a frame of its own from the
+ * table cache of the parameters, if they have one. Every frame stores its
+ * tree, which small buffers rarely save, so a cached tree is only used if
+ * the buffer, planned as one block, is no larger with it than without a
+ * shared tree, and a tree is only built and cached for buffers that a tree
+ * of their own pays off for. Otherwise, every block of the buffer is
+ * planned on its own as without a cache. */
+int _huf_batch_create_cached(struct huf_batch* batch, const uint8_t* input,
+        size_t size, struct frame_shared_code* code) {
+    struct table_cache* cache = batch->params.table_cache;
+    if (!cache || size == 0) return 0;
+
+    freq_dict_clear(batch->batch_dict);
+    freq_dict_add_buffer(batch->batch_dict, input, size);
+
+    struct frame_shared_code none = { NULL, NULL, NULL, NULL };
+    struct frame_block_plan plan;
+    if (frame_plan_block(&batch->params, &none, batch->batch_dict, size, &plan)) {
+        return 1;
+    }
+    uint64_t own_size = plan.header_size + plan.payload_size;
+    int own_tree = plan.type == FRAME_BLOCK_OWN_TREE;
+    frame_block_plan_free(&plan);
+
+    if (own_tree ? table_cache_get(cache, &batch->params, batch->batch_dict,
+                &code->tree, &code->mapping)
+            : table_cache_lookup(cache, &batch->params, batch->batch_dict,
+                &code->tree, &code->mapping)) {
+        return 1;
+    }
+    if (!code->tree) return 0;
+    code->cache = cache;
+
+    if (frame_plan_block(&batch->params, code, batch->batch_dict, size, &plan)) {
+        frame_shared_code_free(code);
+        return 1;
+    }
+    uint64_t cached_size = huffman_tree_serialized_size(code->tree)
+        + plan.header_size + plan.payload_size;
+    frame_block_plan_free(&plan);
+    if (cached_size > own_size) frame_shared_code_free(code);
+
+    return 0;
+}
+
+int huf_compress_batch(struct huf_batch* batch, const uint8_t* const* inputs,
+        const size_t* sizes, size_t count, int shared,
+        struct huf_batch_output* output) {
+    const struct frame_params* params = &batch->params;
+    output->size = 0;
+
+    if (count + 1 > output->offsets_capacity) {
+        size_t* offsets = realloc(output->offsets, (count + 1) * sizeof(size_t));
+        if (!offsets) {
+            errno = ERR_MEM_ERROR;
+            return 1;
+        }
+        output->offsets = offsets;
+        output->offsets_capacity = count + 1;
+    }
+
+    struct frame_shared_code code;
+    memset(&code, 0, sizeof(code));
+    int flags = (params->checksum ? FRAME_FLAG_CHECKSUM : 0)
+        | (params->transform.type != TRANSFORM_NONE ? FRAME_FLAG_TRANSFORM : 0);
+
+    int error_code = 0;
+    if (shared) {
+        error_code = _huf_batch_create_shared(batch, inputs, sizes, count, &code)
+            || _huf_batch_write_header(output,
+                flags | (code.tree ? FRAME_FLAG_SHARED_TREE : 0), &code);
+    }
+
+    uint32_t checksum = 0;
+    for (size_t i = 0; i < count && !error_code; i++) {
+        output->offsets[i] = output->size;
+        if (!shared) {
+            checksum = 0;
+            error_code = _huf_batch_create_cached(batch, inputs[i], sizes[i], &code)
+                || _huf_batch_write_header(output,
+                    flags | (code.tree ? FRAME_FLAG_SHARED_TREE : 0), &code);
+        }
+
+        for (size_t done = 0; done < sizes[i] && !error_code;) {
+            size_t size = sizes[i] - done < params->block_size
+                ? sizes[i] - done : params->block_size;
+            error_code = _huf_batch_write_block(batch, &code, inputs[i] + done,
+                size, &checksum, output);
+            done += size;
+        }
+
+        if (!shared && !error_code) {
+            error_code = _huf_batch_write_end(output, checksum);
+        }
+        if (!shared) frame_shared_code_free(&code);
+    }
+
+    if (!error_code) {
+        output->offsets[count] = output->size;
+        if (shared) error_code = _huf_batch_write_end(output, checksum);
+    }
+    frame_shared_code_free(&code);
+
+    return error_code;
+}
+
+
+/* Reads the code of a block or frame from a buffer. */
+int _huf_batch_read_code(int flags, const uint8_t* buffer, size_t size,
+        struct code_cache* cache, struct huffman_tree** tree, size_t* code_size) {
+    struct canonical_code_table* table = NULL;
+    *code_size = size > 0 ? frame_code_size(flags, buffer) : 0;
+    if (*code_size == 0 || *code_size > size) {
+        errno = ERR_PARSE_ERROR;
+        return 1;
+    }
+
+    return cache
+        ? code_cache_get(cache, flags, buffer, *code_size, tree, &table)
+        : frame_read_code(flags, buffer, *code_size, tree, &table);
+}
+
+void _huf_batch_release_code(struct code_cache* cache, struct huffman_tree* tree) {
+    if (!tree) return;
+
+    if (cache) {
+        code_cache_release(cache, tree, NULL);
+    } else {
+        huffman_tree_free(tree);
+    }
+}
+
+/* Decodes a single block and returns its size, 0 if it is invalid. */
+size_t _huf_batch_decode_block(int flags, struct huffman_tree* shared_tree,
+        const uint8_t* block, size_t size, struct code_cache* cache,
+        uint8_t** output, size_t* capacity, size_t* output_size) {
+    size_t checksum_size = (flags & FRAME_FLAG_CHECKSUM) ? CRC32C_SIZE : 0;
+    size_t position = FRAME_BLOCK_HEADER_SIZE + checksum_size
+        + ((flags & FRAME_FLAG_TRANSFORM) ? FRAME_TRANSFORM_SIZE : 0);
+    if (size < position) {
+        errno = ERR_PARSE_ERROR;
+        return 0;
+    }
+
+    int type = block[0];
+    uint32_t raw_size = io_get_u32(block + 1);
+    uint32_t payload_size = io_get_u32(block + 5);
+    struct transform transform;
+    if (raw_size > FRAME_MAX_BLOCK_SIZE || payload_size > FRAME_MAX_BLOCK_SIZE
+            || (type == FRAME_BLOCK_SHARED_TREE && !shared_tree)
+            || type < FRAME_BLOCK_SHARED_TREE
+            || (type > FRAME_BLOCK_STORED && type != FRAME_BLOCK_ANS)) {
+        errno = ERR_PARSE_ERROR;
+        return 0;
+    }
+    if (frame_read_transform(flags,
+            block + FRAME_BLOCK_HEADER_SIZE + checksum_size, &transform)) {
+        return 0;
+    }
+
+    struct huffman_tree* tree = shared_tree;
+    struct ans_code_table* ans = NULL;
+    size_t code_size = 0;
+    if (type == FRAME_BLOCK_OWN_TREE) {
+        tree = NULL;
+        if (_huf_batch_read_code(flags, block + position, size - position,
+                cache, &tree, &code_size)) {
+            return 0;
+        }
+    } else if (type == FRAME_BLOCK_ANS) {
+        code_size = size - position >= ANS_CODE_HEADER_SIZE
+            ? ans_code_table_size(block + position) : 0;
+        if (code_size == 0 || code_size > size - position) {
+            errno = ERR_PARSE_ERROR;
+            return 0;
+        }
+        ans = ans_code_read_table(block + position, code_size);
+        if (!ans) return 0;
+    }
+    position += code_size;
+
+    int error_code = payload_size > size - position;
+    if (error_code) errno = ERR_PARSE_ERROR;
+    error_code = error_code
+        || frame_reserve(output, capacity, *output_size + raw_size);
+
+    if (!error_code) {
+        uint8_t* decoded = *output + *output_size;
+        error_code = frame_decode_payload(type, flags, tree, NULL, ans,
+            &transform, block + position, payload_size, decoded, raw_size);
+        if (!error_code && (flags & FRAME_FLAG_CHECKSUM)
+                && crc32c_update(0, decoded, raw_size)
+                    != io_get_u32(block + FRAME_BLOCK_HEADER_SIZE)) {
+            errno = ERR_CHECKSUM_ERROR;
+            error_code = 1;
+        }
+        *output_size += raw_size;
+    }
+
+    if (type == FRAME_BLOCK_OWN_TREE) _huf_batch_release_code(cache, tree);
+    if (ans) ans_code_table_free(ans);
+
+    return error_code ? 0 : position + payload_size;
+}
+
+int huf_batch_decode(const uint8_t* header, size_t header_size,
+        const uint8_t* message, size_t message_size, struct code_cache* cache,
+        uint8_t** output, size_t* capacity, size_t* size) {
+    *size = 0;
+
+    /* A buffer of a batch without a shared tree is a frame of its own. */
+    const uint8_t* frame = header ? header : message;
+    size_t frame_size = header ? header_size : message_size;
+    if (frame_size < FRAME_MAGIC_SIZE + 1
+            || memcmp(frame, FRAME_MAGIC, FRAME_MAGIC_SIZE)
+            || (frame[FRAME_MAGIC_SIZE] & ~FRAME_FLAGS)
+            || (frame[FRAME_MAGIC_SIZE] & FRAME_FLAG_WIDE)) {
+        errno = ERR_PARSE_ERROR;
+        return 1;
+    }
+    int flags = frame[FRAME_MAGIC_SIZE];
+    size_t position = FRAME_MAGIC_SIZE + 1;
+
+    struct huffman_tree* shared_tree = NULL;
+    if (flags & FRAME_FLAG_SHARED_TREE) {
+        size_t code_size;
+        if (_huf_batch_read_code(flags, frame + position, frame_size - position,
+                cache, &shared_tree, &code_size)) {
+            return 1;
+        }
+        position += code_size;
+    }
+
+    /* The header of a batch is followed by the blocks of every buffer,
+     * a frame of its own by its blocks and end block. */
+    const uint8_t* blocks = header ? message : message + position;
+    size_t blocks_size = header ? message_size : message_size - position;
+    int error_code = 0;
+    if (header ? position != header_size : blocks_size < FRAME_BLOCK_HEADER_SIZE) {
+        errno = ERR_PARSE_ERROR;
+        error_code = 1;
+    } else if (!header) {
+        blocks_size -= FRAME_BLOCK_HEADER_SIZE;
+        if (blocks[blocks_size] != FRAME_BLOCK_END) {
+            errno = ERR_PARSE_ERROR;
+            error_code = 1;
+        }
+    }
+
+    size_t done = 0;
+    while (!error_code && done < blocks_size) {
+        size_t block_size = _huf_batch_decode_block(flags, shared_tree,
+            blocks + done, blocks_size - done, cache, output, capacity, size);
+        error_code = block_size == 0;
+        done += block_size;
+    }
+
+    if (!error_code && !header && (flags & FRAME_FLAG_CHECKSUM)
+            && crc32c_update(0, *output, *size)
+                != io_get_u32(blocks + blocks_size + 1)) {
+        errno = ERR_CHECKSUM_ERROR;
+        error_code = 1;
+    }
+
+    _huf_batch_release_code(cache, shared_tree);
+
+    return error_code;
+}
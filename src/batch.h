@@ -0,0 +1,130 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "error.h"
+#include "frame.h"
+#include "code_cache.h"
+
+
+/*
+ * Compressing small buffers one at a time spends most of its time setting
+ * up rather than coding: dicts, trees, mappings and buffers are created for
+ * every buffer. A batch keeps all of these between calls and writes the
+ * compressed buffers one after another into a single output.
+ *
+ * Without a shared tree, every buffer becomes a frame of its own without an
+ * index block, so each of them, and the whole output, decodes with
+ * frame_decompress_stream(). With a table cache in the parameters, the
+ * frame of a buffer starts with a tree taken from the cache where that
+ * makes the frame no larger than planning its blocks on their own, as
+ * every frame stores its tree. With a shared tree, the output is a single
+ * frame: a header with a tree built from all buffers, the blocks of every
+ * buffer and one end block. A buffer of such a batch is decoded from the
+ * header of the batch and its own blocks by huf_batch_decode().
+ */
+
+
+/**
+ * @brief The compressed buffers of a batch. Zero it before its first use;
+ * its memory is reused by further batches and must be released with
+ * huf_batch_output_free().
+ */
+struct huf_batch_output {
+    uint8_t* data;
+    /** Number of bytes of <data> in use. */
+    size_t size;
+    size_t capacity;
+    /**
+     * The buffer i is stored from offsets[i] up to offsets[i + 1]. With a
+     * shared tree, offsets[0] is the size of the header of the frame and
+     * the end block follows offsets[count].
+     */
+    size_t* offsets;
+    size_t offsets_capacity;
+};
+
+/**
+ * @brief The state reused by the batches compressed with the same
+ * parameters.
+ */
+struct huf_batch {
+    struct frame_params params;
+    struct freq_dict* block_dict;
+    struct freq_dict* spare_dict;
+    /** The frequencies of all buffers of a batch with a shared tree. */
+    struct freq_dict* batch_dict;
+    /** The transformed bytes of the current block. */
+    uint8_t* transformed;
+    size_t transformed_capacity;
+};
+
+
+/**
+ * @brief Creates the state for compressing batches.
+ *
+ * @param params the parameters for compression. 16 bit words are not
+ * supported by batches, and blocks are never split early.
+ * @return struct huf_batch* the created batch state, NULL if the parameters
+ * are invalid or an error occurred. Must be freed with a call to
+ * huf_batch_free().
+ */
+struct huf_batch* huf_batch_create(const struct frame_params* params);
+
+/**
+ * @brief Frees the state for compressing batches.
+ *
+ * @param batch the batch state to be freed.
+ */
+void huf_batch_free(struct huf_batch* batch);
+
+/**
+ * @brief Compresses a number of buffers at once.
+ *
+ * @param batch the state reused between batches.
+ * @param inputs the buffers to be compressed.
+ * @param sizes the number of bytes of every buffer.
+ * @param count the number of buffers.
+ * @param shared non-zero to code all buffers with a single tree stored
+ * once, zero to compress every buffer into a frame of its own.
+ * @param output set to the compressed buffers.
+ * @return int non-zero if an error occurred, zero otherwise.
+ */
+int huf_compress_batch(struct huf_batch* batch, const uint8_t* const* inputs,
+    const size_t* sizes, size_t count, int shared,
+    struct huf_batch_output* output);
+
+/**
+ * @brief Frees the memory of the output of batches.
+ *
+ * @param output the output to be released.
+ */
+void huf_batch_output_free(struct huf_batch_output* output);
+
+/**
+ * @brief Decodes a single buffer of a batch.
+ *
+ * @param header the header of a batch with a shared tree, i.e. its first
+ * offsets[0] bytes, or NULL for a batch without one.
+ * @param header_size the number of bytes of <header>.
+ * @param message the compressed buffer.
+ * @param message_size the number of bytes of <message>.
+ * @param cache the cache the trees are taken from, may be NULL.
+ * @param output a heap buffer the decoded bytes are written to, may point
+ * to NULL. Must be freed by the caller.
+ * @param capacity the capacity of <output>.
+ * @param size set to the number of decoded bytes.
+ * @return int non-zero if an error occurred, zero otherwise. errno is set
+ * to ERR_CHECKSUM_ERROR if a block decodes to bytes that do not match its
+ * checksum.
+ */
+int huf_batch_decode(const uint8_t* header, size_t header_size,
+    const uint8_t* message, size_t message_size, struct code_cache* cache,
+    uint8_t** output, size_t* capacity, size_t* size);
+
+
+#endif
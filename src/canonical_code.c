@@ -0,0 +1,486 @@
+#include "canonical_code.h"
+#include "io_util.h"
+
+#include <string.h>
+
+
+/**
+ * @brief A symbol together with its weight while code lengths are computed.
+ */
+struct _canonical_code_symbol {
+    uint64_t weight;
+    uint32_t symbol;
+};
+
+int _canonical_code_compare_symbols(const void* a, const void* b) {
+    const struct _canonical_code_symbol* left = a;
+    const struct _canonical_code_symbol* right = b;
+
+    if (left->weight != right->weight) return left->weight < right->weight ? -1 : 1;
+    return (left->symbol > right->symbol) - (left->symbol < right->symbol);
+}
+
+/* Replaces the weights in <values>, sorted in ascending order, with the code
+ * lengths of a Huffman code for them (Moffat and Katajainen, "In-Place
+ * Calculation of Minimum-Redundancy Codes"). The first pass builds the tree
+ * with parent pointers, the second turns them into depths of the internal
+ * nodes and the third hands out the leaf depths. */
+void _canonical_code_lengths_in_place(uint64_t* values, size_t count) {
+    if (count == 1) {
+        values[0] = 1;
+        return;
+    }
+
+    size_t root = 0;
+    size_t leaf = 2;
+    values[0] += values[1];
+    for (size_t next = 1; next < count - 1; next++) {
+        if (leaf >= count || values[root] < values[leaf]) {
+            values[next] = values[root];
+            values[root++] = next;
+        } else {
+            values[next] = values[leaf++];
+        }
+
+        if (leaf >= count || (root < next && values[root] < values[leaf])) {
+            values[next] += values[root];
+            values[root++] = next;
+        } else {
+            values[next] += values[leaf++];
+        }
+    }
+
+    values[count - 2] = 0;
+    for (size_t next = count - 2; next-- > 0;) {
+        values[next] = values[values[next]] + 1;
+    }
+
+    int64_t available = 1;
+    int64_t used = 0;
+    uint64_t depth = 0;
+    int64_t internal = (int64_t)count - 2;
+    int64_t next = (int64_t)count - 1;
+    while (available > 0) {
+        while (internal >= 0 && values[internal] == depth) {
+            used++;
+            internal--;
+        }
+        while (available > used) {
+            values[next--] = depth;
+            available--;
+        }
+        available = 2 * used;
+        depth++;
+        used = 0;
+    }
+}
+
+/* Assigns canonical codes from the code lengths and checks that the
+ * lengths describe a complete code. */
+int _canonical_code_assign(struct canonical_code* code) {
+    uint32_t length_counts[CANONICAL_CODE_MAX_LENGTH + 1] = { 0 };
+    uint32_t next_codes[CANONICAL_CODE_MAX_LENGTH + 1];
+
+    code->symbol_count = 0;
+    code->max_length = 0;
+    for (uint32_t i = 0; i < code->alphabet_size; i++) {
+        int length = code->lengths[i];
+        if (length > CANONICAL_CODE_MAX_LENGTH) return 1;
+        if (length) {
+            length_counts[length]++;
+            code->symbol_count++;
+            if (length > code->max_length) code->max_length = length;
+        }
+    }
+
+    uint64_t kraft_sum = 0;
+    uint32_t next = 0;
+    for (int length = 1; length <= CANONICAL_CODE_MAX_LENGTH; length++) {
+        next = (next + length_counts[length - 1]) << 1;
+        next_codes[length] = next;
+        kraft_sum += (uint64_t)length_counts[length]
+            << (CANONICAL_CODE_MAX_LENGTH - length);
+    }
+    if (code->symbol_count < 2
+            || kraft_sum != (uint64_t)1 << CANONICAL_CODE_MAX_LENGTH) {
+        return 1;
+    }
+
+    for (uint32_t i = 0; i < code->alphabet_size; i++) {
+        if (code->lengths[i]) code->codes[i] = next_codes[code->lengths[i]]++;
+    }
+
+    return 0;
+}
+
+struct canonical_code* _canonical_code_create(uint32_t alphabet_size) {
+    struct canonical_code* code = malloc(sizeof(struct canonical_code));
+    if (!code) {
+        errno = ERR_MEM_ERROR;
+        return NULL;
+    }
+
+    code->alphabet_size = alphabet_size;
+    code->lengths = calloc(alphabet_size, sizeof(uint8_t));
+    code->codes = calloc(alphabet_size, sizeof(uint32_t));
+    code->symbol_count = 0;
+    code->max_length = 0;
+    if (!code->lengths || !code->codes) {
+        canonical_code_free(code);
+        errno = ERR_MEM_ERROR;
+        return NULL;
+    }
+
+    return code;
+}
+
+struct canonical_code* canonical_code_create_from_frequencies(
+        const uint64_t* frequencies, uint32_t alphabet_size, int max_length) {
+    if (alphabet_size < 2 || alphabet_size > CANONICAL_CODE_MAX_ALPHABET
+            || max_length > CANONICAL_CODE_MAX_LENGTH
+            || ((uint32_t)1 << max_length) < alphabet_size) {
+        errno = ERR_ILLEGAL_ARG;
+        return NULL;
+    }
+
+    size_t count = 0;
+    for (uint32_t i = 0; i < alphabet_size; i++) {
+        if (frequencies[i]) count++;
+    }
+    if (count == 0) {
+        errno = ERR_ILLEGAL_ARG;
+        return NULL;
+    }
+
+    struct canonical_code* code = _canonical_code_create(alphabet_size);
+    struct _canonical_code_symbol* symbols = malloc(
+        (count + 1) * sizeof(struct _canonical_code_symbol));
+    uint64_t* values = malloc((count + 1) * sizeof(uint64_t));
+    if (!code || !symbols || !values) {
+        if (code) canonical_code_free(code);
+        free(symbols);
+        free(values);
+        errno = ERR_MEM_ERROR;
+        return NULL;
+    }
+
+    count = 0;
+    for (uint32_t i = 0; i < alphabet_size; i++) {
+        if (frequencies[i]) {
+            symbols[count].weight = frequencies[i];
+            symbols[count].symbol = i;
+            count++;
+        }
+    }
+
+    /* A single symbol still needs a code of one bit, so a neighbour that
+     * never occurs takes the other half of the code space. */
+    if (count == 1) {
+        symbols[1].weight = 0;
+        symbols[1].symbol = symbols[0].symbol ^ 1;
+        count = 2;
+    }
+
+    /* Halving the weights flattens the distribution and shortens the
+     * longest codes, until they fit into <max_length> bits. */
+    for (;;) {
+        qsort(symbols, count, sizeof(struct _canonical_code_symbol),
+            _canonical_code_compare_symbols);
+        for (size_t i = 0; i < count; i++) values[i] = symbols[i].weight;
+        _canonical_code_lengths_in_place(values, count);
+
+        if (values[0] <= (uint64_t)max_length) break;
+        for (size_t i = 0; i < count; i++) {
+            symbols[i].weight = (symbols[i].weight + 1) / 2;
+        }
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        code->lengths[symbols[i].symbol] = (uint8_t)values[i];
+    }
+    free(values);
+    free(symbols);
+
+    if (_canonical_code_assign(code)) {
+        canonical_code_free(code);
+        errno = ERR_ILLEGAL_ARG;
+        return NULL;
+    }
+
+    return code;
+}
+
+void canonical_code_free(struct canonical_code* code) {
+    free(code->lengths);
+    free(code->codes);
+    free(code);
+}
+
+
+uint64_t canonical_code_encoded_bits(struct canonical_code* code,
+        const uint64_t* frequencies) {
+    uint64_t bits = 0;
+    for (uint32_t i = 0; i < code->alphabet_size; i++) {
+        if (!frequencies[i]) continue;
+        if (!code->lengths[i]) return UINT64_MAX;
+        bits += frequencies[i] * code->lengths[i];
+    }
+
+    return bits;
+}
+
+
+uint32_t _canonical_code_dense_count(struct canonical_code* code) {
+    uint32_t count = code->alphabet_size;
+    while (count > 0 && !code->lengths[count - 1]) count--;
+
+    return count;
+}
+
+size_t canonical_code_serialized_size(struct canonical_code* code) {
+    size_t sparse_size = (size_t)code->symbol_count * 3;
+    size_t dense_size = _canonical_code_dense_count(code);
+
+    return CANONICAL_CODE_HEADER_SIZE
+        + (sparse_size < dense_size ? sparse_size : dense_size);
+}
+
+size_t canonical_code_write_to_buffer(struct canonical_code* code, uint8_t* buffer) {
+    uint32_t dense_count = _canonical_code_dense_count(code);
+    size_t position = CANONICAL_CODE_HEADER_SIZE;
+
+    if ((size_t)code->symbol_count * 3 < dense_count) {
+        buffer[0] = CANONICAL_CODE_SPARSE;
+        io_put_u32(buffer + 1, code->symbol_count);
+        for (uint32_t i = 0; i < code->alphabet_size; i++) {
+            if (!code->lengths[i]) continue;
+            buffer[position++] = (uint8_t)i;
+            buffer[position++] = (uint8_t)(i >> 8);
+            buffer[position++] = code->lengths[i];
+        }
+    } else {
+        buffer[0] = CANONICAL_CODE_DENSE;
+        io_put_u32(buffer + 1, dense_count);
+        memcpy(buffer + position, code->lengths, dense_count);
+        position += dense_count;
+    }
+
+    return position;
+}
+
+size_t canonical_code_table_size(const uint8_t* header, uint32_t alphabet_size) {
+    uint32_t count = io_get_u32(header + 1);
+    if (count > alphabet_size) return 0;
+
+    switch (header[0]) {
+        case CANONICAL_CODE_SPARSE:
+            return CANONICAL_CODE_HEADER_SIZE + (size_t)count * 3;
+        case CANONICAL_CODE_DENSE:
+            return CANONICAL_CODE_HEADER_SIZE + count;
+        default:
+            return 0;
+    }
+}
+
+struct canonical_code* canonical_code_read_from_buffer(const uint8_t* buffer,
+        size_t size, uint32_t alphabet_size) {
+    size_t table_size;
+    if (size < CANONICAL_CODE_HEADER_SIZE
+            || alphabet_size > CANONICAL_CODE_MAX_ALPHABET
+            || (table_size = canonical_code_table_size(buffer, alphabet_size)) == 0
+            || table_size > size) {
+        errno = ERR_PARSE_ERROR;
+        return NULL;
+    }
+
+    struct canonical_code* code = _canonical_code_create(alphabet_size);
+    if (!code) return NULL;
+
+    uint32_t count = io_get_u32(buffer + 1);
+    const uint8_t* body = buffer + CANONICAL_CODE_HEADER_SIZE;
+    int error_code = 0;
+    if (buffer[0] == CANONICAL_CODE_SPARSE) {
+        int64_t previous = -1;
+        for (uint32_t i = 0; i < count && !error_code; i++) {
+            uint32_t symbol = (uint32_t)body[3 * i] | ((uint32_t)body[3 * i + 1] << 8);
+            uint8_t length = body[3 * i + 2];
+            error_code = (int64_t)symbol <= previous || symbol >= alphabet_size
+                || length == 0;
+            if (!error_code) code->lengths[symbol] = length;
+            previous = symbol;
+        }
+    } else {
+        memcpy(code->lengths, body, count);
+    }
+
+    if (error_code || _canonical_code_assign(code)) {
+        canonical_code_free(code);
+        errno = ERR_PARSE_ERROR;
+        return NULL;
+    }
+
+    return code;
+}
+
+
+size_t canonical_code_encode_words(struct canonical_code* code,
+        const uint8_t* in_buffer, size_t in_size, int big_endian,
+        uint8_t* out_buffer) {
+    const uint8_t* lengths = code->lengths;
+    const uint32_t* codes = code->codes;
+    int high = big_endian ? 0 : 1;
+    size_t out_size = 0;
+
+    uint64_t bits = 0;
+    int bit_count = 0;
+    for (size_t i = 0; i + 1 < in_size; i += 2) {
+        uint32_t symbol = ((uint32_t)in_buffer[i + high] << 8)
+            | in_buffer[i + 1 - high];
+
+        bits = (bits << lengths[symbol]) | codes[symbol];
+        bit_count += lengths[symbol];
+        while (bit_count >= 8) {
+            bit_count -= 8;
+            out_buffer[out_size++] = (uint8_t)(bits >> bit_count);
+        }
+    }
+    if (bit_count > 0) {
+        out_buffer[out_size++] = (uint8_t)(bits << (8 - bit_count));
+    }
+
+    if (in_size & 1) out_buffer[out_size++] = in_buffer[in_size - 1];
+
+    return out_size;
+}
+
+
+struct canonical_code_table* canonical_code_create_table(struct canonical_code* code) {
+    int root_bits = code->max_length < CANONICAL_CODE_ROOT_BITS
+        ? code->max_length : CANONICAL_CODE_ROOT_BITS;
+    size_t root_size = (size_t)1 << root_bits;
+
+    /* Codes longer than the root bits are grouped by their first
+     * <root_bits> bits. Each group gets a second level table as large as
+     * its longest code requires. */
+    uint8_t* group_lengths = calloc(root_size, sizeof(uint8_t));
+    if (!group_lengths) {
+        errno = ERR_MEM_ERROR;
+        return NULL;
+    }
+    for (uint32_t i = 0; i < code->alphabet_size; i++) {
+        int length = code->lengths[i];
+        if (length <= root_bits) continue;
+
+        size_t prefix = code->codes[i] >> (length - root_bits);
+        if (length > group_lengths[prefix]) group_lengths[prefix] = (uint8_t)length;
+    }
+
+    size_t entry_count = root_size;
+    for (size_t i = 0; i < root_size; i++) {
+        if (group_lengths[i]) entry_count += (size_t)1 << (group_lengths[i] - root_bits);
+    }
+
+    struct canonical_code_table* table = malloc(sizeof(struct canonical_code_table));
+    uint32_t* entries = malloc(entry_count * sizeof(uint32_t));
+    if (!table || !entries) {
+        free(table);
+        free(entries);
+        free(group_lengths);
+        errno = ERR_MEM_ERROR;
+        return NULL;
+    }
+    table->entries = entries;
+    table->entry_count = entry_count;
+    table->root_bits = root_bits;
+
+    size_t offset = root_size;
+    for (size_t i = 0; i < root_size; i++) {
+        if (!group_lengths[i]) continue;
+
+        int sub_bits = group_lengths[i] - root_bits;
+        entries[i] = (uint32_t)(offset << 8) | 0x80 | (uint32_t)sub_bits;
+        offset += (size_t)1 << sub_bits;
+    }
+
+    for (uint32_t i = 0; i < code->alphabet_size; i++) {
+        int length = code->lengths[i];
+        if (!length) continue;
+
+        uint32_t entry = (i << 8) | (uint32_t)length;
+        uint32_t* first;
+        size_t fill;
+        if (length <= root_bits) {
+            fill = (size_t)1 << (root_bits - length);
+            first = entries + ((size_t)code->codes[i] << (root_bits - length));
+        } else {
+            int rest = length - root_bits;
+            size_t prefix = code->codes[i] >> rest;
+            int sub_bits = group_lengths[prefix] - root_bits;
+            size_t suffix = code->codes[i] & (((size_t)1 << rest) - 1);
+
+            fill = (size_t)1 << (sub_bits - rest);
+            first = entries + (entries[prefix] >> 8) + (suffix << (sub_bits - rest));
+        }
+
+        for (size_t j = 0; j < fill; j++) first[j] = entry;
+    }
+    free(group_lengths);
+
+    return table;
+}
+
+void canonical_code_table_free(struct canonical_code_table* table) {
+    free(table->entries);
+    free(table);
+}
+
+int canonical_code_decode_words(struct canonical_code_table* table,
+        const uint8_t* in_buffer, size_t in_size,
+        uint8_t* out_buffer, size_t out_size, int big_endian) {
+    if (out_size & 1) {
+        if (in_size == 0) {
+            errno = ERR_PARSE_ERROR;
+            return 1;
+        }
+        out_buffer[out_size - 1] = in_buffer[--in_size];
+    }
+
+    const uint32_t* entries = table->entries;
+    int root_bits = table->root_bits;
+    uint64_t root_mask = ((uint64_t)1 << root_bits) - 1;
+    int high = big_endian ? 0 : 1;
+
+    uint64_t bits = 0;
+    int bit_count = 0;
+    size_t in_position = 0;
+    for (size_t i = 0; i + 1 < out_size; i += 2) {
+        while (bit_count <= 56 && in_position < in_size) {
+            bits = (bits << 8) | in_buffer[in_position++];
+            bit_count += 8;
+        }
+
+        /* Past the end of the input, missing bits read as zeros. Whether
+         * the code actually fits is checked against its length below. */
+        uint64_t window = bit_count >= 32
+            ? bits >> (bit_count - 32) : bits << (32 - bit_count);
+        uint32_t entry = entries[(window >> (32 - root_bits)) & root_mask];
+        if (entry & 0x80) {
+            int sub_bits = entry & 0x3f;
+            uint64_t suffix = (window >> (32 - root_bits - sub_bits))
+                & (((uint64_t)1 << sub_bits) - 1);
+            entry = entries[(entry >> 8) + suffix];
+        }
+
+        int length = entry & 0x3f;
+        if (length > bit_count) {
+            errno = ERR_PARSE_ERROR;
+            return 1;
+        }
+        bit_count -= length;
+
+        out_buffer[i + 1 - high] = (uint8_t)(entry >> 8);
+        out_buffer[i + high] = (uint8_t)(entry >> 16);
+    }
+
+    return 0;
+}
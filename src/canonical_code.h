@@ -0,0 +1,191 @@
+#ifndef CANONICAL_CODE_H
+#define CANONICAL_CODE_H
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "error.h"
+
+
+/*
+ * Canonical Huffman codes over alphabets of up to 65536 symbols, which are
+ * described completely by the code length of every symbol. They are used for
+ * 16 bit words, where a tree of nodes would be too large to store and too
+ * slow to walk.
+ *
+ * table  := kind:u8 count:u32 body
+ * body   := (symbol:u16 length:u8)*   if kind is CANONICAL_CODE_SPARSE
+ *         | length:u8*                if kind is CANONICAL_CODE_DENSE
+ *
+ * Sparse tables list the <count> symbols with a code in increasing order,
+ * dense tables the lengths of the symbols 0 to <count> - 1, 0 for symbols
+ * without a code. Whichever is smaller is written.
+ */
+
+#define CANONICAL_CODE_SPARSE 0
+#define CANONICAL_CODE_DENSE 1
+
+#define CANONICAL_CODE_HEADER_SIZE 5
+#define CANONICAL_CODE_MAX_LENGTH 20
+#define CANONICAL_CODE_MAX_ALPHABET 65536
+
+/** Number of bits resolved by the first level of a decoding table. */
+#define CANONICAL_CODE_ROOT_BITS 11
+
+
+/**
+ * @brief A canonical code: codes of equal length are consecutive numbers
+ * in the order of their symbols, and shorter codes come first.
+ */
+struct canonical_code {
+    uint32_t alphabet_size;
+    /** The code length of every symbol, 0 for symbols without a code. */
+    uint8_t* lengths;
+    /** The code of every symbol, right aligned. */
+    uint32_t* codes;
+    /** Number of symbols with a code. */
+    uint32_t symbol_count;
+    int max_length;
+};
+
+/**
+ * @brief A two level lookup table decoding a canonical code. The first
+ * level is indexed by the next CANONICAL_CODE_ROOT_BITS bits of the input.
+ * Its entries either hold a symbol and the length of its code, or point
+ * to a second level table resolving the longer codes sharing that prefix.
+ */
+struct canonical_code_table {
+    /**
+     * Entries hold the symbol or the offset of a second level table in the
+     * upper 24 bits. The lower 8 bits are the code length for symbols, or
+     * 0x80 plus the number of bits indexing the second level table.
+     */
+    uint32_t* entries;
+    size_t entry_count;
+    int root_bits;
+};
+
+
+/**
+ * @brief Creates a canonical code from the frequencies of the symbols of an
+ * alphabet. The code lengths are those of a Huffman code, computed in place
+ * after sorting the symbols. Codes longer than <max_length> are avoided by
+ * flattening the frequencies until the code fits. At least two symbols get
+ * a code, even if fewer occur.
+ *
+ * @param frequencies the frequency of every symbol.
+ * @param alphabet_size the number of symbols, at most CANONICAL_CODE_MAX_ALPHABET.
+ * @param max_length the maximum code length, at most CANONICAL_CODE_MAX_LENGTH.
+ * @return struct canonical_code* the created code, NULL if no symbol occurs
+ * or an error occurred. Must be freed with a call to canonical_code_free().
+ */
+struct canonical_code* canonical_code_create_from_frequencies(
+    const uint64_t* frequencies, uint32_t alphabet_size, int max_length);
+
+/**
+ * @brief Frees a canonical code.
+ *
+ * @param code the code to be freed.
+ */
+void canonical_code_free(struct canonical_code* code);
+
+/**
+ * @brief Returns the number of bits a sequence of symbols is encoded to.
+ *
+ * @param code the code to encode the symbols with.
+ * @param frequencies how often every symbol of the alphabet occurs.
+ * @return uint64_t the number of bits, or UINT64_MAX if a symbol that
+ * occurs has no code.
+ */
+uint64_t canonical_code_encoded_bits(struct canonical_code* code,
+    const uint64_t* frequencies);
+
+/**
+ * @brief Returns the number of bytes of the serialized form of a code.
+ *
+ * @param code the code to be serialized.
+ * @return size_t the number of bytes written by canonical_code_write_to_buffer().
+ */
+size_t canonical_code_serialized_size(struct canonical_code* code);
+
+/**
+ * @brief Serializes a code.
+ *
+ * @param code the code to be serialized.
+ * @param buffer the buffer of at least canonical_code_serialized_size() bytes.
+ * @return size_t the number of bytes written.
+ */
+size_t canonical_code_write_to_buffer(struct canonical_code* code, uint8_t* buffer);
+
+/**
+ * @brief Returns the size of a serialized code from its header.
+ *
+ * @param header the first CANONICAL_CODE_HEADER_SIZE bytes of the code.
+ * @param alphabet_size the number of symbols of the alphabet.
+ * @return size_t the size of the code including the header, or 0 if the
+ * header is invalid.
+ */
+size_t canonical_code_table_size(const uint8_t* header, uint32_t alphabet_size);
+
+/**
+ * @brief Reads a serialized code and checks that it is complete.
+ *
+ * @param buffer the serialized code.
+ * @param size the number of bytes in <buffer>.
+ * @param alphabet_size the number of symbols of the alphabet.
+ * @return struct canonical_code* the code, NULL if it is invalid.
+ * Must be freed with a call to canonical_code_free().
+ */
+struct canonical_code* canonical_code_read_from_buffer(const uint8_t* buffer,
+    size_t size, uint32_t alphabet_size);
+
+/**
+ * @brief Encodes 16 bit words, starting with the most significant bit of
+ * every output byte. An odd trailing byte is appended as it is.
+ *
+ * @param code the code of an alphabet of 65536 symbols.
+ * @param in_buffer the words to be encoded.
+ * @param in_size the number of bytes in <in_buffer>.
+ * @param big_endian non-zero if the words are stored big endian.
+ * @param out_buffer the buffer the encoded bits are written to.
+ * @return size_t the number of bytes written to <out_buffer>.
+ */
+size_t canonical_code_encode_words(struct canonical_code* code,
+    const uint8_t* in_buffer, size_t in_size, int big_endian, uint8_t* out_buffer);
+
+/**
+ * @brief Creates the lookup table decoding a code.
+ *
+ * @param code the code to be decoded.
+ * @return struct canonical_code_table* the created table.
+ * Must be freed with a call to canonical_code_table_free().
+ */
+struct canonical_code_table* canonical_code_create_table(struct canonical_code* code);
+
+/**
+ * @brief Frees a decoding table.
+ *
+ * @param table the table to be freed.
+ */
+void canonical_code_table_free(struct canonical_code_table* table);
+
+/**
+ * @brief Decodes 16 bit words encoded by canonical_code_encode_words().
+ *
+ * @param table the table of the code the words are encoded with.
+ * @param in_buffer the encoded bits.
+ * @param in_size the number of bytes in <in_buffer>.
+ * @param out_buffer the buffer the decoded words are written to.
+ * @param out_size the number of bytes the words decode to.
+ * @param big_endian non-zero if the words are stored big endian.
+ * @return int non-zero if <in_buffer> ends before <out_size> bytes have
+ * been decoded, zero otherwise.
+ */
+int canonical_code_decode_words(struct canonical_code_table* table,
+    const uint8_t* in_buffer, size_t in_size,
+    uint8_t* out_buffer, size_t out_size, int big_endian);
+
+
+#endif
@@ -0,0 +1,175 @@
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "error.h"
+#include "transform.h"
+#include "daemon.h"
+
+
+#define FILE_EXTENSION_COMPRESS ".huf"
+#define FILE_EXTENSION_DECOMPRESS ".orig"
+
+
+void print_usage(const char* program) {
+    printf("Usage: %s [options] SOCKET c|d FILE\n"
+        "       %s SOCKET stop\n"
+        "Sends FILE to the daemon started with encoder --daemon SOCKET.\n\n"
+        "  c                compress FILE to FILE%s\n"
+        "  d                decompress FILE to FILE%s\n"
+        "  stop             stop the daemon\n\n"
+        "With - as FILE, standard input is coded to standard output.\n\n"
+        "Options:\n"
+        "  --wide ORDER     with c, code 16 bit words stored in byte ORDER\n"
+        "                   le or be instead of bytes\n"
+        "  --transform T    with c, try a transform on every block: delta,\n"
+        "                   delta:N for records of N bytes or xor:N for\n"
+        "                   N byte floats\n"
+        "  --no-checksum    with c, do not store checksums\n",
+        program, program, FILE_EXTENSION_COMPRESS, FILE_EXTENSION_DECOMPRESS);
+}
+
+
+/* Sends standard input along with the request and writes the response. */
+int run_inline(int connection, struct huf_daemon_request* request) {
+    uint8_t* payload = NULL;
+    size_t capacity = 0;
+    size_t size = 0;
+    size_t read;
+    do {
+        if (frame_reserve(&payload, &capacity, size + FRAME_DEFAULT_BLOCK_SIZE)) {
+            free(payload);
+            return 1;
+        }
+        read = fread(payload + size, 1, FRAME_DEFAULT_BLOCK_SIZE, stdin);
+        size += read;
+    } while (read == FRAME_DEFAULT_BLOCK_SIZE);
+
+    uint8_t* response;
+    uint64_t response_size;
+    request->payload_size = size;
+    int error_code = huf_client_request(connection, request, payload, -1, -1,
+        &response, &response_size);
+    free(payload);
+    if (error_code) return 1;
+
+    if (fwrite(response, 1, response_size, stdout) != response_size) {
+        errno = ERR_IO_ERROR;
+        error_code = 1;
+    }
+    free(response);
+
+    return error_code;
+}
+
+/* Passes FILE and the output file to the daemon. */
+int run_file(int connection, struct huf_daemon_request* request,
+        const char* in_file_name) {
+    const char* extension = request->op == HUF_DAEMON_OP_COMPRESS
+        ? FILE_EXTENSION_COMPRESS : FILE_EXTENSION_DECOMPRESS;
+    char* out_file_name = malloc(strlen(in_file_name) + strlen(extension) + 1);
+    if (!out_file_name) {
+        errno = ERR_MEM_ERROR;
+        return 1;
+    }
+    strcpy(out_file_name, in_file_name);
+    strcat(out_file_name, extension);
+
+    int in_fd = open(in_file_name, O_RDONLY);
+    int out_fd = in_fd < 0 ? -1
+        : open(out_file_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (in_fd < 0 || out_fd < 0) {
+        if (in_fd >= 0) close(in_fd);
+        free(out_file_name);
+        return 1;
+    }
+
+    uint8_t* response;
+    uint64_t response_size;
+    request->flags |= HUF_DAEMON_FLAG_DESCRIPTORS;
+    int error_code = huf_client_request(connection, request, NULL, in_fd,
+        out_fd, &response, &response_size);
+    close(out_fd);
+    close(in_fd);
+
+    if (!error_code) {
+        printf("%s %s to %s (%" PRIu64 " bytes).\n",
+            request->op == HUF_DAEMON_OP_COMPRESS ? "Compressed" : "Decompressed",
+            in_file_name, out_file_name, response_size);
+    }
+    free(out_file_name);
+
+    return error_code;
+}
+
+
+int main(int argc, char* argv[]) {
+    struct huf_daemon_request request;
+    memset(&request, 0, sizeof(request));
+
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-' && argv[i][1] == '-'; i++) {
+        if (!strcmp(argv[i], "--wide") && i + 1 < argc) {
+            i++;
+            if (!strcmp(argv[i], "le")) {
+                request.wide = FRAME_WIDE_LITTLE_ENDIAN;
+            } else if (!strcmp(argv[i], "be")) {
+                request.wide = FRAME_WIDE_BIG_ENDIAN;
+            } else {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (!strcmp(argv[i], "--transform") && i + 1 < argc) {
+            if (transform_from_name(argv[++i], &request.transform)) {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (!strcmp(argv[i], "--no-checksum")) {
+            request.flags |= HUF_DAEMON_FLAG_NO_CHECKSUM;
+        } else if (!strcmp(argv[i], "--help")) {
+            print_usage(argv[0]);
+            return 0;
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (i + 2 == argc && !strcmp(argv[i + 1], "stop")) {
+        request.op = HUF_DAEMON_OP_STOP;
+    } else if (i + 3 == argc && !strcmp(argv[i + 1], "c")) {
+        request.op = HUF_DAEMON_OP_COMPRESS;
+    } else if (i + 3 == argc && !strcmp(argv[i + 1], "d")) {
+        request.op = HUF_DAEMON_OP_DECOMPRESS;
+    } else {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    int connection = huf_client_connect(argv[i]);
+    if (connection < 0) {
+        print_error("Failed to connect to the daemon");
+        return 1;
+    }
+
+    int error_code;
+    if (request.op == HUF_DAEMON_OP_STOP) {
+        uint8_t* response;
+        uint64_t response_size;
+        error_code = huf_client_request(connection, &request, NULL, -1, -1,
+            &response, &response_size);
+    } else if (!strcmp(argv[i + 2], "-")) {
+        error_code = run_inline(connection, &request);
+    } else {
+        error_code = run_file(connection, &request, argv[i + 2]);
+    }
+    close(connection);
+
+    if (error_code) {
+        print_error("Request failed");
+        return 1;
+    }
+
+    return 0;
+}
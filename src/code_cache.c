@@ -0,0 +1,159 @@
+#include "code_cache.h"
+#include "frame.h"
+
+#include <string.h>
+
+
+struct code_cache* code_cache_create(size_t capacity) {
+    struct code_cache* cache = calloc(1, sizeof(struct code_cache));
+    if (!cache) {
+        errno = ERR_MEM_ERROR;
+        return NULL;
+    }
+
+    cache->entries = calloc(capacity ? capacity : 1, sizeof(struct code_cache_entry));
+    if (!cache->entries) {
+        free(cache);
+        errno = ERR_MEM_ERROR;
+        return NULL;
+    }
+    cache->capacity = capacity;
+
+#ifdef HUF_HAVE_PTHREAD
+    pthread_mutex_init(&cache->mutex, NULL);
+#endif
+
+    return cache;
+}
+
+void _code_cache_lock(struct code_cache* cache) {
+#ifdef HUF_HAVE_PTHREAD
+    pthread_mutex_lock(&cache->mutex);
+#else
+    (void)cache;
+#endif
+}
+
+void _code_cache_unlock(struct code_cache* cache) {
+#ifdef HUF_HAVE_PTHREAD
+    pthread_mutex_unlock(&cache->mutex);
+#else
+    (void)cache;
+#endif
+}
+
+void _code_cache_clear_entry(struct code_cache_entry* entry) {
+    if (entry->tree) huffman_tree_free(entry->tree);
+    if (entry->table) canonical_code_table_free(entry->table);
+    free(entry->bytes);
+    memset(entry, 0, sizeof(struct code_cache_entry));
+}
+
+struct code_cache_entry* _code_cache_find(struct code_cache* cache, int wide,
+        uint32_t hash, const uint8_t* buffer, size_t size) {
+    for (size_t i = 0; i < cache->capacity; i++) {
+        struct code_cache_entry* entry = &cache->entries[i];
+        if (entry->bytes && entry->hash == hash && entry->wide == wide
+                && entry->size == size && !memcmp(entry->bytes, buffer, size)) {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+/* Returns an unused entry, or the least recently used one nobody holds. */
+struct code_cache_entry* _code_cache_victim(struct code_cache* cache) {
+    struct code_cache_entry* victim = NULL;
+    for (size_t i = 0; i < cache->capacity; i++) {
+        struct code_cache_entry* entry = &cache->entries[i];
+        if (!entry->bytes) return entry;
+        if (entry->references == 0
+                && (!victim || entry->last_use < victim->last_use)) {
+            victim = entry;
+        }
+    }
+
+    return victim;
+}
+
+int code_cache_get(struct code_cache* cache, int flags, const uint8_t* buffer,
+        size_t size, struct huffman_tree** tree, struct canonical_code_table** table) {
+    int wide = (flags & FRAME_FLAG_WIDE) != 0;
+    uint32_t hash = crc32c_update(0, buffer, size);
+
+    _code_cache_lock(cache);
+    struct code_cache_entry* entry = _code_cache_find(cache, wide, hash,
+        buffer, size);
+    if (entry) {
+        entry->references++;
+        entry->last_use = ++cache->clock;
+        cache->hits++;
+        *tree = entry->tree;
+        *table = entry->table;
+        _code_cache_unlock(cache);
+        return 0;
+    }
+    cache->misses++;
+    _code_cache_unlock(cache);
+
+    /* Codes are built without holding the lock, so that other threads can
+     * use the cache meanwhile. Two threads missing the same code at once
+     * both build it, and only one of them is cached. */
+    if (frame_read_code(flags, buffer, size, tree, table)) return 1;
+
+    uint8_t* bytes = malloc(size);
+    if (!bytes) return 0;
+    memcpy(bytes, buffer, size);
+
+    _code_cache_lock(cache);
+    entry = _code_cache_find(cache, wide, hash, buffer, size)
+        ? NULL : _code_cache_victim(cache);
+    if (entry) {
+        _code_cache_clear_entry(entry);
+        entry->bytes = bytes;
+        entry->size = size;
+        entry->wide = wide;
+        entry->hash = hash;
+        entry->tree = *tree;
+        entry->table = *table;
+        entry->references = 1;
+        entry->last_use = ++cache->clock;
+    }
+    _code_cache_unlock(cache);
+
+    if (!entry) free(bytes);
+
+    return 0;
+}
+
+void code_cache_release(struct code_cache* cache, struct huffman_tree* tree,
+        struct canonical_code_table* table) {
+    _code_cache_lock(cache);
+    struct code_cache_entry* entry = NULL;
+    for (size_t i = 0; i < cache->capacity && !entry; i++) {
+        struct code_cache_entry* candidate = &cache->entries[i];
+        if (candidate->bytes && candidate->tree == tree
+                && candidate->table == table) {
+            entry = candidate;
+        }
+    }
+    if (entry) entry->references--;
+    _code_cache_unlock(cache);
+
+    if (!entry) {
+        if (tree) huffman_tree_free(tree);
+        if (table) canonical_code_table_free(table);
+    }
+}
+
+void code_cache_free(struct code_cache* cache) {
+    for (size_t i = 0; i < cache->capacity; i++) {
+        _code_cache_clear_entry(&cache->entries[i]);
+    }
+#ifdef HUF_HAVE_PTHREAD
+    pthread_mutex_destroy(&cache->mutex);
+#endif
+    free(cache->entries);
+    free(cache);
+}
@@ -0,0 +1,105 @@
+#ifndef CODE_CACHE_H
+#define CODE_CACHE_H
+
+
+#include <stdlib.h>
+#include <inttypes.h>
+
+#include "error.h"
+#include "huffman_tree.h"
+#include "canonical_code.h"
+
+#ifdef HUF_HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+
+/*
+ * A cache of the trees and decoding tables built from the codes stored in
+ * frames, keyed by the serialized code. Processes decoding many frames with
+ * the same codes build each of them once. The cache may be shared by several
+ * threads, which only ever read the cached trees and tables.
+ */
+
+#define CODE_CACHE_DEFAULT_CAPACITY 64
+
+
+/**
+ * @brief A cached code together with what has been built from it.
+ */
+struct code_cache_entry {
+    /** The serialized code, NULL if the entry is unused. */
+    uint8_t* bytes;
+    size_t size;
+    /** Non-zero for codes of 16 bit words. */
+    int wide;
+    uint32_t hash;
+    struct huffman_tree* tree;
+    struct canonical_code_table* table;
+    /** Number of callers that have not released the entry yet. */
+    int references;
+    /** Value of the clock of the cache when the entry was last used. */
+    uint64_t last_use;
+};
+
+/**
+ * @brief A fixed number of codes, of which the least recently used ones are
+ * replaced once the cache is full.
+ */
+struct code_cache {
+    struct code_cache_entry* entries;
+    size_t capacity;
+    uint64_t clock;
+    uint64_t hits;
+    uint64_t misses;
+#ifdef HUF_HAVE_PTHREAD
+    pthread_mutex_t mutex;
+#endif
+};
+
+
+/**
+ * @brief Creates an empty cache.
+ *
+ * @param capacity the maximum number of codes held.
+ * @return struct code_cache* the created cache.
+ * Must be freed with a call to code_cache_free().
+ */
+struct code_cache* code_cache_create(size_t capacity);
+
+/**
+ * @brief Returns the tree or table of a serialized code, reading it only
+ * if it is not cached yet.
+ *
+ * @param cache the cache to look the code up in.
+ * @param flags the FRAME_FLAG_* flags of the frame the code belongs to.
+ * @param buffer the serialized code, as read by frame_read_code().
+ * @param size the number of bytes of the code.
+ * @param tree set to the tree of a code of bytes, NULL otherwise.
+ * @param table set to the table of a code of words, NULL otherwise.
+ * @return int non-zero if the code is invalid, zero otherwise. On success,
+ * the code must be released with code_cache_release().
+ */
+int code_cache_get(struct code_cache* cache, int flags, const uint8_t* buffer,
+    size_t size, struct huffman_tree** tree, struct canonical_code_table** table);
+
+/**
+ * @brief Releases a code returned by code_cache_get(). Codes that could not
+ * be cached are freed.
+ *
+ * @param cache the cache the code was returned by.
+ * @param tree the tree returned, may be NULL.
+ * @param table the table returned, may be NULL.
+ */
+void code_cache_release(struct code_cache* cache, struct huffman_tree* tree,
+    struct canonical_code_table* table);
+
+/**
+ * @brief Frees a cache and all codes in it. No code may be in use.
+ *
+ * @param cache the cache to be freed.
+ */
+void code_cache_free(struct code_cache* cache);
+
+
+#endif
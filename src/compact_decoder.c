@@ -0,0 +1,419 @@
+#include "compact_decoder.h"
+#include "crc32c.h"
+
+#include <string.h>
+
+
+/**
+ * @brief The bits of a payload, taken from the input buffer, which is
+ * filled from the stream with no more than <left> further bytes.
+ */
+struct _compact_reader {
+    FILE* stream;
+    uint8_t* buffer;
+    size_t capacity;
+    size_t position;
+    size_t size;
+    uint64_t left;
+    /** The next bits, starting at the most significant one. */
+    uint64_t bits;
+    int count;
+};
+
+/**
+ * @brief The decoded bytes not yet handed to the sink.
+ */
+struct _compact_output {
+    uint8_t* buffer;
+    size_t capacity;
+    size_t size;
+    const struct sink* sink;
+    /** Non-zero if the checksum of the bytes is kept. */
+    int checksummed;
+    uint32_t checksum;
+};
+
+
+void compact_decoder_init(struct compact_decoder* decoder,
+        uint8_t* in_buffer, size_t in_capacity,
+        uint8_t* out_buffer, size_t out_capacity) {
+    decoder->in_buffer = in_buffer;
+    decoder->in_capacity = in_capacity;
+    decoder->out_buffer = out_buffer;
+    decoder->out_capacity = out_capacity;
+}
+
+int compact_decoder_load_tree(struct compact_decoder_tree* tree,
+        const uint8_t* nodes) {
+    int count = nodes[0];
+    if (count == 0) {
+        errno = ERR_PARSE_ERROR;
+        return 1;
+    }
+    memmove(tree->nodes, nodes, 1 + (size_t)count * 4);
+
+    /* Children have lower numbers than their parents, so every walk ends. */
+    for (int i = 0; i < count; i++) {
+        const uint8_t* node = tree->nodes + 1 + 4 * i;
+        if ((node[0] && node[1] >= i) || (node[2] && node[3] >= i)) {
+            errno = ERR_PARSE_ERROR;
+            return 1;
+        }
+    }
+
+    for (int value = 0; value < (1 << COMPACT_DECODER_LOOKUP_BITS); value++) {
+        int node = count - 1;
+        uint16_t entry = 0;
+        for (int bit = 0; bit < COMPACT_DECODER_LOOKUP_BITS; bit++) {
+            int right = (value >> (COMPACT_DECODER_LOOKUP_BITS - 1 - bit)) & 1;
+            const uint8_t* child = tree->nodes + 1 + 4 * node + 2 * right;
+            if (!child[0]) {
+                entry = (uint16_t)(COMPACT_DECODER_LEAF | (bit + 1) << 8 | child[1]);
+                break;
+            }
+            node = child[1];
+            entry = (uint16_t)node;
+        }
+        tree->lookup[value] = entry;
+    }
+
+    return 0;
+}
+
+/* Reads exactly <size> bytes. */
+int _compact_read(FILE* stream, void* buffer, size_t size) {
+    if (fread(buffer, 1, size, stream) != size) {
+        errno = ferror(stream) ? ERR_IO_ERROR : ERR_PARSE_ERROR;
+        return 1;
+    }
+
+    return 0;
+}
+
+int _compact_skip(struct compact_decoder* decoder, FILE* stream, uint64_t size) {
+    while (size > 0) {
+        size_t chunk = size < decoder->in_capacity
+            ? (size_t)size : decoder->in_capacity;
+        if (_compact_read(stream, decoder->in_buffer, chunk)) return 1;
+        size -= chunk;
+    }
+
+    return 0;
+}
+
+/* Reads a tree whose first byte, the number of nodes, has been read into
+ * tree->nodes already. */
+int _compact_read_tree(FILE* stream, struct compact_decoder_tree* tree,
+        size_t read) {
+    size_t size = 1 + (size_t)tree->nodes[0] * 4;
+    if (tree->nodes[0] == 0) {
+        errno = ERR_PARSE_ERROR;
+        return 1;
+    }
+
+    return _compact_read(stream, tree->nodes + read, size - read)
+        || compact_decoder_load_tree(tree, tree->nodes);
+}
+
+void _compact_reader_refill(struct _compact_reader* reader) {
+    while (reader->count <= 56) {
+        if (reader->position == reader->size) {
+            if (reader->left == 0) return;
+            size_t chunk = reader->left < reader->capacity
+                ? (size_t)reader->left : reader->capacity;
+            reader->size = fread(reader->buffer, 1, chunk, reader->stream);
+            reader->position = 0;
+
+            /* An input ending early leaves the payload short of bits. */
+            reader->left = reader->size < chunk ? 0 : reader->left - chunk;
+            if (reader->size == 0) return;
+        }
+        reader->bits |= (uint64_t)reader->buffer[reader->position++]
+            << (56 - reader->count);
+        reader->count += 8;
+    }
+}
+
+/* Returns the next symbol, -1 if the bits ran out. */
+int _compact_decode_symbol(const struct compact_decoder_tree* tree,
+        struct _compact_reader* reader) {
+    if (reader->count < COMPACT_DECODER_LOOKUP_BITS) _compact_reader_refill(reader);
+
+    int node = tree->nodes[0] - 1;
+    if (reader->count >= COMPACT_DECODER_LOOKUP_BITS) {
+        uint16_t entry = tree->lookup[reader->bits
+            >> (64 - COMPACT_DECODER_LOOKUP_BITS)];
+        if (entry & COMPACT_DECODER_LEAF) {
+            int length = (entry >> 8) & 0x7f;
+            reader->bits <<= length;
+            reader->count -= length;
+            return entry & 0xff;
+        }
+        node = entry;
+        reader->bits <<= COMPACT_DECODER_LOOKUP_BITS;
+        reader->count -= COMPACT_DECODER_LOOKUP_BITS;
+    }
+
+    /* Codes longer than the table, and the last bits of a payload. */
+    while (1) {
+        if (reader->count == 0) {
+            _compact_reader_refill(reader);
+            if (reader->count == 0) return -1;
+        }
+        const uint8_t* child = tree->nodes + 1 + 4 * node
+            + 2 * (int)(reader->bits >> 63);
+        reader->bits <<= 1;
+        reader->count--;
+        if (!child[0]) return child[1];
+        node = child[1];
+    }
+}
+
+int _compact_flush(struct _compact_output* output) {
+    if (output->size == 0) return 0;
+
+    if (output->checksummed) {
+        output->checksum = crc32c_update(output->checksum, output->buffer,
+            output->size);
+    }
+    int error_code = output->sink->write(output->sink->context,
+        output->buffer, output->size);
+    output->size = 0;
+
+    return error_code;
+}
+
+int _compact_decode(const struct compact_decoder_tree* tree,
+        struct _compact_reader* reader, struct _compact_output* output,
+        uint64_t size) {
+    while (size > 0) {
+        uint8_t* out = output->buffer + output->size;
+        size_t room = output->capacity - output->size;
+        if (room > size) room = (size_t)size;
+
+        /* Codes found in the table only take a lookup and a shift, on bits
+         * held in locals, as the stores to <out> may alias the reader. */
+        uint64_t bits = reader->bits;
+        int count = reader->count;
+        for (size_t i = 0; i < room; i++) {
+            if (count >= COMPACT_DECODER_LOOKUP_BITS) {
+                uint16_t entry = tree->lookup[bits
+                    >> (64 - COMPACT_DECODER_LOOKUP_BITS)];
+                if (entry & COMPACT_DECODER_LEAF) {
+                    int length = (entry >> 8) & 0x7f;
+                    bits <<= length;
+                    count -= length;
+                    out[i] = (uint8_t)entry;
+                    continue;
+                }
+            }
+
+            reader->bits = bits;
+            reader->count = count;
+            int symbol = _compact_decode_symbol(tree, reader);
+            bits = reader->bits;
+            count = reader->count;
+            if (symbol < 0) {
+                errno = ferror(reader->stream) ? ERR_IO_ERROR : ERR_PARSE_ERROR;
+                return 1;
+            }
+            out[i] = (uint8_t)symbol;
+        }
+        reader->bits = bits;
+        reader->count = count;
+        output->size += room;
+        size -= room;
+
+        if (output->size == output->capacity && _compact_flush(output)) return 1;
+    }
+
+    return 0;
+}
+
+/* Passes the bytes of a stored block through the output buffer. */
+int _compact_copy(FILE* stream, struct _compact_output* output, uint64_t size) {
+    while (size > 0) {
+        size_t room = output->capacity - output->size;
+        if (room > size) room = (size_t)size;
+        if (_compact_read(stream, output->buffer + output->size, room)) return 1;
+        output->size += room;
+        size -= room;
+
+        if (output->size == output->capacity && _compact_flush(output)) return 1;
+    }
+
+    return 0;
+}
+
+void _compact_reader_init(struct _compact_reader* reader,
+        struct compact_decoder* decoder, FILE* stream, uint64_t size) {
+    reader->stream = stream;
+    reader->buffer = decoder->in_buffer;
+    reader->capacity = decoder->in_capacity;
+    reader->position = 0;
+    reader->size = 0;
+    reader->left = size;
+    reader->bits = 0;
+    reader->count = 0;
+}
+
+void _compact_output_init(struct _compact_output* output,
+        struct compact_decoder* decoder, const struct sink* sink,
+        int checksummed) {
+    output->buffer = decoder->out_buffer;
+    output->capacity = decoder->out_capacity;
+    output->size = 0;
+    output->sink = sink;
+    output->checksummed = checksummed;
+    output->checksum = 0;
+}
+
+int _compact_decompress_block(struct compact_decoder* decoder, FILE* stream,
+        const uint8_t* header, int flags, int shared, const struct sink* sink,
+        uint32_t* checksum) {
+    int type = header[0];
+    uint32_t raw_size = io_get_u32(header + 1);
+    uint32_t payload_size = io_get_u32(header + 5);
+
+    if (type == FRAME_BLOCK_INDEX && raw_size == 0) {
+        return _compact_skip(decoder, stream, payload_size);
+    }
+    if (type == FRAME_BLOCK_ANS) {
+        errno = ERR_ILLEGAL_ARG;
+        return 1;
+    }
+    if (raw_size > FRAME_MAX_BLOCK_SIZE || payload_size > FRAME_MAX_BLOCK_SIZE
+            || (type == FRAME_BLOCK_STORED && payload_size != raw_size)
+            || (type == FRAME_BLOCK_SHARED_TREE && !shared)
+            || type > FRAME_BLOCK_STORED) {
+        errno = ERR_PARSE_ERROR;
+        return 1;
+    }
+
+    uint8_t expected[CRC32C_SIZE];
+    if ((flags & FRAME_FLAG_CHECKSUM)
+            && _compact_read(stream, expected, CRC32C_SIZE)) {
+        return 1;
+    }
+
+    struct _compact_output output;
+    _compact_output_init(&output, decoder, sink, flags & FRAME_FLAG_CHECKSUM);
+
+    if (type == FRAME_BLOCK_STORED) {
+        if (_compact_copy(stream, &output, raw_size)) return 1;
+    } else {
+        struct compact_decoder_tree* tree = &decoder->shared;
+        if (type == FRAME_BLOCK_OWN_TREE) {
+            tree = &decoder->own;
+            if (_compact_read(stream, tree->nodes, 1)
+                    || _compact_read_tree(stream, tree, 1)) {
+                return 1;
+            }
+        }
+
+        /* The payload may end in bits after the last code. */
+        struct _compact_reader reader;
+        _compact_reader_init(&reader, decoder, stream, payload_size);
+        if (_compact_decode(tree, &reader, &output, raw_size)
+                || _compact_skip(decoder, stream, reader.left)) {
+            return 1;
+        }
+    }
+    if (_compact_flush(&output)) return 1;
+
+    if (flags & FRAME_FLAG_CHECKSUM) {
+        if (output.checksum != io_get_u32(expected)) {
+            errno = ERR_CHECKSUM_ERROR;
+            return 1;
+        }
+        *checksum = crc32c_combine(*checksum, output.checksum, raw_size);
+    }
+
+    return 0;
+}
+
+int _compact_decompress_frame(struct compact_decoder* decoder, FILE* stream,
+        const struct sink* sink) {
+    uint8_t flags;
+    if (_compact_read(stream, &flags, 1)) return 1;
+    if (flags & ~FRAME_FLAGS) {
+        errno = ERR_PARSE_ERROR;
+        return 1;
+    }
+    if (flags & (FRAME_FLAG_WIDE | FRAME_FLAG_TRANSFORM)) {
+        errno = ERR_ILLEGAL_ARG;
+        return 1;
+    }
+
+    int shared = flags & FRAME_FLAG_SHARED_TREE;
+    if (shared && (_compact_read(stream, decoder->shared.nodes, 1)
+            || _compact_read_tree(stream, &decoder->shared, 1))) {
+        return 1;
+    }
+
+    uint32_t checksum = 0;
+    while (1) {
+        uint8_t header[FRAME_BLOCK_HEADER_SIZE];
+        if (_compact_read(stream, header, FRAME_BLOCK_HEADER_SIZE)) return 1;
+
+        if (header[0] == FRAME_BLOCK_END) {
+            if ((flags & FRAME_FLAG_CHECKSUM)
+                    && io_get_u32(header + 1) != checksum) {
+                errno = ERR_CHECKSUM_ERROR;
+                return 1;
+            }
+            return 0;
+        }
+
+        if (_compact_decompress_block(decoder, stream, header, flags, shared,
+                sink, &checksum)) {
+            return 1;
+        }
+    }
+}
+
+/* Decodes the format written before frames, a tree followed by the number
+ * of bytes and their codes, of which the first bytes have been read. */
+int _compact_decompress_unframed(struct compact_decoder* decoder, FILE* stream,
+        const uint8_t* start, const struct sink* sink) {
+    struct compact_decoder_tree* tree = &decoder->shared;
+    memcpy(tree->nodes, start, FRAME_MAGIC_SIZE);
+    if (_compact_read_tree(stream, tree, FRAME_MAGIC_SIZE)) return 1;
+
+    uint32_t num_bytes;
+    if (_compact_read(stream, &num_bytes, sizeof(uint32_t))) return 1;
+
+    struct _compact_reader reader;
+    _compact_reader_init(&reader, decoder, stream, UINT64_MAX);
+    struct _compact_output output;
+    _compact_output_init(&output, decoder, sink, 0);
+
+    return _compact_decode(tree, &reader, &output, num_bytes)
+        || _compact_flush(&output);
+}
+
+int compact_decoder_decompress_stream(struct compact_decoder* decoder,
+        FILE* in_stream, const struct sink* sink) {
+    if (decoder->in_capacity == 0 || decoder->out_capacity == 0) {
+        errno = ERR_ILLEGAL_ARG;
+        return 1;
+    }
+
+    uint8_t magic[FRAME_MAGIC_SIZE];
+    if (_compact_read(in_stream, magic, FRAME_MAGIC_SIZE)) return 1;
+    if (memcmp(magic, FRAME_MAGIC, FRAME_MAGIC_SIZE)) {
+        return _compact_decompress_unframed(decoder, in_stream, magic, sink);
+    }
+
+    while (1) {
+        if (_compact_decompress_frame(decoder, in_stream, sink)) return 1;
+
+        size_t read = fread(magic, 1, FRAME_MAGIC_SIZE, in_stream);
+        if (read == 0 && !ferror(in_stream)) return 0;
+        if (read != FRAME_MAGIC_SIZE
+                || memcmp(magic, FRAME_MAGIC, FRAME_MAGIC_SIZE)) {
+            errno = ferror(in_stream) ? ERR_IO_ERROR : ERR_PARSE_ERROR;
+            return 1;
+        }
+    }
+}
@@ -0,0 +1,109 @@
+#ifndef COMPACT_DECODER_H
+#define COMPACT_DECODER_H
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "error.h"
+#include "frame.h"
+#include "sink.h"
+
+
+/*
+ * A decoder for hosts with little memory. It allocates nothing: its state
+ * is a struct of a few KiB the caller places wherever it likes, and input
+ * and output go through two buffers of the caller, which may be as small
+ * as a few bytes. Trees are kept in their serialized layout, an array of
+ * nodes, next to a table giving the symbol and code length, or the node
+ * reached, for every value of the next COMPACT_DECODER_LOOKUP_BITS bits,
+ * so most symbols are decoded with a single lookup and the rest by walking
+ * the array from there.
+ *
+ * Streams in the format written before frames were introduced are decoded,
+ * as are frames of bytes whose blocks are coded with trees or stored. Frames
+ * of words, frames with transforms and blocks coded with tANS, which needs
+ * the whole payload of a block at once, fail with ERR_ILLEGAL_ARG; streams
+ * for such hosts are to be compressed with parameters restricted by
+ * frame_params_set_compact(), i.e. with --compact-compatible. Streams are
+ * only read forwards, so they may be pipes, and cannot be decoded from the
+ * middle. The buffer the C library keeps for
+ * <in_stream> comes on top of the state, unless it is set with setvbuf().
+ */
+
+/** Number of bits the lookup table of a tree is indexed by. */
+#define COMPACT_DECODER_LOOKUP_BITS 8
+/** Set in the entries of a lookup table that end in a symbol. */
+#define COMPACT_DECODER_LEAF 0x8000
+/** Size of the input and output buffers that keep the total below 16 KiB. */
+#define COMPACT_DECODER_BUFFER_SIZE 4096
+
+
+/**
+ * @brief A tree ready to decode with.
+ */
+struct compact_decoder_tree {
+    /** The tree in the layout of huffman_tree_write_to_buffer(): the number
+     * of nodes, then of every node whether its left child is a node and
+     * the node or symbol, and the same for its right child. */
+    uint8_t nodes[FRAME_MAX_TREE_SIZE];
+    /** For every value of the next bits, the symbol they start with and its
+     * length with COMPACT_DECODER_LEAF set, or the node reached after all of
+     * them. */
+    uint16_t lookup[1 << COMPACT_DECODER_LOOKUP_BITS];
+};
+
+/**
+ * @brief The state of a decoder.
+ */
+struct compact_decoder {
+    /** The tree of the frame, and the tree of the current block. */
+    struct compact_decoder_tree shared;
+    struct compact_decoder_tree own;
+    uint8_t* in_buffer;
+    size_t in_capacity;
+    uint8_t* out_buffer;
+    size_t out_capacity;
+};
+
+
+/**
+ * @brief Sets up a decoder with the buffers it reads and decodes into.
+ *
+ * @param decoder the decoder.
+ * @param in_buffer the buffer input is read into.
+ * @param in_capacity the size of <in_buffer>, at least 1.
+ * @param out_buffer the buffer output is decoded into before it is handed
+ * to the sink.
+ * @param out_capacity the size of <out_buffer>, at least 1.
+ */
+void compact_decoder_init(struct compact_decoder* decoder,
+    uint8_t* in_buffer, size_t in_capacity,
+    uint8_t* out_buffer, size_t out_capacity);
+
+/**
+ * @brief Prepares a tree for decoding.
+ *
+ * @param tree the tree to be set up.
+ * @param nodes the tree in the layout of huffman_tree_write_to_buffer().
+ * @return int non-zero if the tree is invalid, zero otherwise.
+ */
+int compact_decoder_load_tree(struct compact_decoder_tree* tree,
+    const uint8_t* nodes);
+
+/**
+ * @brief Decompresses a stream, either all of its frames or a stream in the
+ * format written before frames, and delivers the contents to a sink in
+ * runs of at most the size of the output buffer.
+ *
+ * @param decoder the decoder.
+ * @param in_stream the stream that should be decompressed.
+ * @param sink the sink the decompressed contents are delivered to.
+ * @return int non-zero if an error occurred, zero otherwise.
+ */
+int compact_decoder_decompress_stream(struct compact_decoder* decoder,
+    FILE* in_stream, const struct sink* sink);
+
+
+#endif
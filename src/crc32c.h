@@ -0,0 +1,40 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+
+#include <stdlib.h>
+#include <inttypes.h>
+
+
+/*
+ * CRC-32C (Castagnoli), the checksum computed by the crc32 instruction of
+ * SSE 4.2. The instruction is used where the processor supports it, a table
+ * driven implementation everywhere else.
+ */
+
+#define CRC32C_SIZE 4
+
+
+/**
+ * @brief Extends a checksum by the given bytes.
+ *
+ * @param crc the checksum of the preceding bytes, 0 for none.
+ * @param data the bytes to be added.
+ * @param size the number of bytes in <data>.
+ * @return uint32_t the checksum of the preceding bytes followed by <data>.
+ */
+uint32_t crc32c_update(uint32_t crc, const void* data, size_t size);
+
+/**
+ * @brief Combines the checksums of two adjacent pieces of data into the
+ * checksum of both, without looking at the data again.
+ *
+ * @param crc1 the checksum of the first piece.
+ * @param crc2 the checksum of the second piece.
+ * @param size2 the number of bytes of the second piece.
+ * @return uint32_t the checksum of the first piece followed by the second.
+ */
+uint32_t crc32c_combine(uint32_t crc1, uint32_t crc2, uint64_t size2);
+
+
+#endif
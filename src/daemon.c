@@ -0,0 +1,761 @@
+#include "daemon.h"
+
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+
+/* Time after which a thread waiting for the rest of a request checks
+ * whether the daemon is stopping, in seconds. */
+#define HUF_DAEMON_POLL_INTERVAL 1
+
+/* Number of intervals a client may send nothing in the middle of a request
+ * before its connection is dropped. */
+#define HUF_DAEMON_STALL_LIMIT 30
+
+
+/* The listening socket of the running daemon, shut down by signals. */
+volatile sig_atomic_t _huf_daemon_signal_fd = -1;
+
+
+void _huf_daemon_on_signal(int signal) {
+    (void)signal;
+    if (_huf_daemon_signal_fd >= 0) shutdown(_huf_daemon_signal_fd, SHUT_RDWR);
+}
+
+void _huf_daemon_put_request(uint8_t* buffer,
+        const struct huf_daemon_request* request) {
+    buffer[0] = (uint8_t)request->op;
+    buffer[1] = (uint8_t)request->flags;
+    buffer[2] = (uint8_t)request->wide;
+    buffer[3] = (uint8_t)request->transform.type;
+    buffer[4] = (uint8_t)request->transform.parameter;
+    io_put_u64(buffer + 5, request->payload_size);
+}
+
+void _huf_daemon_get_request(const uint8_t* buffer,
+        struct huf_daemon_request* request) {
+    request->op = buffer[0];
+    request->flags = buffer[1];
+    request->wide = buffer[2];
+    request->transform.type = buffer[3];
+    request->transform.parameter = buffer[4];
+    request->payload_size = io_get_u64(buffer + 5);
+}
+
+int _huf_send_all(int socket, const uint8_t* buffer, size_t size) {
+    while (size > 0) {
+        ssize_t sent = send(socket, buffer, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent <= 0) {
+            errno = ERR_IO_ERROR;
+            return 1;
+        }
+        buffer += sent;
+        size -= (size_t)sent;
+    }
+
+    return 0;
+}
+
+/* Receives exactly <size> bytes. With <closing>, timeouts are retried
+ * until it is set, so that a stopping daemon does not wait for stalled
+ * clients, or until the client has sent nothing for too long. */
+int _huf_receive_all(int socket, uint8_t* buffer, size_t size,
+        atomic_int* closing) {
+    int stalls = 0;
+    while (size > 0) {
+        ssize_t received = recv(socket, buffer, size, 0);
+        if (received < 0 && errno == EINTR) continue;
+        if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)
+                && closing && !atomic_load(closing)
+                && ++stalls < HUF_DAEMON_STALL_LIMIT) {
+            continue;
+        }
+        if (received <= 0) {
+            errno = ERR_IO_ERROR;
+            return 1;
+        }
+        buffer += received;
+        size -= (size_t)received;
+        stalls = 0;
+    }
+
+    return 0;
+}
+
+/* Receives a request header along with up to two descriptors. */
+int _huf_daemon_receive_request(struct huf_daemon* daemon, int connection,
+        uint8_t* header, int* fds, int* fd_count) {
+    union {
+        struct cmsghdr align;
+        char buffer[CMSG_SPACE(2 * sizeof(int))];
+    } control;
+    struct iovec vector = { header, HUF_DAEMON_REQUEST_SIZE };
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &vector;
+    message.msg_iovlen = 1;
+    message.msg_control = control.buffer;
+    message.msg_controllen = sizeof(control.buffer);
+
+    /* The connection has been polled, so the request has begun to arrive
+     * or the client has closed it. */
+    ssize_t received;
+    do {
+        received = recvmsg(connection, &message, MSG_CMSG_CLOEXEC);
+    } while (received < 0 && errno == EINTR);
+    if (received <= 0) return 1;
+
+    *fd_count = 0;
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&message); cmsg;
+            cmsg = CMSG_NXTHDR(&message, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+            continue;
+        }
+        size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (size_t i = 0; i < count; i++) {
+            int fd;
+            memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+            if (*fd_count < 2) {
+                fds[(*fd_count)++] = fd;
+            } else {
+                close(fd);
+            }
+        }
+    }
+
+    if ((size_t)received < HUF_DAEMON_REQUEST_SIZE
+            && _huf_receive_all(connection, header + received,
+                HUF_DAEMON_REQUEST_SIZE - (size_t)received, &daemon->closing)) {
+        for (int i = 0; i < *fd_count; i++) close(fds[i]);
+        return 1;
+    }
+
+    return 0;
+}
+
+/* Wakes the thread polling the connections. A full pipe wakes it too, so
+ * a write that fails for that reason is of no concern. */
+void _huf_daemon_wake(struct huf_daemon* daemon) {
+    uint8_t wake = 1;
+    ssize_t written = write(daemon->wake_fds[1], &wake, 1);
+    (void)written;
+}
+
+FILE* _huf_daemon_open_fd(int fd, const char* mode) {
+    int copy = dup(fd);
+    if (copy < 0) return NULL;
+
+    FILE* stream = fdopen(copy, mode);
+    if (!stream) close(copy);
+
+    return stream;
+}
+
+/* Runs a compression or decompression request from <in> to <out>. */
+int _huf_daemon_code(struct huf_daemon* daemon,
+        const struct huf_daemon_request* request, FILE* in, FILE* out,
+        size_t inline_size) {
+    int io_backend = inline_size != (size_t)-1 ? ASYNC_IO_SYNC : ASYNC_IO_AUTO;
+
+    if (request->op == HUF_DAEMON_OP_DECOMPRESS) {
+        return frame_decompress_stream_cached(in, out, io_backend,
+            daemon->cache);
+    }
+
+    struct frame_params params;
+    frame_params_init(&params);
+    params.io_backend = io_backend;
+    params.wide = request->wide;
+    params.transform = request->transform;
+    params.checksum = !(request->flags & HUF_DAEMON_FLAG_NO_CHECKSUM);
+    if (params.wide > FRAME_WIDE_BIG_ENDIAN || !transform_is_valid(
+            params.transform.type, params.transform.parameter)) {
+        errno = ERR_ILLEGAL_ARG;
+        return 1;
+    }
+
+    /* Small inputs fit into a single block anyway, whose buffers need not be
+     * larger than the input. The output is the same. */
+    if (inline_size != (size_t)-1 && inline_size < params.block_size) {
+        params.block_size = inline_size < 2 ? 2 : (inline_size + 1) & ~(size_t)1;
+    }
+
+    return frame_compress_stream(&params, in, out);
+}
+
+/* Serves one request. The response payload is returned in <output>. */
+int _huf_daemon_process(struct huf_daemon* daemon,
+        struct huf_daemon_worker* worker,
+        const struct huf_daemon_request* request, const int* fds,
+        uint8_t** output, size_t* output_size, uint64_t* written) {
+    if (request->op == HUF_DAEMON_OP_STOP) {
+        atomic_store(&daemon->closing, 1);
+        shutdown(daemon->listen_fd, SHUT_RDWR);
+        _huf_daemon_wake(daemon);
+        return 0;
+    }
+    if (request->op != HUF_DAEMON_OP_COMPRESS
+            && request->op != HUF_DAEMON_OP_DECOMPRESS) {
+        errno = ERR_ILLEGAL_ARG;
+        return 1;
+    }
+
+    int descriptors = request->flags & HUF_DAEMON_FLAG_DESCRIPTORS;
+    size_t inline_size = descriptors ? (size_t)-1 : request->payload_size;
+    FILE* in = NULL;
+    FILE* out = NULL;
+    if (descriptors) {
+        in = _huf_daemon_open_fd(fds[0], "rb");
+        out = _huf_daemon_open_fd(fds[1], "wb");
+    } else {
+        in = fmemopen(worker->payload, request->payload_size, "rb");
+        out = open_memstream((char**)output, output_size);
+    }
+    if (!in || !out) {
+        if (in) fclose(in);
+        if (out) fclose(out);
+        errno = ERR_IO_ERROR;
+        return 1;
+    }
+
+    /* Compression reads its input twice, so inputs that cannot be rewound
+     * are read into memory first. */
+    if (descriptors && request->op == HUF_DAEMON_OP_COMPRESS
+            && io_seek(in, 0, SEEK_CUR)) {
+        size_t size = 0;
+        size_t read;
+        do {
+            if (size > HUF_DAEMON_MAX_PAYLOAD) errno = ERR_ILLEGAL_ARG;
+            if (size > HUF_DAEMON_MAX_PAYLOAD || frame_reserve(&worker->payload,
+                    &worker->payload_capacity, size + FRAME_DEFAULT_BLOCK_SIZE)) {
+                fclose(in);
+                fclose(out);
+                return 1;
+            }
+            read = fread(worker->payload + size, 1, FRAME_DEFAULT_BLOCK_SIZE, in);
+            size += read;
+        } while (read == FRAME_DEFAULT_BLOCK_SIZE);
+        fclose(in);
+
+        in = fmemopen(worker->payload, size, "rb");
+        if (!in) {
+            fclose(out);
+            errno = ERR_IO_ERROR;
+            return 1;
+        }
+        inline_size = size;
+    }
+
+    int error_code = _huf_daemon_code(daemon, request, in, out, inline_size);
+    int error = errno;
+
+    if (descriptors && !error_code) {
+        fflush(out);
+        int64_t position = io_tell(out);
+        *written = position > 0 ? (uint64_t)position : 0;
+    }
+    fclose(in);
+    if (fclose(out) && !error_code) {
+        error_code = 1;
+        error = ERR_IO_ERROR;
+    }
+
+    errno = error;
+    return error_code;
+}
+
+/* Serves the request that has begun to arrive on a connection. Returns
+ * non-zero if the connection is to be closed. */
+int _huf_daemon_serve_request(struct huf_daemon* daemon,
+        struct huf_daemon_worker* worker, int connection) {
+    uint8_t header[HUF_DAEMON_REQUEST_SIZE];
+    int fds[2];
+    int fd_count = 0;
+    if (_huf_daemon_receive_request(daemon, connection, header,
+            fds, &fd_count)) {
+        return 1;
+    }
+
+    struct huf_daemon_request request;
+    _huf_daemon_get_request(header, &request);
+    int descriptors = request.flags & HUF_DAEMON_FLAG_DESCRIPTORS;
+
+    uint8_t response[HUF_DAEMON_RESPONSE_SIZE];
+    memset(response, 0, sizeof(response));
+
+    /* Requests that cannot be read leave the connection out of step, so
+     * it is closed after the error is reported. */
+    if (request.payload_size > HUF_DAEMON_MAX_PAYLOAD
+            || (descriptors && (fd_count != 2 || request.payload_size))) {
+        for (int i = 0; i < fd_count; i++) close(fds[i]);
+        response[0] = 1;
+        io_put_u32(response + 1, ERR_ILLEGAL_ARG);
+        _huf_send_all(connection, response, sizeof(response));
+        return 1;
+    }
+    if (!descriptors) {
+        for (int i = 0; i < fd_count; i++) close(fds[i]);
+    }
+
+    if (frame_reserve(&worker->payload, &worker->payload_capacity,
+                request.payload_size ? request.payload_size : 1)
+            || _huf_receive_all(connection, worker->payload,
+                request.payload_size, &daemon->closing)) {
+        if (descriptors) for (int i = 0; i < fd_count; i++) close(fds[i]);
+        return 1;
+    }
+
+    uint8_t* output = NULL;
+    size_t output_size = 0;
+    uint64_t written = 0;
+    int error_code = _huf_daemon_process(daemon, worker, &request, fds,
+        &output, &output_size, &written);
+    int error = errno;
+    if (descriptors) for (int i = 0; i < fd_count; i++) close(fds[i]);
+
+    response[0] = error_code != 0;
+    io_put_u32(response + 1, error_code ? (uint32_t)error : 0);
+    if (error_code) {
+        output_size = 0;
+    } else {
+        io_put_u64(response + 5, descriptors ? written : output_size);
+    }
+
+    int failed = _huf_send_all(connection, response, sizeof(response))
+        || _huf_send_all(connection, output, output_size);
+    free(output);
+
+    return failed || request.op == HUF_DAEMON_OP_STOP;
+}
+
+int _huf_daemon_queue_push(struct huf_daemon_queue* queue, int connection) {
+    if (queue->count == queue->capacity) {
+        size_t capacity = queue->capacity ? 2 * queue->capacity : 16;
+        int* connections = realloc(queue->connections,
+            capacity * sizeof(int));
+        if (!connections) {
+            errno = ERR_MEM_ERROR;
+            return 1;
+        }
+        queue->connections = connections;
+        queue->capacity = capacity;
+    }
+    queue->connections[queue->count++] = connection;
+
+    return 0;
+}
+
+void _huf_daemon_queue_close(struct huf_daemon_queue* queue) {
+    for (size_t i = 0; i < queue->count; i++) close(queue->connections[i]);
+    free(queue->connections);
+    memset(queue, 0, sizeof(struct huf_daemon_queue));
+}
+
+/* Adds a connection to the polled ones, closing it if that fails. */
+void _huf_daemon_poll_add(struct pollfd** polled, size_t* count,
+        size_t* capacity, int connection) {
+    if (*count == *capacity) {
+        size_t new_capacity = 2 * *capacity;
+        struct pollfd* grown = realloc(*polled,
+            new_capacity * sizeof(struct pollfd));
+        if (!grown) {
+            close(connection);
+            return;
+        }
+        *polled = grown;
+        *capacity = new_capacity;
+    }
+    (*polled)[*count].fd = connection;
+    (*polled)[*count].events = POLLIN;
+    (*polled)[*count].revents = 0;
+    (*count)++;
+}
+
+/* Hands a connection a request has arrived on to the serving threads, or
+ * serves it right away if there are none. Returns non-zero if it has been
+ * closed. */
+int _huf_daemon_dispatch(struct huf_daemon* daemon, int connection) {
+#ifdef HUF_HAVE_PTHREAD
+    if (daemon->pool->thread_count > 1) {
+        pthread_mutex_lock(&daemon->mutex);
+        int error_code = _huf_daemon_queue_push(&daemon->ready, connection);
+        if (!error_code) pthread_cond_signal(&daemon->ready_cond);
+        pthread_mutex_unlock(&daemon->mutex);
+        if (error_code) close(connection);
+        return 1;
+    }
+#endif
+    if (_huf_daemon_serve_request(daemon, &daemon->workers[0], connection)) {
+        close(connection);
+        return 1;
+    }
+    return 0;
+}
+
+/* Polls the listening socket and all idle connections until the daemon
+ * stops. Entry 0 of the polled descriptors is the listening socket and
+ * entry 1 the pipe waking the thread when connections are handed back. */
+void _huf_daemon_poll(struct huf_daemon* daemon) {
+    size_t capacity = 64;
+    size_t count = 2;
+    struct pollfd* polled = malloc(capacity * sizeof(struct pollfd));
+    if (!polled) {
+        atomic_store(&daemon->closing, 1);
+        return;
+    }
+    polled[0].fd = daemon->listen_fd;
+    polled[0].events = POLLIN;
+    polled[1].fd = daemon->wake_fds[0];
+    polled[1].events = POLLIN;
+
+    struct timeval timeout = { HUF_DAEMON_POLL_INTERVAL, 0 };
+    while (!atomic_load(&daemon->closing)) {
+        if (poll(polled, (nfds_t)count, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        /* The listening socket has been shut down. */
+        if (polled[0].revents & (POLLHUP | POLLERR | POLLNVAL)) break;
+
+        if (polled[1].revents & POLLIN) {
+            uint8_t drain[64];
+            while (read(daemon->wake_fds[0], drain, sizeof(drain)) > 0) {}
+#ifdef HUF_HAVE_PTHREAD
+            pthread_mutex_lock(&daemon->mutex);
+            for (size_t i = 0; i < daemon->served.count; i++) {
+                _huf_daemon_poll_add(&polled, &count, &capacity,
+                    daemon->served.connections[i]);
+            }
+            daemon->served.count = 0;
+            pthread_mutex_unlock(&daemon->mutex);
+#endif
+        }
+
+        /* Connections are handed on in reverse, so that removing one only
+         * moves the last entry into a place already looked at. */
+        for (size_t i = count; i-- > 2;) {
+            if (!polled[i].revents) continue;
+            int connection = polled[i].fd;
+            polled[i] = polled[--count];
+            if (!_huf_daemon_dispatch(daemon, connection)) {
+                _huf_daemon_poll_add(&polled, &count, &capacity, connection);
+            }
+        }
+
+        if (polled[0].revents & POLLIN) {
+            int connection = accept(daemon->listen_fd, NULL, NULL);
+            if (connection >= 0) {
+                setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+                    sizeof(timeout));
+                _huf_daemon_poll_add(&polled, &count, &capacity, connection);
+            }
+        }
+    }
+
+    atomic_store(&daemon->closing, 1);
+#ifdef HUF_HAVE_PTHREAD
+    pthread_mutex_lock(&daemon->mutex);
+    pthread_cond_broadcast(&daemon->ready_cond);
+    pthread_mutex_unlock(&daemon->mutex);
+#endif
+    for (size_t i = 2; i < count; i++) close(polled[i].fd);
+    free(polled);
+}
+
+#ifdef HUF_HAVE_PTHREAD
+/* Serves the requests of connections handed over by the polling thread,
+ * until the daemon stops and none are left. */
+void _huf_daemon_serve(struct huf_daemon* daemon,
+        struct huf_daemon_worker* worker) {
+    pthread_mutex_lock(&daemon->mutex);
+    for (;;) {
+        while (daemon->ready.count == 0 && !atomic_load(&daemon->closing)) {
+            pthread_cond_wait(&daemon->ready_cond, &daemon->mutex);
+        }
+        if (daemon->ready.count == 0) break;
+        int connection = daemon->ready.connections[0];
+        memmove(daemon->ready.connections, daemon->ready.connections + 1,
+            --daemon->ready.count * sizeof(int));
+        pthread_mutex_unlock(&daemon->mutex);
+
+        int closed = _huf_daemon_serve_request(daemon, worker, connection);
+
+        pthread_mutex_lock(&daemon->mutex);
+        if (closed || _huf_daemon_queue_push(&daemon->served, connection)) {
+            close(connection);
+        } else {
+            _huf_daemon_wake(daemon);
+        }
+    }
+    pthread_mutex_unlock(&daemon->mutex);
+}
+#endif
+
+void _huf_daemon_run_thread(void* context, size_t item, int worker) {
+    struct huf_daemon* daemon = context;
+    if (item == 0) {
+        _huf_daemon_poll(daemon);
+        return;
+    }
+#ifdef HUF_HAVE_PTHREAD
+    _huf_daemon_serve(daemon, &daemon->workers[worker]);
+#else
+    (void)worker;
+#endif
+}
+
+int _huf_daemon_set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL);
+    return flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK)
+        || fcntl(fd, F_SETFD, FD_CLOEXEC);
+}
+
+int _huf_daemon_address(const char* path, struct sockaddr_un* address) {
+    if (strlen(path) >= sizeof(address->sun_path)) {
+        errno = ERR_ILLEGAL_ARG;
+        return 1;
+    }
+
+    memset(address, 0, sizeof(struct sockaddr_un));
+    address->sun_family = AF_UNIX;
+    strcpy(address->sun_path, path);
+
+    return 0;
+}
+
+int huf_daemon_run(const char* path, int thread_count) {
+    struct sockaddr_un address;
+    if (_huf_daemon_address(path, &address)) return 1;
+
+    /* A socket left behind by a daemon that did not exit cleanly is
+     * replaced, the one of a running daemon is not. */
+    int probe = huf_client_connect(path);
+    if (probe >= 0) {
+        close(probe);
+        errno = ERR_ILLEGAL_ARG;
+        return 1;
+    }
+    unlink(path);
+
+    struct huf_daemon daemon;
+    memset(&daemon, 0, sizeof(daemon));
+    atomic_init(&daemon.closing, 0);
+    daemon.listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (daemon.listen_fd < 0) return 1;
+    if (bind(daemon.listen_fd, (struct sockaddr*)&address, sizeof(address))
+            || listen(daemon.listen_fd, SOMAXCONN)) {
+        int error = errno;
+        close(daemon.listen_fd);
+        errno = error;
+        return 1;
+    }
+
+    /* Neither accepting a client that has gone again nor waking the polling
+     * thread may block. */
+    daemon.wake_fds[0] = daemon.wake_fds[1] = -1;
+    if (_huf_daemon_set_nonblocking(daemon.listen_fd) || pipe(daemon.wake_fds)
+            || _huf_daemon_set_nonblocking(daemon.wake_fds[0])
+            || _huf_daemon_set_nonblocking(daemon.wake_fds[1])) {
+        int error = errno;
+        if (daemon.wake_fds[0] >= 0) close(daemon.wake_fds[0]);
+        if (daemon.wake_fds[1] >= 0) close(daemon.wake_fds[1]);
+        close(daemon.listen_fd);
+        unlink(path);
+        errno = error;
+        return 1;
+    }
+
+    /* One thread more than those serving requests polls the connections. */
+    if (thread_count <= 0) {
+        thread_count = thread_pool_cpu_count();
+        if (thread_count < HUF_DAEMON_MIN_THREADS) {
+            thread_count = HUF_DAEMON_MIN_THREADS;
+        }
+    }
+    daemon.pool = thread_pool_create(thread_count + 1);
+    daemon.workers = daemon.pool
+        ? calloc(daemon.pool->thread_count, sizeof(struct huf_daemon_worker))
+        : NULL;
+    daemon.cache = code_cache_create(CODE_CACHE_DEFAULT_CAPACITY);
+    if (!daemon.pool || !daemon.workers || !daemon.cache) {
+        if (daemon.cache) code_cache_free(daemon.cache);
+        free(daemon.workers);
+        if (daemon.pool) thread_pool_free(daemon.pool);
+        close(daemon.wake_fds[0]);
+        close(daemon.wake_fds[1]);
+        close(daemon.listen_fd);
+        unlink(path);
+        errno = ERR_MEM_ERROR;
+        return 1;
+    }
+#ifdef HUF_HAVE_PTHREAD
+    pthread_mutex_init(&daemon.mutex, NULL);
+    pthread_cond_init(&daemon.ready_cond, NULL);
+#endif
+
+    struct sigaction action;
+    struct sigaction old_int, old_term, old_pipe;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = _huf_daemon_on_signal;
+    sigemptyset(&action.sa_mask);
+    _huf_daemon_signal_fd = daemon.listen_fd;
+    sigaction(SIGINT, &action, &old_int);
+    sigaction(SIGTERM, &action, &old_term);
+    action.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &action, &old_pipe);
+
+    thread_pool_run(daemon.pool, _huf_daemon_run_thread, &daemon,
+        (size_t)daemon.pool->thread_count);
+
+    sigaction(SIGINT, &old_int, NULL);
+    sigaction(SIGTERM, &old_term, NULL);
+    sigaction(SIGPIPE, &old_pipe, NULL);
+    _huf_daemon_signal_fd = -1;
+
+    _huf_daemon_queue_close(&daemon.ready);
+    _huf_daemon_queue_close(&daemon.served);
+#ifdef HUF_HAVE_PTHREAD
+    pthread_cond_destroy(&daemon.ready_cond);
+    pthread_mutex_destroy(&daemon.mutex);
+#endif
+    for (int i = 0; i < daemon.pool->thread_count; i++) {
+        free(daemon.workers[i].payload);
+    }
+    code_cache_free(daemon.cache);
+    free(daemon.workers);
+    thread_pool_free(daemon.pool);
+    close(daemon.wake_fds[0]);
+    close(daemon.wake_fds[1]);
+    close(daemon.listen_fd);
+    unlink(path);
+
+    return 0;
+}
+
+int huf_client_connect(const char* path) {
+    struct sockaddr_un address;
+    if (_huf_daemon_address(path, &address)) return -1;
+
+    int connection = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (connection < 0) return -1;
+
+    if (connect(connection, (struct sockaddr*)&address, sizeof(address))) {
+        int error = errno;
+        close(connection);
+        errno = error;
+        return -1;
+    }
+
+    return connection;
+}
+
+int huf_client_request(int socket, const struct huf_daemon_request* request,
+        const uint8_t* payload, int in_fd, int out_fd,
+        uint8_t** response, uint64_t* response_size) {
+    *response = NULL;
+    *response_size = 0;
+
+    uint8_t header[HUF_DAEMON_REQUEST_SIZE];
+    _huf_daemon_put_request(header, request);
+
+    if (request->flags & HUF_DAEMON_FLAG_DESCRIPTORS) {
+        union {
+            struct cmsghdr align;
+            char buffer[CMSG_SPACE(2 * sizeof(int))];
+        } control;
+        memset(&control, 0, sizeof(control));
+        struct iovec vector = { header, sizeof(header) };
+        struct msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_iov = &vector;
+        message.msg_iovlen = 1;
+        message.msg_control = control.buffer;
+        message.msg_controllen = sizeof(control.buffer);
+
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&message);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(2 * sizeof(int));
+        int fds[2] = { in_fd, out_fd };
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+        ssize_t sent;
+        do {
+            sent = sendmsg(socket, &message, MSG_NOSIGNAL);
+        } while (sent < 0 && errno == EINTR);
+        if (sent <= 0 || _huf_send_all(socket, header + sent,
+                sizeof(header) - (size_t)sent)) {
+            errno = ERR_IO_ERROR;
+            return 1;
+        }
+    } else if (_huf_send_all(socket, header, sizeof(header))
+            || _huf_send_all(socket, payload, request->payload_size)) {
+        return 1;
+    }
+
+    uint8_t status[HUF_DAEMON_RESPONSE_SIZE];
+    if (_huf_receive_all(socket, status, sizeof(status), NULL)) return 1;
+    if (status[0]) {
+        errno = (int)io_get_u32(status + 1);
+        return 1;
+    }
+
+    *response_size = io_get_u64(status + 5);
+    if (request->flags & HUF_DAEMON_FLAG_DESCRIPTORS || !*response_size) {
+        return 0;
+    }
+
+    *response = malloc(*response_size);
+    if (!*response) {
+        errno = ERR_MEM_ERROR;
+        return 1;
+    }
+    if (_huf_receive_all(socket, *response, *response_size, NULL)) {
+        free(*response);
+        *response = NULL;
+        return 1;
+    }
+
+    return 0;
+}
+
+#else
+
+int huf_daemon_run(const char* path, int thread_count) {
+    (void)path;
+    (void)thread_count;
+    errno = ERR_ILLEGAL_ARG;
+    return 1;
+}
+
+int huf_client_connect(const char* path) {
+    (void)path;
+    errno = ERR_ILLEGAL_ARG;
+    return -1;
+}
+
+int huf_client_request(int socket, const struct huf_daemon_request* request,
+        const uint8_t* payload, int in_fd, int out_fd,
+        uint8_t** response, uint64_t* response_size) {
+    (void)socket;
+    (void)request;
+    (void)payload;
+    (void)in_fd;
+    (void)out_fd;
+    *response = NULL;
+    *response_size = 0;
+    errno = ERR_ILLEGAL_ARG;
+    return 1;
+}
+
+#endif
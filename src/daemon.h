@@ -0,0 +1,161 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+
+#ifdef HUF_HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include "error.h"
+#include "io_util.h"
+#include "frame.h"
+#include "code_cache.h"
+#include "thread_pool.h"
+
+
+/*
+ * The daemon serves compression requests over a Unix domain socket, so that
+ * callers issuing many small requests neither start a process nor rebuild
+ * their buffers and decoding tables for every one of them. A connection
+ * carries any number of requests, each of which is answered before the next
+ * one is read. All integers are stored in little endian order.
+ *
+ * request  := op:u8 flags:u8 wide:u8 transform:u8 parameter:u8
+ *             payload_size:u64 payload
+ * response := status:u8 error:u32 payload_size:u64 payload
+ *
+ * <wide>, <transform> and <parameter> are the FRAME_WIDE_* and TRANSFORM_*
+ * settings of compression. A <status> of 0 means success, otherwise <error>
+ * holds the errno value describing the failure.
+ *
+ * With HUF_DAEMON_FLAG_DESCRIPTORS, the request payload is empty and two
+ * file descriptors are passed along with the request (SCM_RIGHTS): the input
+ * and the output. The result is written to the output descriptor, and the
+ * response payload is empty with <payload_size> the number of bytes written
+ * if the output is seekable, 0 otherwise. Without the flag, the request
+ * payload is the input and the response payload the result.
+ */
+
+#define HUF_DAEMON_OP_COMPRESS 1
+#define HUF_DAEMON_OP_DECOMPRESS 2
+#define HUF_DAEMON_OP_STOP 3
+
+#define HUF_DAEMON_FLAG_DESCRIPTORS 0x01
+#define HUF_DAEMON_FLAG_NO_CHECKSUM 0x02
+
+#define HUF_DAEMON_REQUEST_SIZE 13
+#define HUF_DAEMON_RESPONSE_SIZE 13
+#define HUF_DAEMON_MAX_PAYLOAD (1u << 30)
+
+/** Number of threads serving requests if none is given. */
+#define HUF_DAEMON_MIN_THREADS 4
+
+
+/**
+ * @brief A request sent to the daemon, without its payload.
+ */
+struct huf_daemon_request {
+    /** One of the HUF_DAEMON_OP_* operations. */
+    int op;
+    /** Any of the HUF_DAEMON_FLAG_* flags. */
+    int flags;
+    /** The FRAME_WIDE_* mode of compression, 0 for bytes. */
+    int wide;
+    /** The transform tried on every block by compression. */
+    struct transform transform;
+    /** Number of bytes of the payload following the request. */
+    uint64_t payload_size;
+};
+
+/**
+ * @brief The buffers a thread of the daemon reuses for all requests.
+ */
+struct huf_daemon_worker {
+    uint8_t* payload;
+    size_t payload_capacity;
+};
+
+/**
+ * @brief A list of connections handed from one thread of the daemon to
+ * another.
+ */
+struct huf_daemon_queue {
+    int* connections;
+    size_t count;
+    size_t capacity;
+};
+
+/**
+ * @brief A running daemon.
+ */
+struct huf_daemon {
+    int listen_fd;
+    /** Set once the daemon should stop accepting connections. */
+    atomic_int closing;
+    struct thread_pool* pool;
+    struct huf_daemon_worker* workers;
+    /** The decoding tables shared by all threads. */
+    struct code_cache* cache;
+    /** A pipe written to wake the thread polling the connections. */
+    int wake_fds[2];
+    /** Connections a request has arrived on, to be served by any thread. */
+    struct huf_daemon_queue ready;
+    /** Connections whose request has been served, to be polled again. */
+    struct huf_daemon_queue served;
+#ifdef HUF_HAVE_PTHREAD
+    /** Guards both queues. */
+    pthread_mutex_t mutex;
+    /** Signalled when a connection is ready or the daemon stops. */
+    pthread_cond_t ready_cond;
+#endif
+};
+
+
+/**
+ * @brief Listens on a Unix domain socket and serves requests until a stop
+ * request, SIGINT or SIGTERM is received. One thread polls the listening
+ * socket and all idle connections, and every connection a request arrives
+ * on is handed to one of the other threads, which serves that request and
+ * hands the connection back. Idle clients therefore hold no thread.
+ *
+ * @param path the path of the socket, which is removed afterwards.
+ * @param thread_count the number of requests served at once, 0 for one
+ * per processor but at least HUF_DAEMON_MIN_THREADS.
+ * @return int non-zero if the socket could not be set up, zero otherwise.
+ */
+int huf_daemon_run(const char* path, int thread_count);
+
+/**
+ * @brief Connects to a daemon.
+ *
+ * @param path the path of the socket of the daemon.
+ * @return int the connected socket, or -1 if an error occurred.
+ */
+int huf_client_connect(const char* path);
+
+/**
+ * @brief Sends a request to a daemon and waits for its response.
+ *
+ * @param socket the socket returned by huf_client_connect().
+ * @param request the request to be sent. <request->payload_size> bytes of
+ * <payload> are sent along with it.
+ * @param payload the input of the request, unused with descriptors.
+ * @param in_fd the input descriptor, used with HUF_DAEMON_FLAG_DESCRIPTORS.
+ * @param out_fd the output descriptor, used with HUF_DAEMON_FLAG_DESCRIPTORS.
+ * @param response set to a heap buffer holding the response payload, NULL
+ * if it is empty. Must be freed by the caller.
+ * @param response_size set to the <payload_size> of the response.
+ * @return int non-zero if the request failed, with errno set to the error
+ * reported by the daemon, zero otherwise.
+ */
+int huf_client_request(int socket, const struct huf_daemon_request* request,
+    const uint8_t* payload, int in_fd, int out_fd,
+    uint8_t** response, uint64_t* response_size);
+
+
+#endif
@@ -0,0 +1,782 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "error.h"
+#include "frequency_dict.h"
+#include "huffman_tree.h"
+#include "mapping_dict.h"
+#include "ans_code.h"
+#include "frame.h"
+#include "compact_decoder.h"
+#include "batch.h"
+#include "table_cache.h"
+#include "code_cache.h"
+#include "trace.h"
+
+
+/*
+ * Checks every variant of the encoding and decoding kernels against the
+ * reference coder on inputs chosen to break them: Fibonacci frequencies
+ * for the deepest trees the input size allows, a single symbol, all 256
+ * symbols equally often and random frequencies. The reference encoder
+ * writes the code of every byte bit by bit from the mapping dict, as the
+ * coder did before any table was added, and huffman_tree_decompress_file()
+ * is the reference decoder, which the compact decoder is checked against on
+ * the same stream with its tree in front. Encoders must produce the same
+ * bits, decoders the input, and framed streams the same bytes on every
+ * thread count. Batches of buffers cut from the input, with and without a
+ * shared tree and a table cache, must decode back to every buffer. The
+ * throughput of every variant is printed with its speedup over the
+ * reference, and the exit status is non-zero if any variant differs.
+ */
+
+#define DIFFCHECK_DEFAULT_SIZE (1u << 20)
+#define DIFFCHECK_DEFAULT_ROUNDS 3
+#define DIFFCHECK_DEFAULT_THREADS 4
+/** Block size of the framed streams, small enough for several blocks. */
+#define DIFFCHECK_BLOCK_SIZE (64u << 10)
+/** Largest number of buffers the input is cut into for batches. */
+#define DIFFCHECK_BATCH_COUNT 4096
+
+
+/**
+ * @brief An input and the codes and outputs of the variants run on it.
+ */
+struct diffcheck_case {
+    const char* name;
+    uint8_t* input;
+    size_t size;
+    struct freq_dict* dict;
+    struct huffman_tree* tree;
+    struct mapping_dict* mapping;
+    /** The same mapping with a pair table. */
+    struct mapping_dict* pair_mapping;
+    /** The same mapping for mapping_dict_compress_file(), which may add one. */
+    struct mapping_dict* file_mapping;
+    struct ans_code* ans;
+    struct ans_code_table* ans_table;
+    /** The bits of the reference encoder, and their number as counted. */
+    uint8_t* reference;
+    uint64_t reference_bits;
+    size_t reference_size;
+    /** The input and the reference bits behind its size, as files. */
+    FILE* in_stream;
+    FILE* reference_stream;
+    /** The tree followed by the reference stream, as written before frames. */
+    FILE* unframed_stream;
+    struct compact_decoder compact;
+    uint8_t compact_in[COMPACT_DECODER_BUFFER_SIZE];
+    uint8_t compact_out[COMPACT_DECODER_BUFFER_SIZE];
+    uint8_t* encoded;
+    size_t encoded_capacity;
+    size_t encoded_size;
+    uint8_t* ans_encoded;
+    size_t ans_encoded_size;
+    uint8_t* decoded;
+    FILE* out_stream;
+    /** The framed stream of a single thread, which the others must match,
+     * followed by as many bytes to read the others into. */
+    uint8_t* frame;
+    size_t frame_size;
+    size_t frame_capacity;
+    struct frame_params params;
+};
+
+/**
+ * @brief A kernel and how its output is checked.
+ */
+struct diffcheck_variant {
+    const char* name;
+    /** Runs the kernel once, returns non-zero if it failed. */
+    int (*run)(struct diffcheck_case* test);
+    /** Returns non-zero if the output of the last run is wrong. */
+    int (*check)(struct diffcheck_case* test);
+    /** Non-zero for decoders, whose reference is the reference decoder. */
+    int decoder;
+};
+
+
+/* Returns the next number of an xorshift generator. */
+uint32_t diffcheck_random(uint32_t* state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+void diffcheck_shuffle(uint8_t* bytes, size_t size, uint32_t seed) {
+    for (size_t i = size; i > 1; i--) {
+        size_t j = diffcheck_random(&seed) % i;
+        uint8_t byte = bytes[i - 1];
+        bytes[i - 1] = bytes[j];
+        bytes[j] = byte;
+    }
+}
+
+/* Symbol i occurs as often as the i-th Fibonacci number, for as many
+ * symbols as fit into <size> bytes, which gives a tree of maximum depth. */
+size_t diffcheck_fibonacci(uint8_t* bytes, size_t size) {
+    uint64_t counts[256];
+    counts[0] = counts[1] = 1;
+    size_t total = 2;
+    int symbols = 2;
+    while (symbols < 256 && total + counts[symbols - 1] + counts[symbols - 2] <= size) {
+        counts[symbols] = counts[symbols - 1] + counts[symbols - 2];
+        total += counts[symbols++];
+    }
+
+    size_t position = 0;
+    for (int i = 0; i < symbols; i++) {
+        memset(bytes + position, i, counts[i]);
+        position += counts[i];
+    }
+    diffcheck_shuffle(bytes, position, 1);
+
+    return position;
+}
+
+size_t diffcheck_single(uint8_t* bytes, size_t size) {
+    memset(bytes, 'a', size);
+    return size;
+}
+
+size_t diffcheck_uniform(uint8_t* bytes, size_t size) {
+    size -= size % 256;
+    for (size_t i = 0; i < size; i++) bytes[i] = (uint8_t)i;
+    diffcheck_shuffle(bytes, size, 2);
+    return size;
+}
+
+/* Bytes drawn from random frequencies, with some symbols missing. */
+size_t diffcheck_skewed(uint8_t* bytes, size_t size) {
+    uint32_t seed = 3;
+    uint32_t limits[256];
+    uint32_t total = 0;
+    for (int i = 0; i < 256; i++) {
+        uint32_t weight = diffcheck_random(&seed) % 1000;
+        total += weight < 200 ? 0 : weight * weight / 1000;
+        limits[i] = total;
+    }
+
+    for (size_t i = 0; i < size; i++) {
+        uint32_t value = diffcheck_random(&seed) % total;
+        int symbol = 0;
+        while (limits[symbol] <= value) symbol++;
+        bytes[i] = (uint8_t)symbol;
+    }
+
+    return size;
+}
+
+size_t diffcheck_random_bytes(uint8_t* bytes, size_t size) {
+    uint32_t seed = 4;
+    for (size_t i = 0; i < size; i++) bytes[i] = (uint8_t)diffcheck_random(&seed);
+    return size;
+}
+
+static const struct {
+    const char* name;
+    size_t (*fill)(uint8_t* bytes, size_t size);
+} diffcheck_inputs[] = {
+    { "fibonacci", diffcheck_fibonacci },
+    { "single", diffcheck_single },
+    { "uniform", diffcheck_uniform },
+    { "skewed", diffcheck_skewed },
+    { "random", diffcheck_random_bytes },
+};
+
+
+/* Reads a whole stream back into a buffer that is compared to <expected>. */
+int diffcheck_compare_stream(FILE* stream, const uint8_t* expected, size_t size,
+        uint8_t* buffer) {
+    fflush(stream);
+    long length = ftell(stream);
+    rewind(stream);
+    if (length < 0 || (size_t)length != size
+            || fread(buffer, 1, size, stream) != size) {
+        return 1;
+    }
+
+    return memcmp(buffer, expected, size) != 0;
+}
+
+int diffcheck_reference_encode(struct diffcheck_case* test) {
+    uint8_t byte = 0;
+    int bit_count = 0;
+    size_t position = 0;
+    for (size_t i = 0; i < test->size; i++) {
+        struct mapping_dict_mapping* mapping = &test->mapping->mappings[test->input[i]];
+        for (uint32_t j = 0; j < mapping->bit_count; j++) {
+            byte = (uint8_t)(byte << 1 | mapping_dict_get_bit(mapping, (uint8_t)j));
+            if (++bit_count == 8) {
+                test->reference[position++] = byte;
+                byte = 0;
+                bit_count = 0;
+            }
+        }
+    }
+    if (bit_count) test->reference[position++] = (uint8_t)(byte << (8 - bit_count));
+    test->reference_size = position;
+
+    return 0;
+}
+
+int diffcheck_check_reference_encode(struct diffcheck_case* test) {
+    /* The bits themselves are checked by the reference decoder. */
+    return test->reference_size != (test->reference_bits + 7) / 8;
+}
+
+int diffcheck_encode(struct diffcheck_case* test) {
+    test->encoded_size = mapping_dict_encode_buffer(test->mapping, test->input,
+        test->size, test->encoded);
+    return 0;
+}
+
+int diffcheck_encode_pairs(struct diffcheck_case* test) {
+    test->encoded_size = mapping_dict_encode_buffer(test->pair_mapping,
+        test->input, test->size, test->encoded);
+    return 0;
+}
+
+int diffcheck_check_encoded(struct diffcheck_case* test) {
+    return test->encoded_size != test->reference_size
+        || memcmp(test->encoded, test->reference, test->reference_size);
+}
+
+int diffcheck_compress_file(struct diffcheck_case* test) {
+    rewind(test->in_stream);
+    rewind(test->out_stream);
+    return mapping_dict_compress_file(test->file_mapping, test->in_stream,
+        test->out_stream);
+}
+
+int diffcheck_check_compress_file(struct diffcheck_case* test) {
+    /* The file starts with the number of bytes, like the reference stream. */
+    uint8_t header[sizeof(uint32_t)];
+    uint32_t size = (uint32_t)test->size;
+    memcpy(header, &size, sizeof(uint32_t));
+
+    fflush(test->out_stream);
+    long length = ftell(test->out_stream);
+    rewind(test->out_stream);
+    return length < 0
+        || (size_t)length != sizeof(uint32_t) + test->reference_size
+        || fread(test->encoded, 1, sizeof(uint32_t), test->out_stream) != sizeof(uint32_t)
+        || memcmp(test->encoded, header, sizeof(uint32_t))
+        || fread(test->encoded, 1, test->reference_size, test->out_stream)
+            != test->reference_size
+        || memcmp(test->encoded, test->reference, test->reference_size);
+}
+
+int diffcheck_reference_decode(struct diffcheck_case* test) {
+    rewind(test->reference_stream);
+    rewind(test->out_stream);
+    return huffman_tree_decompress_file(test->tree, test->reference_stream,
+        test->out_stream);
+}
+
+int diffcheck_check_reference_decode(struct diffcheck_case* test) {
+    return diffcheck_compare_stream(test->out_stream, test->input, test->size,
+        test->decoded);
+}
+
+int diffcheck_decode(struct diffcheck_case* test) {
+    memset(test->decoded, 0, test->size);
+    return huffman_tree_decode_buffer(test->tree, test->reference,
+        test->reference_size, test->decoded, test->size);
+}
+
+int diffcheck_compact_decode(struct diffcheck_case* test) {
+    struct sink_iovec vector = { test->decoded, test->size };
+    struct sink_buffers buffers;
+    struct sink sink;
+    sink_buffers_init(&buffers, &vector, 1, &sink);
+    compact_decoder_init(&test->compact, test->compact_in,
+        sizeof(test->compact_in), test->compact_out, sizeof(test->compact_out));
+
+    memset(test->decoded, 0, test->size);
+    rewind(test->unframed_stream);
+    return compact_decoder_decompress_stream(&test->compact,
+            test->unframed_stream, &sink)
+        || buffers.size != test->size;
+}
+
+int diffcheck_ans_decode(struct diffcheck_case* test) {
+    memset(test->decoded, 0, test->size);
+    return ans_code_decode_buffer(test->ans_table, test->ans_encoded,
+        test->ans_encoded_size, test->decoded, test->size);
+}
+
+int diffcheck_check_decoded(struct diffcheck_case* test) {
+    return memcmp(test->decoded, test->input, test->size) != 0;
+}
+
+static const struct diffcheck_variant diffcheck_variants[] = {
+    { "reference-encode", diffcheck_reference_encode,
+        diffcheck_check_reference_encode, 0 },
+    { "encode", diffcheck_encode, diffcheck_check_encoded, 0 },
+    { "encode-pairs", diffcheck_encode_pairs, diffcheck_check_encoded, 0 },
+    { "compress-file", diffcheck_compress_file, diffcheck_check_compress_file, 0 },
+    { "reference-decode", diffcheck_reference_decode,
+        diffcheck_check_reference_decode, 1 },
+    { "decode", diffcheck_decode, diffcheck_check_decoded, 1 },
+    { "compact-decode", diffcheck_compact_decode, diffcheck_check_decoded, 1 },
+    { "ans-decode", diffcheck_ans_decode, diffcheck_check_decoded, 1 },
+};
+
+
+/* Builds the codes of an input, the outputs of the reference encoder and
+ * the files the variants read. */
+int diffcheck_prepare(struct diffcheck_case* test) {
+    test->dict = freq_dict_create();
+    if (!test->dict) return 1;
+    freq_dict_add_buffer(test->dict, test->input, test->size);
+
+    test->tree = huffman_tree_create_from_freq_dict(test->dict);
+    test->mapping = test->tree ? mapping_dict_create_mapping(test->tree) : NULL;
+    test->pair_mapping = test->tree ? mapping_dict_create_mapping(test->tree) : NULL;
+    test->file_mapping = test->tree ? mapping_dict_create_mapping(test->tree) : NULL;
+    if (!test->mapping || !test->pair_mapping || !test->file_mapping
+            || mapping_dict_create_pairs(test->pair_mapping)) {
+        return 1;
+    }
+
+    /* Words are stored behind the last encoded byte. */
+    test->reference_bits = mapping_dict_encoded_bits(test->mapping, test->dict);
+    test->encoded_capacity = (size_t)(test->reference_bits / 8) + 2 * sizeof(uint64_t);
+    test->reference = malloc(test->encoded_capacity);
+    test->encoded = malloc(test->encoded_capacity);
+    test->ans_encoded = malloc(2 * test->size + ANS_CODE_SLACK);
+    test->decoded = malloc(test->size);
+    test->frame_capacity = 2 * test->size + DIFFCHECK_BLOCK_SIZE;
+    test->frame = malloc(2 * test->frame_capacity);
+    if (!test->reference || !test->encoded || !test->ans_encoded
+            || !test->decoded || !test->frame) {
+        errno = ERR_MEM_ERROR;
+        return 1;
+    }
+
+    test->ans = ans_code_create_from_frequencies(test->dict->frequencies);
+    if (test->ans) {
+        uint8_t ans_buffer[ANS_CODE_MAX_SIZE];
+        size_t ans_size = ans_code_write_to_buffer(test->ans, ans_buffer);
+        test->ans_encoded_size = ans_code_encode_buffer(test->ans, test->input,
+            test->size, test->ans_encoded, 2 * test->size + ANS_CODE_SLACK);
+
+        /* Inputs tANS does not fit into the buffer are left to the tree. */
+        if (test->ans_encoded_size) {
+            test->ans_table = ans_code_read_table(ans_buffer, ans_size);
+        }
+    }
+
+    diffcheck_reference_encode(test);
+    uint32_t size = (uint32_t)test->size;
+    test->in_stream = tmpfile();
+    test->reference_stream = tmpfile();
+    test->unframed_stream = tmpfile();
+    test->out_stream = tmpfile();
+    if (!test->in_stream || !test->reference_stream || !test->unframed_stream
+            || !test->out_stream
+            || fwrite(test->input, 1, test->size, test->in_stream) != test->size
+            || fwrite(&size, sizeof(uint32_t), 1, test->reference_stream) != 1
+            || fwrite(test->reference, 1, test->reference_size,
+                test->reference_stream) != test->reference_size
+            || huffman_tree_write_to_stream(test->tree, test->unframed_stream)
+            || fwrite(&size, sizeof(uint32_t), 1, test->unframed_stream) != 1
+            || fwrite(test->reference, 1, test->reference_size,
+                test->unframed_stream) != test->reference_size
+            || fflush(test->in_stream) || fflush(test->reference_stream)
+            || fflush(test->unframed_stream)) {
+        errno = ERR_IO_ERROR;
+        return 1;
+    }
+
+    return 0;
+}
+
+void diffcheck_release(struct diffcheck_case* test) {
+    if (test->dict) freq_dict_free(test->dict);
+    if (test->tree) huffman_tree_free(test->tree);
+    if (test->mapping) mapping_dict_free(test->mapping);
+    if (test->pair_mapping) mapping_dict_free(test->pair_mapping);
+    if (test->file_mapping) mapping_dict_free(test->file_mapping);
+    if (test->ans) ans_code_free(test->ans);
+    if (test->ans_table) ans_code_table_free(test->ans_table);
+    if (test->in_stream) fclose(test->in_stream);
+    if (test->reference_stream) fclose(test->reference_stream);
+    if (test->unframed_stream) fclose(test->unframed_stream);
+    if (test->out_stream) fclose(test->out_stream);
+    free(test->reference);
+    free(test->encoded);
+    free(test->ans_encoded);
+    free(test->decoded);
+    free(test->frame);
+}
+
+/* Runs a kernel <rounds> times and returns the fastest run in nanoseconds,
+ * 0 if a run failed. */
+uint64_t diffcheck_time(struct diffcheck_case* test,
+        int (*run)(struct diffcheck_case* test), int rounds) {
+    uint64_t best = 0;
+    for (int i = 0; i < rounds; i++) {
+        uint64_t start = trace_now();
+        if (run(test)) return 0;
+        uint64_t elapsed = trace_now() - start;
+        if (!best || elapsed < best) best = elapsed + !elapsed;
+    }
+
+    return best;
+}
+
+void diffcheck_print(const char* name, size_t size, uint64_t elapsed,
+        uint64_t reference, int failed) {
+    if (elapsed == 0) {
+        printf("  %-18s %10s %8s  FAILED\n", name, "-", "-");
+        return;
+    }
+
+    printf("  %-18s %10.1f %7.2fx  %s\n", name,
+        (double)size / (1 << 20) / ((double)elapsed / 1e9),
+        reference ? (double)reference / (double)elapsed : 1.0,
+        failed ? "MISMATCH" : "ok");
+}
+
+/* Runs every variant on an input and returns the number that failed. */
+int diffcheck_run_variants(struct diffcheck_case* test, int rounds) {
+    int failures = 0;
+    uint64_t references[2] = { 0, 0 };
+    for (size_t i = 0; i < sizeof(diffcheck_variants) / sizeof(diffcheck_variants[0]); i++) {
+        const struct diffcheck_variant* variant = &diffcheck_variants[i];
+        if (variant->run == diffcheck_ans_decode && !test->ans_table) continue;
+
+        uint64_t elapsed = diffcheck_time(test, variant->run, rounds);
+        int failed = elapsed == 0 || variant->check(test);
+        if (!references[variant->decoder]) references[variant->decoder] = elapsed;
+        diffcheck_print(variant->name, test->size, elapsed,
+            references[variant->decoder], failed);
+        failures += failed;
+    }
+
+    return failures;
+}
+
+int diffcheck_compress_frame(struct diffcheck_case* test) {
+    if (test->out_stream) fclose(test->out_stream);
+    test->out_stream = tmpfile();
+    if (!test->out_stream) {
+        errno = ERR_IO_ERROR;
+        return 1;
+    }
+
+    rewind(test->in_stream);
+    return frame_compress_stream(&test->params, test->in_stream, test->out_stream);
+}
+
+/* Compresses the input as a framed stream on every thread count, checks
+ * that the output is the same as on one thread and that it decodes back
+ * to the input, and returns the number of thread counts that failed. */
+int diffcheck_run_threads(struct diffcheck_case* test, int max_threads,
+        int rounds, int ans) {
+    int failures = 0;
+    uint64_t reference = 0;
+    frame_params_init(&test->params);
+    test->params.block_size = DIFFCHECK_BLOCK_SIZE;
+    test->params.ans = ans;
+
+    for (int threads = 1;; threads *= 2) {
+        if (threads > max_threads) threads = max_threads;
+        test->params.thread_count = threads;
+        uint64_t elapsed = diffcheck_time(test, diffcheck_compress_frame, rounds);
+        int failed = elapsed == 0;
+
+        if (!failed) {
+            fflush(test->out_stream);
+            long length = ftell(test->out_stream);
+            failed = length < 0 || (size_t)length > test->frame_capacity;
+            if (!failed && threads == 1) {
+                test->frame_size = (size_t)length;
+                rewind(test->out_stream);
+                failed = fread(test->frame, 1, test->frame_size, test->out_stream)
+                    != test->frame_size;
+            } else if (!failed) {
+                failed = diffcheck_compare_stream(test->out_stream, test->frame,
+                    test->frame_size, test->frame + test->frame_capacity);
+            }
+        }
+
+        /* The stream of every thread count is the same, so one decoding
+         * checks them all. */
+        if (!failed && threads == 1) {
+            FILE* decoded_stream = tmpfile();
+            rewind(test->out_stream);
+            failed = !decoded_stream
+                || frame_decompress_stream(test->out_stream, decoded_stream,
+                    ASYNC_IO_SYNC)
+                || diffcheck_compare_stream(decoded_stream, test->input,
+                    test->size, test->decoded);
+            if (decoded_stream) fclose(decoded_stream);
+        }
+
+        char name[32];
+        snprintf(name, sizeof(name), "frame%s-t%d", ans ? "" : "-tree", threads);
+        if (threads == 1) reference = elapsed;
+        diffcheck_print(name, test->size, elapsed, reference, failed);
+        failures += failed;
+        if (threads == max_threads) break;
+    }
+
+    return failures;
+}
+
+
+/* Cuts the input into buffers of a few bytes to a few KiB, every eighth of
+ * them larger than a block and every 64th empty, and returns their number. */
+size_t diffcheck_cut(const struct diffcheck_case* test,
+        const uint8_t** messages, size_t* sizes) {
+    uint32_t seed = 5;
+    size_t count = 0;
+    for (size_t position = 0; position < test->size
+            && count < DIFFCHECK_BATCH_COUNT; count++) {
+        uint32_t value = diffcheck_random(&seed);
+        size_t size = count % 64 == 0 ? 0
+            : count % 8 == 0 ? DIFFCHECK_BLOCK_SIZE + value % DIFFCHECK_BLOCK_SIZE
+            : 1 + value % 4096;
+        if (size > test->size - position) size = test->size - position;
+        messages[count] = test->input + position;
+        sizes[count] = size;
+        position += size;
+    }
+
+    return count;
+}
+
+/* Decodes every buffer of a batch and compares it to its input. */
+int diffcheck_check_batch(const struct huf_batch_output* output, int shared,
+        const uint8_t* const* messages, const size_t* sizes, size_t count,
+        struct code_cache* cache) {
+    uint8_t* decoded = NULL;
+    size_t capacity = 0;
+    int failed = 0;
+    for (size_t i = 0; i < count && !failed; i++) {
+        size_t size;
+        failed = huf_batch_decode(shared ? output->data : NULL,
+                shared ? output->offsets[0] : 0,
+                output->data + output->offsets[i],
+                output->offsets[i + 1] - output->offsets[i], cache,
+                &decoded, &capacity, &size)
+            || size != sizes[i]
+            || (size && memcmp(decoded, messages[i], size));
+    }
+    free(decoded);
+
+    return failed;
+}
+
+/* Compresses the input cut into buffers as batches with and without a
+ * shared tree and a table cache, checks that every buffer decodes back to
+ * itself, with the decoding cache for batches with a table cache, and that
+ * the cache does not make buffers compressed into frames of their own any
+ * larger, and returns the number of batch variants that failed. */
+int diffcheck_run_batches(struct diffcheck_case* test, int rounds) {
+    static const char* names[] = {
+        "batch", "batch-cache", "batch-shared", "batch-shared-cache"
+    };
+    const uint8_t** messages = malloc(DIFFCHECK_BATCH_COUNT * sizeof(uint8_t*));
+    size_t* sizes = malloc(DIFFCHECK_BATCH_COUNT * sizeof(size_t));
+    if (!messages || !sizes) {
+        free(messages);
+        free(sizes);
+        errno = ERR_MEM_ERROR;
+        return 4;
+    }
+    size_t count = diffcheck_cut(test, messages, sizes);
+
+    int failures = 0;
+    uint64_t reference = 0;
+    size_t uncached_size = 0;
+    for (int variant = 0; variant < 4; variant++) {
+        int cached = variant & 1;
+        int shared = variant >> 1;
+        struct frame_params params;
+        frame_params_init(&params);
+        params.block_size = DIFFCHECK_BLOCK_SIZE;
+        params.table_cache = cached ? table_cache_create(
+            TABLE_CACHE_DEFAULT_CAPACITY, TABLE_CACHE_DEFAULT_TOLERANCE) : NULL;
+        struct code_cache* code_cache = cached
+            ? code_cache_create(TABLE_CACHE_DEFAULT_CAPACITY) : NULL;
+        struct huf_batch* batch = (!cached || (params.table_cache && code_cache))
+            ? huf_batch_create(&params) : NULL;
+        struct huf_batch_output output;
+        memset(&output, 0, sizeof(output));
+
+        /* The caches are kept between the rounds, as between batches. */
+        uint64_t elapsed = 0;
+        for (int i = 0; i < rounds && batch; i++) {
+            uint64_t start = trace_now();
+            if (huf_compress_batch(batch, messages, sizes, count, shared, &output)) {
+                elapsed = 0;
+                break;
+            }
+            uint64_t round = trace_now() - start;
+            if (!elapsed || round < elapsed) elapsed = round + !round;
+        }
+        int failed = elapsed == 0 || diffcheck_check_batch(&output, shared,
+            messages, sizes, count, code_cache)
+            || (variant == 1 && output.size > uncached_size);
+
+        if (variant == 0) {
+            reference = elapsed;
+            uncached_size = output.size;
+        }
+        diffcheck_print(names[variant], test->size, elapsed, reference, failed);
+        failures += failed;
+
+        huf_batch_output_free(&output);
+        if (batch) huf_batch_free(batch);
+        if (code_cache) code_cache_free(code_cache);
+        if (params.table_cache) table_cache_free(params.table_cache);
+    }
+
+    free(messages);
+    free(sizes);
+    return failures;
+}
+
+
+uint8_t* diffcheck_load(const char* path, size_t* size) {
+    FILE* stream = fopen(path, "rb");
+    if (!stream) {
+        errno = ERR_IO_ERROR;
+        return NULL;
+    }
+
+    uint8_t* buffer = malloc(*size ? *size : 1);
+    if (!buffer) {
+        fclose(stream);
+        errno = ERR_MEM_ERROR;
+        return NULL;
+    }
+    *size = fread(buffer, 1, *size, stream);
+    fclose(stream);
+
+    if (*size == 0) {
+        free(buffer);
+        errno = ERR_ILLEGAL_ARG;
+        return NULL;
+    }
+
+    return buffer;
+}
+
+/* Checks all variants on one input, returns the number that failed or -1
+ * if the input could not be prepared. */
+int diffcheck_run(const char* name, uint8_t* input, size_t size,
+        int max_threads, int rounds) {
+    struct diffcheck_case test;
+    memset(&test, 0, sizeof(test));
+    test.name = name;
+    test.input = input;
+    test.size = size;
+
+    if (diffcheck_prepare(&test)) {
+        print_error("Failed to prepare input");
+        diffcheck_release(&test);
+        return -1;
+    }
+
+    int max_length = 0;
+    for (int i = 0; i < 256; i++) {
+        int length = (int)test.mapping->mappings[i].bit_count;
+        if (length > max_length) max_length = length;
+    }
+    printf("%s: %zu bytes, codes up to %d bits\n", name, size, max_length);
+    printf("  %-18s %10s %8s  %s\n", "variant", "MiB/s", "speedup", "result");
+
+    int failures = diffcheck_run_variants(&test, rounds)
+        + diffcheck_run_threads(&test, max_threads, rounds, 1)
+        + diffcheck_run_threads(&test, max_threads, rounds, 0)
+        + diffcheck_run_batches(&test, rounds);
+    printf("\n");
+
+    diffcheck_release(&test);
+    return failures;
+}
+
+
+void print_usage(const char* program) {
+    printf("Usage: %s [options] [FILE]\n"
+        "Checks the encoders and decoders, framed compression on 1, 2, 4 ...\n"
+        "threads and batches, against the reference coder on generated\n"
+        "inputs and FILE, and prints the speedup of every variant over the\n"
+        "reference. Exits with a non-zero status if any output differs.\n\n"
+        "Options:\n"
+        "  --size N         number of bytes of every input, default %u\n"
+        "  --rounds N       number of timed runs per variant, default %d\n"
+        "  --threads N      largest number of threads, default %d\n",
+        program, DIFFCHECK_DEFAULT_SIZE, DIFFCHECK_DEFAULT_ROUNDS,
+        DIFFCHECK_DEFAULT_THREADS);
+}
+
+
+int main(int argc, char* argv[]) {
+    size_t size = DIFFCHECK_DEFAULT_SIZE;
+    int rounds = DIFFCHECK_DEFAULT_ROUNDS;
+    int max_threads = DIFFCHECK_DEFAULT_THREADS;
+    const char* path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--size") && i + 1 < argc) {
+            size = strtoul(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--rounds") && i + 1 < argc) {
+            rounds = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+            max_threads = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--help")) {
+            print_usage(argv[0]);
+            return 0;
+        } else if (argv[i][0] != '-' && !path) {
+            path = argv[i];
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (size < 256 || size > UINT32_MAX || rounds <= 0 || max_threads <= 0) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    uint8_t* input = malloc(size);
+    if (!input) {
+        errno = ERR_MEM_ERROR;
+        print_error("Failed to allocate input");
+        return 1;
+    }
+
+    int failures = 0;
+    for (size_t i = 0; i < sizeof(diffcheck_inputs) / sizeof(diffcheck_inputs[0]); i++) {
+        size_t input_size = diffcheck_inputs[i].fill(input, size);
+        int result = diffcheck_run(diffcheck_inputs[i].name, input, input_size,
+            max_threads, rounds);
+        failures += result < 0 ? 1 : result;
+    }
+    free(input);
+
+    if (path) {
+        size_t file_size = size;
+        uint8_t* file_input = diffcheck_load(path, &file_size);
+        int result = file_input ? diffcheck_run(path, file_input, file_size,
+            max_threads, rounds) : -1;
+        if (!file_input) print_error("Failed to load input");
+        failures += result < 0 ? 1 : result;
+        free(file_input);
+    }
+
+    if (failures) {
+        printf("%d variants differ from the reference.\n", failures);
+        return 1;
+    }
+    printf("All variants match the reference.\n");
+
+    return 0;
+}
@@ -20,6 +20,9 @@ void print_error(const char* msg) {
             case ERR_PARSE_ERROR:
                 error_description = ERR_PARSE_ERROR_MSG;
                 break;
+            case ERR_CHECKSUM_ERROR:
+                error_description = ERR_CHECKSUM_ERROR_MSG;
+                break;
         }
 
         fprintf(stderr, "%s:%s\n", msg, error_description);
@@ -13,6 +13,8 @@
 #define ERR_IO_ERROR_MSG "IO Error"
 #define ERR_PARSE_ERROR 203
 #define ERR_PARSE_ERROR_MSG "File format errors found"
+#define ERR_CHECKSUM_ERROR 204
+#define ERR_CHECKSUM_ERROR_MSG "Checksum mismatch, the data is corrupt"
 
 
 /**
@@ -0,0 +1,199 @@
+#include "estimate.h"
+#include "frame_index.h"
+
+#include <string.h>
+
+
+void _huf_estimate_finish(struct huf_size_estimate* estimate) {
+    estimate->total_size = estimate->header_size + estimate->payload_size;
+}
+
+int huf_estimate(const struct frame_params* params,
+        struct freq_dict* histogram, struct huf_size_estimate* estimate) {
+    memset(estimate, 0, sizeof(struct huf_size_estimate));
+    estimate->raw_size = freq_dict_total(histogram) * (params->wide ? 2 : 1);
+
+    /* The histogram is planned as the single block compression would make
+     * of an input of at most one block, with the shared code of the frame
+     * built from the same frequencies. */
+    struct frame_shared_code shared;
+    if (frame_create_shared_code_from_dict(params, histogram, &shared)) return 1;
+
+    estimate->header_size = frame_header_size(&shared)
+        + frame_index_footer_size(0);
+
+    int ans = 0;
+    if (estimate->raw_size > 0) {
+        struct frame_block_plan plan;
+        if (frame_plan_block(params, &shared, histogram, estimate->raw_size,
+                &plan)) {
+            frame_shared_code_free(&shared);
+            return 1;
+        }
+
+        estimate->header_size += plan.header_size + FRAME_INDEX_ENTRY_SIZE;
+        estimate->payload_size = plan.payload_size;
+        ans = plan.type == FRAME_BLOCK_ANS;
+        frame_block_plan_free(&plan);
+    }
+    frame_shared_code_free(&shared);
+
+    /* The size of a tANS payload depends on the order of the symbols, and
+     * that of a transformed block on the bytes it is applied to. */
+    estimate->exact = estimate->raw_size <= params->block_size
+        && !ans && params->transform.type == TRANSFORM_NONE
+        && !params->sampled && !params->table_cache;
+
+    _huf_estimate_finish(estimate);
+    return 0;
+}
+
+int huf_estimate_stream(const struct frame_params* params, FILE* in_stream,
+        struct huf_size_estimate* estimate) {
+    memset(estimate, 0, sizeof(struct huf_size_estimate));
+    estimate->exact = 1;
+
+    struct frame_shared_code shared;
+    if (frame_create_shared_code(params, in_stream, &shared)) return 1;
+
+    int split = params->split_size && !params->wide;
+    struct freq_dict* block_dict = frame_create_dict(params);
+    struct freq_dict* spare_dict = frame_create_dict(params);
+    struct freq_dict* front_dict = split ? freq_dict_create() : NULL;
+    struct freq_dict* all_dict = split ? freq_dict_create() : NULL;
+    uint8_t* buffer = malloc(3 * params->block_size + ANS_CODE_SLACK);
+    int error_code = !block_dict || !spare_dict || !buffer
+        || (split && (!front_dict || !all_dict));
+    if (error_code) errno = ERR_MEM_ERROR;
+
+    estimate->header_size = frame_header_size(&shared)
+        + frame_index_footer_size(0);
+
+    /* Blocks end where compression would end them. */
+    size_t pending = 0;
+    while (!error_code) {
+        size_t available = pending + frame_read_fully(in_stream,
+            buffer + pending, params->block_size - pending);
+        if (available == pending && ferror(in_stream)) {
+            errno = ERR_IO_ERROR;
+            error_code = 1;
+            break;
+        }
+        if (available == 0) break;
+
+        size_t read = split ? frame_split_block(params, &shared, buffer,
+            available, front_dict, all_dict) : available;
+
+        struct transform transform;
+        const uint8_t* symbols = frame_analyze_block(params, buffer, read,
+            buffer + params->block_size, &block_dict, &spare_dict, &transform);
+
+        struct frame_block_plan plan;
+        error_code = frame_plan_block(params, &shared, block_dict, read, &plan);
+        if (error_code) break;
+
+        /* Only the size of a tANS payload is not known from its plan. */
+        if (plan.type == FRAME_BLOCK_ANS) {
+            frame_encode_block(params, &plan, symbols, read,
+                buffer + 2 * params->block_size);
+        }
+
+        estimate->raw_size += read;
+        estimate->header_size += plan.header_size + FRAME_INDEX_ENTRY_SIZE;
+        estimate->payload_size += plan.payload_size;
+        frame_block_plan_free(&plan);
+
+        pending = available - read;
+        memmove(buffer, buffer + read, pending);
+    }
+
+    free(buffer);
+    if (block_dict) freq_dict_free(block_dict);
+    if (spare_dict) freq_dict_free(spare_dict);
+    if (front_dict) freq_dict_free(front_dict);
+    if (all_dict) freq_dict_free(all_dict);
+    frame_shared_code_free(&shared);
+
+    if (!error_code && io_seek(in_stream, 0, SEEK_SET)) {
+        errno = ERR_IO_ERROR;
+        error_code = 1;
+    }
+
+    _huf_estimate_finish(estimate);
+    return error_code;
+}
+
+int huf_estimate_sampled(const struct frame_params* params, FILE* in_stream,
+        struct huf_size_estimate* estimate) {
+    int64_t size = io_stream_size(in_stream);
+    if (size < 0) {
+        errno = ERR_IO_ERROR;
+        return 1;
+    }
+
+    int exact = 0;
+    struct freq_dict* sample = frame_create_dict(params);
+    if (!sample) return 1;
+    struct freq_dict_filter filter = { transform_filter, &params->transform };
+    if (freq_dict_add_stream_sampled(sample, in_stream, &params->sampling,
+            params->transform.type != TRANSFORM_NONE ? &filter : NULL, &exact)) {
+        freq_dict_free(sample);
+        return 1;
+    }
+
+    /* A sample covering the whole stream is cheap enough to plan exactly. */
+    if (exact || freq_dict_total(sample) == 0) {
+        freq_dict_free(sample);
+
+        struct frame_params exact_params = *params;
+        exact_params.sampled = 0;
+
+        return huf_estimate_stream(&exact_params, in_stream, estimate);
+    }
+
+    /* The sample is coded with the shared code compression would build
+     * from it, whose cost per symbol is extrapolated to the whole stream. */
+    struct frame_shared_code shared = { NULL, NULL, NULL, NULL };
+    double bits_per_byte;
+    if (params->wide) {
+        shared.code = frame_create_code(params, sample);
+        bits_per_byte = shared.code
+            ? (double)canonical_code_encoded_bits(shared.code, sample->frequencies)
+                / (double)(2 * freq_dict_total(sample))
+            : 0;
+    } else {
+        shared.tree = frame_create_tree(params, sample);
+        if (shared.tree) shared.mapping = mapping_dict_create_mapping(shared.tree);
+        bits_per_byte = shared.mapping
+            ? (double)mapping_dict_encoded_bits(shared.mapping, sample)
+                / (double)freq_dict_total(sample)
+            : 0;
+    }
+    freq_dict_free(sample);
+    if (!shared.code && !shared.mapping) {
+        frame_shared_code_free(&shared);
+        return 1;
+    }
+
+    uint64_t block_count = ((uint64_t)size + params->block_size - 1)
+        / params->block_size;
+    size_t block_header_size = FRAME_BLOCK_HEADER_SIZE
+        + (params->checksum ? CRC32C_SIZE : 0)
+        + (params->transform.type != TRANSFORM_NONE ? FRAME_TRANSFORM_SIZE : 0);
+
+    memset(estimate, 0, sizeof(struct huf_size_estimate));
+    estimate->raw_size = (uint64_t)size;
+    estimate->header_size = frame_header_size(&shared)
+        + block_count * block_header_size
+        + frame_index_footer_size(block_count);
+    estimate->payload_size = (uint64_t)((double)size * bits_per_byte / 8)
+        + block_count;
+    if (estimate->payload_size > estimate->raw_size) {
+        estimate->payload_size = estimate->raw_size;
+    }
+    _huf_estimate_finish(estimate);
+
+    frame_shared_code_free(&shared);
+
+    return 0;
+}
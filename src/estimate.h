@@ -0,0 +1,81 @@
+#ifndef ESTIMATE_H
+#define ESTIMATE_H
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "error.h"
+#include "frequency_dict.h"
+#include "huffman_tree.h"
+#include "mapping_dict.h"
+#include "frame.h"
+
+
+/**
+ * @brief The size a stream takes up once it is compressed.
+ */
+struct huf_size_estimate {
+    /** Number of bytes of the uncompressed input. */
+    uint64_t raw_size;
+    /** Number of bytes of frame headers, block headers and trees. */
+    uint64_t header_size;
+    /** Number of bytes of the encoded block contents. */
+    uint64_t payload_size;
+    /** Number of bytes of the whole compressed output. */
+    uint64_t total_size;
+    /** Non-zero if the sizes are exact, zero if they are extrapolated. */
+    int exact;
+};
+
+
+/**
+ * @brief Computes the size of the bytes or words counted in a histogram
+ * when they are compressed into a frame of a single block, planned as
+ * compression plans its blocks. This is exact for inputs of up to one
+ * block that are neither coded with tANS nor transformed, and an
+ * approximation otherwise, which may be too high or too low.
+ *
+ * @param params the parameters compression would use.
+ * @param histogram the frequencies of the input, counted by a dict of
+ * frame_create_dict().
+ * @param estimate the estimate to be filled.
+ * @return int non-zero if an error occurred, zero otherwise.
+ */
+int huf_estimate(const struct frame_params* params,
+    struct freq_dict* histogram, struct huf_size_estimate* estimate);
+
+/**
+ * @brief Computes the exact size frame_compress_stream() produces for a
+ * stream, without encoding any of it. Every block is planned just like
+ * during compression, so this costs one frequency analysis per block but
+ * no bit packing and no output.
+ *
+ * @param params the parameters compression would use.
+ * @param in_stream the seekable stream to be analyzed. It is rewound
+ * afterwards.
+ * @param estimate the estimate to be filled.
+ * @return int non-zero if an error occurred, zero otherwise.
+ */
+int huf_estimate_stream(const struct frame_params* params, FILE* in_stream,
+    struct huf_size_estimate* estimate);
+
+/**
+ * @brief Approximates the compressed size of a stream from a sample of it.
+ * The average code length of the sampled symbols is extrapolated to the
+ * size of the whole stream, assuming every block is encoded with the same
+ * code.
+ *
+ * @param params the parameters compression would use, whose sampling
+ * selects the parts of <in_stream> that are analyzed.
+ * @param in_stream the seekable stream to be analyzed. It is rewound
+ * afterwards.
+ * @param estimate the estimate to be filled.
+ * @return int non-zero if an error occurred, zero otherwise.
+ */
+int huf_estimate_sampled(const struct frame_params* params, FILE* in_stream,
+    struct huf_size_estimate* estimate);
+
+
+#endif
@@ -0,0 +1,1251 @@
+#include "frame.h"
+#include "frame_index.h"
+#include "trace.h"
+#include "scheduler.h"
+#include "table_cache.h"
+
+#include <string.h>
+
+
+void frame_params_init(struct frame_params* params) {
+    params->block_size = FRAME_DEFAULT_BLOCK_SIZE;
+    params->sampled = 0;
+    params->sampling.head_size = FREQ_DICT_SAMPLING_HEAD_SIZE;
+    params->sampling.probe_size = FREQ_DICT_SAMPLING_PROBE_SIZE;
+    params->sampling.probe_count = FREQ_DICT_SAMPLING_PROBE_COUNT;
+    params->sampling.random = 0;
+    params->divergence = FRAME_DEFAULT_DIVERGENCE;
+    params->io_backend = ASYNC_IO_AUTO;
+    params->checksum = 1;
+    params->wide = 0;
+    params->transform.type = TRANSFORM_NONE;
+    params->transform.parameter = 0;
+    params->split_size = 0;
+    params->max_code_length = 0;
+    params->ans = 1;
+    params->thread_count = 1;
+    params->memory_limit = 0;
+    params->cpus = NULL;
+    params->cpu_count = 0;
+    params->table_cache = NULL;
+}
+
+int frame_params_set_level(struct frame_params* params, int level) {
+    /* Sampling, divergence, code length limit and split step per level. */
+    static const struct {
+        int sampled;
+        double divergence;
+        int max_code_length;
+        size_t split_size;
+    } levels[FRAME_MAX_LEVEL] = {
+        { 1, 1e9, 11, 0 },
+        { 1, 0.25, 12, 0 },
+        { 1, 0.10, 0, 0 },
+        { 0, 0.10, 0, 0 },
+        { 0, FRAME_DEFAULT_DIVERGENCE, 0, 0 },
+        { 0, FRAME_DEFAULT_DIVERGENCE, 0, 64u << 10 },
+        { 0, 0.02, 0, FRAME_DEFAULT_SPLIT_SIZE },
+        { 0, 0.01, 0, 8u << 10 },
+        { 0, 0, 0, 4u << 10 },
+    };
+
+    if (level < FRAME_MIN_LEVEL || level > FRAME_MAX_LEVEL) {
+        errno = ERR_ILLEGAL_ARG;
+        return 1;
+    }
+
+    params->sampled = levels[level - 1].sampled;
+    params->divergence = levels[level - 1].divergence;
+    params->max_code_length = levels[level - 1].max_code_length;
+    params->split_size = levels[level - 1].split_size;
+    if (level == FRAME_MAX_LEVEL && params->transform.type == TRANSFORM_NONE) {
+        params->transform.type = TRANSFORM_DELTA;
+        params->transform.parameter = 1;
+    }
+
+    return 0;
+}
+
+int frame_params_set_compact(struct frame_params* params) {
+    if (params->wide) {
+        errno = ERR_ILLEGAL_ARG;
+        return 1;
+    }
+
+    params->ans = 0;
+    params->transform.type = TRANSFORM_NONE;
+    params->transform.parameter = 0;
+
+    return 0;
+}
+
+struct freq_dict* frame_create_dict(const struct frame_params* params) {
+    return params->wide
+        ? freq_dict_create_wide(params->wide == FRAME_WIDE_BIG_ENDIAN)
+        : freq_dict_create();
+}
+
+struct huffman_tree* frame_create_tree(const struct frame_params* params,
+        struct freq_dict* dict) {
+    return params->max_code_length
+        ? huffman_tree_create_from_freq_dict_limited(dict, params->max_code_length)
+        : huffman_tree_create_from_freq_dict(dict);
+}
+
+struct canonical_code* frame_create_code(const struct frame_params* params,
+        struct freq_dict* dict) {
+    /* Every word needs a code, so no limit can be below 16 bits. */
+    int max_length = params->max_code_length;
+    if (max_length == 0 || max_length > CANONICAL_CODE_MAX_LENGTH) {
+        max_length = CANONICAL_CODE_MAX_LENGTH;
+    }
+    if (max_length < 16) max_length = 16;
+
+    return canonical_code_create_from_frequencies(dict->frequencies,
+        dict->alphabet_size, max_length);
+}
+
+
+const uint8_t* frame_analyze_block(const struct frame_params* params,
+        const uint8_t* block, size_t size, uint8_t* transformed,
+        struct freq_dict** block_dict, struct freq_dict** spare_dict,
+        struct transform* transform) {
+    transform->type = TRANSFORM_NONE;
+    transform->parameter = 0;
+
+    freq_dict_clear(*block_dict);
+    freq_dict_add_buffer(*block_dict, block, size);
+    if (params->transform.type == TRANSFORM_NONE) return block;
+
+    transform_encode(&params->transform, block, size, transformed);
+    freq_dict_clear(*spare_dict);
+    freq_dict_add_buffer(*spare_dict, transformed, size);
+
+    if (freq_dict_entropy_bits(*spare_dict) >= freq_dict_entropy_bits(*block_dict)) {
+        return block;
+    }
+
+    struct freq_dict* swap = *block_dict;
+    *block_dict = *spare_dict;
+    *spare_dict = swap;
+    *transform = params->transform;
+
+    return transformed;
+}
+
+
+/* Estimates the bits a part of a block is coded in: with the shared tree,
+ * a tree of its own or stored, whichever is the smallest. */
+double _frame_part_bits(const struct frame_shared_code* shared,
+        struct freq_dict* dict, uint64_t size) {
+    size_t symbol_count = 0;
+    for (size_t i = 0; i < FREQ_DICT_BYTE_ALPHABET; i++) {
+        symbol_count += dict->frequencies[i] != 0;
+    }
+
+    double bits = freq_dict_entropy_bits(dict) + 8.0 * (1 + 4 * symbol_count);
+    uint64_t shared_bits = shared->mapping
+        ? mapping_dict_encoded_bits(shared->mapping, dict) : UINT64_MAX;
+    if (shared_bits != UINT64_MAX && (double)shared_bits < bits) {
+        bits = (double)shared_bits;
+    }
+
+    return bits < 8.0 * (double)size ? bits : 8.0 * (double)size;
+}
+
+size_t frame_split_block(const struct frame_params* params,
+        const struct frame_shared_code* shared, const uint8_t* buffer,
+        size_t size, struct freq_dict* front, struct freq_dict* all) {
+    size_t step = params->split_size;
+    if (step == 0 || params->wide || size < 2 * step) return size;
+
+    freq_dict_clear(front);
+    freq_dict_clear(all);
+    freq_dict_add_buffer(all, buffer, size);
+
+    uint64_t back_frequencies[FREQ_DICT_BYTE_ALPHABET];
+    struct freq_dict back = { back_frequencies, FREQ_DICT_BYTE_ALPHABET, 0 };
+
+    /* Another block costs its header and an entry in the index. */
+    double best_bits = _frame_part_bits(shared, all, size)
+        - 8.0 * (FRAME_BLOCK_HEADER_SIZE + FRAME_INDEX_ENTRY_SIZE
+            + (params->checksum ? CRC32C_SIZE : 0));
+    size_t best = size;
+    for (size_t end = step; end + step <= size; end += step) {
+        freq_dict_add_buffer(front, buffer + end - step, step);
+        for (size_t i = 0; i < FREQ_DICT_BYTE_ALPHABET; i++) {
+            back_frequencies[i] = all->frequencies[i] - front->frequencies[i];
+        }
+
+        double bits = _frame_part_bits(shared, front, end)
+            + _frame_part_bits(shared, &back, size - end);
+        if (bits < best_bits) {
+            best_bits = bits;
+            best = end;
+        }
+    }
+
+    return best;
+}
+
+/* Returns the payload size of a block of words encoded with a canonical
+ * code, or UINT64_MAX if the code cannot encode it. */
+uint64_t _frame_wide_payload_size(struct canonical_code* code,
+        struct freq_dict* block_dict, uint64_t raw_size) {
+    uint64_t bits = code
+        ? canonical_code_encoded_bits(code, block_dict->frequencies) : UINT64_MAX;
+
+    return bits == UINT64_MAX ? UINT64_MAX : (bits + 7) / 8 + (raw_size & 1);
+}
+
+int _frame_plan_wide_block(const struct frame_params* params,
+        const struct frame_shared_code* shared, struct freq_dict* block_dict,
+        uint64_t raw_size, struct frame_block_plan* plan) {
+    uint64_t shared_size = _frame_wide_payload_size(shared->code,
+        block_dict, raw_size);
+
+    if (shared_size != UINT64_MAX) {
+        plan->type = FRAME_BLOCK_SHARED_TREE;
+        plan->payload_size = shared_size;
+        plan->code = shared->code;
+    }
+
+    double bound = freq_dict_entropy_bits(block_dict);
+    if (shared_size == UINT64_MAX
+            || (double)(shared_size * 8) > bound * (1 + params->divergence)) {
+        struct canonical_code* code = frame_create_code(params, block_dict);
+        if (!code) return 1;
+
+        uint64_t own_size = _frame_wide_payload_size(code, block_dict, raw_size);
+        size_t own_header_size = FRAME_BLOCK_HEADER_SIZE
+            + canonical_code_serialized_size(code);
+
+        if (own_size + own_header_size < plan->payload_size + plan->header_size) {
+            plan->type = FRAME_BLOCK_OWN_TREE;
+            plan->payload_size = own_size;
+            plan->header_size = own_header_size;
+            plan->code = code;
+        } else {
+            canonical_code_free(code);
+        }
+    }
+
+    return 0;
+}
+
+/* Plans a block for tANS if that beats the plan so far. The payload size is
+ * an estimate, which frame_encode_block() replaces by the actual size. */
+int _frame_plan_ans_block(struct freq_dict* block_dict, double bound,
+        struct frame_block_plan* plan) {
+    /* No code gets below the entropy, nor does a table cost less than one
+     * count per byte up to the highest byte that occurs. */
+    int last_symbol = FREQ_DICT_BYTE_ALPHABET - 1;
+    while (last_symbol > 0 && !block_dict->frequencies[last_symbol]) last_symbol--;
+    if (bound / 8 + ANS_CODE_HEADER_SIZE + 2 * (last_symbol + 1)
+            >= (double)(plan->payload_size + plan->header_size)) {
+        return 0;
+    }
+
+    struct ans_code* ans = ans_code_create_from_frequencies(block_dict->frequencies);
+    if (!ans) return 1;
+
+    uint64_t ans_size = (ans_code_encoded_bits(ans, block_dict->frequencies) + 7) / 8;
+    size_t ans_header_size = FRAME_BLOCK_HEADER_SIZE + ans_code_serialized_size(ans);
+    if (ans_size + ans_header_size >= plan->payload_size + plan->header_size) {
+        ans_code_free(ans);
+        return 0;
+    }
+
+    frame_block_plan_free(plan);
+    plan->type = FRAME_BLOCK_ANS;
+    plan->payload_size = ans_size;
+    plan->header_size = ans_header_size;
+    plan->ans = ans;
+
+    return 0;
+}
+
+int _frame_plan_byte_block(const struct frame_params* params,
+        const struct frame_shared_code* shared, struct freq_dict* block_dict,
+        struct frame_block_plan* plan) {
+    uint64_t shared_bits = shared->mapping
+        ? mapping_dict_encoded_bits(shared->mapping, block_dict) : UINT64_MAX;
+
+    if (shared_bits != UINT64_MAX) {
+        plan->type = FRAME_BLOCK_SHARED_TREE;
+        plan->payload_size = (shared_bits + 7) / 8;
+        plan->mapping = shared->mapping;
+    }
+
+    /* Building a tree for every block is only worth it if the shared tree
+     * is noticeably worse than the best any tree could do on this block. */
+    double bound = freq_dict_entropy_bits(block_dict);
+    if (shared_bits == UINT64_MAX
+            || (double)shared_bits > bound * (1 + params->divergence)) {
+        /* Nor does a tree of its own pay off if its size alone, four bytes
+         * per byte that occurs, eats up what it could save, which is the
+         * common case for small blocks. */
+        size_t symbol_count = 0;
+        for (size_t i = 0; i < FREQ_DICT_BYTE_ALPHABET; i++) {
+            symbol_count += block_dict->frequencies[i] != 0;
+        }
+        if (bound / 8 + FRAME_BLOCK_HEADER_SIZE + 1 + 4 * (double)symbol_count
+                >= (double)(plan->payload_size + plan->header_size)) {
+            return params->ans ? _frame_plan_ans_block(block_dict, bound, plan) : 0;
+        }
+
+        struct huffman_tree* tree = frame_create_tree(params, block_dict);
+        if (!tree) return 1;
+
+        struct mapping_dict* mapping = mapping_dict_create_mapping(tree);
+        if (!mapping) {
+            huffman_tree_free(tree);
+            return 1;
+        }
+
+        uint64_t own_size = (mapping_dict_encoded_bits(mapping, block_dict) + 7) / 8;
+        size_t own_header_size = FRAME_BLOCK_HEADER_SIZE
+            + huffman_tree_serialized_size(tree);
+
+        if (own_size + own_header_size < plan->payload_size + plan->header_size) {
+            plan->type = FRAME_BLOCK_OWN_TREE;
+            plan->payload_size = own_size;
+            plan->header_size = own_header_size;
+            plan->tree = tree;
+            plan->mapping = mapping;
+        } else {
+            mapping_dict_free(mapping);
+            huffman_tree_free(tree);
+        }
+
+        if (params->ans) return _frame_plan_ans_block(block_dict, bound, plan);
+    }
+
+    return 0;
+}
+
+int frame_plan_block(const struct frame_params* params,
+        const struct frame_shared_code* shared, struct freq_dict* block_dict,
+        uint64_t raw_size, struct frame_block_plan* plan) {
+    memset(plan, 0, sizeof(struct frame_block_plan));
+    plan->type = FRAME_BLOCK_STORED;
+    plan->payload_size = raw_size;
+    plan->header_size = FRAME_BLOCK_HEADER_SIZE;
+
+    /* A block of words needs at least one word to be coded. */
+    int error_code = params->wide
+        ? raw_size > 1 && _frame_plan_wide_block(params, shared, block_dict,
+            raw_size, plan)
+        : _frame_plan_byte_block(params, shared, block_dict, plan);
+    if (error_code) return 1;
+
+    if (plan->type != FRAME_BLOCK_STORED && plan->payload_size >= raw_size) {
+        frame_block_plan_free(plan);
+        plan->type = FRAME_BLOCK_STORED;
+        plan->payload_size = raw_size;
+        plan->header_size = FRAME_BLOCK_HEADER_SIZE;
+    }
+    if (params->checksum) plan->header_size += CRC32C_SIZE;
+    if (params->transform.type != TRANSFORM_NONE) {
+        plan->header_size += FRAME_TRANSFORM_SIZE;
+    }
+
+    return 0;
+}
+
+void frame_block_plan_free(struct frame_block_plan* plan) {
+    if (plan->tree) {
+        mapping_dict_free(plan->mapping);
+        huffman_tree_free(plan->tree);
+    }
+    if (plan->type == FRAME_BLOCK_OWN_TREE && plan->code) {
+        canonical_code_free(plan->code);
+    }
+    if (plan->ans) ans_code_free(plan->ans);
+    plan->tree = NULL;
+    plan->mapping = NULL;
+    plan->code = NULL;
+    plan->ans = NULL;
+}
+
+const uint8_t* frame_encode_block(const struct frame_params* params,
+        struct frame_block_plan* plan, const uint8_t* in_buffer, size_t in_size,
+        uint8_t* out_buffer) {
+    if (plan->type == FRAME_BLOCK_ANS) {
+        size_t size = ans_code_encode_buffer(plan->ans, in_buffer, in_size,
+            out_buffer, in_size + ANS_CODE_SLACK);
+        if (size > 0 && size < in_size) {
+            plan->payload_size = size;
+            return out_buffer;
+        }
+
+        plan->header_size -= ans_code_serialized_size(plan->ans);
+        frame_block_plan_free(plan);
+        plan->type = FRAME_BLOCK_STORED;
+        plan->payload_size = in_size;
+    }
+
+    if (plan->type == FRAME_BLOCK_STORED) return in_buffer;
+
+    if (params->wide) {
+        canonical_code_encode_words(plan->code, in_buffer, in_size,
+            params->wide == FRAME_WIDE_BIG_ENDIAN, out_buffer);
+    } else {
+        /* The table of a shared tree is built with it. Failing to build
+         * one only makes the block slower to encode. */
+        if (plan->type == FRAME_BLOCK_OWN_TREE && !plan->mapping->pairs
+                && in_size >= MAPPING_DICT_PAIR_MIN_SIZE) {
+            mapping_dict_create_pairs(plan->mapping);
+        }
+        mapping_dict_encode_buffer(plan->mapping, in_buffer, in_size, out_buffer);
+    }
+
+    return out_buffer;
+}
+
+
+int frame_is_framed(FILE* stream) {
+    int64_t position = io_tell(stream);
+    if (position < 0) return 0;
+
+    uint8_t magic[FRAME_MAGIC_SIZE];
+    size_t read = fread(magic, 1, FRAME_MAGIC_SIZE, stream);
+    io_seek(stream, position, SEEK_SET);
+
+    return read == FRAME_MAGIC_SIZE
+        && !memcmp(magic, FRAME_MAGIC, FRAME_MAGIC_SIZE);
+}
+
+
+size_t frame_read_fully(FILE* stream, uint8_t* buffer, size_t size) {
+    size_t total = 0;
+    while (total < size) {
+        size_t read = fread(buffer + total, 1, size - total, stream);
+        if (read == 0) break;
+        total += read;
+    }
+
+    return total;
+}
+
+int _frame_flags(const struct frame_params* params,
+        const struct frame_shared_code* shared) {
+    return (shared->tree || shared->code ? FRAME_FLAG_SHARED_TREE : 0)
+        | (params->checksum ? FRAME_FLAG_CHECKSUM : 0)
+        | (params->wide ? FRAME_FLAG_WIDE : 0)
+        | (params->wide == FRAME_WIDE_BIG_ENDIAN ? FRAME_FLAG_BIG_ENDIAN : 0)
+        | (params->transform.type != TRANSFORM_NONE ? FRAME_FLAG_TRANSFORM : 0);
+}
+
+int _frame_write_header(struct async_writer* writer,
+        const struct frame_shared_code* shared, int flags) {
+    size_t header_size = frame_header_size(shared);
+    uint8_t* header = malloc(header_size);
+    if (!header) {
+        errno = ERR_MEM_ERROR;
+        return 1;
+    }
+
+    memcpy(header, FRAME_MAGIC, FRAME_MAGIC_SIZE);
+    header[FRAME_MAGIC_SIZE] = (uint8_t)flags;
+    if (shared->tree) {
+        huffman_tree_write_to_buffer(shared->tree, header + FRAME_MAGIC_SIZE + 1);
+    } else if (shared->code) {
+        canonical_code_write_to_buffer(shared->code, header + FRAME_MAGIC_SIZE + 1);
+    }
+
+    int error_code = async_writer_write(writer, header, header_size);
+    free(header);
+
+    return error_code;
+}
+
+void frame_put_block_header(const struct frame_block_plan* plan,
+        size_t raw_size, const uint32_t* checksum,
+        const struct transform* transform, uint8_t* header) {
+    size_t tree_offset = FRAME_BLOCK_HEADER_SIZE;
+
+    header[0] = (uint8_t)plan->type;
+    io_put_u32(header + 1, (uint32_t)raw_size);
+    io_put_u32(header + 5, (uint32_t)plan->payload_size);
+    if (checksum) {
+        io_put_u32(header + tree_offset, *checksum);
+        tree_offset += CRC32C_SIZE;
+    }
+    if (transform) {
+        header[tree_offset] = (uint8_t)transform->type;
+        header[tree_offset + 1] = (uint8_t)transform->parameter;
+        tree_offset += FRAME_TRANSFORM_SIZE;
+    }
+    if (plan->tree) {
+        huffman_tree_write_to_buffer(plan->tree, header + tree_offset);
+    } else if (plan->type == FRAME_BLOCK_OWN_TREE) {
+        canonical_code_write_to_buffer(plan->code, header + tree_offset);
+    } else if (plan->type == FRAME_BLOCK_ANS) {
+        ans_code_write_to_buffer(plan->ans, header + tree_offset);
+    }
+}
+
+int _frame_write_block(const struct frame_params* params,
+        struct async_writer* writer, struct frame_block_plan* plan,
+        const uint32_t* checksum, const struct transform* transform,
+        const uint8_t* in_buffer, size_t in_size,
+        uint8_t* header, uint8_t* out_buffer) {
+    TRACE_BEGIN(encode_start);
+    const uint8_t* payload = frame_encode_block(params, plan, in_buffer, in_size,
+        out_buffer);
+    frame_put_block_header(plan, in_size, checksum, transform, header);
+    TRACE_END(encode_start, "encode", in_size);
+
+    TRACE_BEGIN(write_start);
+    int error_code = async_writer_write(writer, header, plan->header_size)
+        || async_writer_write(writer, payload, plan->payload_size);
+    TRACE_END(write_start, "write", plan->header_size + plan->payload_size);
+
+    return error_code;
+}
+
+int frame_compress_blocks(const struct frame_params* params,
+        const struct frame_shared_code* shared, struct async_reader* reader,
+        struct async_writer* writer, struct frame_index* index,
+        uint32_t* checksum) {
+    if (params->thread_count != 1) {
+        return scheduler_compress_blocks(params, shared, reader, writer, index,
+            checksum);
+    }
+
+    int transformed = params->transform.type != TRANSFORM_NONE;
+    int split = params->split_size && !params->wide;
+    struct freq_dict* block_dict = frame_create_dict(params);
+    struct freq_dict* spare_dict = frame_create_dict(params);
+    struct freq_dict* front_dict = split ? freq_dict_create() : NULL;
+    struct freq_dict* all_dict = split ? freq_dict_create() : NULL;
+
+    /* The encoded size of a block is only known once it has been planned.
+     * Blocks that do not compress are stored, so the output of a block
+     * never exceeds its input. */
+    uint8_t* in_buffer = malloc((transformed ? 3 : 2) * params->block_size
+        + ANS_CODE_SLACK);
+    uint8_t* transform_buffer = in_buffer + params->block_size;
+    uint8_t* out_buffer = transform_buffer
+        + (transformed ? params->block_size : 0);
+    uint8_t* header = malloc(FRAME_BLOCK_HEADER_SIZE + CRC32C_SIZE
+        + FRAME_TRANSFORM_SIZE
+        + (params->wide ? FRAME_MAX_CODE_SIZE : FRAME_MAX_TREE_SIZE));
+    int error_code = !block_dict || !spare_dict || !in_buffer || !header
+        || (split && (!front_dict || !all_dict));
+    if (error_code) errno = ERR_MEM_ERROR;
+
+    /* Bytes behind the end of a block that was split are kept for the
+     * next block. */
+    size_t pending = 0;
+    while (!error_code) {
+        TRACE_BEGIN(read_start);
+        size_t available = pending + async_reader_read(reader,
+            in_buffer + pending, params->block_size - pending);
+        TRACE_END(read_start, "read", available - pending);
+        if (available == pending && async_reader_error(reader)) {
+            errno = ERR_IO_ERROR;
+            error_code = 1;
+            break;
+        }
+        if (available == 0) break;
+
+        TRACE_BEGIN(histogram_start);
+        size_t read = split ? frame_split_block(params, shared, in_buffer,
+            available, front_dict, all_dict) : available;
+
+        struct transform transform;
+        const uint8_t* symbols = frame_analyze_block(params, in_buffer, read,
+            transform_buffer, &block_dict, &spare_dict, &transform);
+        TRACE_END(histogram_start, "histogram", read);
+
+        TRACE_BEGIN(tree_start);
+        struct frame_block_plan plan;
+        error_code = frame_plan_block(params, shared, block_dict, read, &plan);
+        TRACE_END(tree_start, "tree build", read);
+        if (error_code) break;
+
+        uint32_t block_checksum = 0;
+        if (params->checksum) {
+            block_checksum = crc32c_update(0, in_buffer, read);
+            *checksum = crc32c_combine(*checksum, block_checksum, read);
+        }
+
+        error_code = (index && frame_index_add_block(index,
+                async_writer_position(writer), (uint32_t)read))
+            || _frame_write_block(params, writer, &plan,
+                params->checksum ? &block_checksum : NULL,
+                transformed ? &transform : NULL,
+                symbols, read, header, out_buffer);
+        frame_block_plan_free(&plan);
+
+        pending = available - read;
+        memmove(in_buffer, in_buffer + read, pending);
+    }
+
+    free(header);
+    free(in_buffer);
+    if (block_dict) freq_dict_free(block_dict);
+    if (spare_dict) freq_dict_free(spare_dict);
+    if (front_dict) freq_dict_free(front_dict);
+    if (all_dict) freq_dict_free(all_dict);
+
+    return error_code;
+}
+
+int frame_create_shared_code_from_dict(const struct frame_params* params,
+        struct freq_dict* dict, struct frame_shared_code* shared) {
+    memset(shared, 0, sizeof(struct frame_shared_code));
+    if (freq_dict_total(dict) == 0) return 0;
+
+    int error_code;
+    if (params->wide) {
+        shared->code = frame_create_code(params, dict);
+        error_code = !shared->code;
+
+        /* A table of words can be as large as a block. It is only stored if
+         * it saves more than its own size on the analyzed words, which are
+         * all of the input or a sample of it. */
+        uint64_t raw_bits = 16 * freq_dict_total(dict);
+        if (shared->code && canonical_code_encoded_bits(shared->code,
+                dict->frequencies) + 8 * canonical_code_serialized_size(
+                    shared->code) >= raw_bits) {
+            canonical_code_free(shared->code);
+            shared->code = NULL;
+        }
+    } else if (params->table_cache) {
+        error_code = table_cache_get(params->table_cache, params, dict,
+            &shared->tree, &shared->mapping);
+        if (!error_code) shared->cache = params->table_cache;
+    } else {
+        shared->tree = frame_create_tree(params, dict);
+        if (shared->tree) shared->mapping = mapping_dict_create_mapping(shared->tree);
+        error_code = !shared->mapping
+            || (freq_dict_total(dict) >= MAPPING_DICT_PAIR_MIN_SIZE
+                && mapping_dict_create_pairs(shared->mapping));
+    }
+
+    if (error_code) frame_shared_code_free(shared);
+
+    return error_code;
+}
+
+int frame_create_shared_code(const struct frame_params* params,
+        FILE* in_stream, struct frame_shared_code* shared) {
+    memset(shared, 0, sizeof(struct frame_shared_code));
+
+    struct freq_dict* dict = frame_create_dict(params);
+    if (!dict) return 1;
+
+    /* The blocks the transform helps dominate the shared code. */
+    struct freq_dict_filter filter = { transform_filter, &params->transform };
+    const struct freq_dict_filter* used_filter
+        = params->transform.type != TRANSFORM_NONE ? &filter : NULL;
+
+    int error_code = params->sampled
+        ? freq_dict_add_stream_sampled(dict, in_stream, &params->sampling,
+            used_filter, NULL)
+        : freq_dict_add_stream(dict, in_stream, used_filter);
+
+    if (!error_code) {
+        error_code = frame_create_shared_code_from_dict(params, dict, shared);
+    }
+    freq_dict_free(dict);
+
+    return error_code;
+}
+
+void frame_shared_code_free(struct frame_shared_code* shared) {
+    if (shared->cache) {
+        table_cache_release(shared->cache, shared->tree, shared->mapping);
+    } else {
+        if (shared->mapping) mapping_dict_free(shared->mapping);
+        if (shared->tree) huffman_tree_free(shared->tree);
+    }
+    if (shared->code) canonical_code_free(shared->code);
+    memset(shared, 0, sizeof(struct frame_shared_code));
+}
+
+size_t frame_header_size(const struct frame_shared_code* shared) {
+    size_t size = FRAME_MAGIC_SIZE + 1;
+    if (shared->tree) size += huffman_tree_serialized_size(shared->tree);
+    if (shared->code) size += canonical_code_serialized_size(shared->code);
+
+    return size;
+}
+
+int _frame_check_params(const struct frame_params* params) {
+    if (params->block_size == 0 || params->block_size > FRAME_MAX_BLOCK_SIZE
+            || (params->wide && (params->block_size & 1))) {
+        errno = ERR_ILLEGAL_ARG;
+        return 1;
+    }
+
+    return 0;
+}
+
+/* Writes the rest of <in_stream> as a frame at the current position of
+ * <out_stream>. <index> holds the frames in front of it, if any, with
+ * offsets relative to that position. */
+int _frame_write_frame(const struct frame_params* params,
+        FILE* in_stream, FILE* out_stream, struct frame_index* index) {
+    struct frame_shared_code shared;
+    if (frame_create_shared_code(params, in_stream, &shared)) return 1;
+
+    /* Reading the next blocks and writing the previous ones overlaps
+     * with encoding the current block. */
+    struct async_reader* reader = async_reader_create(in_stream,
+        params->io_backend, ASYNC_IO_DEFAULT_CHUNK_SIZE, ASYNC_IO_DEFAULT_DEPTH);
+    struct async_writer* writer = async_writer_create(out_stream,
+        params->io_backend, ASYNC_IO_DEFAULT_CHUNK_SIZE, ASYNC_IO_DEFAULT_DEPTH);
+
+    uint32_t checksum = 0;
+
+    int error_code = !reader || !writer
+        || frame_index_add_frame(index, 0)
+        || _frame_write_header(writer, &shared, _frame_flags(params, &shared))
+        || frame_compress_blocks(params, &shared, reader, writer,
+            index, &checksum)
+        || frame_index_write(index, writer, checksum)
+        || async_writer_finish(writer);
+
+    if (writer) async_writer_free(writer);
+    if (reader) async_reader_free(reader);
+    frame_shared_code_free(&shared);
+
+    return error_code;
+}
+
+int frame_compress_stream(const struct frame_params* params,
+        FILE* in_stream, FILE* out_stream) {
+    if (_frame_check_params(params)) return 1;
+
+    struct frame_index* index = frame_index_create();
+    if (!index) return 1;
+
+    int error_code = _frame_write_frame(params, in_stream, out_stream, index);
+    frame_index_free(index);
+
+    return error_code;
+}
+
+/* Checks that the last block of an index decodes to the bytes of <stream>
+ * at the same offset, as far as its checksum tells. */
+int _frame_check_last_block(struct frame_index* index, FILE* out_stream,
+        FILE* in_stream) {
+    if (index->entry_count == 0) return 0;
+
+    struct frame_index_entry* entry = &index->entries[index->entry_count - 1];
+    if (!(index->frames[entry->frame].flags & FRAME_FLAG_CHECKSUM)) return 0;
+
+    uint8_t expected[CRC32C_SIZE];
+    uint8_t* buffer = malloc(entry->raw_size ? entry->raw_size : 1);
+    if (!buffer) {
+        errno = ERR_MEM_ERROR;
+        return 1;
+    }
+
+    int error_code = io_read_at(out_stream, expected, CRC32C_SIZE,
+            entry->offset + FRAME_BLOCK_HEADER_SIZE) != CRC32C_SIZE
+        || io_read_at(in_stream, buffer, entry->raw_size,
+            (int64_t)entry->raw_offset) != entry->raw_size;
+    if (error_code) {
+        errno = ERR_IO_ERROR;
+    } else if (crc32c_update(0, buffer, entry->raw_size) != io_get_u32(expected)) {
+        errno = ERR_CHECKSUM_ERROR;
+        error_code = 1;
+    }
+    free(buffer);
+
+    return error_code;
+}
+
+int frame_append_stream(const struct frame_params* params, FILE* in_stream,
+        FILE* out_stream, uint64_t* appended) {
+    *appended = 0;
+    if (_frame_check_params(params)) return 1;
+
+    int64_t in_size = io_stream_size(in_stream);
+    if (in_size < 0) {
+        errno = ERR_IO_ERROR;
+        return 1;
+    }
+
+    /* The new frame replaces a frame an earlier append left cut short. */
+    struct frame_index* index = frame_index_load_prefix(out_stream);
+    if (!index) return 1;
+    int64_t out_size = index->size;
+
+    int error_code = 0;
+    if (index->raw_size > (uint64_t)in_size) {
+        errno = ERR_ILLEGAL_ARG;
+        error_code = 1;
+    }
+    error_code = error_code
+        || _frame_check_last_block(index, out_stream, in_stream);
+    if (!error_code && io_stream_size(out_stream) > out_size
+            && io_truncate(out_stream, out_size)) {
+        errno = ERR_IO_ERROR;
+        error_code = 1;
+    }
+
+    if (!error_code && index->raw_size < (uint64_t)in_size) {
+        /* The offsets of the old frames become negative, relative to the
+         * new frame, which is all the index written after it needs. */
+        for (size_t i = 0; i < index->frame_count; i++) {
+            index->frames[i].offset -= out_size;
+        }
+        for (size_t i = 0; i < index->entry_count; i++) {
+            index->entries[i].offset -= out_size;
+        }
+
+        uint64_t old_raw_size = index->raw_size;
+        error_code = io_seek(in_stream, (int64_t)old_raw_size, SEEK_SET)
+            || io_seek(out_stream, out_size, SEEK_SET);
+        if (error_code) errno = ERR_IO_ERROR;
+        error_code = error_code
+            || _frame_write_frame(params, in_stream, out_stream, index);
+        if (!error_code && io_sync(out_stream)) {
+            errno = ERR_IO_ERROR;
+            error_code = 1;
+        }
+
+        if (error_code) {
+            io_truncate(out_stream, out_size);
+        } else {
+            *appended = index->raw_size - old_raw_size;
+        }
+    }
+    frame_index_free(index);
+
+    return error_code;
+}
+
+
+/**
+ * @brief The buffers reused for all blocks of a stream while decoding.
+ */
+struct _frame_decoder {
+    uint8_t* payload;
+    size_t payload_capacity;
+    uint8_t* output;
+    size_t output_capacity;
+    uint8_t* code;
+    size_t code_capacity;
+    /** The cache codes are looked up in, NULL to read every code. */
+    struct code_cache* cache;
+};
+
+int frame_reserve(uint8_t** buffer, size_t* capacity, size_t size) {
+    if (size <= *capacity) return 0;
+
+    uint8_t* resized = realloc(*buffer, size);
+    if (!resized) {
+        errno = ERR_MEM_ERROR;
+        return 1;
+    }
+    *buffer = resized;
+    *capacity = size;
+
+    return 0;
+}
+
+size_t frame_code_size(int flags, const uint8_t* header) {
+    if (flags & FRAME_FLAG_WIDE) {
+        return canonical_code_table_size(header, FREQ_DICT_WORD_ALPHABET);
+    }
+
+    return header[0] ? 1 + (size_t)header[0] * 4 : 0;
+}
+
+int frame_read_code(int flags, const uint8_t* buffer, size_t size,
+        struct huffman_tree** tree, struct canonical_code_table** table) {
+    *tree = NULL;
+    *table = NULL;
+
+    if (flags & FRAME_FLAG_WIDE) {
+        struct canonical_code* code = canonical_code_read_from_buffer(buffer,
+            size, FREQ_DICT_WORD_ALPHABET);
+        if (!code) return 1;
+
+        *table = canonical_code_create_table(code);
+        canonical_code_free(code);
+
+        return !*table;
+    }
+
+    size_t tree_size = size > 0 ? frame_code_size(flags, buffer) : 0;
+    if (tree_size == 0 || tree_size > size) {
+        errno = ERR_PARSE_ERROR;
+        return 1;
+    }
+    *tree = huffman_tree_read_from_buffer(buffer);
+
+    return !*tree;
+}
+
+int _frame_read_code(struct _frame_decoder* decoder, int flags,
+        struct async_reader* reader, struct huffman_tree** tree,
+        struct canonical_code_table** table) {
+    size_t size;
+    if (frame_reserve(&decoder->code, &decoder->code_capacity,
+            FRAME_CODE_HEADER_SIZE)) {
+        return 1;
+    }
+
+    /* No tree is smaller than the header of a canonical code. */
+    if (async_reader_read(reader, decoder->code, FRAME_CODE_HEADER_SIZE)
+                != FRAME_CODE_HEADER_SIZE
+            || (size = frame_code_size(flags, decoder->code)) == 0) {
+        errno = ERR_PARSE_ERROR;
+        return 1;
+    }
+
+    if (frame_reserve(&decoder->code, &decoder->code_capacity, size)) return 1;
+    if (async_reader_read(reader, decoder->code + FRAME_CODE_HEADER_SIZE,
+            size - FRAME_CODE_HEADER_SIZE) != size - FRAME_CODE_HEADER_SIZE) {
+        errno = ERR_PARSE_ERROR;
+        return 1;
+    }
+
+    if (decoder->cache) {
+        return code_cache_get(decoder->cache, flags, decoder->code, size,
+            tree, table);
+    }
+
+    return frame_read_code(flags, decoder->code, size, tree, table);
+}
+
+void _frame_release_code(struct _frame_decoder* decoder,
+        struct huffman_tree* tree, struct canonical_code_table* table) {
+    if (decoder->cache) {
+        code_cache_release(decoder->cache, tree, table);
+    } else {
+        if (tree) huffman_tree_free(tree);
+        if (table) canonical_code_table_free(table);
+    }
+}
+
+int frame_decode_payload(int type, int flags, struct huffman_tree* tree,
+        struct canonical_code_table* table, struct ans_code_table* ans,
+        const struct transform* transform,
+        const uint8_t* payload, size_t payload_size,
+        uint8_t* output, size_t raw_size) {
+    /* Stored blocks are copied and reversed in the same pass. */
+    if (type == FRAME_BLOCK_STORED) {
+        if (payload_size != raw_size) {
+            errno = ERR_PARSE_ERROR;
+            return 1;
+        }
+        transform_decode(transform, payload, raw_size, output);
+        return 0;
+    }
+
+    int error_code = type == FRAME_BLOCK_ANS
+        ? ans_code_decode_buffer(ans, payload, payload_size, output, raw_size)
+        : (flags & FRAME_FLAG_WIDE)
+        ? canonical_code_decode_words(table, payload, payload_size,
+            output, raw_size, flags & FRAME_FLAG_BIG_ENDIAN)
+        : huffman_tree_decode_buffer(tree, payload, payload_size,
+            output, raw_size);
+
+    /* The block is still in the cache right after it has been decoded. */
+    if (!error_code && transform->type != TRANSFORM_NONE) {
+        transform_decode(transform, output, raw_size, output);
+    }
+
+    return error_code;
+}
+
+int frame_read_transform(int flags, const uint8_t* buffer,
+        struct transform* transform) {
+    transform->type = TRANSFORM_NONE;
+    transform->parameter = 0;
+    if (!(flags & FRAME_FLAG_TRANSFORM)) return 0;
+
+    if (!transform_is_valid(buffer[0], buffer[1])) {
+        errno = ERR_PARSE_ERROR;
+        return 1;
+    }
+    transform->type = buffer[0];
+    transform->parameter = buffer[1];
+
+    return 0;
+}
+
+int _frame_read_ans(struct _frame_decoder* decoder, struct async_reader* reader,
+        struct ans_code_table** ans) {
+    size_t size;
+    if (frame_reserve(&decoder->code, &decoder->code_capacity, ANS_CODE_MAX_SIZE)) {
+        return 1;
+    }
+
+    if (async_reader_read(reader, decoder->code, ANS_CODE_HEADER_SIZE)
+                != ANS_CODE_HEADER_SIZE
+            || (size = ans_code_table_size(decoder->code)) == 0
+            || async_reader_read(reader, decoder->code + ANS_CODE_HEADER_SIZE,
+                size - ANS_CODE_HEADER_SIZE) != size - ANS_CODE_HEADER_SIZE) {
+        errno = ERR_PARSE_ERROR;
+        return 1;
+    }
+
+    *ans = ans_code_read_table(decoder->code, size);
+
+    return !*ans;
+}
+
+int _frame_skip(struct async_reader* reader, uint64_t size) {
+    uint8_t buffer[4096];
+    while (size > 0) {
+        size_t chunk = size < sizeof(buffer) ? (size_t)size : sizeof(buffer);
+        if (async_reader_read(reader, buffer, chunk) != chunk) {
+            errno = ERR_PARSE_ERROR;
+            return 1;
+        }
+        size -= chunk;
+    }
+
+    return 0;
+}
+
+int _frame_decompress_block(struct _frame_decoder* decoder,
+        const uint8_t* header, int flags, struct huffman_tree* shared_tree,
+        struct canonical_code_table* shared_table,
+        struct async_reader* reader, const struct sink* sink,
+        uint32_t* checksum) {
+    int type = header[0];
+    uint32_t raw_size = io_get_u32(header + 1);
+    uint32_t payload_size = io_get_u32(header + 5);
+
+    if (type == FRAME_BLOCK_INDEX && raw_size == 0) {
+        return _frame_skip(reader, payload_size);
+    }
+
+    if (raw_size > FRAME_MAX_BLOCK_SIZE || payload_size > FRAME_MAX_BLOCK_SIZE
+            || (type == FRAME_BLOCK_STORED && payload_size != raw_size)
+            || (type == FRAME_BLOCK_SHARED_TREE && !shared_tree && !shared_table)
+            || (type > FRAME_BLOCK_STORED && type != FRAME_BLOCK_ANS)
+            || (type == FRAME_BLOCK_ANS && (flags & FRAME_FLAG_WIDE))) {
+        errno = ERR_PARSE_ERROR;
+        return 1;
+    }
+
+    uint8_t expected[CRC32C_SIZE];
+    if ((flags & FRAME_FLAG_CHECKSUM)
+            && async_reader_read(reader, expected, CRC32C_SIZE) != CRC32C_SIZE) {
+        errno = ERR_PARSE_ERROR;
+        return 1;
+    }
+
+    uint8_t transform_header[FRAME_TRANSFORM_SIZE];
+    struct transform transform;
+    if ((flags & FRAME_FLAG_TRANSFORM) && async_reader_read(reader,
+            transform_header, FRAME_TRANSFORM_SIZE) != FRAME_TRANSFORM_SIZE) {
+        errno = ERR_PARSE_ERROR;
+        return 1;
+    }
+    if (frame_read_transform(flags, transform_header, &transform)) return 1;
+
+    struct huffman_tree* tree = shared_tree;
+    struct canonical_code_table* table = shared_table;
+    struct ans_code_table* ans = NULL;
+    if (type == FRAME_BLOCK_OWN_TREE
+            && _frame_read_code(decoder, flags, reader, &tree, &table)) {
+        return 1;
+    }
+    if (type == FRAME_BLOCK_ANS && _frame_read_ans(decoder, reader, &ans)) {
+        return 1;
+    }
+
+    /* Blocks are decoded, and stored blocks read, straight into the memory
+     * of the sink if it offers some. */
+    uint8_t* target = sink->reserve && raw_size > 0
+        ? sink->reserve(sink->context, raw_size) : NULL;
+    int copy = type == FRAME_BLOCK_STORED && transform.type == TRANSFORM_NONE;
+    int error_code = (!(copy && target) && frame_reserve(&decoder->payload,
+            &decoder->payload_capacity, payload_size))
+        || (!copy && !target && frame_reserve(&decoder->output,
+            &decoder->output_capacity, raw_size));
+    uint8_t* payload = copy && target ? target : decoder->payload;
+
+    if (!error_code && async_reader_read(reader, payload,
+            payload_size) != payload_size) {
+        errno = ERR_PARSE_ERROR;
+        error_code = 1;
+    }
+
+    const uint8_t* output = payload;
+    if (!error_code && !copy) {
+        uint8_t* decoded = target ? target : decoder->output;
+        TRACE_BEGIN(decode_start);
+        error_code = frame_decode_payload(type, flags, tree, table, ans,
+            &transform, payload, payload_size, decoded, raw_size);
+        TRACE_END(decode_start, "decode", raw_size);
+        output = decoded;
+    }
+
+    if (!error_code && (flags & FRAME_FLAG_CHECKSUM)) {
+        uint32_t block_checksum = crc32c_update(0, output, raw_size);
+        if (block_checksum != io_get_u32(expected)) {
+            errno = ERR_CHECKSUM_ERROR;
+            error_code = 1;
+        }
+        *checksum = crc32c_combine(*checksum, block_checksum, raw_size);
+    }
+
+    if (!error_code) error_code = sink->write(sink->context, output, raw_size);
+
+    if (type == FRAME_BLOCK_OWN_TREE) _frame_release_code(decoder, tree, table);
+    if (ans) ans_code_table_free(ans);
+
+    return error_code;
+}
+
+int _frame_decompress_blocks(struct _frame_decoder* decoder, int flags,
+        struct huffman_tree* shared_tree, struct canonical_code_table* shared_table,
+        struct async_reader* reader, const struct sink* sink) {
+    uint32_t checksum = 0;
+    int error_code = 0;
+    while (!error_code) {
+        uint8_t header[FRAME_BLOCK_HEADER_SIZE];
+        if (async_reader_read(reader, header, FRAME_BLOCK_HEADER_SIZE)
+                != FRAME_BLOCK_HEADER_SIZE) {
+            errno = ERR_PARSE_ERROR;
+            error_code = 1;
+            break;
+        }
+
+        if (header[0] == FRAME_BLOCK_END) {
+            if ((flags & FRAME_FLAG_CHECKSUM)
+                    && io_get_u32(header + 1) != checksum) {
+                errno = ERR_CHECKSUM_ERROR;
+                error_code = 1;
+            }
+            break;
+        }
+
+        error_code = _frame_decompress_block(decoder, header, flags,
+            shared_tree, shared_table, reader, sink, &checksum);
+    }
+
+    return error_code;
+}
+
+int _frame_decompress_frame(struct _frame_decoder* decoder,
+        struct async_reader* reader, const struct sink* sink) {
+    uint8_t flags;
+    if (async_reader_read(reader, &flags, 1) != 1
+            || (flags & ~FRAME_FLAGS)) {
+        errno = ERR_PARSE_ERROR;
+        return 1;
+    }
+
+    struct huffman_tree* shared_tree = NULL;
+    struct canonical_code_table* shared_table = NULL;
+    if ((flags & FRAME_FLAG_SHARED_TREE) && _frame_read_code(decoder, flags,
+            reader, &shared_tree, &shared_table)) {
+        return 1;
+    }
+
+    int error_code = _frame_decompress_blocks(decoder, flags, shared_tree,
+        shared_table, reader, sink);
+
+    if (shared_tree || shared_table) {
+        _frame_release_code(decoder, shared_tree, shared_table);
+    }
+
+    return error_code;
+}
+
+int _frame_write_output(void* context, const uint8_t* data, size_t size) {
+    return async_writer_write(context, data, size);
+}
+
+/* Makes a sink of a writer, for the decoders taking one. */
+void _frame_writer_sink(struct async_writer* writer, struct sink* sink) {
+    sink->reserve = NULL;
+    sink->write = _frame_write_output;
+    sink->context = writer;
+}
+
+int frame_decompress_blocks(int flags, struct huffman_tree* shared_tree,
+        struct canonical_code_table* shared_table,
+        struct async_reader* reader, struct async_writer* writer) {
+    struct _frame_decoder decoder;
+    memset(&decoder, 0, sizeof(struct _frame_decoder));
+    struct sink sink;
+    _frame_writer_sink(writer, &sink);
+
+    int error_code = _frame_decompress_blocks(&decoder, flags, shared_tree,
+        shared_table, reader, &sink);
+
+    free(decoder.payload);
+    free(decoder.output);
+    free(decoder.code);
+
+    return error_code;
+}
+
+/* Decompresses frames until the reader ends after at least one. */
+int _frame_decompress_frames(struct _frame_decoder* decoder,
+        struct async_reader* reader, const struct sink* sink) {
+    int error_code = 0;
+    int frames = 0;
+    while (!error_code) {
+        uint8_t magic[FRAME_MAGIC_SIZE];
+        size_t read = async_reader_read(reader, magic, FRAME_MAGIC_SIZE);
+        if (read == 0 && frames > 0 && !async_reader_error(reader)) break;
+
+        if (read != FRAME_MAGIC_SIZE
+                || memcmp(magic, FRAME_MAGIC, FRAME_MAGIC_SIZE)) {
+            errno = ERR_PARSE_ERROR;
+            error_code = 1;
+            break;
+        }
+
+        error_code = _frame_decompress_frame(decoder, reader, sink);
+        frames++;
+    }
+
+    return error_code;
+}
+
+int frame_decompress_stream(FILE* in_stream, FILE* out_stream, int io_backend) {
+    return frame_decompress_stream_cached(in_stream, out_stream, io_backend, NULL);
+}
+
+int frame_decompress_stream_cached(FILE* in_stream, FILE* out_stream,
+        int io_backend, struct code_cache* cache) {
+    struct async_writer* writer = async_writer_create(out_stream,
+        io_backend, ASYNC_IO_DEFAULT_CHUNK_SIZE, ASYNC_IO_DEFAULT_DEPTH);
+    if (!writer) return 1;
+
+    struct sink sink;
+    _frame_writer_sink(writer, &sink);
+    int error_code = frame_decompress_stream_sink(in_stream, &sink,
+            io_backend, cache)
+        || async_writer_finish(writer);
+    async_writer_free(writer);
+
+    return error_code;
+}
+
+int frame_decompress_stream_sink(FILE* in_stream, const struct sink* sink,
+        int io_backend, struct code_cache* cache) {
+    struct _frame_decoder decoder;
+    memset(&decoder, 0, sizeof(struct _frame_decoder));
+    decoder.cache = cache;
+
+    struct async_reader* reader = async_reader_create(in_stream,
+        io_backend, ASYNC_IO_DEFAULT_CHUNK_SIZE, ASYNC_IO_DEFAULT_DEPTH);
+    int error_code = !reader
+        || _frame_decompress_frames(&decoder, reader, sink);
+
+    if (reader) async_reader_free(reader);
+    free(decoder.payload);
+    free(decoder.output);
+    free(decoder.code);
+
+    return error_code;
+}
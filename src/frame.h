@@ -0,0 +1,631 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "error.h"
+#include "io_util.h"
+#include "frequency_dict.h"
+#include "huffman_tree.h"
+#include "mapping_dict.h"
+#include "async_io.h"
+#include "crc32c.h"
+#include "canonical_code.h"
+#include "ans_code.h"
+#include "transform.h"
+#include "code_cache.h"
+#include "sink.h"
+
+
+struct frame_index;
+struct table_cache;
+
+
+/*
+ * The framed format splits the input into blocks that are encoded one
+ * after another, so the input only has to be read once after the tree
+ * has been determined. All integers are stored in little endian order.
+ *
+ * frame       := magic flags [tree] block* [index_block] end_block
+ * magic       := 'H' 'U' 'F' 0x01
+ * flags       := u8, any of the FRAME_FLAG_* flags
+ * block       := type:u8 raw_size:u32 payload_size:u32 [checksum:u32]
+ *                [transform:u8 parameter:u8] [tree | ans_table] payload
+ * index_block := 0x04 0:u32 payload_size:u32 index
+ * end_block   := 0x00 content_checksum:u32 index_block_size:u32
+ *
+ * A tree has the layout written by huffman_tree_write_to_stream(). Blocks
+ * of type FRAME_BLOCK_SHARED_TREE are encoded with the tree of the frame,
+ * blocks of type FRAME_BLOCK_OWN_TREE carry their own tree and blocks of
+ * type FRAME_BLOCK_STORED contain the raw bytes. Blocks of type
+ * FRAME_BLOCK_ANS, which only occur in frames of bytes, carry the table of
+ * a tANS code instead of a tree and a payload in the layout described in
+ * ans_code.h. A stream may consist of any number of frames, which decode to
+ * the concatenation of their contents.
+ *
+ * Frames with FRAME_FLAG_WIDE code 16 bit words instead of bytes, stored
+ * big endian if FRAME_FLAG_BIG_ENDIAN is set as well. Their trees are
+ * replaced by the code length tables described in canonical_code.h, and a
+ * block of an odd number of bytes stores its last byte after the payload.
+ *
+ * Frames with FRAME_FLAG_CHECKSUM store the CRC-32C of the decoded bytes of
+ * every block in front of its tree, and the CRC-32C of all decoded bytes of
+ * the frame in their end block. Without the flag, <content_checksum> is 0.
+ *
+ * Frames with FRAME_FLAG_TRANSFORM store the TRANSFORM_* type and parameter
+ * of every block in front of its tree. The payload of such a block decodes to
+ * the transformed bytes, see transform.h, and the checksum covers the bytes
+ * after the transform has been reversed.
+ *
+ * The index block maps uncompressed offsets to the positions of blocks, see
+ * frame_index.h for its layout. The end block stores the size of the index
+ * block in front of it, so the index can be found from the end of a file.
+ */
+
+#define FRAME_MAGIC "HUF\x01"
+#define FRAME_MAGIC_SIZE 4
+
+#define FRAME_FLAG_SHARED_TREE 0x01
+#define FRAME_FLAG_CHECKSUM 0x02
+#define FRAME_FLAG_WIDE 0x04
+#define FRAME_FLAG_BIG_ENDIAN 0x08
+#define FRAME_FLAG_TRANSFORM 0x10
+#define FRAME_FLAGS (FRAME_FLAG_SHARED_TREE | FRAME_FLAG_CHECKSUM \
+    | FRAME_FLAG_WIDE | FRAME_FLAG_BIG_ENDIAN | FRAME_FLAG_TRANSFORM)
+
+#define FRAME_BLOCK_END 0
+#define FRAME_BLOCK_SHARED_TREE 1
+#define FRAME_BLOCK_OWN_TREE 2
+#define FRAME_BLOCK_STORED 3
+#define FRAME_BLOCK_INDEX 4
+#define FRAME_BLOCK_ANS 5
+
+#define FRAME_BLOCK_HEADER_SIZE 9
+#define FRAME_TRANSFORM_SIZE 2
+#define FRAME_MAX_TREE_SIZE (1 + 255 * 4)
+#define FRAME_MAX_CODE_SIZE (CANONICAL_CODE_HEADER_SIZE + CANONICAL_CODE_MAX_ALPHABET)
+#define FRAME_CODE_HEADER_SIZE CANONICAL_CODE_HEADER_SIZE
+
+#define FRAME_DEFAULT_BLOCK_SIZE (1u << 20)
+#define FRAME_MAX_BLOCK_SIZE (64u << 20)
+#define FRAME_DEFAULT_DIVERGENCE 0.05
+#define FRAME_DEFAULT_SPLIT_SIZE (16u << 10)
+
+#define FRAME_MIN_LEVEL 1
+#define FRAME_MAX_LEVEL 9
+#define FRAME_DEFAULT_LEVEL 5
+
+#define FRAME_WIDE_LITTLE_ENDIAN 1
+#define FRAME_WIDE_BIG_ENDIAN 2
+
+
+/**
+ * @brief The parameters that control how a stream is split into blocks
+ * and which trees are used to encode them.
+ */
+struct frame_params {
+    /** Number of input bytes per block. */
+    size_t block_size;
+    /** Non-zero to build the shared tree from a sample of the input only. */
+    int sampled;
+    /** The parts of the input analyzed if <sampled> is set. */
+    struct freq_dict_sampling sampling;
+    /**
+     * How much the cost of a block encoded with the shared tree may exceed
+     * the Shannon bound of the block, relative to it, before the block is
+     * considered for a tree of its own.
+     */
+    double divergence;
+    /** The ASYNC_IO_* backend used to read the input and write the output. */
+    int io_backend;
+    /** Non-zero to store checksums of the blocks and of the whole frame. */
+    int checksum;
+    /**
+     * 0 to code bytes, FRAME_WIDE_LITTLE_ENDIAN or FRAME_WIDE_BIG_ENDIAN to
+     * code 16 bit words. <block_size> must be even for words.
+     */
+    int wide;
+    /**
+     * The transform tried on every block. Blocks it does not make more
+     * compressible are coded as they are.
+     */
+    struct transform transform;
+    /**
+     * Distance between the positions at which a block may end early if the
+     * distribution of its bytes changes there, 0 to end every block after
+     * <block_size> bytes. Blocks of words are never ended early.
+     */
+    size_t split_size;
+    /**
+     * The maximum length of the codes of the trees built, 0 for no limit
+     * on trees of bytes. Codes of words are at most CANONICAL_CODE_MAX_LENGTH
+     * and at least 16 bits long.
+     */
+    int max_code_length;
+    /**
+     * Non-zero to code blocks of bytes with tANS instead of a tree where
+     * that is estimated to be smaller.
+     */
+    int ans;
+    /**
+     * Number of threads compressing blocks, 0 for one per processor. With
+     * more than one, blocks are compressed as described in scheduler.h.
+     */
+    int thread_count;
+    /**
+     * Maximum number of bytes the blocks being compressed in parallel and
+     * the state of their threads may hold, 0 for no limit.
+     */
+    size_t memory_limit;
+    /**
+     * The processors the threads compressing blocks run on, in the order
+     * threads are assigned to them, NULL to choose them from the topology
+     * of the host. With thread_count 0, one thread per processor listed.
+     */
+    const int* cpus;
+    size_t cpu_count;
+    /**
+     * The cache the shared trees of frames of bytes are taken from, and
+     * those built are added to, NULL to build every tree afresh. See
+     * table_cache.h.
+     */
+    struct table_cache* table_cache;
+};
+
+/**
+ * @brief The code shared by the blocks of a frame that have no code of
+ * their own: a tree for frames of bytes, a canonical code for words.
+ */
+struct frame_shared_code {
+    struct huffman_tree* tree;
+    struct mapping_dict* mapping;
+    struct canonical_code* code;
+    /** The cache <tree> and <mapping> belong to, NULL if they are owned. */
+    struct table_cache* cache;
+};
+
+/**
+ * @brief Describes how a single block is going to be encoded.
+ */
+struct frame_block_plan {
+    /** One of the FRAME_BLOCK_* block types. */
+    int type;
+    /** Number of bytes of the payload following the block header. */
+    uint64_t payload_size;
+    /** Number of bytes of the block header, including its tree. */
+    size_t header_size;
+    /** The tree of the block if it has its own tree, NULL otherwise. */
+    struct huffman_tree* tree;
+    /** The mapping the block is encoded with, NULL for stored blocks. */
+    struct mapping_dict* mapping;
+    /**
+     * The canonical code a block of words is encoded with, owned by the
+     * plan if the block has its own tree.
+     */
+    struct canonical_code* code;
+    /** The tANS code of a block of type FRAME_BLOCK_ANS, owned by the plan. */
+    struct ans_code* ans;
+};
+
+
+/**
+ * @brief Initializes frame parameters to the defaults: exact two-pass
+ * frequency analysis, blocks of FRAME_DEFAULT_BLOCK_SIZE bytes and
+ * checksums.
+ *
+ * @param params the parameters to be initialized.
+ */
+void frame_params_init(struct frame_params* params);
+
+/**
+ * @brief Sets the parameters a compression level stands for. Levels below
+ * the default analyze a sample of the input only, reuse the shared tree
+ * for more blocks and limit the length of codes. Levels above it split
+ * blocks where their contents change, give more blocks trees of their own
+ * and try a delta transform on every block unless a transform is set.
+ * FRAME_DEFAULT_LEVEL leaves the parameters set by frame_params_init().
+ *
+ * @param params the parameters to be changed.
+ * @param level the level from FRAME_MIN_LEVEL, fastest, to FRAME_MAX_LEVEL,
+ * smallest.
+ * @return int non-zero if <level> is out of range, zero otherwise.
+ */
+int frame_params_set_level(struct frame_params* params, int level);
+
+/**
+ * @brief Restricts the parameters to frames the compact decoder of
+ * compact_decoder.h can read: frames of bytes whose blocks are coded with
+ * trees or stored, never with tANS, and never transformed. The levels and
+ * all other parameters are kept.
+ *
+ * @param params the parameters to be changed.
+ * @return int non-zero if <params> code 16 bit words, which the compact
+ * decoder does not read, zero otherwise.
+ */
+int frame_params_set_compact(struct frame_params* params);
+
+/**
+ * @brief Creates an empty frequency dict counting the symbols of a frame,
+ * bytes or words depending on the parameters.
+ *
+ * @param params the parameters of the frame.
+ * @return struct freq_dict* the created frequency dict.
+ * Must be freed by freq_dict_free().
+ */
+struct freq_dict* frame_create_dict(const struct frame_params* params);
+
+/**
+ * @brief Builds the tree of bytes the parameters ask for.
+ *
+ * @param params the parameters of the frame.
+ * @param dict the frequencies of the bytes to be coded.
+ * @return struct huffman_tree* the created tree, NULL if an error occurred.
+ * Must be freed with a call to huffman_tree_free().
+ */
+struct huffman_tree* frame_create_tree(const struct frame_params* params,
+    struct freq_dict* dict);
+
+/**
+ * @brief Builds the canonical code of words the parameters ask for.
+ *
+ * @param params the parameters of the frame.
+ * @param dict the frequencies of the words to be coded.
+ * @return struct canonical_code* the created code, NULL if no word occurs
+ * or an error occurred. Must be freed with a call to canonical_code_free().
+ */
+struct canonical_code* frame_create_code(const struct frame_params* params,
+    struct freq_dict* dict);
+
+/**
+ * @brief Counts the symbols of a block. If the parameters name a transform,
+ * the transformed block is counted as well and used if its symbols carry
+ * less information.
+ *
+ * @param params the parameters of the frame.
+ * @param block the bytes of the block.
+ * @param size the number of bytes in <block>.
+ * @param transformed a buffer of <size> bytes for the transformed block.
+ * @param block_dict the dict the symbols of the block are counted into,
+ * swapped with <spare_dict> if the transformed block is used.
+ * @param spare_dict an empty dict of the same alphabet as <block_dict>.
+ * @param transform set to the transform applied to the block.
+ * @return const uint8_t* the bytes to be coded, <block> or <transformed>.
+ */
+const uint8_t* frame_analyze_block(const struct frame_params* params,
+    const uint8_t* block, size_t size, uint8_t* transformed,
+    struct freq_dict** block_dict, struct freq_dict** spare_dict,
+    struct transform* transform);
+
+/**
+ * @brief Chooses where the next block ends. Candidate positions every
+ * <params->split_size> bytes are rated by the estimated coded sizes of the
+ * bytes in front of and behind them. The histogram of the bytes in front
+ * grows by one step per candidate, and the one behind is the difference
+ * to the histogram of the whole buffer. The candidate saving most bits is
+ * taken if it saves more than the header of another block.
+ *
+ * @param params the parameters of the frame.
+ * @param shared the code shared by the blocks of the frame.
+ * @param buffer the bytes up to the end of the next block at most.
+ * @param size the number of bytes in <buffer>.
+ * @param front an empty dict of bytes, used as scratch space.
+ * @param all an empty dict of bytes, used as scratch space.
+ * @return size_t the number of bytes of the next block, <size> if the
+ * buffer should not be split.
+ */
+size_t frame_split_block(const struct frame_params* params,
+    const struct frame_shared_code* shared, const uint8_t* buffer,
+    size_t size, struct freq_dict* front, struct freq_dict* all);
+
+/**
+ * @brief Decides how a block is encoded. The shared code is used unless
+ * the block diverges from it by more than the configured threshold and a
+ * code of its own is cheaper. A block of bytes is coded with tANS if the
+ * parameters allow it and its estimated size is smaller still. Blocks that
+ * do not compress are stored.
+ *
+ * @param params the parameters of the frame.
+ * @param shared the code shared by the blocks of the frame.
+ * @param block_dict the frequencies of the symbols of the block.
+ * @param raw_size the number of bytes of the block.
+ * @param plan the plan to be filled. Must be released with
+ * frame_block_plan_free().
+ * @return int non-zero if an error occurred, zero otherwise.
+ */
+int frame_plan_block(const struct frame_params* params,
+    const struct frame_shared_code* shared, struct freq_dict* block_dict,
+    uint64_t raw_size, struct frame_block_plan* plan);
+
+/**
+ * @brief Encodes the payload of a planned block. The payload size of a
+ * block of type FRAME_BLOCK_ANS is only estimated by its plan and set here;
+ * if its payload would not be smaller than its bytes, the block is turned
+ * into a stored block instead.
+ *
+ * @param params the parameters of the frame.
+ * @param plan the plan of the block, updated as described above.
+ * @param in_buffer the bytes to be coded.
+ * @param in_size the number of bytes in <in_buffer>.
+ * @param out_buffer a buffer of <in_size> + ANS_CODE_SLACK bytes the
+ * payload is written to.
+ * @return const uint8_t* the payload, <in_buffer> for stored blocks and
+ * <out_buffer> otherwise.
+ */
+const uint8_t* frame_encode_block(const struct frame_params* params,
+    struct frame_block_plan* plan, const uint8_t* in_buffer, size_t in_size,
+    uint8_t* out_buffer);
+
+/**
+ * @brief Writes the header of an encoded block, including its code.
+ *
+ * @param plan the plan of the block, after frame_encode_block().
+ * @param raw_size the number of bytes the block decodes to.
+ * @param checksum the checksum of the block, NULL in frames without
+ * FRAME_FLAG_CHECKSUM.
+ * @param transform the transform of the block, NULL in frames without
+ * FRAME_FLAG_TRANSFORM.
+ * @param header the buffer of <plan->header_size> bytes to write to.
+ */
+void frame_put_block_header(const struct frame_block_plan* plan,
+    size_t raw_size, const uint32_t* checksum,
+    const struct transform* transform, uint8_t* header);
+
+/**
+ * @brief Frees the tree and mapping a block plan owns.
+ *
+ * @param plan the plan to be released.
+ */
+void frame_block_plan_free(struct frame_block_plan* plan);
+
+/**
+ * @brief Creates the shared code of a frame from the frequencies of its
+ * symbols.
+ *
+ * @param params the parameters for compression.
+ * @param dict the frequencies, counted by a dict of frame_create_dict().
+ * @param shared set to the shared code, all of whose members are NULL if
+ * <dict> is empty. Must be released with frame_shared_code_free().
+ * @return int non-zero if an error occurred, zero otherwise.
+ */
+int frame_create_shared_code_from_dict(const struct frame_params* params,
+    struct freq_dict* dict, struct frame_shared_code* shared);
+
+/**
+ * @brief Creates the shared code of a frame from the frequencies of a
+ * stream from its current position on, or from a sample of them. The
+ * stream is returned to that position afterwards.
+ *
+ * @param params the parameters for compression.
+ * @param in_stream the seekable stream that should be analyzed.
+ * @param shared set to the shared code, all of whose members are NULL if
+ * <in_stream> is empty. Must be released with frame_shared_code_free().
+ * @return int non-zero if an error occurred, zero otherwise.
+ */
+int frame_create_shared_code(const struct frame_params* params,
+    FILE* in_stream, struct frame_shared_code* shared);
+
+/**
+ * @brief Frees the members of a shared code.
+ *
+ * @param shared the shared code to be released.
+ */
+void frame_shared_code_free(struct frame_shared_code* shared);
+
+/**
+ * @brief Returns the number of bytes of a frame header.
+ *
+ * @param shared the shared code of the frame.
+ * @return size_t the number of bytes of the header, including its tree.
+ */
+size_t frame_header_size(const struct frame_shared_code* shared);
+
+/**
+ * @brief Reads from a stream until a buffer is full or the stream ends.
+ *
+ * @param stream the stream to read from.
+ * @param buffer the buffer to be filled.
+ * @param size the number of bytes that should be read.
+ * @return size_t the number of bytes read, less than <size> only at the
+ * end of <stream> or if an error occurred.
+ */
+size_t frame_read_fully(FILE* stream, uint8_t* buffer, size_t size);
+
+/**
+ * @brief Grows a heap buffer to hold at least a given number of bytes.
+ *
+ * @param buffer the buffer to be grown, may point to NULL.
+ * @param capacity the current capacity of <buffer>, updated on success.
+ * @param size the number of bytes <buffer> must be able to hold.
+ * @return int non-zero if an error occurred, zero otherwise.
+ */
+int frame_reserve(uint8_t** buffer, size_t* capacity, size_t size);
+
+/**
+ * @brief Reads a shared or own code in the layout of a frame from the
+ * start of a buffer.
+ *
+ * @param flags the FRAME_FLAG_* flags of the frame.
+ * @param buffer the buffer holding the code.
+ * @param size the number of bytes in <buffer>.
+ * @param tree set to the tree in frames of bytes, NULL otherwise.
+ * @param table set to the decoding table in frames of words, NULL otherwise.
+ * @return int non-zero if the code is invalid, zero otherwise.
+ */
+int frame_read_code(int flags, const uint8_t* buffer, size_t size,
+    struct huffman_tree** tree, struct canonical_code_table** table);
+
+/**
+ * @brief Returns the size of a shared or own code from its first bytes.
+ *
+ * @param flags the FRAME_FLAG_* flags of the frame.
+ * @param header the first FRAME_CODE_HEADER_SIZE bytes of the code, of which
+ * only the first one is used in frames of bytes.
+ * @return size_t the number of bytes of the code, 0 if it is invalid.
+ */
+size_t frame_code_size(int flags, const uint8_t* header);
+
+/**
+ * @brief Decodes the payload of a block and reverses its transform.
+ *
+ * @param type the FRAME_BLOCK_* type of the block.
+ * @param flags the FRAME_FLAG_* flags of the frame.
+ * @param tree the tree a block of bytes is encoded with.
+ * @param table the table a block of words is encoded with.
+ * @param ans the table a block of type FRAME_BLOCK_ANS is encoded with.
+ * @param transform the transform of the block.
+ * @param payload the payload of the block.
+ * @param payload_size the number of bytes in <payload>.
+ * @param output the buffer the decoded bytes are written to.
+ * @param raw_size the number of bytes the block decodes to.
+ * @return int non-zero if the payload is corrupt, zero otherwise.
+ */
+int frame_decode_payload(int type, int flags, struct huffman_tree* tree,
+    struct canonical_code_table* table, struct ans_code_table* ans,
+    const struct transform* transform,
+    const uint8_t* payload, size_t payload_size,
+    uint8_t* output, size_t raw_size);
+
+/**
+ * @brief Reads the transform of a block.
+ *
+ * @param flags the FRAME_FLAG_* flags of the frame.
+ * @param buffer the FRAME_TRANSFORM_SIZE bytes of the transform in the block
+ * header, unused without FRAME_FLAG_TRANSFORM.
+ * @param transform set to the transform, TRANSFORM_NONE for frames without
+ * FRAME_FLAG_TRANSFORM.
+ * @return int non-zero if the transform is unknown, zero otherwise.
+ */
+int frame_read_transform(int flags, const uint8_t* buffer,
+    struct transform* transform);
+
+/**
+ * @brief Checks whether a stream starts with a frame. The position of
+ * the stream is restored afterwards.
+ *
+ * @param stream the stream to be checked.
+ * @return int non-zero if <stream> is in the framed format, zero otherwise.
+ */
+int frame_is_framed(FILE* stream);
+
+/**
+ * @brief Compresses all remaining input of a reader into blocks, without the
+ * header and the end block of a frame.
+ *
+ * @param params the parameters for compression.
+ * @param shared the code of the blocks that have none of their own.
+ * @param reader the input to be compressed.
+ * @param writer the output the blocks are written to.
+ * @param index the index the blocks are added to, may be NULL.
+ * @param checksum the CRC-32C of all bytes compressed before, updated with
+ * the bytes of the blocks if <params> asks for checksums.
+ * @return int non-zero if an error occurred, zero otherwise. errno is set
+ * to ERR_ILLEGAL_ARG if params->memory_limit does not hold a single block.
+ */
+int frame_compress_blocks(const struct frame_params* params,
+    const struct frame_shared_code* shared, struct async_reader* reader,
+    struct async_writer* writer, struct frame_index* index,
+    uint32_t* checksum);
+
+/**
+ * @brief Compresses a stream into a single frame.
+ *
+ * @param params the parameters for compression.
+ * @param in_stream the seekable stream that should be compressed.
+ * @param out_stream the stream to which the frame should be written.
+ * @return int non-zero if an error occurred, zero otherwise.
+ */
+int frame_compress_stream(const struct frame_params* params,
+    FILE* in_stream, FILE* out_stream);
+
+/**
+ * @brief Appends the bytes a stream has grown by to its compressed form as
+ * another frame. The uncompressed size stored in the index of <out_stream>
+ * tells where the new bytes start, and the checksum of the last block of
+ * <out_stream>, if it has one, is compared to the bytes in front of them to
+ * make sure that <in_stream> has only been appended to. The new frame ends
+ * with an index of all frames, so decoding the result is the same as
+ * decoding the whole stream compressed at once. Nothing in front of the
+ * new frame is rewritten, and <out_stream> is cut back to its old size if
+ * an error occurs while appending. The new frame is on the storage device
+ * once this returns successfully.
+ *
+ * If the process is killed or the host crashes while appending, the frames
+ * in front of the new one remain intact, but the new frame is cut short and
+ * its index is missing. Such a file fails to load with frame_index_load(),
+ * but frame_index_load_prefix() leaves the frame out, so the old contents
+ * can still be decoded on request, and the next append replaces it. The
+ * bytes of the interrupted append are lost and compressed again by the next
+ * one. A file whose only frame was cut short, i.e. one that was compressed
+ * rather than appended to, cannot be recovered.
+ *
+ * @param params the parameters for compression of the new frame.
+ * @param in_stream the seekable stream that has grown.
+ * @param out_stream the framed stream, opened for reading and writing.
+ * @param appended set to the number of bytes appended to the uncompressed
+ * contents, 0 if <in_stream> has not grown.
+ * @return int non-zero if an error occurred, <in_stream> is shorter than
+ * the contents of <out_stream> or does not start with them, zero otherwise.
+ */
+int frame_append_stream(const struct frame_params* params, FILE* in_stream,
+    FILE* out_stream, uint64_t* appended);
+
+/**
+ * @brief Decompresses blocks up to and including an end block, as written
+ * by frame_compress_blocks().
+ *
+ * @param flags the FRAME_FLAG_* flags the blocks were written with.
+ * @param shared_tree the shared tree of blocks of bytes, may be NULL.
+ * @param shared_table the shared code of blocks of words, may be NULL.
+ * @param reader the input positioned at the first block.
+ * @param writer the output the decoded bytes are written to.
+ * @return int non-zero if an error occurred or a checksum does not match,
+ * zero otherwise.
+ */
+int frame_decompress_blocks(int flags, struct huffman_tree* shared_tree,
+    struct canonical_code_table* shared_table,
+    struct async_reader* reader, struct async_writer* writer);
+
+/**
+ * @brief Decompresses all frames of a stream.
+ *
+ * @param in_stream the stream that should be decompressed.
+ * @param out_stream the stream to which the decompressed contents
+ * should be written.
+ * @param io_backend the ASYNC_IO_* backend used to read and write.
+ * @return int non-zero if an error occurred, zero otherwise.
+ */
+int frame_decompress_stream(FILE* in_stream, FILE* out_stream, int io_backend);
+
+/**
+ * @brief Like frame_decompress_stream(), but takes the trees and tables of
+ * the frames from a cache, which is filled with the codes not found in it.
+ *
+ * @param in_stream the stream that should be decompressed.
+ * @param out_stream the stream to which the decompressed contents
+ * should be written.
+ * @param io_backend the ASYNC_IO_* backend used to read and write.
+ * @param cache the cache of codes, may be shared with other threads.
+ * @return int non-zero if an error occurred, zero otherwise.
+ */
+int frame_decompress_stream_cached(FILE* in_stream, FILE* out_stream,
+    int io_backend, struct code_cache* cache);
+
+/**
+ * @brief Like frame_decompress_stream_cached(), but delivers the decompressed
+ * contents to a sink, block by block. Blocks are decoded into the memory of
+ * the sink where it offers some, and read into it if they are stored.
+ *
+ * @param in_stream the stream that should be decompressed.
+ * @param sink the sink the decompressed contents are delivered to.
+ * @param io_backend the ASYNC_IO_* backend used to read.
+ * @param cache the cache of codes, NULL to read every code.
+ * @return int non-zero if an error occurred, zero otherwise.
+ */
+int frame_decompress_stream_sink(FILE* in_stream, const struct sink* sink,
+    int io_backend, struct code_cache* cache);
+
+
+#endif
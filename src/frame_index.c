@@ -0,0 +1,696 @@
+#include "frame_index.h"
+#include "trace.h"
+
+#include <string.h>
+
+
+struct frame_index* frame_index_create() {
+    struct frame_index* index = calloc(1, sizeof(struct frame_index));
+    if (!index) errno = ERR_MEM_ERROR;
+
+    return index;
+}
+
+int frame_index_add_frame(struct frame_index* index, int64_t offset) {
+    if (index->frame_count == index->frame_capacity) {
+        size_t capacity = index->frame_capacity ? index->frame_capacity * 2 : 4;
+        struct frame_index_frame* frames = realloc(index->frames,
+            capacity * sizeof(struct frame_index_frame));
+        if (!frames) {
+            errno = ERR_MEM_ERROR;
+            return 1;
+        }
+        index->frames = frames;
+        index->frame_capacity = capacity;
+    }
+
+    index->frames[index->frame_count].offset = offset;
+    index->frames[index->frame_count].flags = 0;
+    index->frames[index->frame_count].shared_tree = NULL;
+    index->frames[index->frame_count].shared_table = NULL;
+    index->frames[index->frame_count].checksum = 0;
+    index->frame_count++;
+
+    return 0;
+}
+
+int frame_index_add_block(struct frame_index* index, int64_t offset,
+        uint32_t raw_size) {
+    if (index->frame_count == 0) {
+        errno = ERR_ILLEGAL_ARG;
+        return 1;
+    }
+
+    if (index->entry_count == index->entry_capacity) {
+        size_t capacity = index->entry_capacity ? index->entry_capacity * 2 : 64;
+        struct frame_index_entry* entries = realloc(index->entries,
+            capacity * sizeof(struct frame_index_entry));
+        if (!entries) {
+            errno = ERR_MEM_ERROR;
+            return 1;
+        }
+        index->entries = entries;
+        index->entry_capacity = capacity;
+    }
+
+    struct frame_index_entry* entry = &index->entries[index->entry_count++];
+    entry->raw_offset = index->raw_size;
+    entry->offset = offset;
+    entry->raw_size = raw_size;
+    entry->frame = (uint32_t)(index->frame_count - 1);
+    index->raw_size += raw_size;
+
+    return 0;
+}
+
+uint64_t frame_index_footer_size(uint64_t block_count) {
+    return 2 * FRAME_BLOCK_HEADER_SIZE + FRAME_INDEX_HEADER_SIZE
+        + block_count * FRAME_INDEX_ENTRY_SIZE;
+}
+
+int frame_index_write(struct frame_index* index, struct async_writer* writer,
+        uint32_t checksum) {
+    uint64_t payload_size = FRAME_INDEX_HEADER_SIZE
+        + (uint64_t)index->entry_count * FRAME_INDEX_ENTRY_SIZE;
+    if (index->frame_count == 0
+            || payload_size + FRAME_BLOCK_HEADER_SIZE > UINT32_MAX) {
+        errno = ERR_ILLEGAL_ARG;
+        return 1;
+    }
+
+    int64_t position = async_writer_position(writer);
+    uint8_t header[FRAME_BLOCK_HEADER_SIZE + FRAME_INDEX_HEADER_SIZE];
+    header[0] = FRAME_BLOCK_INDEX;
+    io_put_u32(header + 1, 0);
+    io_put_u32(header + 5, (uint32_t)payload_size);
+    io_put_u32(header + 9, (uint32_t)index->entry_count);
+    io_put_u64(header + 13, (uint64_t)(position - index->frames[0].offset));
+    if (async_writer_write(writer, header, sizeof(header))) return 1;
+
+    for (size_t i = 0; i < index->entry_count; i++) {
+        struct frame_index_entry* entry = &index->entries[i];
+        uint8_t buffer[FRAME_INDEX_ENTRY_SIZE];
+        io_put_u64(buffer, entry->raw_offset);
+        io_put_u64(buffer + 8, (uint64_t)(position - entry->offset));
+        io_put_u64(buffer + 16,
+            (uint64_t)(position - index->frames[entry->frame].offset));
+        io_put_u32(buffer + 24, entry->raw_size);
+        if (async_writer_write(writer, buffer, FRAME_INDEX_ENTRY_SIZE)) return 1;
+    }
+
+    uint8_t end_block[FRAME_BLOCK_HEADER_SIZE] = { FRAME_BLOCK_END };
+    io_put_u32(end_block + 1, checksum);
+    io_put_u32(end_block + 5, (uint32_t)(payload_size + FRAME_BLOCK_HEADER_SIZE));
+
+    return async_writer_write(writer, end_block, FRAME_BLOCK_HEADER_SIZE);
+}
+
+
+int _frame_index_read_footer(struct frame_index* index, FILE* stream,
+        int64_t size) {
+    uint8_t header[FRAME_BLOCK_HEADER_SIZE + FRAME_INDEX_HEADER_SIZE];
+    if (size < (int64_t)frame_index_footer_size(0)
+            || io_read_at(stream, header, FRAME_BLOCK_HEADER_SIZE,
+                size - FRAME_BLOCK_HEADER_SIZE) != FRAME_BLOCK_HEADER_SIZE
+            || header[0] != FRAME_BLOCK_END) {
+        return 1;
+    }
+
+    uint32_t index_block_size = io_get_u32(header + 5);
+    int64_t position = size - FRAME_BLOCK_HEADER_SIZE - index_block_size;
+    if (index_block_size < FRAME_BLOCK_HEADER_SIZE + FRAME_INDEX_HEADER_SIZE
+            || position < FRAME_MAGIC_SIZE + 1
+            || io_read_at(stream, header, sizeof(header), position)
+                != sizeof(header)
+            || header[0] != FRAME_BLOCK_INDEX || io_get_u32(header + 1) != 0
+            || io_get_u32(header + 5) + FRAME_BLOCK_HEADER_SIZE
+                != index_block_size) {
+        return 1;
+    }
+
+    /* Indexes that only cover the frames at the end of the file, such as
+     * those of files that have been concatenated, are of no use. */
+    uint64_t count = io_get_u32(header + 9);
+    if (io_get_u64(header + 13) != (uint64_t)position
+            || FRAME_INDEX_HEADER_SIZE + count * FRAME_INDEX_ENTRY_SIZE
+                != io_get_u32(header + 5)) {
+        return 1;
+    }
+
+    size_t entries_size = (size_t)count * FRAME_INDEX_ENTRY_SIZE;
+    uint8_t* entries = malloc(entries_size ? entries_size : 1);
+    if (!entries) return 1;
+
+    int error_code = io_read_at(stream, entries, entries_size,
+            position + FRAME_BLOCK_HEADER_SIZE + FRAME_INDEX_HEADER_SIZE)
+        != entries_size;
+    int64_t frame_distance = -1;
+    for (uint64_t i = 0; !error_code && i < count; i++) {
+        const uint8_t* buffer = entries + i * FRAME_INDEX_ENTRY_SIZE;
+        uint64_t raw_offset = io_get_u64(buffer);
+        uint64_t block_distance = io_get_u64(buffer + 8);
+        uint64_t distance = io_get_u64(buffer + 16);
+        uint32_t raw_size = io_get_u32(buffer + 24);
+
+        if (raw_offset != index->raw_size || raw_size > FRAME_MAX_BLOCK_SIZE
+                || distance > (uint64_t)position
+                || block_distance >= distance) {
+            error_code = 1;
+            break;
+        }
+
+        if ((int64_t)distance != frame_distance) {
+            frame_distance = (int64_t)distance;
+            error_code = frame_index_add_frame(index, position - frame_distance);
+        }
+        error_code = error_code || frame_index_add_block(index,
+            position - (int64_t)block_distance, raw_size);
+    }
+    free(entries);
+
+    return error_code;
+}
+
+/* Returns the size of the code at an offset, 0 if it cannot be read. */
+size_t _frame_index_code_size(FILE* stream, int flags, int64_t offset) {
+    uint8_t header[FRAME_CODE_HEADER_SIZE];
+    if (io_read_at(stream, header, FRAME_CODE_HEADER_SIZE, offset)
+            != FRAME_CODE_HEADER_SIZE) {
+        return 0;
+    }
+
+    return frame_code_size(flags, header);
+}
+
+size_t _frame_index_ans_size(FILE* stream, int64_t offset) {
+    uint8_t header[ANS_CODE_HEADER_SIZE];
+    if (io_read_at(stream, header, ANS_CODE_HEADER_SIZE, offset)
+            != ANS_CODE_HEADER_SIZE) {
+        return 0;
+    }
+
+    return ans_code_table_size(header);
+}
+
+/* Walks the block headers of all frames. <complete_size> is set to the end
+ * of the last frame whose end block was reached. */
+int _frame_index_scan(struct frame_index* index, FILE* stream, int64_t size,
+        int64_t* complete_size) {
+    int64_t position = 0;
+    *complete_size = 0;
+    while (position < size) {
+        uint8_t header[FRAME_BLOCK_HEADER_SIZE];
+        if (io_read_at(stream, header, FRAME_MAGIC_SIZE + 1, position)
+                != FRAME_MAGIC_SIZE + 1
+                || memcmp(header, FRAME_MAGIC, FRAME_MAGIC_SIZE)
+                || frame_index_add_frame(index, position)) {
+            return 1;
+        }
+        int flags = header[FRAME_MAGIC_SIZE];
+        position += FRAME_MAGIC_SIZE + 1;
+
+        if (flags & FRAME_FLAG_SHARED_TREE) {
+            size_t code_size = _frame_index_code_size(stream, flags, position);
+            if (code_size == 0) return 1;
+            position += (int64_t)code_size;
+        }
+
+        for (;;) {
+            if (io_read_at(stream, header, FRAME_BLOCK_HEADER_SIZE, position)
+                    != FRAME_BLOCK_HEADER_SIZE) {
+                return 1;
+            }
+
+            int type = header[0];
+            uint32_t raw_size = io_get_u32(header + 1);
+            int64_t block_position = position;
+            position += FRAME_BLOCK_HEADER_SIZE;
+
+            if (type == FRAME_BLOCK_END) {
+                index->frames[index->frame_count - 1].checksum = raw_size;
+                break;
+            }
+            if (type == FRAME_BLOCK_INDEX) {
+                position += io_get_u32(header + 5);
+                continue;
+            }
+            if ((type > FRAME_BLOCK_STORED && type != FRAME_BLOCK_ANS)
+                    || raw_size > FRAME_MAX_BLOCK_SIZE) {
+                return 1;
+            }
+            if (flags & FRAME_FLAG_CHECKSUM) position += CRC32C_SIZE;
+            if (flags & FRAME_FLAG_TRANSFORM) position += FRAME_TRANSFORM_SIZE;
+
+            if (type == FRAME_BLOCK_OWN_TREE || type == FRAME_BLOCK_ANS) {
+                size_t code_size = type == FRAME_BLOCK_ANS
+                    ? _frame_index_ans_size(stream, position)
+                    : _frame_index_code_size(stream, flags, position);
+                if (code_size == 0) return 1;
+                position += (int64_t)code_size;
+            }
+            position += io_get_u32(header + 5);
+
+            if (frame_index_add_block(index, block_position, raw_size)) return 1;
+        }
+        *complete_size = position;
+    }
+
+    return position != size;
+}
+
+/* Removes the frames and blocks from an offset on, none of which have their
+ * shared codes loaded yet. */
+void _frame_index_cut(struct frame_index* index, int64_t size) {
+    while (index->entry_count > 0
+            && index->entries[index->entry_count - 1].offset >= size) {
+        index->raw_size -= index->entries[--index->entry_count].raw_size;
+    }
+    while (index->frame_count > 0
+            && index->frames[index->frame_count - 1].offset >= size) {
+        index->frame_count--;
+    }
+}
+
+int _frame_index_read_code(FILE* stream, int flags, int64_t offset,
+        struct huffman_tree** tree, struct canonical_code_table** table,
+        size_t* size) {
+    *size = _frame_index_code_size(stream, flags, offset);
+    if (*size == 0) {
+        errno = ERR_PARSE_ERROR;
+        return 1;
+    }
+
+    uint8_t* buffer = malloc(*size);
+    if (!buffer) {
+        errno = ERR_MEM_ERROR;
+        return 1;
+    }
+
+    int error_code = io_read_at(stream, buffer, *size, offset) != *size;
+    if (error_code) {
+        errno = ERR_PARSE_ERROR;
+    } else {
+        error_code = frame_read_code(flags, buffer, *size, tree, table);
+    }
+    free(buffer);
+
+    return error_code;
+}
+
+void _frame_index_reset(struct frame_index* index) {
+    for (size_t i = 0; i < index->frame_count; i++) {
+        if (index->frames[i].shared_tree) {
+            huffman_tree_free(index->frames[i].shared_tree);
+        }
+        if (index->frames[i].shared_table) {
+            canonical_code_table_free(index->frames[i].shared_table);
+        }
+    }
+    index->frame_count = 0;
+    index->entry_count = 0;
+    index->raw_size = 0;
+}
+
+struct frame_index* _frame_index_open(FILE* stream, int scan, int prefix) {
+    int64_t size = io_stream_size(stream);
+    if (size < 0) {
+        errno = ERR_IO_ERROR;
+        return NULL;
+    }
+
+    struct frame_index* index = frame_index_create();
+    if (!index) return NULL;
+
+    index->size = size;
+    if (scan || _frame_index_read_footer(index, stream, size)) {
+        _frame_index_reset(index);
+        int64_t complete_size;
+        int error_code = _frame_index_scan(index, stream, size, &complete_size);
+
+        /* The frames in front of one cut short, as an append interrupted
+         * by a crash leaves it, are still of use to those asking for them. */
+        if (error_code && prefix && complete_size > 0) {
+            _frame_index_cut(index, complete_size);
+            index->size = complete_size;
+            error_code = 0;
+        }
+        if (error_code) {
+            frame_index_free(index);
+            errno = ERR_PARSE_ERROR;
+            return NULL;
+        }
+    }
+
+    for (size_t i = 0; i < index->frame_count; i++) {
+        struct frame_index_frame* frame = &index->frames[i];
+        uint8_t header[FRAME_MAGIC_SIZE + 1];
+        if (io_read_at(stream, header, sizeof(header), frame->offset)
+                != sizeof(header)
+                || memcmp(header, FRAME_MAGIC, FRAME_MAGIC_SIZE)
+                || (header[FRAME_MAGIC_SIZE] & ~FRAME_FLAGS)) {
+            frame_index_free(index);
+            errno = ERR_PARSE_ERROR;
+            return NULL;
+        }
+        frame->flags = header[FRAME_MAGIC_SIZE];
+
+        if (header[FRAME_MAGIC_SIZE] & FRAME_FLAG_SHARED_TREE) {
+            size_t code_size;
+            if (_frame_index_read_code(stream, frame->flags,
+                    frame->offset + FRAME_MAGIC_SIZE + 1, &frame->shared_tree,
+                    &frame->shared_table, &code_size)) {
+                frame_index_free(index);
+                return NULL;
+            }
+        }
+    }
+
+    return index;
+}
+
+struct frame_index* frame_index_load(FILE* stream) {
+    return _frame_index_open(stream, 0, 0);
+}
+
+struct frame_index* frame_index_load_prefix(FILE* stream) {
+    return _frame_index_open(stream, 0, 1);
+}
+
+struct frame_index* frame_index_scan(FILE* stream) {
+    return _frame_index_open(stream, 1, 0);
+}
+
+size_t frame_index_find(struct frame_index* index, uint64_t raw_offset) {
+    size_t low = 0;
+    size_t high = index->entry_count;
+
+    /* The first block ending after <raw_offset> contains it. */
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        struct frame_index_entry* entry = &index->entries[middle];
+        if (entry->raw_offset + entry->raw_size <= raw_offset) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    return low;
+}
+
+int frame_index_decode_block(struct frame_index* index, FILE* stream,
+        const struct frame_index_entry* entry, uint8_t* output,
+        uint8_t** scratch, size_t* scratch_capacity, uint32_t* checksum) {
+    int flags = index->frames[entry->frame].flags;
+    size_t checksum_size = (flags & FRAME_FLAG_CHECKSUM) ? CRC32C_SIZE : 0;
+    size_t header_size = FRAME_BLOCK_HEADER_SIZE + checksum_size
+        + ((flags & FRAME_FLAG_TRANSFORM) ? FRAME_TRANSFORM_SIZE : 0);
+
+    uint8_t header[FRAME_BLOCK_HEADER_SIZE + CRC32C_SIZE + FRAME_TRANSFORM_SIZE];
+    if (io_read_at(stream, header, header_size, entry->offset) != header_size) {
+        errno = ERR_PARSE_ERROR;
+        return 1;
+    }
+
+    int type = header[0];
+    uint32_t payload_size = io_get_u32(header + 5);
+    struct transform transform;
+    if (frame_read_transform(flags,
+            header + FRAME_BLOCK_HEADER_SIZE + checksum_size, &transform)) {
+        return 1;
+    }
+    struct huffman_tree* tree = index->frames[entry->frame].shared_tree;
+    struct canonical_code_table* table = index->frames[entry->frame].shared_table;
+    if (type < FRAME_BLOCK_SHARED_TREE
+            || (type > FRAME_BLOCK_STORED && type != FRAME_BLOCK_ANS)
+            || (type == FRAME_BLOCK_ANS && (flags & FRAME_FLAG_WIDE))
+            || io_get_u32(header + 1) != entry->raw_size
+            || payload_size > FRAME_MAX_BLOCK_SIZE
+            || (type == FRAME_BLOCK_SHARED_TREE && !tree && !table)) {
+        errno = ERR_PARSE_ERROR;
+        return 1;
+    }
+
+    int64_t payload_offset = entry->offset + (int64_t)header_size;
+    if (type == FRAME_BLOCK_OWN_TREE) {
+        size_t code_size;
+        if (_frame_index_read_code(stream, flags, payload_offset,
+                &tree, &table, &code_size)) {
+            return 1;
+        }
+        payload_offset += (int64_t)code_size;
+    }
+
+    struct ans_code_table* ans = NULL;
+    if (type == FRAME_BLOCK_ANS) {
+        uint8_t code[ANS_CODE_MAX_SIZE];
+        size_t code_size = _frame_index_ans_size(stream, payload_offset);
+        if (code_size == 0 || io_read_at(stream, code, code_size, payload_offset)
+                != code_size) {
+            errno = ERR_PARSE_ERROR;
+            return 1;
+        }
+        ans = ans_code_read_table(code, code_size);
+        if (!ans) return 1;
+        payload_offset += (int64_t)code_size;
+    }
+
+    TRACE_BEGIN(read_start);
+    int error_code = frame_reserve(scratch, scratch_capacity, payload_size);
+    if (!error_code && io_read_at(stream, *scratch, payload_size,
+            payload_offset) != payload_size) {
+        errno = ERR_PARSE_ERROR;
+        error_code = 1;
+    }
+    TRACE_END(read_start, "read", payload_size);
+
+    if (!error_code) {
+        TRACE_BEGIN(decode_start);
+        error_code = frame_decode_payload(type, flags, tree, table, ans,
+            &transform, *scratch, payload_size, output, entry->raw_size);
+        TRACE_END(decode_start, "decode", entry->raw_size);
+    }
+
+    if (!error_code && (flags & FRAME_FLAG_CHECKSUM)) {
+        uint32_t block_checksum = crc32c_update(0, output, entry->raw_size);
+        if (block_checksum != io_get_u32(header + FRAME_BLOCK_HEADER_SIZE)) {
+            errno = ERR_CHECKSUM_ERROR;
+            error_code = 1;
+        }
+        if (checksum) *checksum = block_checksum;
+    }
+
+    if (type == FRAME_BLOCK_OWN_TREE) {
+        if (tree) huffman_tree_free(tree);
+        if (table) canonical_code_table_free(table);
+    }
+    if (ans) ans_code_table_free(ans);
+
+    return error_code;
+}
+
+int frame_index_block_symbols(struct frame_index* index, FILE* stream,
+        const struct frame_index_entry* entry, uint8_t* present) {
+    int flags = index->frames[entry->frame].flags;
+    size_t checksum_size = (flags & FRAME_FLAG_CHECKSUM) ? CRC32C_SIZE : 0;
+    size_t header_size = FRAME_BLOCK_HEADER_SIZE + checksum_size
+        + ((flags & FRAME_FLAG_TRANSFORM) ? FRAME_TRANSFORM_SIZE : 0);
+
+    uint8_t header[FRAME_BLOCK_HEADER_SIZE + CRC32C_SIZE + FRAME_TRANSFORM_SIZE];
+    if (io_read_at(stream, header, header_size, entry->offset) != header_size) {
+        errno = ERR_PARSE_ERROR;
+        return 1;
+    }
+
+    int type = header[0];
+    struct transform transform;
+    if (frame_read_transform(flags,
+            header + FRAME_BLOCK_HEADER_SIZE + checksum_size, &transform)) {
+        return 1;
+    }
+
+    /* The code describes the transformed bytes, not the decoded ones. */
+    if ((flags & FRAME_FLAG_WIDE) || transform.type != TRANSFORM_NONE
+            || (type != FRAME_BLOCK_SHARED_TREE && type != FRAME_BLOCK_OWN_TREE
+                && type != FRAME_BLOCK_ANS)) {
+        memset(present, 1, 256);
+        return 0;
+    }
+    memset(present, 0, 256);
+
+    int64_t code_offset = entry->offset + (int64_t)header_size;
+    if (type == FRAME_BLOCK_SHARED_TREE) {
+        struct huffman_tree* tree = index->frames[entry->frame].shared_tree;
+        if (!tree) {
+            errno = ERR_PARSE_ERROR;
+            return 1;
+        }
+        huffman_tree_mark_symbols(tree, present);
+    } else if (type == FRAME_BLOCK_OWN_TREE) {
+        struct huffman_tree* tree = NULL;
+        struct canonical_code_table* table = NULL;
+        size_t code_size;
+        if (_frame_index_read_code(stream, flags, code_offset,
+                &tree, &table, &code_size)) {
+            return 1;
+        }
+        huffman_tree_mark_symbols(tree, present);
+        huffman_tree_free(tree);
+    } else {
+        /* A byte can only be encoded if its count in the table is not 0. */
+        uint8_t code[ANS_CODE_MAX_SIZE];
+        size_t code_size = _frame_index_ans_size(stream, code_offset);
+        if (code_size == 0 || io_read_at(stream, code, code_size, code_offset)
+                != code_size) {
+            errno = ERR_PARSE_ERROR;
+            return 1;
+        }
+        for (size_t i = ANS_CODE_HEADER_SIZE; i + 1 < code_size; i += 2) {
+            present[(i - ANS_CODE_HEADER_SIZE) / 2] = code[i] || code[i + 1];
+        }
+    }
+
+    return 0;
+}
+
+void frame_index_free(struct frame_index* index) {
+    _frame_index_reset(index);
+    free(index->entries);
+    free(index->frames);
+    free(index);
+}
+
+
+int frame_index_decompress_range(struct frame_index* index, FILE* in_stream,
+        FILE* out_stream, uint64_t start, uint64_t length) {
+    uint8_t* scratch = NULL;
+    size_t scratch_capacity = 0;
+    uint8_t* output = NULL;
+    size_t output_capacity = 0;
+
+    uint64_t end = start + length < start ? UINT64_MAX : start + length;
+    int error_code = 0;
+    for (size_t i = frame_index_find(index, start);
+            !error_code && i < index->entry_count; i++) {
+        struct frame_index_entry* entry = &index->entries[i];
+        if (entry->raw_offset >= end) break;
+
+        error_code = frame_reserve(&output, &output_capacity, entry->raw_size)
+            || frame_index_decode_block(index, in_stream, entry, output,
+                &scratch, &scratch_capacity, NULL);
+        if (error_code) break;
+
+        uint64_t first = start > entry->raw_offset ? start - entry->raw_offset : 0;
+        uint64_t last = end - entry->raw_offset < entry->raw_size
+            ? end - entry->raw_offset : entry->raw_size;
+        if (fwrite(output + first, 1, (size_t)(last - first), out_stream)
+                != last - first) {
+            errno = ERR_IO_ERROR;
+            error_code = 1;
+        }
+    }
+
+    free(output);
+    free(scratch);
+
+    return error_code;
+}
+
+int frame_decompress_range(FILE* in_stream, FILE* out_stream,
+        uint64_t start, uint64_t length) {
+    struct frame_index* index = frame_index_load(in_stream);
+    if (!index) return 1;
+
+    int error_code = frame_index_decompress_range(index, in_stream, out_stream,
+        start, length);
+    frame_index_free(index);
+
+    return error_code;
+}
+
+
+/* Adds the frames and blocks of a file to an index, shifted to where the
+ * file starts in the merged file, and returns the size of its frames. */
+int _frame_index_merge(struct frame_index* merged, FILE* stream, int64_t base,
+        int64_t* size) {
+    /* A file ending in a frame cut short is refused rather than merged
+     * without it, which would hide the loss behind a valid index. */
+    struct frame_index* index = frame_index_load(stream);
+    if (!index) return 1;
+    *size = index->size;
+
+    /* The merged index covers every file from its start, even if its first
+     * frame holds no blocks and is therefore not in its index. */
+    int error_code = 0;
+    size_t frame_base = merged->frame_count;
+    if (index->frame_count == 0 || index->frames[0].offset != 0) {
+        error_code = frame_index_add_frame(merged, base);
+        frame_base++;
+    }
+    for (size_t i = 0; !error_code && i < index->frame_count; i++) {
+        error_code = frame_index_add_frame(merged, base + index->frames[i].offset);
+    }
+    for (size_t i = 0; !error_code && i < index->entry_count; i++) {
+        struct frame_index_entry* entry = &index->entries[i];
+        error_code = frame_index_add_block(merged, base + entry->offset,
+            entry->raw_size);
+        if (!error_code) {
+            merged->entries[merged->entry_count - 1].frame
+                = (uint32_t)(frame_base + entry->frame);
+        }
+    }
+    frame_index_free(index);
+
+    return error_code;
+}
+
+int frame_merge_streams(FILE* const* in_streams, size_t count,
+        FILE* out_stream, int io_backend) {
+    if (count == 0) {
+        errno = ERR_ILLEGAL_ARG;
+        return 1;
+    }
+
+    struct frame_index* merged = frame_index_create();
+    uint8_t* buffer = malloc(ASYNC_IO_DEFAULT_CHUNK_SIZE);
+    struct async_writer* writer = merged && buffer
+        ? async_writer_create(out_stream, io_backend,
+            ASYNC_IO_DEFAULT_CHUNK_SIZE, ASYNC_IO_DEFAULT_DEPTH)
+        : NULL;
+    if (!buffer) errno = ERR_MEM_ERROR;
+
+    int error_code = !writer;
+    for (size_t i = 0; !error_code && i < count; i++) {
+        int64_t size = 0;
+        error_code = _frame_index_merge(merged, in_streams[i],
+                async_writer_position(writer), &size)
+            || io_seek(in_streams[i], 0, SEEK_SET);
+
+        /* The frames are copied as they are, without being decoded. */
+        while (!error_code && size > 0) {
+            size_t chunk = size < ASYNC_IO_DEFAULT_CHUNK_SIZE
+                ? (size_t)size : ASYNC_IO_DEFAULT_CHUNK_SIZE;
+            if (frame_read_fully(in_streams[i], buffer, chunk) != chunk) {
+                errno = ERR_IO_ERROR;
+                error_code = 1;
+                break;
+            }
+            error_code = async_writer_write(writer, buffer, chunk);
+            size -= (int64_t)chunk;
+        }
+    }
+
+    /* An empty frame at the end holds the index of all frames before it. */
+    uint8_t header[FRAME_MAGIC_SIZE + 1] = FRAME_MAGIC;
+    header[FRAME_MAGIC_SIZE] = 0;
+    error_code = error_code
+        || async_writer_write(writer, header, sizeof(header))
+        || frame_index_write(merged, writer, 0)
+        || async_writer_finish(writer);
+
+    if (writer) async_writer_free(writer);
+    if (merged) frame_index_free(merged);
+    free(buffer);
+
+    return error_code;
+}
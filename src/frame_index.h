@@ -0,0 +1,278 @@
+#ifndef FRAME_INDEX_H
+#define FRAME_INDEX_H
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "error.h"
+#include "io_util.h"
+#include "huffman_tree.h"
+#include "frame.h"
+
+
+/*
+ * The index block at the end of a frame lists every block of the frames it
+ * covers, so that a byte range can be decoded without reading the blocks in
+ * front of it. Positions are stored as distances back from the index block,
+ * which keeps an index valid when the file it is in is moved or prefixed.
+ *
+ * index := count:u32 coverage_distance:u64 entry*
+ * entry := raw_offset:u64 block_distance:u64 frame_distance:u64 raw_size:u32
+ *
+ * <coverage_distance> points to the first frame the index covers and
+ * <raw_offset> is the uncompressed offset of a block relative to that frame.
+ * <block_distance> and <frame_distance> point to the header of the block
+ * and of the frame it belongs to.
+ */
+
+#define FRAME_INDEX_HEADER_SIZE 12
+#define FRAME_INDEX_ENTRY_SIZE 28
+
+
+/**
+ * @brief A frame known to an index.
+ */
+struct frame_index_frame {
+    /** Offset of the magic of the frame in the file. */
+    int64_t offset;
+    /** The FRAME_FLAG_* flags of the frame, valid once it has been loaded. */
+    int flags;
+    /** The shared tree of a frame of bytes once loaded, NULL otherwise. */
+    struct huffman_tree* shared_tree;
+    /** The shared code of a frame of words once loaded, NULL otherwise. */
+    struct canonical_code_table* shared_table;
+    /**
+     * The checksum stored in the end block of the frame. Only known to
+     * indexes created by frame_index_scan(), 0 otherwise.
+     */
+    uint32_t checksum;
+};
+
+/**
+ * @brief A block known to an index.
+ */
+struct frame_index_entry {
+    /** Offset of the first byte of the block in the uncompressed data. */
+    uint64_t raw_offset;
+    /** Offset of the block header in the file. */
+    int64_t offset;
+    /** Number of bytes the block decodes to. */
+    uint32_t raw_size;
+    /** Position of the frame of the block in the frames of the index. */
+    uint32_t frame;
+};
+
+/**
+ * @brief The blocks of one or more consecutive frames, sorted by
+ * their uncompressed offsets.
+ */
+struct frame_index {
+    struct frame_index_entry* entries;
+    size_t entry_count;
+    size_t entry_capacity;
+    struct frame_index_frame* frames;
+    size_t frame_count;
+    size_t frame_capacity;
+    /** Number of bytes all blocks decode to together. */
+    uint64_t raw_size;
+    /**
+     * Number of bytes of the file the frames of the index take up, which
+     * is less than the size of the file if frame_index_load_prefix() left
+     * out a frame cut short at its end.
+     */
+    int64_t size;
+};
+
+
+/**
+ * @brief Creates an empty index.
+ *
+ * @return struct frame_index* the created index.
+ * Must be freed with a call to frame_index_free().
+ */
+struct frame_index* frame_index_create();
+
+/**
+ * @brief Records the start of a frame. Blocks added afterwards belong to it.
+ *
+ * @param index the index to be extended.
+ * @param offset the offset of the magic of the frame in the file.
+ * @return int non-zero if an error occurred, zero otherwise.
+ */
+int frame_index_add_frame(struct frame_index* index, int64_t offset);
+
+/**
+ * @brief Records a block of the last frame added.
+ *
+ * @param index the index to be extended.
+ * @param offset the offset of the block header in the file.
+ * @param raw_size the number of bytes the block decodes to.
+ * @return int non-zero if an error occurred, zero otherwise.
+ */
+int frame_index_add_block(struct frame_index* index, int64_t offset,
+    uint32_t raw_size);
+
+/**
+ * @brief Returns the number of bytes of the index block and end block
+ * written for an index of a number of blocks.
+ *
+ * @param block_count the number of blocks in the index.
+ * @return uint64_t the size of both blocks together.
+ */
+uint64_t frame_index_footer_size(uint64_t block_count);
+
+/**
+ * @brief Writes the index block and the end block that terminate a frame.
+ * The offsets of <index> must be relative to the start of <writer>.
+ *
+ * @param index the index to be written.
+ * @param writer the writer the blocks are appended to.
+ * @param checksum the checksum of the contents of the frame, stored in the
+ * end block.
+ * @return int non-zero if an error occurred, zero otherwise.
+ */
+int frame_index_write(struct frame_index* index, struct async_writer* writer,
+    uint32_t checksum);
+
+/**
+ * @brief Loads the index of a seekable file of frames, together with the
+ * shared codes of its frames. Files without a usable index at their end
+ * are indexed by walking the block headers, and fail to load if their last
+ * frame is cut short.
+ *
+ * @param stream the stream of the file, its position is not changed.
+ * @return struct frame_index* the index of all blocks in <stream>.
+ * Must be freed with a call to frame_index_free().
+ */
+struct frame_index* frame_index_load(FILE* stream);
+
+/**
+ * @brief Loads the index of a seekable file of frames like
+ * frame_index_load(), except that a frame at the end of the file that ends
+ * before its end block, such as the one an append interrupted by a crash
+ * leaves behind, is left out of the index if any frame in front of it is
+ * complete. <size> of the index then tells where that frame starts, and
+ * the caller decides whether losing its contents is acceptable.
+ *
+ * @param stream the stream of the file, its position is not changed.
+ * @return struct frame_index* the index of the complete frames of <stream>.
+ * Must be freed with a call to frame_index_free().
+ */
+struct frame_index* frame_index_load_prefix(FILE* stream);
+
+/**
+ * @brief Indexes a seekable file of frames by walking its block headers,
+ * ignoring any index stored in it. Unlike frame_index_load(), this checks
+ * that the file is complete, including its last frame, and records the
+ * checksums of the frames.
+ *
+ * @param stream the stream of the file, its position is not changed.
+ * @return struct frame_index* the index of all blocks in <stream>.
+ * Must be freed with a call to frame_index_free().
+ */
+struct frame_index* frame_index_scan(FILE* stream);
+
+/**
+ * @brief Finds the block containing an uncompressed offset.
+ *
+ * @param index the index to be searched.
+ * @param raw_offset the offset in the uncompressed data.
+ * @return size_t the position of the block in the entries of <index>,
+ * or the number of entries if <raw_offset> is past the end.
+ */
+size_t frame_index_find(struct frame_index* index, uint64_t raw_offset);
+
+/**
+ * @brief Decodes a single block of an indexed file. Different blocks of
+ * the same stream may be decoded from several threads at once.
+ *
+ * @param index the index of <stream>, as returned by frame_index_load().
+ * @param stream the stream of the file.
+ * @param entry the block to be decoded.
+ * @param output the buffer of at least <entry->raw_size> bytes to decode to.
+ * @param scratch a heap buffer reused for the payload, may point to NULL.
+ * Must be freed by the caller.
+ * @param scratch_capacity the capacity of <scratch>.
+ * @param checksum set to the checksum of the decoded bytes if the block
+ * stores one, which has been verified. May be NULL.
+ * @return int non-zero if an error occurred, zero otherwise. errno is set
+ * to ERR_CHECKSUM_ERROR if the block decodes to bytes that do not match
+ * its checksum.
+ */
+int frame_index_decode_block(struct frame_index* index, FILE* stream,
+    const struct frame_index_entry* entry, uint8_t* output,
+    uint8_t** scratch, size_t* scratch_capacity, uint32_t* checksum);
+
+/**
+ * @brief Finds the bytes a block can decode to from its code alone,
+ * without decoding it. Blocks without a code of bytes, i.e. stored blocks,
+ * transformed blocks and blocks of 16 bit words, can hold any byte.
+ *
+ * @param index the index of <stream>, as returned by frame_index_load().
+ * @param stream the stream of the file.
+ * @param entry the block to be examined.
+ * @param present the 256 flags of the bytes, set to 1 for every byte the
+ * block may hold and to 0 for every byte it cannot hold.
+ * @return int non-zero if an error occurred, zero otherwise.
+ */
+int frame_index_block_symbols(struct frame_index* index, FILE* stream,
+    const struct frame_index_entry* entry, uint8_t* present);
+
+/**
+ * @brief Frees an index and the shared codes it holds.
+ *
+ * @param index the index to be freed.
+ */
+void frame_index_free(struct frame_index* index);
+
+
+/**
+ * @brief Decompresses a range of bytes of a seekable file of frames through
+ * an index already loaded, decoding only the blocks that overlap it. Ranges
+ * reaching past the end of the blocks of the index are cut off there.
+ *
+ * @param index the index of <in_stream>, as returned by frame_index_load()
+ * or frame_index_load_prefix().
+ * @param in_stream the stream of the compressed file.
+ * @param out_stream the stream the range is written to.
+ * @param start the uncompressed offset of the first byte of the range.
+ * @param length the number of bytes in the range.
+ * @return int non-zero if an error occurred, zero otherwise.
+ */
+int frame_index_decompress_range(struct frame_index* index, FILE* in_stream,
+    FILE* out_stream, uint64_t start, uint64_t length);
+
+/**
+ * @brief Decompresses a range of bytes of a seekable file of frames,
+ * decoding only the blocks that overlap it. Ranges reaching past the end
+ * of the uncompressed data are cut off there.
+ *
+ * @param in_stream the stream of the compressed file.
+ * @param out_stream the stream the range is written to.
+ * @param start the uncompressed offset of the first byte of the range.
+ * @param length the number of bytes in the range.
+ * @return int non-zero if an error occurred, zero otherwise.
+ */
+int frame_decompress_range(FILE* in_stream, FILE* out_stream,
+    uint64_t start, uint64_t length);
+
+/**
+ * @brief Merges files of frames, such as the shards of a dataset compressed
+ * on different hosts, into a file that decompresses to the concatenation of
+ * their contents. The frames are copied without being decoded and followed
+ * by an empty frame whose index covers all blocks of all files, found from
+ * the index of every file or, where a file has none, its block headers.
+ *
+ * @param in_streams the seekable streams of the files, in order.
+ * @param count the number of streams, at least 1.
+ * @param out_stream the stream the merged file is written to, at its start.
+ * @param io_backend the ASYNC_IO_* backend used to write.
+ * @return int non-zero if an error occurred, zero otherwise.
+ */
+int frame_merge_streams(FILE* const* in_streams, size_t count,
+    FILE* out_stream, int io_backend);
+
+
+#endif
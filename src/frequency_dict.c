@@ -1,42 +1,100 @@
 #include "frequency_dict.h"
 
+#include <math.h>
+#include <string.h>
+
 
 #define BUFFER_SIZE 32768
 
 
-struct freq_dict* freq_dict_create() {
+struct freq_dict* _freq_dict_create(uint32_t alphabet_size, int big_endian) {
     struct freq_dict* frequency_dict = malloc(sizeof(struct freq_dict));
     if (!frequency_dict) {
         errno = ERR_MEM_ERROR;
         return NULL;
     }
 
-    frequency_dict->frequencies = calloc(256, sizeof(int));
+    frequency_dict->frequencies = calloc(alphabet_size, sizeof(uint64_t));
     if (!frequency_dict->frequencies) {
         free(frequency_dict);
         errno = ERR_MEM_ERROR;
         return NULL;
     }
+    frequency_dict->alphabet_size = alphabet_size;
+    frequency_dict->big_endian = big_endian;
 
     return frequency_dict;
 }
 
+struct freq_dict* freq_dict_create() {
+    return _freq_dict_create(FREQ_DICT_BYTE_ALPHABET, 0);
+}
+
+struct freq_dict* freq_dict_create_wide(int big_endian) {
+    return _freq_dict_create(FREQ_DICT_WORD_ALPHABET, big_endian);
+}
+
 void freq_dict_free(struct freq_dict* frequency_dict) {
     free(frequency_dict->frequencies);
     free(frequency_dict);
 }
 
+void freq_dict_clear(struct freq_dict* frequency_dict) {
+    memset(frequency_dict->frequencies, 0,
+        frequency_dict->alphabet_size * sizeof(uint64_t));
+}
 
-int freq_dict_frequency_for(struct freq_dict* frequency_dict, uint8_t c) {
+
+uint64_t freq_dict_frequency_for(struct freq_dict* frequency_dict, uint8_t c) {
     return frequency_dict->frequencies[c];
 }
 
+uint64_t freq_dict_total(struct freq_dict* frequency_dict) {
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < frequency_dict->alphabet_size; i++) {
+        total += frequency_dict->frequencies[i];
+    }
+
+    return total;
+}
+
+double freq_dict_entropy_bits(struct freq_dict* frequency_dict) {
+    uint64_t total = freq_dict_total(frequency_dict);
+    if (!total) return 0;
+
+    double bits = 0;
+    for (uint32_t i = 0; i < frequency_dict->alphabet_size; i++) {
+        uint64_t frequency = frequency_dict->frequencies[i];
+        if (frequency) {
+            bits += (double)frequency * log2((double)total / (double)frequency);
+        }
+    }
+
+    return bits;
+}
+
+void freq_dict_add_buffer(struct freq_dict* frequency_dict,
+        const uint8_t* buffer, size_t size) {
+    uint64_t* frequencies = frequency_dict->frequencies;
+    if (frequency_dict->alphabet_size == FREQ_DICT_BYTE_ALPHABET) {
+        for (size_t i = 0; i < size; i++) {
+            frequencies[buffer[i]] += 1;
+        }
+        return;
+    }
+
+    int high = frequency_dict->big_endian ? 0 : 1;
+    for (size_t i = 0; i + 1 < size; i += 2) {
+        frequencies[((uint32_t)buffer[i + high] << 8) | buffer[i + 1 - high]] += 1;
+    }
+}
+
 
 void freq_dict_print(struct freq_dict* frequency_dict) {
     for (int i = 0; i < 256; i++) {
-        int frequency = freq_dict_frequency_for(frequency_dict, i);
+        uint64_t frequency = freq_dict_frequency_for(frequency_dict, i);
         if (frequency > 0) {
-            printf("%c:\t%d\n", i, frequency);
+            printf("%c:\t%" PRIu64 "\n", i, frequency);
         }
     }
 }
@@ -49,26 +107,154 @@ struct freq_dict* freq_dict_create_from_stream(FILE* stream) {
         return NULL;
     }
 
-    uint8_t *buffer = malloc(BUFFER_SIZE);
-    if (!buffer) {
-        errno = ERR_MEM_ERROR;
+    if (freq_dict_add_stream(ret, stream, NULL)) {
         freq_dict_free(ret);
         return NULL;
     }
+
+    return ret;
+}
+
+void _freq_dict_add_filtered(struct freq_dict* frequency_dict,
+        const struct freq_dict_filter* filter, uint8_t* buffer, size_t size) {
+    if (filter) {
+        filter->apply(filter->context, buffer, size, buffer + BUFFER_SIZE);
+        buffer += BUFFER_SIZE;
+    }
+    freq_dict_add_buffer(frequency_dict, buffer, size);
+}
+
+int freq_dict_add_stream(struct freq_dict* frequency_dict, FILE* stream,
+        const struct freq_dict_filter* filter) {
+    uint8_t *buffer = malloc(filter ? 2 * BUFFER_SIZE : BUFFER_SIZE);
+    if (!buffer) {
+        errno = ERR_MEM_ERROR;
+        return 1;
+    }
+    int64_t start = io_tell(stream);
     size_t read = 0;
     do {
         read = fread(buffer, sizeof(uint8_t), BUFFER_SIZE, stream);
-        for (size_t i = 0; i < read; i++) {
-            ret->frequencies[buffer[i]] += 1;
-        }
+        _freq_dict_add_filtered(frequency_dict, filter, buffer, read);
     } while (read != 0);
     free(buffer);
 
-    if (fseek(stream, 0, 0)) {
-        freq_dict_free(ret);
+    if (start < 0 || io_seek(stream, start, SEEK_SET)) {
         errno = ERR_IO_ERROR;
+        return 1;
+    }
+
+    return 0;
+}
+
+
+int _freq_dict_sample_range(struct freq_dict* frequency_dict, FILE* stream,
+        const struct freq_dict_filter* filter, uint8_t* buffer,
+        int64_t offset, size_t size) {
+    if (io_seek(stream, offset, SEEK_SET)) return 1;
+
+    while (size > 0) {
+        size_t chunk = size < BUFFER_SIZE ? size : BUFFER_SIZE;
+        size_t read = fread(buffer, sizeof(uint8_t), chunk, stream);
+        _freq_dict_add_filtered(frequency_dict, filter, buffer, read);
+
+        if (read != chunk) return ferror(stream) != 0;
+        size -= read;
+    }
+
+    return 0;
+}
+
+int _freq_dict_compare_offsets(const void* a, const void* b) {
+    int64_t left = *(const int64_t*)a;
+    int64_t right = *(const int64_t*)b;
+
+    return (left > right) - (left < right);
+}
+
+struct freq_dict* freq_dict_create_from_stream_sampled(FILE* stream,
+        const struct freq_dict_sampling* sampling, int* exact) {
+    struct freq_dict* ret = freq_dict_create();
+    if (!ret) return NULL;
+
+    if (freq_dict_add_stream_sampled(ret, stream, sampling, NULL, exact)) {
+        freq_dict_free(ret);
         return NULL;
     }
 
     return ret;
 }
+
+int freq_dict_add_stream_sampled(struct freq_dict* ret, FILE* stream,
+        const struct freq_dict_sampling* sampling,
+        const struct freq_dict_filter* filter, int* exact) {
+    int64_t start = io_tell(stream);
+    int64_t size = io_stream_size(stream) - start;
+    if (start < 0 || size < 0) {
+        errno = ERR_IO_ERROR;
+        return 1;
+    }
+
+    uint64_t sample_size = (uint64_t)sampling->head_size
+        + (uint64_t)sampling->probe_size * sampling->probe_count;
+    if (sample_size >= (uint64_t)size) {
+        if (exact) *exact = 1;
+        return freq_dict_add_stream(ret, stream, filter);
+    }
+
+    uint8_t* buffer = malloc(filter ? 2 * BUFFER_SIZE : BUFFER_SIZE);
+    int64_t* offsets = malloc((sampling->probe_count + 1) * sizeof(int64_t));
+    if (!buffer || !offsets) {
+        free(buffer);
+        free(offsets);
+        errno = ERR_MEM_ERROR;
+        return 1;
+    }
+
+    /* Probes are placed in the part of the stream after the head. Strided
+     * probes start every <span / probe_count> bytes, random probes are
+     * drawn from a fixed xorshift sequence so that the same input always
+     * yields the same tree. Both are visited in ascending order. */
+    int64_t span = size - (int64_t)sampling->head_size
+        - (int64_t)sampling->probe_size;
+    size_t probe_count = span > 0 ? sampling->probe_count : 0;
+    uint64_t state = 0x9E3779B97F4A7C15u;
+    for (size_t i = 0; i < probe_count; i++) {
+        int64_t position;
+        if (sampling->random) {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            position = (int64_t)(state % (uint64_t)(span + 1));
+        } else {
+            position = (int64_t)((uint64_t)span * i / probe_count);
+        }
+        offsets[i] = (int64_t)sampling->head_size + position;
+
+        /* Words must not be split by the start of a probe. */
+        if (ret->alphabet_size != FREQ_DICT_BYTE_ALPHABET) offsets[i] &= ~(int64_t)1;
+        offsets[i] += start;
+    }
+    qsort(offsets, probe_count, sizeof(int64_t), _freq_dict_compare_offsets);
+
+    int error_code = _freq_dict_sample_range(ret, stream, filter, buffer,
+        start, sampling->head_size);
+    for (size_t i = 0; i < probe_count && !error_code; i++) {
+        error_code = _freq_dict_sample_range(ret, stream, filter, buffer,
+            offsets[i], sampling->probe_size);
+    }
+    free(offsets);
+    free(buffer);
+
+    if (error_code || io_seek(stream, start, SEEK_SET)) {
+        errno = ERR_IO_ERROR;
+        return 1;
+    }
+
+    for (uint32_t i = 0; i < ret->alphabet_size; i++) {
+        if (!ret->frequencies[i]) ret->frequencies[i] = 1;
+    }
+    if (exact) *exact = 0;
+
+    return 0;
+}
@@ -7,6 +7,7 @@
 #include <inttypes.h>
 
 #include "error.h"
+#include "io_util.h"
 
 
 /**
@@ -14,9 +15,45 @@
  * occurence of characters.
  */
 struct freq_dict {
-    int* frequencies;
+    uint64_t* frequencies;
+    /** Number of symbols counted, 256 for bytes or 65536 for 16 bit words. */
+    uint32_t alphabet_size;
+    /** Non-zero if 16 bit words are stored big endian. */
+    int big_endian;
 };
 
+#define FREQ_DICT_BYTE_ALPHABET 256
+#define FREQ_DICT_WORD_ALPHABET 65536
+
+/**
+ * @brief Describes which parts of a stream are analyzed when only a
+ * sample of it is used to approximate its frequencies.
+ */
+struct freq_dict_sampling {
+    /** Number of bytes read from the start of the stream. */
+    size_t head_size;
+    /** Number of bytes read by every probe after the head. */
+    size_t probe_size;
+    /** Number of probes spread over the rest of the stream. */
+    size_t probe_count;
+    /** Non-zero to place probes at pseudo-random instead of evenly strided offsets. */
+    int random;
+};
+
+/**
+ * @brief Rewrites the bytes read from a stream before they are counted,
+ * e.g. to count them as they are going to be encoded.
+ */
+struct freq_dict_filter {
+    /** Writes the filtered form of the <size> bytes of <in> to <out>. */
+    void (*apply)(const void* context, const uint8_t* in, size_t size, uint8_t* out);
+    const void* context;
+};
+
+#define FREQ_DICT_SAMPLING_HEAD_SIZE (4u << 20)
+#define FREQ_DICT_SAMPLING_PROBE_SIZE (64u << 10)
+#define FREQ_DICT_SAMPLING_PROBE_COUNT 64
+
 /**
  * @brief Creates a frequency dictionary on the heap.
  * 
@@ -25,6 +62,16 @@ struct freq_dict {
  */
 struct freq_dict* freq_dict_create();
 
+/**
+ * @brief Creates a frequency dictionary counting 16 bit words instead of
+ * bytes. An odd byte at the end of a buffer is not counted.
+ *
+ * @param big_endian non-zero if the words are stored big endian.
+ * @return struct freq_dict* the created frequency dict.
+ * Must be freed by freq_dict_free().
+ */
+struct freq_dict* freq_dict_create_wide(int big_endian);
+
 /**
  * @brief Frees a frequency dict object.
  * 
@@ -32,15 +79,49 @@ struct freq_dict* freq_dict_create();
  */
 void freq_dict_free(struct freq_dict* frequency_dict);
 
+/**
+ * @brief Resets all frequencies of a frequency dict to zero.
+ * 
+ * @param frequency_dict the frequency dict to be cleared.
+ */
+void freq_dict_clear(struct freq_dict* frequency_dict);
+
 
 /**
  * @brief Returns the frequency of occurence of a given byte.
  * 
  * @param frequency_dict the frequency dict for lookup.
  * @param c the byte of which the frequency should be returned.
- * @return int the frequency with which <c> occurs.
+ * @return uint64_t the frequency with which <c> occurs.
+ */
+uint64_t freq_dict_frequency_for(struct freq_dict* frequency_dict, uint8_t c);
+
+/**
+ * @brief Returns the sum of all frequencies in a frequency dict.
+ * 
+ * @param frequency_dict the frequency dict to be summed up.
+ * @return uint64_t the number of symbols counted by <frequency_dict>.
  */
-int freq_dict_frequency_for(struct freq_dict* frequency_dict, uint8_t c);
+uint64_t freq_dict_total(struct freq_dict* frequency_dict);
+
+/**
+ * @brief Computes the Shannon bound for a frequency dict, i.e. the minimum
+ * number of bits any order-0 coder needs for the counted bytes.
+ * 
+ * @param frequency_dict the frequency dict to be analyzed.
+ * @return double the entropy of <frequency_dict> times its total in bits.
+ */
+double freq_dict_entropy_bits(struct freq_dict* frequency_dict);
+
+/**
+ * @brief Counts the symbols of a buffer into a frequency dict.
+ * 
+ * @param frequency_dict the frequency dict that should be updated.
+ * @param buffer the symbols to be counted.
+ * @param size the number of bytes in <buffer>.
+ */
+void freq_dict_add_buffer(struct freq_dict* frequency_dict,
+    const uint8_t* buffer, size_t size);
 
 /**
  * @brief Prints the contents of the frequency dict to stdout.
@@ -59,5 +140,51 @@ void freq_dict_print(struct freq_dict* frequency_dict);
  */
 struct freq_dict* freq_dict_create_from_stream(FILE* stream);
 
+/**
+ * @brief Counts all symbols of a stream from its current position on into
+ * a frequency dict. The stream is returned to that position afterwards.
+ *
+ * @param frequency_dict the frequency dict that should be updated.
+ * @param stream the stream that should be analyzed.
+ * @param filter applied to every chunk read before it is counted. May be NULL.
+ * @return int non-zero if an error occurred, zero otherwise.
+ */
+int freq_dict_add_stream(struct freq_dict* frequency_dict, FILE* stream,
+    const struct freq_dict_filter* filter);
+
+/**
+ * @brief Approximates the frequencies of a seekable stream by analyzing
+ * only the head of it and a number of probes spread over the remainder.
+ * If the sample covers the whole stream the result is exact. Otherwise
+ * every byte is given a frequency of at least one, so that a huffman tree
+ * created from the result can encode any byte of the stream.
+ * Only the part of the stream from its current position on is analyzed,
+ * and the stream is returned to that position afterwards.
+ * 
+ * @param stream the stream that should be analyzed.
+ * @param sampling the parts of <stream> that should be analyzed.
+ * @param exact set to non-zero if the whole stream was analyzed. May be NULL.
+ * @return struct freq_dict* the approximated frequency dict.
+ * Must be freed by freq_dict_free().
+ */
+struct freq_dict* freq_dict_create_from_stream_sampled(FILE* stream,
+    const struct freq_dict_sampling* sampling, int* exact);
+
+/**
+ * @brief Like freq_dict_create_from_stream_sampled(), but counts into an
+ * existing, empty frequency dict of any alphabet. Probes of word dicts
+ * start at even offsets.
+ *
+ * @param frequency_dict the frequency dict that should be filled.
+ * @param stream the stream that should be analyzed.
+ * @param sampling the parts of <stream> that should be analyzed.
+ * @param filter applied to every chunk read before it is counted. May be NULL.
+ * @param exact set to non-zero if the whole stream was analyzed. May be NULL.
+ * @return int non-zero if an error occurred, zero otherwise.
+ */
+int freq_dict_add_stream_sampled(struct freq_dict* frequency_dict,
+    FILE* stream, const struct freq_dict_sampling* sampling,
+    const struct freq_dict_filter* filter, int* exact);
+
 
 #endif
@@ -1,4 +1,5 @@
 #include "huffman_tree.h"
+#include "canonical_code.h"
 
 
 #define BUFFER_SIZE 65536
@@ -29,15 +30,21 @@ void huffman_tree_print(struct huffman_tree* tree, int indent) {
     }
 
     if (tree->symbol >= 0) {
-        printf("%d|%c\n", tree->frequency, tree->symbol);
+        printf("%" PRIu64 "|%c\n", tree->frequency, tree->symbol);
     } else {
-        printf("%d\n", tree->frequency);
+        printf("%" PRIu64 "\n", tree->frequency);
     }
 
     if (tree->right) huffman_tree_print(tree->right, indent + 1);
     if (tree->left) huffman_tree_print(tree->left, indent + 1);
 }
 
+void huffman_tree_mark_symbols(struct huffman_tree* tree, uint8_t* present) {
+    if (tree->symbol >= 0) present[tree->symbol & 0xff] = 1;
+    if (tree->left) huffman_tree_mark_symbols(tree->left, present);
+    if (tree->right) huffman_tree_mark_symbols(tree->right, present);
+}
+
 int huffman_tree_find_tree_after(struct huffman_tree* tree_after,
         struct huffman_tree* tree) {
     if (tree_after->frequency == tree->frequency)
@@ -58,42 +65,77 @@ int huffman_tree_number_nodes(struct huffman_tree* tree, int number) {
     return number;
 }
 
-struct huffman_tree* huffman_tree_create_from_stream(FILE* stream) {
-    struct freq_dict* dict = freq_dict_create_from_stream(stream);
-    if (!dict) return NULL;
+int _huffman_tree_insert_sorted(struct linked_list* list,
+        struct huffman_tree* tree) {
+    struct linked_list_node* before_node
+        = linked_list_find_node(list, huffman_tree_find_tree_after, tree);
 
-    struct linked_list* list = linked_list_create();
-    if (!list) {
-        freq_dict_free(dict);
-        return NULL;
+    return linked_list_insert_before(list, before_node, tree);
+}
+
+void _huffman_tree_free_list(struct linked_list* list) {
+    while (list->length > 0) {
+        huffman_tree_free(linked_list_pop(list, 0));
     }
+    linked_list_free(list);
+}
 
+struct huffman_tree* huffman_tree_create_from_freq_dict(struct freq_dict* dict) {
+    struct linked_list* list = linked_list_create();
+    if (!list) return NULL;
+
+    /* Bytes that do not occur get no leaf. A tree needs at least two leaves
+     * for every symbol to have a code, so unused bytes are added with a
+     * frequency of zero if there are fewer than two symbols. */
     for (int i = 0; i < 256; i++) {
-        int frequency = freq_dict_frequency_for(dict, i);
+        uint64_t frequency = freq_dict_frequency_for(dict, i);
         if (!frequency) continue;
 
         struct huffman_tree* tree = huffman_tree_create_with_symbol(i);
+        if (!tree) {
+            _huffman_tree_free_list(list);
+            return NULL;
+        }
         tree->frequency = frequency;
 
-        struct linked_list_node* before_node
-            = linked_list_find_node(list, huffman_tree_find_tree_after, tree);
-        linked_list_insert_before(list, before_node, tree);
+        if (_huffman_tree_insert_sorted(list, tree)) {
+            huffman_tree_free(tree);
+            _huffman_tree_free_list(list);
+            return NULL;
+        }
     }
 
-    freq_dict_free(dict);
+    for (int i = 0; i < 256 && list->length < 2; i++) {
+        if (freq_dict_frequency_for(dict, i)) continue;
+
+        struct huffman_tree* tree = huffman_tree_create_with_symbol(i);
+        if (!tree || _huffman_tree_insert_sorted(list, tree)) {
+            if (tree) huffman_tree_free(tree);
+            _huffman_tree_free_list(list);
+            return NULL;
+        }
+    }
 
     while (list->length > 1) {
         struct huffman_tree* left = linked_list_pop(list, 0);
         struct huffman_tree* right = linked_list_pop(list, 0);
 
         struct huffman_tree* tree = huffman_tree_create();
+        if (!tree) {
+            huffman_tree_free(left);
+            huffman_tree_free(right);
+            _huffman_tree_free_list(list);
+            return NULL;
+        }
         tree->frequency = left->frequency + right->frequency;
         tree->left = left;
         tree->right = right;
 
-        struct linked_list_node* before_node
-            = linked_list_find_node(list, huffman_tree_find_tree_after, tree);
-        linked_list_insert_before(list, before_node, tree);
+        if (_huffman_tree_insert_sorted(list, tree)) {
+            huffman_tree_free(tree);
+            _huffman_tree_free_list(list);
+            return NULL;
+        }
     }
 
     struct huffman_tree* ret = linked_list_pop(list, 0);
@@ -104,6 +146,75 @@ struct huffman_tree* huffman_tree_create_from_stream(FILE* stream) {
     return ret;
 }
 
+/* Adds a leaf below <root> at the path given by the bits of <code>, most
+ * significant first, creating the inner nodes on the way. */
+int _huffman_tree_insert_code(struct huffman_tree* root, uint32_t code,
+        int length, int symbol, uint64_t frequency) {
+    struct huffman_tree* node = root;
+    for (int i = length - 1; i >= 0; i--) {
+        struct huffman_tree** child = (code >> i) & 1 ? &node->right : &node->left;
+        if (!*child) {
+            *child = i ? huffman_tree_create() : huffman_tree_create_with_symbol(symbol);
+            if (!*child) return 1;
+        }
+        node = *child;
+        node->frequency += frequency;
+    }
+
+    return 0;
+}
+
+/* A tree built from code lengths is only usable if every inner node has
+ * two children. */
+int _huffman_tree_is_full(struct huffman_tree* tree) {
+    if (tree->symbol >= 0) return 1;
+
+    return tree->left && tree->right
+        && _huffman_tree_is_full(tree->left) && _huffman_tree_is_full(tree->right);
+}
+
+struct huffman_tree* huffman_tree_create_from_freq_dict_limited(
+        struct freq_dict* dict, int max_length) {
+    if (freq_dict_total(dict) == 0) return huffman_tree_create_from_freq_dict(dict);
+
+    struct canonical_code* code = canonical_code_create_from_frequencies(
+        dict->frequencies, FREQ_DICT_BYTE_ALPHABET, max_length);
+    if (!code) return NULL;
+
+    struct huffman_tree* ret = huffman_tree_create();
+    int error_code = !ret;
+    for (int i = 0; i < FREQ_DICT_BYTE_ALPHABET && !error_code; i++) {
+        if (code->lengths[i]) {
+            error_code = _huffman_tree_insert_code(ret, code->codes[i],
+                code->lengths[i], i, dict->frequencies[i]);
+        }
+    }
+    canonical_code_free(code);
+
+    if (!error_code && !_huffman_tree_is_full(ret)) {
+        errno = ERR_ILLEGAL_ARG;
+        error_code = 1;
+    }
+    if (error_code) {
+        if (ret) huffman_tree_free(ret);
+        return NULL;
+    }
+
+    huffman_tree_number_nodes(ret, 0);
+
+    return ret;
+}
+
+struct huffman_tree* huffman_tree_create_from_stream(FILE* stream) {
+    struct freq_dict* dict = freq_dict_create_from_stream(stream);
+    if (!dict) return NULL;
+
+    struct huffman_tree* ret = huffman_tree_create_from_freq_dict(dict);
+    freq_dict_free(dict);
+
+    return ret;
+}
+
 uint8_t* _huffman_tree_write_to_buffer(struct huffman_tree* tree,
         uint8_t* buffer) {
     uint8_t local_buffer[4];
@@ -131,19 +242,28 @@ uint8_t* _huffman_tree_write_to_buffer(struct huffman_tree* tree,
     return buffer + 4;
 }
 
+size_t huffman_tree_serialized_size(struct huffman_tree* tree) {
+    return (size_t)(tree->number + 1) * 4 + 1;
+}
+
+size_t huffman_tree_write_to_buffer(struct huffman_tree* tree,
+        uint8_t* buffer) {
+    buffer[0] = (uint8_t)(tree->number + 1);
+    _huffman_tree_write_to_buffer(tree, buffer + 1);
+
+    return huffman_tree_serialized_size(tree);
+}
+
 int huffman_tree_write_to_stream(struct huffman_tree* tree, FILE* stream) {
-    uint8_t num_nodes = tree->number + 1;
-    size_t buffer_size = (size_t)num_nodes * 4 + 1;
+    size_t buffer_size = huffman_tree_serialized_size(tree);
 
-    char* buffer = malloc(buffer_size);
+    uint8_t* buffer = malloc(buffer_size);
     if (!buffer) {
         errno = ERR_MEM_ERROR;
         return 1;
     }
 
-    buffer[0] = num_nodes;
-    
-    _huffman_tree_write_to_buffer(tree, buffer + 1);
+    huffman_tree_write_to_buffer(tree, buffer);
 
     int bytes_written = (int)fwrite(buffer, 1, buffer_size, stream);
     free(buffer);
@@ -155,6 +275,14 @@ int _huffman_tree_read_from_buffer(struct huffman_tree* parent,
         uint8_t* buffer) {
     uint8_t* read_node = buffer + 4 * parent->number;
 
+    /* Nodes are numbered in post-order, so children always have a lower
+     * number than their parent. Anything else is a corrupt or cyclic tree. */
+    if ((read_node[0] && read_node[1] >= parent->number)
+            || (read_node[2] && read_node[3] >= parent->number)) {
+        errno = ERR_PARSE_ERROR;
+        return 1;
+    }
+
     if (read_node[0] == 0) {
         parent->left = huffman_tree_create_with_symbol(read_node[1]);
         if (!parent->left) return 1;
@@ -179,11 +307,33 @@ int _huffman_tree_read_from_buffer(struct huffman_tree* parent,
     return 0;
 }
 
+struct huffman_tree* huffman_tree_read_from_buffer(const uint8_t* buffer) {
+    uint8_t num_nodes = buffer[0];
+    if (num_nodes == 0) {
+        errno = ERR_PARSE_ERROR;
+        return NULL;
+    }
+
+    struct huffman_tree* root = huffman_tree_create();
+    if (!root) return NULL;
+    root->number = num_nodes - 1;
+
+    if (_huffman_tree_read_from_buffer(root, (uint8_t*)buffer + 1)) {
+        huffman_tree_free(root);
+        return NULL;
+    }
+
+    return root;
+}
+
 struct huffman_tree* huffman_tree_read_from_stream(FILE* stream) {
     uint8_t num_nodes = 0;
-    if (fread(&num_nodes, 1, 1, stream) != 1) return NULL;
+    if (fread(&num_nodes, 1, 1, stream) != 1 || num_nodes == 0) {
+        errno = ERR_PARSE_ERROR;
+        return NULL;
+    }
 
-    size_t buffer_size = (size_t)num_nodes * 4;
+    size_t buffer_size = (size_t)num_nodes * 4 + 1;
 
     uint8_t* buffer = malloc(buffer_size);
     if (!buffer) {
@@ -191,27 +341,69 @@ struct huffman_tree* huffman_tree_read_from_stream(FILE* stream) {
         return NULL;
     }
 
-    if (fread(buffer, 1, buffer_size, stream) != buffer_size) {
+    buffer[0] = num_nodes;
+    if (fread(buffer + 1, 1, buffer_size - 1, stream) != buffer_size - 1) {
         free(buffer);
         errno = ERR_PARSE_ERROR;
         return NULL;
     }
 
-    struct huffman_tree* root = huffman_tree_create();
-    root->number = num_nodes - 1;
-    if (!root) {
-        free(buffer);
-        return NULL;
-    }
-    int result = _huffman_tree_read_from_buffer(root, buffer);
+    struct huffman_tree* root = huffman_tree_read_from_buffer(buffer);
     free(buffer);
 
-    if (result) return NULL;
-    else return root;
+    return root;
+}
+
+int huffman_tree_decode_buffer(struct huffman_tree* tree,
+        const uint8_t* in_buffer, size_t in_size,
+        uint8_t* out_buffer, size_t out_size) {
+    struct huffman_tree* current_tree = tree;
+    size_t write_index = 0;
+
+    if (out_size == 0) return 0;
+
+    for (size_t i = 0; i < in_size; i++) {
+        uint8_t current_byte = in_buffer[i];
+
+        for (int j = 7; j >= 0; j--) {
+            if ((current_byte >> j) & 1)
+                current_tree = current_tree->right;
+            else
+                current_tree = current_tree->left;
+
+            if (current_tree->symbol >= 0) {
+                out_buffer[write_index] = current_tree->symbol;
+                current_tree = tree;
+                write_index++;
+
+                if (write_index == out_size) return 0;
+            }
+        }
+    }
+
+    errno = ERR_PARSE_ERROR;
+    return 1;
 }
 
 int huffman_tree_decompress_file(struct huffman_tree* tree,
         FILE* in_stream, FILE* out_stream) {
+    struct sink sink;
+    sink_stream_init(out_stream, &sink);
+
+    return huffman_tree_decompress_sink(tree, in_stream, &sink);
+}
+
+/* Returns where the next run of at most BUFFER_SIZE bytes is decoded to. */
+uint8_t* _huffman_tree_next_run(const struct sink* sink, uint8_t* buffer,
+        uint32_t remaining) {
+    uint8_t* run = sink->reserve ? sink->reserve(sink->context,
+        remaining < BUFFER_SIZE ? remaining : BUFFER_SIZE) : NULL;
+
+    return run ? run : buffer;
+}
+
+int huffman_tree_decompress_sink(struct huffman_tree* tree, FILE* in_stream,
+        const struct sink* sink) {
     uint8_t* in_buffer = malloc(2 * BUFFER_SIZE);
     uint8_t* out_buffer = in_buffer + BUFFER_SIZE;
     if (!in_buffer) {
@@ -221,17 +413,30 @@ int huffman_tree_decompress_file(struct huffman_tree* tree,
 
     uint32_t num_bytes = 0;
     if (fread(&num_bytes, sizeof(uint32_t), 1, in_stream) != 1) {
-        return ERR_PARSE_ERROR;
+        free(in_buffer);
+        errno = ERR_PARSE_ERROR;
         return 1;
     }
+    if (num_bytes == 0) {
+        free(in_buffer);
+        return 0;
+    }
 
     int bytes_converted = 0;
     int write_byte_index = 0; 
     struct huffman_tree* current_tree = tree;
+    uint8_t* run = _huffman_tree_next_run(sink, out_buffer, num_bytes);
 
     while (1) {
         size_t read = fread(in_buffer, 1, BUFFER_SIZE, in_stream);
 
+        /* The input ended before <num_bytes> bytes have been decoded. */
+        if (read == 0) {
+            free(in_buffer);
+            errno = ferror(in_stream) ? ERR_IO_ERROR : ERR_PARSE_ERROR;
+            return 1;
+        }
+
         for (size_t i = 0; i < read; i++) {
             uint8_t current_byte = in_buffer[i];
 
@@ -242,16 +447,15 @@ int huffman_tree_decompress_file(struct huffman_tree* tree,
                     current_tree = current_tree->left;
 
                 if (current_tree->symbol >= 0) {
-                    out_buffer[write_byte_index] = current_tree->symbol;
+                    run[write_byte_index] = current_tree->symbol;
                     current_tree = tree;
                     bytes_converted++;
                     write_byte_index++;
 
                     if (write_byte_index == BUFFER_SIZE
                             || bytes_converted == num_bytes) {
-                        if (fwrite(out_buffer, 1, write_byte_index, out_stream)
-                                != write_byte_index) {
-                            errno = ERR_IO_ERROR;
+                        if (sink->write(sink->context, run, write_byte_index)) {
+                            free(in_buffer);
                             return 1;
                         }
                         
@@ -261,6 +465,8 @@ int huffman_tree_decompress_file(struct huffman_tree* tree,
                             free(in_buffer);
                             return 0;
                         }
+                        run = _huffman_tree_next_run(sink, out_buffer,
+                            num_bytes - bytes_converted);
                     }
                 }
             }
@@ -10,6 +10,7 @@
 #include "error.h"
 #include "frequency_dict.h"
 #include "linked_list.h"
+#include "sink.h"
 
 
 /**
@@ -21,7 +22,7 @@ struct huffman_tree {
 
     int number;
     int symbol;
-    int frequency;
+    uint64_t frequency;
 };
 
 
@@ -42,6 +43,30 @@ struct huffman_tree* huffman_tree_create_with_symbol(int symbol);
  */
 struct huffman_tree* huffman_tree_create();
 
+/**
+ * @brief Creates a full huffman tree from the frequencies of a
+ * frequency dict. The tree always has at least two leaves, so that
+ * every byte with a non-zero frequency has a code.
+ * 
+ * @param dict the frequency dict from which the tree should be created.
+ * @return struct huffman_tree* the filled huffman tree.
+ * Must be freed with a call to huffman_tree_free().
+ */
+struct huffman_tree* huffman_tree_create_from_freq_dict(struct freq_dict* dict);
+
+/**
+ * @brief Creates a full huffman tree from the frequencies of a frequency
+ * dict, none of whose codes is longer than a given number of bits. Such
+ * trees cost a few bits more but can be decoded through smaller tables.
+ *
+ * @param dict the frequency dict of bytes from which the tree should be created.
+ * @param max_length the maximum code length, 8 to CANONICAL_CODE_MAX_LENGTH.
+ * @return struct huffman_tree* the filled huffman tree.
+ * Must be freed with a call to huffman_tree_free().
+ */
+struct huffman_tree* huffman_tree_create_from_freq_dict_limited(
+    struct freq_dict* dict, int max_length);
+
 /**
  * @brief Creates a full huffman tree from a given file.
  * 
@@ -59,6 +84,16 @@ struct huffman_tree* huffman_tree_create_from_stream(FILE* stream);
  * @return int non-zero when an error occurred, zero otherwise.
  */
 int _huffman_tree_read_from_buffer(struct huffman_tree* parent, uint8_t* buffer);
+/**
+ * @brief Reads a huffman tree from its serialized form in a buffer.
+ * 
+ * @param buffer the buffer holding the node count followed by the nodes,
+ * as written by huffman_tree_write_to_buffer().
+ * @return struct huffman_tree* the filled huffman tree.
+ * Must be freed with a call to huffman_tree_free().
+ */
+struct huffman_tree* huffman_tree_read_from_buffer(const uint8_t* buffer);
+
 /**
  * @brief Reads huffman trees from a stream.
  * 
@@ -83,6 +118,15 @@ void huffman_tree_free(struct huffman_tree* tree);
  */
 void huffman_tree_print(struct huffman_tree* tree, int indent);
 
+/**
+ * @brief Marks the symbols a tree has a code for.
+ *
+ * @param tree the tree whose leaves should be marked.
+ * @param present the 256 flags of the symbols, set to 1 for every symbol
+ * of <tree> and left as they are for the others.
+ */
+void huffman_tree_mark_symbols(struct huffman_tree* tree, uint8_t* present);
+
 
 /**
  * @brief Writes a huffman tree to a given buffer.
@@ -93,6 +137,24 @@ void huffman_tree_print(struct huffman_tree* tree, int indent);
  */
 uint8_t* _huffman_tree_write_to_buffer(struct huffman_tree* tree, uint8_t* buffer);
 
+/**
+ * @brief Returns the number of bytes the serialized form of a tree takes up.
+ * 
+ * @param tree the huffman tree that should be measured.
+ * @return size_t the number of bytes huffman_tree_write_to_buffer() writes.
+ */
+size_t huffman_tree_serialized_size(struct huffman_tree* tree);
+
+/**
+ * @brief Writes the serialized form of a huffman tree to a buffer,
+ * including the leading node count.
+ * 
+ * @param tree the huffman tree that should be written.
+ * @param buffer the buffer of at least huffman_tree_serialized_size() bytes.
+ * @return size_t the number of bytes written.
+ */
+size_t huffman_tree_write_to_buffer(struct huffman_tree* tree, uint8_t* buffer);
+
 /**
  * 
  * @brief Writes a huffman tree to a stream.
@@ -115,5 +177,33 @@ int huffman_tree_write_to_stream(struct huffman_tree* tree, FILE* stream);
  */
 int huffman_tree_decompress_file(struct huffman_tree* tree, FILE* in_stream, FILE* out_stream);
 
+/**
+ * @brief Like huffman_tree_decompress_file(), but delivers the decompressed
+ * bytes to a sink, in runs of up to 64 KiB decoded into its memory where it
+ * offers some.
+ *
+ * @param tree the huffman tree that should be used to decompress.
+ * @param in_stream the stream that should be decompressed.
+ * @param sink the sink the decompressed bytes are delivered to.
+ * @return int non-zero if an error occurred, zero otherwise.
+ */
+int huffman_tree_decompress_sink(struct huffman_tree* tree, FILE* in_stream,
+    const struct sink* sink);
+
+/**
+ * @brief Decodes a fixed number of bytes from a buffer of encoded bits.
+ * 
+ * @param tree the huffman tree that should be used to decode.
+ * @param in_buffer the encoded bits, most significant bit first.
+ * @param in_size the number of bytes in <in_buffer>.
+ * @param out_buffer the buffer the decoded bytes are written to.
+ * @param out_size the number of bytes that should be decoded.
+ * @return int non-zero if <in_buffer> ended before <out_size> bytes
+ * were decoded, zero otherwise.
+ */
+int huffman_tree_decode_buffer(struct huffman_tree* tree,
+    const uint8_t* in_buffer, size_t in_size,
+    uint8_t* out_buffer, size_t out_size);
+
 
 #endif
@@ -0,0 +1,98 @@
+#include "io_util.h"
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+
+void io_put_u32(uint8_t* buffer, uint32_t value) {
+    buffer[0] = (uint8_t)value;
+    buffer[1] = (uint8_t)(value >> 8);
+    buffer[2] = (uint8_t)(value >> 16);
+    buffer[3] = (uint8_t)(value >> 24);
+}
+
+uint32_t io_get_u32(const uint8_t* buffer) {
+    return (uint32_t)buffer[0]
+        | ((uint32_t)buffer[1] << 8)
+        | ((uint32_t)buffer[2] << 16)
+        | ((uint32_t)buffer[3] << 24);
+}
+
+void io_put_u64(uint8_t* buffer, uint64_t value) {
+    io_put_u32(buffer, (uint32_t)value);
+    io_put_u32(buffer + 4, (uint32_t)(value >> 32));
+}
+
+uint64_t io_get_u64(const uint8_t* buffer) {
+    return (uint64_t)io_get_u32(buffer)
+        | ((uint64_t)io_get_u32(buffer + 4) << 32);
+}
+
+int io_seek(FILE* stream, int64_t offset, int whence) {
+#ifdef _WIN32
+    return _fseeki64(stream, offset, whence);
+#else
+    return fseeko(stream, (off_t)offset, whence);
+#endif
+}
+
+int64_t io_tell(FILE* stream) {
+#ifdef _WIN32
+    return _ftelli64(stream);
+#else
+    return (int64_t)ftello(stream);
+#endif
+}
+
+int64_t io_stream_size(FILE* stream) {
+    int64_t position = io_tell(stream);
+    if (position < 0 || io_seek(stream, 0, SEEK_END)) return -1;
+
+    int64_t size = io_tell(stream);
+    if (io_seek(stream, position, SEEK_SET)) return -1;
+
+    return size;
+}
+
+int io_truncate(FILE* stream, int64_t size) {
+    if (fflush(stream)) return 1;
+#ifdef _WIN32
+    return _chsize_s(_fileno(stream), size) != 0;
+#else
+    return ftruncate(fileno(stream), (off_t)size) != 0;
+#endif
+}
+
+int io_sync(FILE* stream) {
+    if (fflush(stream)) return 1;
+#ifdef _WIN32
+    return _commit(_fileno(stream)) != 0;
+#else
+    return fsync(fileno(stream)) != 0;
+#endif
+}
+
+size_t io_read_at(FILE* stream, void* buffer, size_t size, int64_t offset) {
+    uint8_t* out = buffer;
+    size_t total = 0;
+
+#ifdef _WIN32
+    int64_t position = io_tell(stream);
+    if (position < 0 || io_seek(stream, offset, SEEK_SET)) return 0;
+    total = fread(out, 1, size, stream);
+    io_seek(stream, position, SEEK_SET);
+#else
+    int fd = fileno(stream);
+    while (total < size) {
+        ssize_t read = pread(fd, out + total, size - total,
+            (off_t)(offset + (int64_t)total));
+        if (read <= 0) break;
+        total += (size_t)read;
+    }
+#endif
+
+    return total;
+}
@@ -0,0 +1,103 @@
+#ifndef IO_UTIL_H
+#define IO_UTIL_H
+
+
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "error.h"
+
+
+/**
+ * @brief Stores a 32 bit value in little endian byte order.
+ *
+ * @param buffer the buffer of at least 4 bytes to write to.
+ * @param value the value that should be stored.
+ */
+void io_put_u32(uint8_t* buffer, uint32_t value);
+
+/**
+ * @brief Loads a 32 bit value stored in little endian byte order.
+ *
+ * @param buffer the buffer of at least 4 bytes to read from.
+ * @return uint32_t the value stored in <buffer>.
+ */
+uint32_t io_get_u32(const uint8_t* buffer);
+
+/**
+ * @brief Stores a 64 bit value in little endian byte order.
+ *
+ * @param buffer the buffer of at least 8 bytes to write to.
+ * @param value the value that should be stored.
+ */
+void io_put_u64(uint8_t* buffer, uint64_t value);
+
+/**
+ * @brief Loads a 64 bit value stored in little endian byte order.
+ *
+ * @param buffer the buffer of at least 8 bytes to read from.
+ * @return uint64_t the value stored in <buffer>.
+ */
+uint64_t io_get_u64(const uint8_t* buffer);
+
+/**
+ * @brief Seeks in a stream using 64 bit offsets on every platform.
+ *
+ * @param stream the stream to reposition.
+ * @param offset the offset relative to <whence>.
+ * @param whence one of SEEK_SET, SEEK_CUR or SEEK_END.
+ * @return int non-zero if an error occurred, zero otherwise.
+ */
+int io_seek(FILE* stream, int64_t offset, int whence);
+
+/**
+ * @brief Returns the current position of a stream as a 64 bit offset.
+ *
+ * @param stream the stream of which the position should be returned.
+ * @return int64_t the position of <stream>, or -1 if an error occurred.
+ */
+int64_t io_tell(FILE* stream);
+
+/**
+ * @brief Cuts a file off after a number of bytes, flushing the stream first.
+ *
+ * @param stream the stream of the file to be truncated.
+ * @param size the number of bytes the file should keep.
+ * @return int non-zero if an error occurred, zero otherwise.
+ */
+int io_truncate(FILE* stream, int64_t size);
+
+/**
+ * @brief Flushes a stream and waits until its file is on the storage
+ * device.
+ *
+ * @param stream the stream of the file to be synchronized.
+ * @return int non-zero if an error occurred, zero otherwise.
+ */
+int io_sync(FILE* stream);
+
+/**
+ * @brief Reads bytes at a given offset of a file without moving the
+ * position of the stream. On POSIX systems this may be called from
+ * several threads at once for the same stream.
+ *
+ * @param stream the stream of the file to be read.
+ * @param buffer the buffer to be filled.
+ * @param size the number of bytes that should be read.
+ * @param offset the offset of the first byte to be read.
+ * @return size_t the number of bytes read, less than <size> only at
+ * the end of the file or if an error occurred.
+ */
+size_t io_read_at(FILE* stream, void* buffer, size_t size, int64_t offset);
+
+/**
+ * @brief Determines the size of a seekable stream. The position of
+ * the stream is restored afterwards.
+ *
+ * @param stream the stream of which the size should be determined.
+ * @return int64_t the size of <stream> in bytes, or -1 if it is not seekable.
+ */
+int64_t io_stream_size(FILE* stream);
+
+
+#endif
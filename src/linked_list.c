@@ -36,6 +36,8 @@ void linked_list_free(struct linked_list* list) {
         linked_list_free_node(current);
         current = next;
     }
+
+    free(list);
 }
 
 int linked_list_length(struct linked_list* list) {
@@ -2,18 +2,56 @@
 #include <string.h>
 #include <time.h>
 
+#ifdef _WIN32
+#include <direct.h>
+#define make_directory(path) _mkdir(path)
+#else
+#include <sys/resource.h>
+#include <sys/stat.h>
+#define make_directory(path) mkdir(path, 0755)
+#endif
+
 #include "error.h"
 #include "linked_list.h"
 #include "frequency_dict.h"
 #include "mapping_dict.h"
 #include "huffman_tree.h"
+#include "frame.h"
+#include "frame_index.h"
+#include "estimate.h"
+#include "verify.h"
+#include "search.h"
+#include "daemon.h"
+#include "archive.h"
+#include "trace.h"
+#include "numa.h"
+#include "table_cache.h"
+#include "sink.h"
+#include "compact_decoder.h"
 
 
 #define FILE_EXTENSION_COMPRESS ".huf"
 #define FILE_EXTENSION_DECOMPRESS ".orig"
 
 
-int compress_file(char* in_file_name) {
+/* Returns the most memory the process has held so far in bytes, 0 where
+ * it is not known. */
+uint64_t peak_memory() {
+#ifdef _WIN32
+    return 0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage)) return 0;
+#ifdef __APPLE__
+    return (uint64_t)usage.ru_maxrss;
+#else
+    return (uint64_t)usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+
+int compress_file(char* in_file_name, struct frame_params* params) {
     char* out_file_name = malloc(strlen(in_file_name)
         + strlen(FILE_EXTENSION_COMPRESS) + 1);
     if (!out_file_name) {
@@ -24,8 +62,8 @@ int compress_file(char* in_file_name) {
     strcpy(out_file_name, in_file_name);
     strcat(out_file_name, FILE_EXTENSION_COMPRESS);
 
-    clock_t start, end;
-    start = clock();
+    /* Wall time, as the blocks may be compressed on several threads. */
+    uint64_t start = trace_now();
 
     FILE* in_stream = fopen(in_file_name, "rb");
     if (!in_stream) {
@@ -39,45 +77,496 @@ int compress_file(char* in_file_name) {
         return 1;
     }
 
-    struct huffman_tree* tree = huffman_tree_create_from_stream(in_stream);
-    if (!tree) {
-        fclose(in_stream);
+    int error_code = frame_compress_stream(params, in_stream, out_stream);
+    int64_t in_size = io_stream_size(in_stream);
+
+    fclose(out_stream);
+    fclose(in_stream);
+
+    double time_used = (double)(trace_now() - start) / 1e9;
+
+    if (!error_code) {
+        printf("Compressed file %s to %s in %.2fs (%.1f MiB/s, peak memory "
+            "%.1f MiB).\n", in_file_name, out_file_name, time_used,
+            in_size > 0 && time_used > 0
+                ? (double)in_size / time_used / (1 << 20) : 0.0,
+            (double)peak_memory() / (1 << 20));
+        free(out_file_name);
+        return 0;
+    } else {
         free(out_file_name);
         return 1;
     }
-    struct mapping_dict* mapping_dict = mapping_dict_create_mapping(tree);
-    if (!mapping_dict) {
-        huffman_tree_free(tree);
-        fclose(in_stream);
+}
+
+
+/* Compresses every file on its own, taking the trees of files of similar
+ * contents from a cache rather than building one per file. */
+int compress_files(char* const* in_file_names, size_t count,
+        struct frame_params* params) {
+    struct table_cache* cache = table_cache_create(TABLE_CACHE_DEFAULT_CAPACITY,
+        TABLE_CACHE_DEFAULT_TOLERANCE);
+    if (!cache) return 1;
+
+    struct frame_params cached_params = *params;
+    cached_params.table_cache = cache;
+
+    int error_code = 0;
+    for (size_t i = 0; i < count && !error_code; i++) {
+        error_code = compress_file(in_file_names[i], &cached_params);
+    }
+
+    if (!error_code) {
+        printf("Reused a cached tree for %" PRIu64 " of %zu files.\n",
+            cache->hits, count);
+    }
+    table_cache_free(cache);
+
+    return error_code;
+}
+
+/* Compresses the bytes FILE has grown by since FILE.huf was written, or all
+ * of FILE if there is no FILE.huf yet. */
+int append_file(char* in_file_name, struct frame_params* params) {
+    char* out_file_name = malloc(strlen(in_file_name)
+        + strlen(FILE_EXTENSION_COMPRESS) + 1);
+    if (!out_file_name) {
+        errno = ERR_MEM_ERROR;
+        return 1;
+    }
+
+    strcpy(out_file_name, in_file_name);
+    strcat(out_file_name, FILE_EXTENSION_COMPRESS);
+
+    FILE* out_stream = fopen(out_file_name, "r+b");
+    if (!out_stream) {
+        free(out_file_name);
+        return compress_file(in_file_name, params);
+    }
+
+    uint64_t start = trace_now();
+
+    FILE* in_stream = fopen(in_file_name, "rb");
+    if (!in_stream) {
+        fclose(out_stream);
         free(out_file_name);
         return 1;
     }
 
-    int error_code = (fseek(in_stream, 0, 0)
-        || huffman_tree_write_to_stream(tree, out_stream)
-        || mapping_dict_compress_file(mapping_dict, in_stream, out_stream));
+    uint64_t appended;
+    int error_code = frame_append_stream(params, in_stream, out_stream,
+        &appended);
 
-    mapping_dict_free(mapping_dict);
-    huffman_tree_free(tree);
-    fclose(out_stream);
+    if (fclose(out_stream) && !error_code) {
+        errno = ERR_IO_ERROR;
+        error_code = 1;
+    }
+    fclose(in_stream);
+
+    double time_used = (double)(trace_now() - start) / 1e9;
+
+    if (!error_code) {
+        printf("Appended %" PRIu64 " bytes of %s to %s in %.2fs.\n",
+            appended, in_file_name, out_file_name, time_used);
+    }
+    free(out_file_name);
+
+    return error_code;
+}
+
+
+int estimate_file(char* in_file_name, struct frame_params* params) {
+    clock_t start, end;
+    start = clock();
+
+    FILE* in_stream = fopen(in_file_name, "rb");
+    if (!in_stream) return 1;
+
+    struct huf_size_estimate estimate;
+    int error_code = params->sampled
+        ? huf_estimate_sampled(params, in_stream, &estimate)
+        : huf_estimate_stream(params, in_stream, &estimate);
     fclose(in_stream);
 
     end = clock();
     double time_used = ((double) end - start) / CLOCKS_PER_SEC;
 
-    if (!error_code) {
-        printf("Compressed file %s to %s in %.2fs.\n",
-            in_file_name, out_file_name, time_used);
-        free(out_file_name);
-        return 0;
-    } else {
-        free(out_file_name);
+    if (error_code) return 1;
+
+    double ratio = estimate.raw_size
+        ? 100.0 * estimate.total_size / estimate.raw_size : 100.0;
+    printf("%s: %" PRIu64 " -> %" PRIu64 " bytes (%.2f%%, %" PRIu64
+        " header, %" PRIu64 " payload), %s, estimated in %.2fs.\n",
+        in_file_name, estimate.raw_size, estimate.total_size, ratio,
+        estimate.header_size, estimate.payload_size,
+        estimate.exact ? "exact" : "approximate", time_used);
+
+    return 0;
+}
+
+
+int test_file(char* in_file_name) {
+    FILE* in_stream = fopen(in_file_name, "rb");
+    if (!in_stream) return 1;
+
+    /* Files written before the framed format carry no checksums. */
+    if (!frame_is_framed(in_stream)) {
+        fclose(in_stream);
+        errno = ERR_PARSE_ERROR;
+        return 1;
+    }
+
+    struct huf_verify_result result;
+    int error_code = huf_verify(in_stream, 0, &result);
+    fclose(in_stream);
+
+    if (error_code) {
+        if (errno == ERR_CHECKSUM_ERROR) {
+            fprintf(stderr, "%s: damaged at or after offset %" PRIu64 "\n",
+                in_file_name, result.failed_offset);
+        }
+        return 1;
+    }
+
+    printf("%s: OK, %" PRIu64 " bytes in %" PRIu64 " blocks, %" PRIu64
+        " of them checksummed.\n", in_file_name, result.raw_size,
+        result.block_count, result.checksummed_blocks);
+
+    return 0;
+}
+
+
+/* Returns the number of bytes of a frame cut short at the end of a framed
+ * file, as an append interrupted by a crash leaves it, 0 if there is none
+ * or the file cannot be indexed at all. errno is left as it is. */
+int64_t incomplete_size(FILE* stream) {
+    int saved_errno = errno;
+    struct frame_index* index = frame_index_load_prefix(stream);
+    int64_t size = io_stream_size(stream);
+    int64_t incomplete = index && size > index->size ? size - index->size : 0;
+    if (index) frame_index_free(index);
+    errno = saved_errno;
+    return incomplete;
+}
+
+/* Tells how to read a file that failed to be read because it ends in a
+ * frame cut short. */
+void report_incomplete(const char* file_name, FILE* stream) {
+    int64_t incomplete = incomplete_size(stream);
+    if (incomplete > 0) {
+        fprintf(stderr, "%s: ends in an incomplete frame of %" PRId64
+            " bytes; --ignore-incomplete reads the frames in front of it\n",
+            file_name, incomplete);
+    }
+}
+
+/* Loads the index of a framed file. A file ending in a frame cut short
+ * fails to load unless <ignore_incomplete> is set; then the frames in front
+ * of it are indexed and <incomplete> is set to the number of bytes left
+ * out, which the caller reports with end_incomplete(). */
+struct frame_index* load_index(const char* file_name, FILE* stream,
+        int ignore_incomplete, int64_t* incomplete) {
+    *incomplete = 0;
+    if (!ignore_incomplete) {
+        struct frame_index* index = frame_index_load(stream);
+        if (!index) report_incomplete(file_name, stream);
+        return index;
+    }
+
+    struct frame_index* index = frame_index_load_prefix(stream);
+    int64_t size = io_stream_size(stream);
+    if (index && size > index->size) *incomplete = size - index->size;
+    return index;
+}
+
+/* Fails an operation that has read around a frame cut short, so that the
+ * loss of its contents never goes unnoticed. */
+int end_incomplete(const char* file_name, int64_t incomplete, int error_code) {
+    if (incomplete == 0) return error_code;
+
+    fprintf(stderr, "%s: ignored an incomplete frame of %" PRId64
+        " bytes at the end\n", file_name, incomplete);
+    if (!error_code) errno = ERR_PARSE_ERROR;
+    return 1;
+}
+
+
+/**
+ * @brief The patterns searched for by search_file().
+ */
+struct search_output {
+    char* const* patterns;
+    /** Non-zero once a match could not be written. */
+    int failed;
+};
+
+int print_match(void* context, uint64_t offset, size_t pattern) {
+    struct search_output* output = context;
+    if (printf("%" PRIu64 ":%s\n", offset, output->patterns[pattern]) < 0) {
+        output->failed = 1;
+        return 1;
+    }
+    return 0;
+}
+
+int search_file(char* in_file_name, char* const* patterns, size_t count,
+        int ignore_incomplete) {
+    FILE* in_stream = fopen(in_file_name, "rb");
+    if (!in_stream) return 1;
+
+    if (!frame_is_framed(in_stream)) {
+        fclose(in_stream);
+        errno = ERR_PARSE_ERROR;
+        return 1;
+    }
+
+    const uint8_t** bytes = malloc(count * sizeof(uint8_t*));
+    size_t* sizes = malloc(count * sizeof(size_t));
+    if (!bytes || !sizes) {
+        free(bytes);
+        free(sizes);
+        fclose(in_stream);
+        errno = ERR_MEM_ERROR;
+        return 1;
+    }
+    for (size_t i = 0; i < count; i++) {
+        bytes[i] = (const uint8_t*)patterns[i];
+        sizes[i] = strlen(patterns[i]);
+    }
+
+    struct search_output output = { patterns, 0 };
+    struct huf_search_result result;
+    int64_t incomplete;
+    struct frame_index* index = load_index(in_file_name, in_stream,
+        ignore_incomplete, &incomplete);
+    int error_code = !index || huf_search_index(index, in_stream, bytes, sizes,
+        count, 0, print_match, &output, &result);
+    if (!error_code && output.failed) {
+        errno = ERR_IO_ERROR;
+        error_code = 1;
+    }
+    error_code = end_incomplete(in_file_name, incomplete, error_code);
+
+    if (index) frame_index_free(index);
+    free(bytes);
+    free(sizes);
+    fclose(in_stream);
+
+    return error_code;
+}
+
+
+int create_archive(char* archive_name, char* const* paths, size_t count,
+        struct frame_params* params) {
+    uint64_t start = trace_now();
+
+    /* Only members that can be extracted again are packed. */
+    for (size_t i = 0; i < count; i++) {
+        if (!archive_is_member_name(paths[i])) {
+            fprintf(stderr, "%s: not a relative path below the current "
+                "directory\n", paths[i]);
+            errno = ERR_ILLEGAL_ARG;
+            return 1;
+        }
+    }
+
+    FILE* out_stream = fopen(archive_name, "wb");
+    if (!out_stream) return 1;
+
+    int error_code = archive_create(params, paths, count, out_stream);
+    if (fclose(out_stream) && !error_code) {
+        errno = ERR_IO_ERROR;
+        error_code = 1;
+    }
+
+    double time_used = (double)(trace_now() - start) / 1e9;
+
+    if (error_code) return 1;
+
+    printf("Packed %zu files into %s in %.2fs.\n", count, archive_name, time_used);
+
+    return 0;
+}
+
+
+/* Merges files of frames into one with an index of all of them. */
+int merge_files(char* out_file_name, char* const* in_file_names, size_t count,
+        struct frame_params* params) {
+    uint64_t start = trace_now();
+
+    FILE** in_streams = calloc(count, sizeof(FILE*));
+    if (!in_streams) {
+        errno = ERR_MEM_ERROR;
+        return 1;
+    }
+
+    int error_code = 0;
+    for (size_t i = 0; i < count && !error_code; i++) {
+        in_streams[i] = fopen(in_file_names[i], "rb");
+        if (!in_streams[i]) {
+            fprintf(stderr, "%s: ", in_file_names[i]);
+            errno = ERR_IO_ERROR;
+            error_code = 1;
+        } else if (!frame_is_framed(in_streams[i])) {
+            fprintf(stderr, "%s: ", in_file_names[i]);
+            errno = ERR_PARSE_ERROR;
+            error_code = 1;
+        } else {
+            /* Merging only the complete frames of a file cut short would
+             * give a valid file that silently lacks the rest. */
+            int64_t incomplete = incomplete_size(in_streams[i]);
+            if (incomplete > 0) {
+                fprintf(stderr, "%s: ends in an incomplete frame of %" PRId64
+                    " bytes\n", in_file_names[i], incomplete);
+                errno = ERR_PARSE_ERROR;
+                error_code = 1;
+            }
+        }
+    }
+
+    FILE* out_stream = error_code ? NULL : fopen(out_file_name, "wb");
+    if (!error_code && !out_stream) error_code = 1;
+    error_code = error_code || frame_merge_streams(in_streams, count,
+        out_stream, params->io_backend);
+    if (out_stream && fclose(out_stream) && !error_code) {
+        errno = ERR_IO_ERROR;
+        error_code = 1;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (in_streams[i]) fclose(in_streams[i]);
+    }
+    free(in_streams);
+
+    double time_used = (double)(trace_now() - start) / 1e9;
+
+    if (error_code) return 1;
+
+    printf("Merged %zu files into %s in %.2fs.\n", count, out_file_name,
+        time_used);
+
+    return 0;
+}
+
+
+int list_archive(char* archive_name) {
+    FILE* in_stream = fopen(archive_name, "rb");
+    if (!in_stream) return 1;
+
+    struct archive* archive = archive_open(in_stream);
+    if (!archive) {
+        fclose(in_stream);
+        return 1;
+    }
+
+    for (size_t i = 0; i < archive->entry_count; i++) {
+        struct archive_entry* entry = &archive->entries[i];
+        printf("%12" PRIu64 " %12" PRIu64 "  %s\n", entry->raw_size,
+            entry->stored_size, entry->name);
+    }
+    printf("%zu files, %" PRIu32 " shared trees.\n", archive->entry_count,
+        archive->table_count);
+
+    archive_free(archive);
+    fclose(in_stream);
+
+    return 0;
+}
+
+
+/* Creates the directories leading to a file, ignoring those that exist. */
+void _make_parent_directories(char* path) {
+    for (char* separator = strpbrk(path, "/\\"); separator;
+            separator = strpbrk(separator + 1, "/\\")) {
+        char saved = *separator;
+        *separator = '\0';
+        make_directory(path);
+        *separator = saved;
+    }
+}
+
+int extract_member(struct archive* archive, size_t entry,
+        struct frame_params* params) {
+    const char* name = archive->entries[entry].name;
+    if (!archive_is_member_name(name)) {
+        errno = ERR_PARSE_ERROR;
+        return 1;
+    }
+
+    char* out_file_name = malloc(strlen(name)
+        + strlen(FILE_EXTENSION_DECOMPRESS) + 1);
+    if (!out_file_name) {
+        errno = ERR_MEM_ERROR;
+        return 1;
+    }
+    strcpy(out_file_name, name);
+    strcat(out_file_name, FILE_EXTENSION_DECOMPRESS);
+
+    _make_parent_directories(out_file_name);
+    FILE* out_stream = fopen(out_file_name, "wb");
+    free(out_file_name);
+    if (!out_stream) return 1;
+
+    int error_code = archive_extract(archive, entry, out_stream,
+        params->io_backend);
+    if (fclose(out_stream) && !error_code) {
+        errno = ERR_IO_ERROR;
+        error_code = 1;
+    }
+
+    return error_code;
+}
+
+int extract_archive(char* archive_name, char* const* names, size_t count,
+        struct frame_params* params) {
+    FILE* in_stream = fopen(archive_name, "rb");
+    if (!in_stream) return 1;
+
+    struct archive* archive = archive_open(in_stream);
+    if (!archive) {
+        fclose(in_stream);
         return 1;
     }
+
+    /* Without names, all members are extracted. */
+    int error_code = 0;
+    size_t total = count ? count : archive->entry_count;
+    for (size_t i = 0; i < total && !error_code; i++) {
+        size_t entry = count ? archive_find(archive, names[i]) : i;
+        if (entry == archive->entry_count) {
+            fprintf(stderr, "%s: no such member\n", names[i]);
+            errno = ERR_ILLEGAL_ARG;
+            error_code = 1;
+            break;
+        }
+        error_code = extract_member(archive, entry, params);
+        if (error_code) {
+            fprintf(stderr, "%s: ", archive->entries[entry].name);
+        }
+    }
+    if (!error_code) {
+        printf("Extracted %zu files from %s.\n", total, archive_name);
+    }
+
+    archive_free(archive);
+    fclose(in_stream);
+
+    return error_code;
 }
 
 
-int decompress_file(char* in_file_name) {
+/**
+ * @brief A range of uncompressed bytes requested on the command line.
+ */
+struct byte_range {
+    uint64_t start;
+    uint64_t length;
+    /** Non-zero if only this range should be decompressed. */
+    int set;
+};
+
+
+int decompress_file(char* in_file_name, struct frame_params* params,
+        struct byte_range* range, int ignore_incomplete) {
     char* out_file_name = malloc(strlen(in_file_name)
         + strlen(FILE_EXTENSION_DECOMPRESS) + 1);
     if (!out_file_name) return 1;
@@ -100,16 +589,39 @@ int decompress_file(char* in_file_name) {
         return 1;
     }
 
-    struct huffman_tree* tree = huffman_tree_read_from_stream(in_stream);
-    if (!tree) {
-        fclose(in_stream);
-        free(out_file_name);
-        return 1;
+    int error_code = 0;
+    int framed = frame_is_framed(in_stream);
+    if ((range && range->set) || (framed && ignore_incomplete)) {
+        /* Only the framed format can be decoded from the middle, and only
+         * through the index can a frame cut short be left out. */
+        uint64_t first = range && range->set ? range->start : 0;
+        uint64_t length = range && range->set ? range->length : UINT64_MAX;
+        int64_t incomplete = 0;
+        struct frame_index* index = framed
+            ? load_index(in_file_name, in_stream, ignore_incomplete, &incomplete)
+            : NULL;
+        if (!index) {
+            if (!framed) errno = ERR_PARSE_ERROR;
+            error_code = 1;
+        } else {
+            error_code = frame_index_decompress_range(index, in_stream,
+                out_stream, first, length);
+            frame_index_free(index);
+        }
+        error_code = end_incomplete(in_file_name, incomplete, error_code);
+    } else if (framed) {
+        error_code = frame_decompress_stream(in_stream, out_stream,
+            params->io_backend);
+        if (error_code) report_incomplete(in_file_name, in_stream);
+    } else {
+        /* Files written before the framed format consist of a single
+         * tree followed by the length and the encoded bits. */
+        struct huffman_tree* tree = huffman_tree_read_from_stream(in_stream);
+        error_code = !tree
+            || huffman_tree_decompress_file(tree, in_stream, out_stream);
+        if (tree) huffman_tree_free(tree);
     }
 
-    int error_code = huffman_tree_decompress_file(tree, in_stream, out_stream);
-
-    huffman_tree_free(tree);
     fclose(out_stream);
     fclose(in_stream);
 
@@ -127,7 +639,232 @@ int decompress_file(char* in_file_name) {
 }
 
 
-int main(int argc, char* argv[]) {
+/* Writes the decompressed contents of a file to standard output. Where it
+ * is a pipe, the blocks are decoded into pages that are spliced into it
+ * rather than copied. */
+int splice_file(char* in_file_name, struct frame_params* params,
+        struct byte_range* range, int ignore_incomplete) {
+    FILE* in_stream = fopen(in_file_name, "rb");
+    if (!in_stream) return 1;
+
+    struct sink sink;
+    struct sink_pipe* pipe = sink_pipe_create(fileno(stdout), &sink);
+    if (!pipe) {
+        fclose(in_stream);
+        return 1;
+    }
+
+    int error_code = 0;
+    int framed = frame_is_framed(in_stream);
+    if ((range && range->set) || (framed && ignore_incomplete)) {
+        uint64_t first = range && range->set ? range->start : 0;
+        uint64_t length = range && range->set ? range->length : UINT64_MAX;
+        int64_t incomplete = 0;
+        struct frame_index* index = framed
+            ? load_index(in_file_name, in_stream, ignore_incomplete, &incomplete)
+            : NULL;
+        if (!index) {
+            if (!framed) errno = ERR_PARSE_ERROR;
+            error_code = 1;
+        } else {
+            error_code = frame_index_decompress_range(index, in_stream,
+                stdout, first, length) || fflush(stdout);
+            frame_index_free(index);
+        }
+        error_code = end_incomplete(in_file_name, incomplete, error_code);
+    } else if (framed) {
+        error_code = frame_decompress_stream_sink(in_stream, &sink,
+            params->io_backend, NULL);
+        if (error_code) report_incomplete(in_file_name, in_stream);
+    } else {
+        struct huffman_tree* tree = huffman_tree_read_from_stream(in_stream);
+        error_code = !tree
+            || huffman_tree_decompress_sink(tree, in_stream, &sink);
+        if (tree) huffman_tree_free(tree);
+    }
+
+    sink_pipe_free(pipe);
+    fclose(in_stream);
+
+    return error_code;
+}
+
+
+/* Decompresses a file with the compact decoder, which allocates nothing,
+ * to FILE.orig or, with <splice>, to standard output. */
+int decompress_file_compact(char* in_file_name, int splice) {
+    static uint8_t in_buffer[COMPACT_DECODER_BUFFER_SIZE];
+    static uint8_t out_buffer[COMPACT_DECODER_BUFFER_SIZE];
+    static struct compact_decoder decoder;
+    compact_decoder_init(&decoder, in_buffer, sizeof(in_buffer),
+        out_buffer, sizeof(out_buffer));
+
+    char* out_file_name = NULL;
+    if (!splice) {
+        out_file_name = malloc(strlen(in_file_name)
+            + strlen(FILE_EXTENSION_DECOMPRESS) + 1);
+        if (!out_file_name) return 1;
+        strcpy(out_file_name, in_file_name);
+        strcat(out_file_name, FILE_EXTENSION_DECOMPRESS);
+    }
+
+    FILE* in_stream = fopen(in_file_name, "rb");
+    FILE* out_stream = in_stream && !splice ? fopen(out_file_name, "wb") : NULL;
+    if (!in_stream || (!splice && !out_stream)) {
+        if (in_stream) fclose(in_stream);
+        free(out_file_name);
+        return 1;
+    }
+    setvbuf(in_stream, NULL, _IONBF, 0);
+
+    struct sink sink;
+    struct sink_pipe* pipe = NULL;
+    if (splice) {
+        pipe = sink_pipe_create(fileno(stdout), &sink);
+    } else {
+        setvbuf(out_stream, NULL, _IONBF, 0);
+        sink_stream_init(out_stream, &sink);
+    }
+
+    int error_code = (splice && !pipe)
+        || compact_decoder_decompress_stream(&decoder, in_stream, &sink);
+
+    if (pipe) sink_pipe_free(pipe);
+    if (out_stream && fclose(out_stream) && !error_code) {
+        errno = ERR_IO_ERROR;
+        error_code = 1;
+    }
+    fclose(in_stream);
+
+    if (!error_code && !splice) {
+        printf("Decompressed file %s to %s with %zu bytes of state and "
+            "buffers.\n", in_file_name, out_file_name,
+            sizeof(decoder) + sizeof(in_buffer) + sizeof(out_buffer));
+    }
+    free(out_file_name);
+
+    return error_code;
+}
+
+
+/* Parses a number of bytes with an optional suffix K, M or G. */
+int parse_size(const char* text, size_t* size) {
+    char* end;
+    unsigned long long value = strtoull(text, &end, 10);
+    int shift = 0;
+    if (*end == 'K' || *end == 'k') shift = 10;
+    if (*end == 'M' || *end == 'm') shift = 20;
+    if (*end == 'G' || *end == 'g') shift = 30;
+    if (shift) end++;
+
+    if (end == text || *end != '\0' || value > (SIZE_MAX >> shift)) {
+        errno = ERR_ILLEGAL_ARG;
+        return 1;
+    }
+    *size = (size_t)value << shift;
+
+    return 0;
+}
+
+int write_trace(const char* file_name) {
+    FILE* stream = fopen(file_name, "w");
+    if (!stream) {
+        errno = ERR_IO_ERROR;
+        return 1;
+    }
+
+    int error_code = trace_write_json(stream);
+    if (fclose(stream) && !error_code) {
+        errno = ERR_IO_ERROR;
+        error_code = 1;
+    }
+
+    return error_code;
+}
+
+
+void print_usage(const char* program) {
+    printf("Usage: %s [options] c|d|u FILE\n"
+        "       %s [options] c FILE...\n"
+        "       %s [options] a ARCHIVE FILE...\n"
+        "       %s m OUT FILE...\n"
+        "       %s l|x ARCHIVE [NAME...]\n"
+        "       %s s FILE PATTERN...\n"
+        "       %s --daemon SOCKET\n"
+        "Without arguments, the file and operation are prompted for.\n\n"
+        "  c                compress FILE to FILE%s; several FILEs take\n"
+        "                   the trees of similar contents from a cache\n"
+        "  d                decompress FILE to FILE%s\n"
+        "  u                append the bytes FILE has grown by to FILE%s,\n"
+        "                   or compress FILE if there is no FILE%s yet\n"
+        "  a                pack the FILEs into ARCHIVE\n"
+        "  m                merge the compressed FILEs into OUT, which\n"
+        "                   decompresses to their concatenated contents,\n"
+        "                   with an index of all blocks, without decoding\n"
+        "  l                list the members of ARCHIVE\n"
+        "  x                extract the members NAME, or all members, of\n"
+        "                   ARCHIVE to NAME%s\n"
+        "  s                print OFFSET:PATTERN for every occurrence of a\n"
+        "                   PATTERN in the contents of FILE, without\n"
+        "                   decompressing it to disk\n\n"
+        "Options:\n"
+        "  -1 ... -9        with c, u or a, trade speed for ratio: -1 is the\n"
+        "                   fastest, -9 the smallest, -%d the default;\n"
+        "                   options following a level override it\n"
+        "  --sample         build the tree from a sample of FILE, so that\n"
+        "                   FILE is only read once while encoding\n"
+        "  --sample-random  like --sample, but probe random offsets\n"
+        "  --block-size N   number of bytes per block\n"
+        "  --split          with c, end blocks early where the distribution\n"
+        "                   of the bytes changes\n"
+        "  --wide ORDER     with c, code 16 bit words stored in byte ORDER\n"
+        "                   le or be instead of bytes\n"
+        "  --transform T    with c, try a transform on every block: delta,\n"
+        "                   delta:N for records of N bytes or xor:N for\n"
+        "                   N byte floats\n"
+        "  --estimate       with c, print the compressed size without\n"
+        "                   writing any output; approximate with --sample\n"
+        "  --io MODE        how files are read and written: auto, uring,\n"
+        "                   threads or sync\n"
+        "  --range S:L      with d, only decompress the L bytes starting\n"
+        "                   at uncompressed offset S\n"
+        "  --splice         with d, write the contents to standard output,\n"
+        "                   splicing them into it if it is a pipe\n"
+        "  --low-memory     with d, decode with a few KiB of fixed state and\n"
+        "                   no allocations; reads files compressed with\n"
+        "                   --compact-compatible, not with --range\n"
+        "  --test           with d, decode FILE and verify its checksums on\n"
+        "                   all processors without writing any output\n"        "  --ignore-incomplete\n"
+        "                   with d or s, read the frames in front of an\n"
+        "                   incomplete one at the end of FILE, as a crash\n"
+        "                   while appending leaves it, and exit non-zero\n"
+        "  --no-checksum    with c, do not store checksums\n"
+        "  --no-ans         with c, code every block with a tree, never\n"
+        "                   with tANS\n"
+        "  --compact-compatible\n"
+        "                   with c or u, write frames --low-memory can\n"
+        "                   decode: no tANS and no transforms, whatever\n"
+        "                   the level; not with --wide or --transform\n"
+        "  --threads N      with c, u or a, compress blocks on N threads,\n"
+        "                   0 for one per processor; 1 by default\n"
+        "  --mem-limit N    with --threads, hold at most N bytes of blocks\n"
+        "                   in flight, with an optional suffix K, M or G\n"
+        "  --cpus LIST      with --threads, pin the threads to the listed\n"
+        "                   processors, like 0-3,8; without it, one thread\n"
+        "                   per listed processor\n"
+        "  --trace FILE     write a timeline of the work of every thread\n"
+        "                   to FILE, to be opened in Perfetto or\n"
+        "                   chrome://tracing\n"
+        "  --daemon SOCKET  serve requests of huf-client on the Unix\n"
+        "                   socket SOCKET until stopped\n",
+        program, program, program, program, program, program, program,
+        FILE_EXTENSION_COMPRESS, FILE_EXTENSION_DECOMPRESS, FILE_EXTENSION_COMPRESS,
+        FILE_EXTENSION_COMPRESS, FILE_EXTENSION_DECOMPRESS,
+        FRAME_DEFAULT_LEVEL);
+}
+
+
+int run_interactive(struct frame_params* params) {
     printf("Enter c to compress, d to decompress, x to exit:\n");
     char c = getchar();
 
@@ -136,8 +873,9 @@ int main(int argc, char* argv[]) {
             printf("Enter the path to the file which should be compressed:\n");
             char buffer[256];
             scanf("%255s", buffer);
-            if (compress_file(buffer)) {
+            if (compress_file(buffer, params)) {
                 print_error("Failed to compress file");
+                return 1;
             }
             break;
         }
@@ -145,12 +883,286 @@ int main(int argc, char* argv[]) {
             printf("Enter the path to the file which should be decompressed:\n");
             char buffer[256];
             scanf("%255s", buffer);
-            if (decompress_file(buffer)) {
-                print_error("Failed to compress file");
+            if (decompress_file(buffer, params, NULL, 0)) {
+                print_error("Failed to decompress file");
+                return 1;
             }
             break;
         }
         case 'x':
             return 0;
     }
+
+    return 0;
+}
+
+
+/* Runs the operation args[0] on the arguments following it. */
+int run_operation(const char* program, char* const* args, int count,
+        struct frame_params* params, int estimate, int test, int splice,
+        int low_memory, int ignore_incomplete, struct byte_range* range) {
+    if (count < 2 || args[0][1] != '\0') {
+        print_usage(program);
+        return 1;
+    }
+
+    switch (args[0][0]) {
+        case 'a':
+            if (count < 3) break;
+            if (create_archive(args[1], args + 2, count - 2, params)) {
+                print_error("Failed to create archive");
+                return 1;
+            }
+            return 0;
+        case 'm':
+            if (count < 3) break;
+            if (merge_files(args[1], args + 2, count - 2, params)) {
+                print_error("Failed to merge files");
+                return 1;
+            }
+            return 0;
+        case 'l':
+            if (count != 2) break;
+            if (list_archive(args[1])) {
+                print_error("Failed to list archive");
+                return 1;
+            }
+            return 0;
+        case 's':
+            if (count < 3) break;
+            if (search_file(args[1], args + 2, count - 2,
+                    ignore_incomplete)) {
+                print_error("Failed to search file");
+                return 1;
+            }
+            return 0;
+        case 'x':
+            if (extract_archive(args[1], args + 2, count - 2, params)) {
+                print_error("Failed to extract archive");
+                return 1;
+            }
+            return 0;
+        case 'c':
+            if (count < 3 || estimate) break;
+            if (compress_files(args + 1, (size_t)count - 1, params)) {
+                print_error("Failed to compress file");
+                return 1;
+            }
+            return 0;
+    }
+
+    if (count != 2) {
+        print_usage(program);
+        return 1;
+    }
+
+    switch (args[0][0]) {
+        case 'c':
+            if (estimate) {
+                if (estimate_file(args[1], params)) {
+                    print_error("Failed to estimate file");
+                    return 1;
+                }
+                return 0;
+            }
+            if (compress_file(args[1], params)) {
+                print_error("Failed to compress file");
+                return 1;
+            }
+            return 0;
+        case 'u':
+            if (append_file(args[1], params)) {
+                print_error("Failed to append to file");
+                return 1;
+            }
+            return 0;
+        case 'd':
+            if (test) {
+                if (test_file(args[1])) {
+                    print_error("Failed to verify file");
+                    return 1;
+                }
+                return 0;
+            }
+            if (low_memory) {
+                /* The compact decoder only reads streams from the front,
+                 * and the index would have to be allocated. */
+                if (range->set) {
+                    errno = ERR_ILLEGAL_ARG;
+                    print_error("--low-memory cannot decompress a --range");
+                    return 1;
+                }
+                if (decompress_file_compact(args[1], splice)) {
+                    print_error("Failed to decompress file");
+                    return 1;
+                }
+                return 0;
+            }
+            if (splice) {
+                if (splice_file(args[1], params, range, ignore_incomplete)) {
+                    print_error("Failed to decompress file");
+                    return 1;
+                }
+                return 0;
+            }
+            if (decompress_file(args[1], params, range, ignore_incomplete)) {
+                print_error("Failed to decompress file");
+                return 1;
+            }
+            return 0;
+        default:
+            print_usage(program);
+            return 1;
+    }
+}
+
+
+int main(int argc, char* argv[]) {
+    struct frame_params params;
+    frame_params_init(&params);
+
+    if (argc < 2) return run_interactive(&params);
+
+    int estimate = 0;
+    int test = 0;
+    int splice = 0;
+    int low_memory = 0;
+    int ignore_incomplete = 0;
+    int compact = 0;
+    int transform_set = 0;
+    struct byte_range range = { 0, 0, 0 };
+    const char* trace_file_name = NULL;
+    int cpus[NUMA_MAX_CPUS];
+    int threads_set = 0;
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-'
+            && (argv[i][1] == '-' || (argv[i][1] >= '0' && argv[i][1] <= '9')); i++) {
+        if (argv[i][1] != '-') {
+            if (argv[i][2] != '\0'
+                    || frame_params_set_level(&params, argv[i][1] - '0')) {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (!strcmp(argv[i], "--sample")) {
+            params.sampled = 1;
+        } else if (!strcmp(argv[i], "--sample-random")) {
+            params.sampled = 1;
+            params.sampling.random = 1;
+        } else if (!strcmp(argv[i], "--block-size") && i + 1 < argc) {
+            params.block_size = strtoul(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--split")) {
+            params.split_size = FRAME_DEFAULT_SPLIT_SIZE;
+        } else if (!strcmp(argv[i], "--io") && i + 1 < argc) {
+            params.io_backend = async_io_backend_from_name(argv[++i]);
+            if (params.io_backend < 0) {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (!strcmp(argv[i], "--wide") && i + 1 < argc) {
+            i++;
+            if (!strcmp(argv[i], "le")) {
+                params.wide = FRAME_WIDE_LITTLE_ENDIAN;
+            } else if (!strcmp(argv[i], "be")) {
+                params.wide = FRAME_WIDE_BIG_ENDIAN;
+            } else {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (!strcmp(argv[i], "--transform") && i + 1 < argc) {
+            if (transform_from_name(argv[++i], &params.transform)) {
+                print_usage(argv[0]);
+                return 1;
+            }
+            transform_set = 1;
+        } else if (!strcmp(argv[i], "--range") && i + 1 < argc) {
+            char* end;
+            range.start = strtoull(argv[++i], &end, 10);
+            if (*end != ':') {
+                print_usage(argv[0]);
+                return 1;
+            }
+            range.length = strtoull(end + 1, &end, 10);
+            range.set = 1;
+        } else if (!strcmp(argv[i], "--test")) {
+            test = 1;
+        } else if (!strcmp(argv[i], "--splice")) {
+            splice = 1;
+        } else if (!strcmp(argv[i], "--low-memory")) {
+            low_memory = 1;
+        } else if (!strcmp(argv[i], "--ignore-incomplete")) {
+            ignore_incomplete = 1;
+        } else if (!strcmp(argv[i], "--no-checksum")) {
+            params.checksum = 0;
+        } else if (!strcmp(argv[i], "--no-ans")) {
+            params.ans = 0;
+        } else if (!strcmp(argv[i], "--compact-compatible")) {
+            compact = 1;
+        } else if (!strcmp(argv[i], "--estimate")) {
+            estimate = 1;
+        } else if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+            params.thread_count = atoi(argv[++i]);
+            threads_set = 1;
+            if (params.thread_count < 0) {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (!strcmp(argv[i], "--mem-limit") && i + 1 < argc) {
+            if (parse_size(argv[++i], &params.memory_limit)) {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (!strcmp(argv[i], "--cpus") && i + 1 < argc) {
+            int count = numa_parse_cpu_list(argv[++i], cpus, NUMA_MAX_CPUS);
+            if (count == 0) {
+                print_usage(argv[0]);
+                return 1;
+            }
+            params.cpus = cpus;
+            params.cpu_count = (size_t)count;
+        } else if (!strcmp(argv[i], "--trace") && i + 1 < argc) {
+            trace_file_name = argv[++i];
+        } else if (!strcmp(argv[i], "--daemon") && i + 2 == argc) {
+            if (huf_daemon_run(argv[i + 1], 0)) {
+                print_error("Failed to run daemon");
+                return 1;
+            }
+            return 0;
+        } else if (!strcmp(argv[i], "--help")) {
+            print_usage(argv[0]);
+            return 0;
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (params.cpus && !threads_set) params.thread_count = 0;
+
+    /* The profile overrides the transform of a level, but not one asked for. */
+    if (compact && (transform_set || frame_params_set_compact(&params))) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    if (trace_file_name) {
+        if (trace_start()) {
+            print_error("Failed to start tracing");
+            return 1;
+        }
+        trace_set_thread_name("main");
+    }
+
+    int error_code = run_operation(argv[0], argv + i, argc - i, &params,
+        estimate, test, splice, low_memory, ignore_incomplete, &range);
+
+    if (trace_file_name) {
+        trace_stop();
+        if (write_trace(trace_file_name)) {
+            print_error("Failed to write trace");
+            error_code = 1;
+        }
+        trace_clear();
+    }
+
+    return error_code;
 }
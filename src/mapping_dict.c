@@ -12,6 +12,7 @@ struct mapping_dict* mapping_dict_create() {
 }
 
 void mapping_dict_free(struct mapping_dict* mapping_dict) {
+    free(mapping_dict->pairs);
     free(mapping_dict);
 }
 
@@ -76,9 +77,149 @@ struct mapping_dict* mapping_dict_create_mapping(struct huffman_tree* tree) {
     return mapping_dict;
 }
 
+/* Collects the bits of codes, most significant bit first, and stores them
+ * 32 at a time. Only the lowest <bit_count> bits of <bits> are pending. */
+struct _mapping_dict_writer {
+    uint64_t bits;
+    int bit_count;
+    uint8_t* out;
+    size_t position;
+};
+
+/* Appends up to MAPPING_DICT_PAIR_MAX_BITS bits. */
+void _mapping_dict_put(struct _mapping_dict_writer* writer, uint32_t code,
+        int length) {
+    writer->bits = (writer->bits << length) | code;
+    writer->bit_count += length;
+    if (writer->bit_count >= 32) {
+        writer->bit_count -= 32;
+        uint32_t word = (uint32_t)(writer->bits >> writer->bit_count);
+        writer->out[writer->position] = (uint8_t)(word >> 24);
+        writer->out[writer->position + 1] = (uint8_t)(word >> 16);
+        writer->out[writer->position + 2] = (uint8_t)(word >> 8);
+        writer->out[writer->position + 3] = (uint8_t)word;
+        writer->position += 4;
+    }
+}
+
+/* Stores all complete bytes, and the last bits padded with zero bits if
+ * <pad> is non-zero. */
+void _mapping_dict_flush(struct _mapping_dict_writer* writer, int pad) {
+    while (writer->bit_count >= 8) {
+        writer->bit_count -= 8;
+        writer->out[writer->position++]
+            = (uint8_t)(writer->bits >> writer->bit_count);
+    }
+    if (pad && writer->bit_count > 0) {
+        writer->out[writer->position++]
+            = (uint8_t)(writer->bits << (8 - writer->bit_count));
+        writer->bit_count = 0;
+    }
+}
+
+/* Returns <count> bits of a code starting at bit <first>. */
+uint32_t _mapping_dict_code_bits(const struct mapping_dict_mapping* mapping,
+        uint32_t first, uint32_t count) {
+    uint32_t code = 0;
+    for (uint32_t i = first; i < first + count; i++) {
+        code = (code << 1) | (1u & (mapping->code[i / 8] >> (7 - i % 8)));
+    }
+
+    return code;
+}
+
+/* Fills the entries of single bytes, laid out like those of the pair
+ * table. Bytes with longer codes get 0. */
+void _mapping_dict_singles(const struct mapping_dict* mapping_dict,
+        uint32_t* singles) {
+    for (int i = 0; i < 256; i++) {
+        const struct mapping_dict_mapping* mapping = mapping_dict->mappings + i;
+        singles[i] = mapping->bit_count <= MAPPING_DICT_PAIR_MAX_BITS
+            ? (_mapping_dict_code_bits(mapping, 0, mapping->bit_count) << 8)
+                | mapping->bit_count
+            : 0;
+    }
+}
+
+/* Appends the code of a byte, however long it is. */
+void _mapping_dict_put_byte(struct _mapping_dict_writer* writer,
+        const struct mapping_dict* mapping_dict, const uint32_t* singles,
+        uint8_t c) {
+    uint32_t entry = singles[c];
+    if (entry) {
+        _mapping_dict_put(writer, entry >> 8, (int)(entry & 0xff));
+        return;
+    }
+
+    const struct mapping_dict_mapping* mapping = mapping_dict->mappings + c;
+    for (uint32_t i = 0; i < mapping->bit_count; i += MAPPING_DICT_PAIR_MAX_BITS) {
+        uint32_t count = mapping->bit_count - i < MAPPING_DICT_PAIR_MAX_BITS
+            ? mapping->bit_count - i : MAPPING_DICT_PAIR_MAX_BITS;
+        _mapping_dict_put(writer, _mapping_dict_code_bits(mapping, i, count),
+            (int)count);
+    }
+}
+
+void _mapping_dict_encode(const struct mapping_dict* mapping_dict,
+        const uint8_t* in_buffer, size_t in_size,
+        struct _mapping_dict_writer* writer) {
+    uint32_t singles[256];
+    _mapping_dict_singles(mapping_dict, singles);
+
+    size_t i = 0;
+    const uint32_t* pairs = mapping_dict->pairs;
+    if (pairs) {
+        for (; i + 1 < in_size; i += 2) {
+            uint32_t entry = pairs[(in_buffer[i] << 8) | in_buffer[i + 1]];
+            if (entry) {
+                _mapping_dict_put(writer, entry >> 8, (int)(entry & 0xff));
+            } else {
+                _mapping_dict_put_byte(writer, mapping_dict, singles,
+                    in_buffer[i]);
+                _mapping_dict_put_byte(writer, mapping_dict, singles,
+                    in_buffer[i + 1]);
+            }
+        }
+    }
+
+    for (; i < in_size; i++) {
+        _mapping_dict_put_byte(writer, mapping_dict, singles, in_buffer[i]);
+    }
+}
+
+int mapping_dict_create_pairs(struct mapping_dict* mapping_dict) {
+    uint32_t* pairs = mapping_dict->pairs;
+    if (!pairs) pairs = malloc(256 * 256 * sizeof(uint32_t));
+    if (!pairs) {
+        errno = ERR_MEM_ERROR;
+        return 1;
+    }
+
+    uint32_t singles[256];
+    _mapping_dict_singles(mapping_dict, singles);
+
+    for (int first = 0; first < 256; first++) {
+        uint32_t* row = pairs + 256 * first;
+        uint32_t first_length = singles[first] & 0xff;
+        for (int second = 0; second < 256; second++) {
+            uint32_t second_length = singles[second] & 0xff;
+            uint32_t length = first_length + second_length;
+            row[second] = first_length && second_length
+                    && length <= MAPPING_DICT_PAIR_MAX_BITS
+                ? ((singles[first] >> 8 << second_length
+                    | singles[second] >> 8) << 8) | length
+                : 0;
+        }
+    }
+    mapping_dict->pairs = pairs;
+
+    return 0;
+}
+
 int mapping_dict_compress_file(struct mapping_dict* mapping_dict,
         FILE* in_stream, FILE* out_stream) {
-    uint8_t* in_buffer = malloc(2 * BUFFER_SIZE);
+    /* A byte encodes to at most 32 bytes. */
+    uint8_t* in_buffer = malloc(BUFFER_SIZE + 32 * BUFFER_SIZE);
     uint8_t* out_buffer = in_buffer + BUFFER_SIZE;
     if (!in_buffer) {
         errno = ERR_MEM_ERROR;
@@ -90,61 +231,62 @@ int mapping_dict_compress_file(struct mapping_dict* mapping_dict,
         || !(length = (int)ftell(in_stream))
         || fseek(in_stream, 0, 0));
 
-    if (error_code) {
-        errno = ERR_IO_ERROR;
+    if (!error_code && !mapping_dict->pairs
+            && (uint64_t)length >= MAPPING_DICT_PAIR_MIN_SIZE
+            && mapping_dict_create_pairs(mapping_dict)) {
         free(in_buffer);
         return 1;
     }
 
-    (*(int*)out_buffer) = length;
-
-    size_t read = 0;
-    size_t write_index = 4;
-    uint8_t current_byte = 0;
-    int bit_index = 7;
-
-    do {
-        read = fread(in_buffer, sizeof(uint8_t), BUFFER_SIZE, in_stream);
-        for (size_t i = 0; i < read; i++) {
-            struct mapping_dict_mapping* current_mapping
-                = mapping_dict->mappings + in_buffer[i];
-            for (uint32_t j = 0; j < current_mapping->bit_count; j++) {
-                current_byte |= mapping_dict_get_bit(current_mapping, j) << bit_index;
-                bit_index -= 1;
-
-                if (bit_index < 0) {
-                    out_buffer[write_index] = current_byte;
-                    current_byte = 0;
-                    bit_index = 7;
-                    write_index += 1;
-
-                    if (write_index == BUFFER_SIZE) {
-                        if (fwrite(out_buffer, sizeof(uint8_t),
-                                BUFFER_SIZE, out_stream) != BUFFER_SIZE) {
-                            free(in_buffer);
-                            errno = ERR_IO_ERROR;
-                            return 1;
-                        }
-                        write_index = 0;
-                    }
-                }
-            }
-        }
+    error_code = error_code
+        || fwrite(&length, sizeof(int), 1, out_stream) != 1;
 
-    } while(read != 0);
+    struct _mapping_dict_writer writer = { 0, 0, out_buffer, 0 };
+    size_t read;
+    while (!error_code
+            && (read = fread(in_buffer, 1, BUFFER_SIZE, in_stream)) > 0) {
+        writer.position = 0;
+        _mapping_dict_encode(mapping_dict, in_buffer, read, &writer);
 
-    if (bit_index < 7) {
-        out_buffer[write_index] = current_byte;
-        write_index += 1;
+        /* The bits of an unfinished byte are kept for the next chunk. */
+        _mapping_dict_flush(&writer, 0);
+        error_code = fwrite(out_buffer, 1, writer.position, out_stream)
+            != writer.position;
     }
 
-    if (write_index > 0 && fwrite(out_buffer, 1, write_index, out_stream)
-            != write_index) {
-        errno = ERR_IO_ERROR;
-        free(in_buffer);
-        return 1;
+    if (!error_code) {
+        writer.position = 0;
+        _mapping_dict_flush(&writer, 1);
+        error_code = fwrite(out_buffer, 1, writer.position, out_stream)
+            != writer.position;
     }
 
+    if (error_code) errno = ERR_IO_ERROR;
     free(in_buffer);
-    return 0;
+    return error_code;
+}
+
+uint64_t mapping_dict_encoded_bits(struct mapping_dict* mapping_dict,
+        struct freq_dict* frequency_dict) {
+    uint64_t bits = 0;
+    for (int i = 0; i < 256; i++) {
+        uint64_t frequency = freq_dict_frequency_for(frequency_dict, i);
+        if (!frequency) continue;
+
+        uint32_t bit_count = mapping_dict->mappings[i].bit_count;
+        if (!bit_count) return UINT64_MAX;
+
+        bits += frequency * bit_count;
+    }
+
+    return bits;
+}
+
+size_t mapping_dict_encode_buffer(struct mapping_dict* mapping_dict,
+        const uint8_t* in_buffer, size_t in_size, uint8_t* out_buffer) {
+    struct _mapping_dict_writer writer = { 0, 0, out_buffer, 0 };
+    _mapping_dict_encode(mapping_dict, in_buffer, in_size, &writer);
+    _mapping_dict_flush(&writer, 1);
+
+    return writer.position;
 }
@@ -9,6 +9,16 @@
 #include "huffman_tree.h"
 
 
+/** Maximum number of bits of the codes of two bytes coded at once. */
+#define MAPPING_DICT_PAIR_MAX_BITS 24
+
+/**
+ * Number of bytes a code should encode for its pair table to pay off,
+ * about four times the number of pairs.
+ */
+#define MAPPING_DICT_PAIR_MIN_SIZE (256 * 1024)
+
+
 /**
  * @brief The mapping which maps one byte to its huffman codes.
  */
@@ -23,6 +33,14 @@ struct mapping_dict_mapping {
  */
 struct mapping_dict {
     struct mapping_dict_mapping mappings[256];
+    /**
+     * The codes of all pairs of bytes whose codes together take at most
+     * MAPPING_DICT_PAIR_MAX_BITS bits, indexed by the first byte times 256
+     * plus the second: the code in the upper bits and its length in the
+     * lowest 8 bits, 0 for pairs coded byte by byte. NULL until
+     * mapping_dict_create_pairs() is called.
+     */
+    uint32_t* pairs;
 };
 
 /**
@@ -41,6 +59,19 @@ struct mapping_dict* mapping_dict_create();
  */
 struct mapping_dict* mapping_dict_create_mapping(struct huffman_tree* tree);
 
+/**
+ * @brief Creates the pair table of a mapping dict, so that
+ * mapping_dict_encode_buffer() codes two bytes per lookup where their codes
+ * are short. The encoded bits are the same with and without it. Building
+ * the table takes about as long as encoding MAPPING_DICT_PAIR_MIN_SIZE / 4
+ * bytes.
+ *
+ * @param mapping_dict the mapping dict the table is created for. Its
+ * mappings must not change afterwards.
+ * @return int non-zero if an error occurred, zero otherwise.
+ */
+int mapping_dict_create_pairs(struct mapping_dict* mapping_dict);
+
 /**
  * @brief Frees a mapping dict.
  * 
@@ -99,5 +130,33 @@ void mapping_dict_set_bit(struct mapping_dict_mapping* mapping,
 int mapping_dict_compress_file(struct mapping_dict* mapping_dict,
     FILE* in_stream, FILE* out_stream);
 
+/**
+ * @brief Computes the number of bits the bytes counted in a frequency dict
+ * take up when they are encoded with a mapping dict.
+ * 
+ * @param mapping_dict the mapping dict containg the byte => code mappings.
+ * @param frequency_dict the frequencies of the bytes to be encoded.
+ * @return uint64_t the number of encoded bits, or UINT64_MAX if a byte
+ * of <frequency_dict> has no code in <mapping_dict>.
+ */
+uint64_t mapping_dict_encoded_bits(struct mapping_dict* mapping_dict,
+    struct freq_dict* frequency_dict);
+
+/**
+ * @brief Encodes a buffer according to the codes in a mapping dict.
+ * The last byte is padded with zero bits.
+ * 
+ * @param mapping_dict the mapping dict containg the byte => code mappings.
+ * @param in_buffer the bytes that should be encoded.
+ * @param in_size the number of bytes in <in_buffer>. Every byte must
+ * have a code in <mapping_dict>.
+ * @param out_buffer the buffer the encoded bits are written to, most
+ * significant bit first. Must be large enough for the number of bits
+ * mapping_dict_encoded_bits() reports.
+ * @return size_t the number of bytes written to <out_buffer>.
+ */
+size_t mapping_dict_encode_buffer(struct mapping_dict* mapping_dict,
+    const uint8_t* in_buffer, size_t in_size, uint8_t* out_buffer);
+
 
 #endif
@@ -0,0 +1,597 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef HUF_HAVE_PERF_EVENT
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HUF_HAVE_RDTSC
+#endif
+
+#include "error.h"
+#include "frequency_dict.h"
+#include "huffman_tree.h"
+#include "mapping_dict.h"
+#include "ans_code.h"
+#include "crc32c.h"
+#include "frame.h"
+#include "numa.h"
+#include "trace.h"
+
+
+/*
+ * Runs every hot kernel of the encoder and decoder on its own over a buffer
+ * in memory and reports hardware counters per call: cycles, instructions,
+ * branch misses and misses of the L1 data cache and the last level cache,
+ * read through perf_event_open() on Linux. Counters the kernel or the
+ * processor do not provide are shown as "-". The time stamp counter, or the
+ * monotonic clock where there is none, is read in any case.
+ */
+
+#define MICROBENCH_DEFAULT_SIZE (1u << 20)
+#define MICROBENCH_DEFAULT_ROUNDS 10
+/** Block size and number of timed runs per thread count of --scaling. */
+#define MICROBENCH_SCALING_BLOCK_SIZE (64u << 10)
+#define MICROBENCH_SCALING_RUNS 3
+
+/** Calls per round of the kernels that work on a code rather than bytes. */
+#define MICROBENCH_CODE_CALLS 1000
+
+
+enum microbench_counter {
+    MICROBENCH_CYCLES,
+    MICROBENCH_INSTRUCTIONS,
+    MICROBENCH_BRANCH_MISSES,
+    MICROBENCH_L1D_MISSES,
+    MICROBENCH_LLC_MISSES,
+    MICROBENCH_COUNTER_COUNT
+};
+
+/**
+ * @brief The counters read around every round of a kernel.
+ */
+struct microbench_counters {
+    /** The file descriptors of the events, -1 for those not available. */
+    int fds[MICROBENCH_COUNTER_COUNT];
+    uint64_t values[MICROBENCH_COUNTER_COUNT];
+    /** Time stamp counter ticks, or nanoseconds without one. */
+    uint64_t ticks;
+};
+
+/**
+ * @brief The inputs and outputs shared by the kernels, all prepared before
+ * the first kernel runs so that every kernel only does its own work.
+ */
+struct microbench_state {
+    const uint8_t* input;
+    size_t size;
+    struct freq_dict* dict;
+    struct huffman_tree* tree;
+    struct mapping_dict* mapping;
+    /** The same mapping with a pair table. */
+    struct mapping_dict* pair_mapping;
+    uint8_t tree_buffer[1 + 255 * 4];
+    size_t tree_size;
+    struct ans_code* ans;
+    uint8_t ans_buffer[ANS_CODE_MAX_SIZE];
+    size_t ans_size;
+    struct ans_code_table* ans_table;
+    uint8_t* encoded;
+    size_t encoded_size;
+    uint8_t* ans_encoded;
+    size_t ans_encoded_size;
+    uint8_t* decoded;
+    /** Keeps the compiler from dropping the results of the kernels. */
+    uint64_t sink;
+};
+
+/**
+ * @brief A kernel and what a call of it covers.
+ */
+struct microbench_kernel {
+    const char* name;
+    void (*run)(struct microbench_state* state);
+    /** Non-zero if every call works on all bytes of the input. */
+    int per_byte;
+};
+
+
+#ifdef HUF_HAVE_PERF_EVENT
+int microbench_open_event(uint32_t type, uint64_t config) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    /* Unprivileged processes may only count their own user space. */
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#endif
+
+void microbench_open_counters(struct microbench_counters* counters) {
+    for (int i = 0; i < MICROBENCH_COUNTER_COUNT; i++) counters->fds[i] = -1;
+
+#ifdef HUF_HAVE_PERF_EVENT
+    uint64_t cache_miss = (PERF_COUNT_HW_CACHE_OP_READ << 8)
+        | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    counters->fds[MICROBENCH_CYCLES] = microbench_open_event(
+        PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    counters->fds[MICROBENCH_INSTRUCTIONS] = microbench_open_event(
+        PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    counters->fds[MICROBENCH_BRANCH_MISSES] = microbench_open_event(
+        PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+    counters->fds[MICROBENCH_L1D_MISSES] = microbench_open_event(
+        PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | cache_miss);
+    counters->fds[MICROBENCH_LLC_MISSES] = microbench_open_event(
+        PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | cache_miss);
+#endif
+}
+
+void microbench_close_counters(struct microbench_counters* counters) {
+#ifdef HUF_HAVE_PERF_EVENT
+    for (int i = 0; i < MICROBENCH_COUNTER_COUNT; i++) {
+        if (counters->fds[i] >= 0) close(counters->fds[i]);
+    }
+#endif
+    (void)counters;
+}
+
+uint64_t microbench_ticks() {
+#ifdef HUF_HAVE_RDTSC
+    return __rdtsc();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+#endif
+}
+
+void microbench_start(struct microbench_counters* counters) {
+#ifdef HUF_HAVE_PERF_EVENT
+    for (int i = 0; i < MICROBENCH_COUNTER_COUNT; i++) {
+        if (counters->fds[i] < 0) continue;
+        ioctl(counters->fds[i], PERF_EVENT_IOC_RESET, 0);
+        ioctl(counters->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+    counters->ticks -= microbench_ticks();
+}
+
+void microbench_stop(struct microbench_counters* counters) {
+    counters->ticks += microbench_ticks();
+#ifdef HUF_HAVE_PERF_EVENT
+    for (int i = 0; i < MICROBENCH_COUNTER_COUNT; i++) {
+        if (counters->fds[i] < 0) continue;
+        ioctl(counters->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+
+        uint64_t value;
+        if (read(counters->fds[i], &value, sizeof(value)) == sizeof(value)) {
+            counters->values[i] += value;
+        }
+    }
+#endif
+}
+
+
+void microbench_histogram(struct microbench_state* state) {
+    struct freq_dict* dict = state->dict;
+    freq_dict_clear(dict);
+    freq_dict_add_buffer(dict, state->input, state->size);
+    state->sink += dict->frequencies[state->input[0]];
+}
+
+void microbench_tree(struct microbench_state* state) {
+    for (int i = 0; i < MICROBENCH_CODE_CALLS; i++) {
+        struct huffman_tree* tree = huffman_tree_create_from_freq_dict(state->dict);
+        state->sink += tree->frequency;
+        huffman_tree_free(tree);
+    }
+}
+
+void microbench_mapping(struct microbench_state* state) {
+    for (int i = 0; i < MICROBENCH_CODE_CALLS; i++) {
+        struct mapping_dict* mapping = mapping_dict_create_mapping(state->tree);
+        state->sink += mapping->mappings[state->input[0]].bit_count;
+        mapping_dict_free(mapping);
+    }
+}
+
+void microbench_pairs(struct microbench_state* state) {
+    for (int i = 0; i < MICROBENCH_CODE_CALLS; i++) {
+        mapping_dict_create_pairs(state->pair_mapping);
+        state->sink += state->pair_mapping->pairs[state->input[0] << 8];
+    }
+}
+
+void microbench_tree_write(struct microbench_state* state) {
+    for (int i = 0; i < MICROBENCH_CODE_CALLS; i++) {
+        state->sink += huffman_tree_write_to_buffer(state->tree, state->tree_buffer);
+    }
+}
+
+void microbench_tree_read(struct microbench_state* state) {
+    for (int i = 0; i < MICROBENCH_CODE_CALLS; i++) {
+        struct huffman_tree* tree = huffman_tree_read_from_buffer(state->tree_buffer);
+        state->sink += tree->number;
+        huffman_tree_free(tree);
+    }
+}
+
+void microbench_encode(struct microbench_state* state) {
+    state->sink += mapping_dict_encode_buffer(state->mapping, state->input,
+        state->size, state->encoded);
+}
+
+void microbench_encode_pairs(struct microbench_state* state) {
+    state->sink += mapping_dict_encode_buffer(state->pair_mapping, state->input,
+        state->size, state->encoded);
+}
+
+void microbench_decode(struct microbench_state* state) {
+    state->sink += huffman_tree_decode_buffer(state->tree, state->encoded,
+        state->encoded_size, state->decoded, state->size);
+}
+
+void microbench_ans_table(struct microbench_state* state) {
+    for (int i = 0; i < MICROBENCH_CODE_CALLS; i++) {
+        struct ans_code_table* table = ans_code_read_table(state->ans_buffer,
+            state->ans_size);
+        state->sink += table->entries[0].symbol;
+        ans_code_table_free(table);
+    }
+}
+
+void microbench_ans_encode(struct microbench_state* state) {
+    state->sink += ans_code_encode_buffer(state->ans, state->input, state->size,
+        state->ans_encoded, state->size + ANS_CODE_SLACK);
+}
+
+void microbench_ans_decode(struct microbench_state* state) {
+    state->sink += ans_code_decode_buffer(state->ans_table, state->ans_encoded,
+        state->ans_encoded_size, state->decoded, state->size);
+}
+
+void microbench_checksum(struct microbench_state* state) {
+    state->sink += crc32c_update(0, state->input, state->size);
+}
+
+static const struct microbench_kernel microbench_kernels[] = {
+    { "histogram", microbench_histogram, 1 },
+    { "tree-build", microbench_tree, 0 },
+    { "mapping", microbench_mapping, 0 },
+    { "pairs", microbench_pairs, 0 },
+    { "tree-write", microbench_tree_write, 0 },
+    { "tree-read", microbench_tree_read, 0 },
+    { "encode", microbench_encode, 1 },
+    { "encode-pairs", microbench_encode_pairs, 1 },
+    { "decode", microbench_decode, 1 },
+    { "ans-table", microbench_ans_table, 0 },
+    { "ans-encode", microbench_ans_encode, 1 },
+    { "ans-decode", microbench_ans_decode, 1 },
+    { "crc32c", microbench_checksum, 1 },
+};
+
+
+/* Builds the codes and encoded buffers the kernels start from, and checks
+ * that the input decodes back to itself. */
+int microbench_prepare(struct microbench_state* state) {
+    state->dict = freq_dict_create();
+    if (!state->dict) return 1;
+    freq_dict_add_buffer(state->dict, state->input, state->size);
+
+    state->tree = huffman_tree_create_from_freq_dict(state->dict);
+    if (!state->tree) return 1;
+    state->mapping = mapping_dict_create_mapping(state->tree);
+    if (!state->mapping) return 1;
+    state->pair_mapping = mapping_dict_create_mapping(state->tree);
+    if (!state->pair_mapping || mapping_dict_create_pairs(state->pair_mapping)) {
+        return 1;
+    }
+    state->tree_size = huffman_tree_write_to_buffer(state->tree, state->tree_buffer);
+
+    state->ans = ans_code_create_from_frequencies(state->dict->frequencies);
+    if (!state->ans) return 1;
+    state->ans_size = ans_code_write_to_buffer(state->ans, state->ans_buffer);
+    state->ans_table = ans_code_read_table(state->ans_buffer, state->ans_size);
+    if (!state->ans_table) return 1;
+
+    /* A code spends at most 255 bits on a byte. */
+    state->encoded = malloc(state->size * 32 + ANS_CODE_SLACK);
+    state->ans_encoded = malloc(state->size * 2 + ANS_CODE_SLACK);
+    state->decoded = malloc(state->size);
+    if (!state->encoded || !state->ans_encoded || !state->decoded) {
+        errno = ERR_MEM_ERROR;
+        return 1;
+    }
+
+    state->encoded_size = mapping_dict_encode_buffer(state->mapping,
+        state->input, state->size, state->encoded);
+    state->ans_encoded_size = ans_code_encode_buffer(state->ans, state->input,
+        state->size, state->ans_encoded, state->size * 2 + ANS_CODE_SLACK);
+
+    if (huffman_tree_decode_buffer(state->tree, state->encoded,
+                state->encoded_size, state->decoded, state->size)
+            || memcmp(state->decoded, state->input, state->size)
+            || state->ans_encoded_size == 0
+            || ans_code_decode_buffer(state->ans_table, state->ans_encoded,
+                state->ans_encoded_size, state->decoded, state->size)
+            || memcmp(state->decoded, state->input, state->size)) {
+        errno = ERR_PARSE_ERROR;
+        return 1;
+    }
+
+    return 0;
+}
+
+void microbench_release(struct microbench_state* state) {
+    if (state->dict) freq_dict_free(state->dict);
+    if (state->mapping) mapping_dict_free(state->mapping);
+    if (state->pair_mapping) mapping_dict_free(state->pair_mapping);
+    if (state->tree) huffman_tree_free(state->tree);
+    if (state->ans) ans_code_free(state->ans);
+    if (state->ans_table) ans_code_table_free(state->ans_table);
+    free(state->encoded);
+    free(state->ans_encoded);
+    free(state->decoded);
+}
+
+void microbench_print_value(const struct microbench_counters* counters,
+        int counter, double calls) {
+    if (counters->fds[counter] < 0) {
+        printf(" %12s", "-");
+    } else {
+        printf(" %12.1f", (double)counters->values[counter] / calls);
+    }
+}
+
+void microbench_run(struct microbench_state* state,
+        const struct microbench_kernel* kernel, int rounds) {
+    struct microbench_counters counters;
+    memset(&counters, 0, sizeof(counters));
+    microbench_open_counters(&counters);
+
+    /* The first round warms up the caches and is not counted. */
+    kernel->run(state);
+    for (int i = 0; i < rounds; i++) {
+        microbench_start(&counters);
+        kernel->run(state);
+        microbench_stop(&counters);
+    }
+
+    double calls = (double)rounds * (kernel->per_byte ? 1 : MICROBENCH_CODE_CALLS);
+    printf("%-11s %12.1f", kernel->name, (double)counters.ticks / calls);
+    for (int i = 0; i < MICROBENCH_COUNTER_COUNT; i++) {
+        microbench_print_value(&counters, i, calls);
+    }
+    if (kernel->per_byte && counters.fds[MICROBENCH_CYCLES] >= 0) {
+        printf(" %8.2f", (double)counters.values[MICROBENCH_CYCLES]
+            / calls / (double)state->size);
+    } else if (kernel->per_byte) {
+        printf(" %8.2f", (double)counters.ticks / calls / (double)state->size);
+    }
+    printf("\n");
+
+    microbench_close_counters(&counters);
+}
+
+
+/* Fills a buffer with text-like bytes of a skewed distribution. */
+void microbench_fill(uint8_t* buffer, size_t size) {
+    static const char letters[] = "    eeeetttaaoinshrdlucmfwypvbgkjqxz\n.,";
+    uint32_t state = 12345;
+    for (size_t i = 0; i < size; i++) {
+        state = state * 1103515245u + 12345u;
+        buffer[i] = (uint8_t)letters[(state >> 16) % (sizeof(letters) - 1)];
+    }
+}
+
+uint8_t* microbench_load(const char* path, size_t* size) {
+    FILE* stream = fopen(path, "rb");
+    if (!stream) return NULL;
+
+    uint8_t* buffer = malloc(*size ? *size : 1);
+    if (!buffer) {
+        fclose(stream);
+        errno = ERR_MEM_ERROR;
+        return NULL;
+    }
+    *size = fread(buffer, 1, *size, stream);
+    fclose(stream);
+
+    if (*size == 0) {
+        free(buffer);
+        errno = ERR_ILLEGAL_ARG;
+        return NULL;
+    }
+
+    return buffer;
+}
+
+/* Compresses the input as a framed stream on 1, 2, 4 ... <max_threads>
+ * threads and prints the best throughput of every thread count. */
+int microbench_scaling(const uint8_t* input, size_t size, int max_threads,
+        const int* cpus, size_t cpu_count) {
+    FILE* in_stream = tmpfile();
+    if (!in_stream || fwrite(input, 1, size, in_stream) != size) {
+        if (in_stream) fclose(in_stream);
+        errno = ERR_IO_ERROR;
+        return 1;
+    }
+
+    struct numa_topology* topology = numa_topology_detect();
+    if (topology) {
+        printf("%d processors on %d nodes, %zu bytes in blocks of %u bytes\n\n",
+            topology->cpu_count, topology->node_count, size,
+            MICROBENCH_SCALING_BLOCK_SIZE);
+        numa_topology_free(topology);
+    }
+    printf("%-7s %10s %8s\n", "threads", "MiB/s", "speedup");
+
+    struct frame_params params;
+    frame_params_init(&params);
+    params.block_size = MICROBENCH_SCALING_BLOCK_SIZE;
+    params.cpus = cpus;
+    params.cpu_count = cpu_count;
+
+    double base = 0;
+    int error_code = 0;
+    for (int threads = 1; !error_code; threads *= 2) {
+        if (threads > max_threads) threads = max_threads;
+        params.thread_count = threads;
+
+        uint64_t best = 0;
+        for (int run = 0; run < MICROBENCH_SCALING_RUNS && !error_code; run++) {
+            FILE* out_stream = tmpfile();
+            rewind(in_stream);
+            uint64_t start = trace_now();
+            error_code = !out_stream
+                || frame_compress_stream(&params, in_stream, out_stream);
+            uint64_t elapsed = trace_now() - start;
+            if (out_stream) fclose(out_stream);
+            if (!best || elapsed < best) best = elapsed;
+        }
+        if (error_code) break;
+
+        double speed = (double)size / (1 << 20) / ((double)(best ? best : 1) / 1e9);
+        if (threads == 1) base = speed;
+        printf("%-7d %10.1f %7.2fx\n", threads, speed, speed / base);
+        if (threads == max_threads) break;
+    }
+
+    fclose(in_stream);
+    return error_code;
+}
+
+
+void print_usage(const char* program) {
+    printf("Usage: %s [options] [FILE]\n"
+        "Runs the kernels of the encoder and decoder on the first bytes of\n"
+        "FILE, or on generated text, and prints the averages per call of:\n"
+        "ticks of the time stamp counter (nanoseconds without one), cycles,\n"
+        "instructions, branch misses, L1 data cache and last level cache\n"
+        "misses, and, for the kernels working on all bytes, cycles per byte\n"
+        "(cyc/B) or, where the cycle counter cannot be read, ticks per byte\n"
+        "(ticks/B).\n\n"
+        "Options:\n"
+        "  --size N         number of bytes to work on, default %u\n"
+        "  --rounds N       number of measured calls, default %d\n"
+        "  --kernel NAME    only run the kernel NAME\n"
+        "  --scaling N      instead, compress the bytes in blocks of 64 KiB\n"
+        "                   on 1, 2, 4 ... N threads and print the speedup\n"
+        "  --cpus LIST      with --scaling, run the threads on the listed\n"
+        "                   processors, like 0-3,8\n",
+        program, MICROBENCH_DEFAULT_SIZE, MICROBENCH_DEFAULT_ROUNDS);
+}
+
+
+int main(int argc, char* argv[]) {
+    size_t size = MICROBENCH_DEFAULT_SIZE;
+    int rounds = MICROBENCH_DEFAULT_ROUNDS;
+    const char* only = NULL;
+    const char* path = NULL;
+    int scaling = 0;
+    int cpus[NUMA_MAX_CPUS];
+    int cpu_count = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--size") && i + 1 < argc) {
+            size = strtoul(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--rounds") && i + 1 < argc) {
+            rounds = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--kernel") && i + 1 < argc) {
+            only = argv[++i];
+        } else if (!strcmp(argv[i], "--scaling") && i + 1 < argc) {
+            scaling = atoi(argv[++i]);
+            if (scaling <= 0) {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (!strcmp(argv[i], "--cpus") && i + 1 < argc) {
+            cpu_count = numa_parse_cpu_list(argv[++i], cpus, NUMA_MAX_CPUS);
+            if (cpu_count == 0) {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (!strcmp(argv[i], "--help")) {
+            print_usage(argv[0]);
+            return 0;
+        } else if (argv[i][0] != '-' && !path) {
+            path = argv[i];
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (size == 0 || rounds <= 0) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    struct microbench_state state;
+    memset(&state, 0, sizeof(state));
+    uint8_t* input = path ? microbench_load(path, &size) : malloc(size);
+    if (!input) {
+        if (!path) errno = ERR_MEM_ERROR;
+        print_error("Failed to load input");
+        return 1;
+    }
+    if (!path) microbench_fill(input, size);
+    state.input = input;
+    state.size = size;
+
+    if (scaling) {
+        int error_code = microbench_scaling(input, size, scaling,
+            cpu_count ? cpus : NULL, (size_t)cpu_count);
+        if (error_code) print_error("Failed to compress input");
+        free(input);
+        return error_code;
+    }
+
+    if (microbench_prepare(&state)) {
+        print_error("Failed to prepare kernels");
+        microbench_release(&state);
+        free(input);
+        return 1;
+    }
+
+    struct microbench_counters probe;
+    microbench_open_counters(&probe);
+    int counted = probe.fds[MICROBENCH_CYCLES] >= 0;
+    if (!counted) {
+        printf("Hardware counters are not available, showing ticks only.\n");
+    }
+    microbench_close_counters(&probe);
+
+    printf("%zu bytes, tree of %zu bytes, %zu bytes encoded, %zu with tANS\n\n",
+        size, state.tree_size, state.encoded_size, state.ans_encoded_size);
+    printf("%-11s %12s %12s %12s %12s %12s %12s %8s\n", "kernel", "ticks",
+        "cycles", "instructions", "branch-miss", "L1d-miss", "LLC-miss",
+        counted ? "cyc/B" : "ticks/B");
+
+    int found = 0;
+    for (size_t i = 0; i < sizeof(microbench_kernels) / sizeof(microbench_kernels[0]); i++) {
+        if (only && strcmp(only, microbench_kernels[i].name)) continue;
+        microbench_run(&state, &microbench_kernels[i], rounds);
+        found = 1;
+    }
+
+    microbench_release(&state);
+    free(input);
+
+    if (!found) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    return 0;
+}
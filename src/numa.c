@@ -0,0 +1,264 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include "numa.h"
+#include "thread_pool.h"
+
+#include <string.h>
+
+#ifdef __linux__
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/mempolicy.h>
+#endif
+
+
+int numa_parse_cpu_list(const char* text, int* cpus, int capacity) {
+    int count = 0;
+    while (*text && *text != '\n') {
+        char* end;
+        long first = strtol(text, &end, 10);
+        long last = first;
+        if (end == text) return 0;
+        if (*end == '-') {
+            text = end + 1;
+            last = strtol(text, &end, 10);
+            if (end == text) return 0;
+        }
+        if (first < 0 || last < first || last >= NUMA_MAX_CPUS
+                || last - first + 1 > capacity - count) {
+            return 0;
+        }
+
+        for (long cpu = first; cpu <= last; cpu++) cpus[count++] = (int)cpu;
+        text = end;
+        if (*text == ',') text++;
+    }
+
+    return count;
+}
+
+#ifdef __linux__
+/* Reads a list of processors or nodes from a file of sysfs. */
+int _numa_read_list(const char* path, int* list, int capacity) {
+    FILE* stream = fopen(path, "r");
+    if (!stream) return 0;
+
+    char text[4096];
+    int count = fgets(text, sizeof(text), stream)
+        ? numa_parse_cpu_list(text, list, capacity) : 0;
+    fclose(stream);
+
+    return count;
+}
+
+/* Assigns the allowed processors to the nodes sysfs lists them under. */
+void _numa_read_nodes(struct numa_topology* topology, const uint8_t* allowed) {
+    int* node_ids = malloc(NUMA_MAX_CPUS * sizeof(int));
+    int* node_cpus = malloc(NUMA_MAX_CPUS * sizeof(int));
+    int node_id_count = node_ids && node_cpus ? _numa_read_list(
+        "/sys/devices/system/node/online", node_ids, NUMA_MAX_CPUS) : 0;
+
+    for (int i = 0; i < node_id_count; i++) {
+        char path[64];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+            node_ids[i]);
+        int count = _numa_read_list(path, node_cpus, NUMA_MAX_CPUS);
+
+        /* Nodes with memory only, or none of the allowed processors, do
+         * not take part. */
+        int used = 0;
+        for (int j = 0; j < count; j++) {
+            if (!allowed[node_cpus[j]]) continue;
+            for (int k = 0; k < topology->cpu_count; k++) {
+                if (topology->cpus[k] == node_cpus[j]) {
+                    topology->nodes[k] = topology->node_count;
+                    used = 1;
+                }
+            }
+        }
+        if (used) topology->node_ids[topology->node_count++] = node_ids[i];
+    }
+
+    free(node_ids);
+    free(node_cpus);
+}
+#endif
+
+struct numa_topology* numa_topology_detect() {
+    struct numa_topology* topology = calloc(1, sizeof(struct numa_topology));
+    if (topology) {
+        topology->cpus = malloc(NUMA_MAX_CPUS * sizeof(int));
+        topology->nodes = calloc(NUMA_MAX_CPUS, sizeof(int));
+        topology->node_ids = calloc(NUMA_MAX_CPUS, sizeof(int));
+    }
+    if (!topology || !topology->cpus || !topology->nodes || !topology->node_ids) {
+        if (topology) numa_topology_free(topology);
+        errno = ERR_MEM_ERROR;
+        return NULL;
+    }
+
+#ifdef __linux__
+    uint8_t allowed[NUMA_MAX_CPUS];
+    memset(allowed, 0, sizeof(allowed));
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (!sched_getaffinity(0, sizeof(set), &set)) {
+        for (int cpu = 0; cpu < NUMA_MAX_CPUS && cpu < CPU_SETSIZE; cpu++) {
+            if (!CPU_ISSET(cpu, &set)) continue;
+            allowed[cpu] = 1;
+            topology->cpus[topology->cpu_count++] = cpu;
+        }
+    }
+    if (topology->cpu_count > 0) _numa_read_nodes(topology, allowed);
+#endif
+
+    /* Without anything better, all processors form a single node. */
+    if (topology->cpu_count == 0) {
+        topology->cpu_count = thread_pool_cpu_count();
+        if (topology->cpu_count > NUMA_MAX_CPUS) topology->cpu_count = NUMA_MAX_CPUS;
+        for (int i = 0; i < topology->cpu_count; i++) topology->cpus[i] = i;
+    }
+    if (topology->node_count == 0) {
+        topology->node_count = 1;
+        memset(topology->nodes, 0, NUMA_MAX_CPUS * sizeof(int));
+        topology->node_ids[0] = 0;
+    }
+
+    return topology;
+}
+
+void numa_topology_free(struct numa_topology* topology) {
+    free(topology->cpus);
+    free(topology->nodes);
+    free(topology->node_ids);
+    free(topology);
+}
+
+int numa_node_of(const struct numa_topology* topology, int cpu) {
+    for (int i = 0; i < topology->cpu_count; i++) {
+        if (topology->cpus[i] == cpu) return topology->nodes[i];
+    }
+
+    return 0;
+}
+
+void numa_spread_cpus(const struct numa_topology* topology, int* cpus) {
+    /* Takes the next processor of every node in turn. */
+    int count = 0;
+    for (int round = 0; count < topology->cpu_count; round++) {
+        for (int node = 0; node < topology->node_count; node++) {
+            int seen = 0;
+            for (int i = 0; i < topology->cpu_count; i++) {
+                if (topology->nodes[i] != node) continue;
+                if (seen++ == round) {
+                    cpus[count++] = topology->cpus[i];
+                    break;
+                }
+            }
+        }
+    }
+}
+
+int numa_pin_thread(int cpu) {
+#ifdef __linux__
+    if (cpu < 0 || cpu >= CPU_SETSIZE) {
+        errno = ERR_ILLEGAL_ARG;
+        return 1;
+    }
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set)) {
+        errno = ERR_ILLEGAL_ARG;
+        return 1;
+    }
+#else
+    (void)cpu;
+#endif
+    return 0;
+}
+
+int numa_save_affinity(struct numa_affinity* affinity) {
+    memset(affinity->allowed, 0, sizeof(affinity->allowed));
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set)) {
+        errno = ERR_ILLEGAL_ARG;
+        return 1;
+    }
+    for (int cpu = 0; cpu < NUMA_MAX_CPUS && cpu < CPU_SETSIZE; cpu++) {
+        affinity->allowed[cpu] = CPU_ISSET(cpu, &set) != 0;
+    }
+#endif
+    return 0;
+}
+
+int numa_restore_affinity(const struct numa_affinity* affinity) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu = 0; cpu < NUMA_MAX_CPUS && cpu < CPU_SETSIZE; cpu++) {
+        if (affinity->allowed[cpu]) CPU_SET(cpu, &set);
+    }
+    if (sched_setaffinity(0, sizeof(set), &set)) {
+        errno = ERR_ILLEGAL_ARG;
+        return 1;
+    }
+#else
+    (void)affinity;
+#endif
+    return 0;
+}
+
+void* numa_alloc(size_t size, int node) {
+#ifdef __linux__
+    if (node >= 0 && node < NUMA_MAX_CPUS) {
+        void* memory = mmap(NULL, size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED) {
+            errno = ERR_MEM_ERROR;
+            return NULL;
+        }
+
+        /* Without the policy, the memory is still usable, only placed
+         * wherever it is first written. */
+        unsigned long mask[NUMA_MAX_CPUS / (8 * sizeof(unsigned long))];
+        memset(mask, 0, sizeof(mask));
+        mask[node / (8 * sizeof(unsigned long))]
+            |= 1ul << (node % (8 * sizeof(unsigned long)));
+        syscall(SYS_mbind, memory, size, MPOL_PREFERRED, mask,
+            (unsigned long)NUMA_MAX_CPUS + 1, 0);
+
+        return memory;
+    }
+#else
+    (void)node;
+#endif
+
+    void* memory = malloc(size);
+    if (!memory) errno = ERR_MEM_ERROR;
+
+    return memory;
+}
+
+void numa_free(void* memory, size_t size, int node) {
+    if (!memory) return;
+
+#ifdef __linux__
+    if (node >= 0 && node < NUMA_MAX_CPUS) {
+        munmap(memory, size);
+        return;
+    }
+#else
+    (void)size;
+    (void)node;
+#endif
+
+    free(memory);
+}
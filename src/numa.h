@@ -0,0 +1,141 @@
+#ifndef NUMA_H
+#define NUMA_H
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "error.h"
+
+
+/*
+ * The processors and memory nodes of the host, read from
+ * /sys/devices/system/node on Linux. Elsewhere, and where sysfs lists no
+ * nodes, all processors form a single node. Threads are only pinned and
+ * memory only placed on Linux; the calls succeed without effect elsewhere.
+ */
+
+/** Maximum number of processors and of nodes taken into account. */
+#define NUMA_MAX_CPUS 1024
+
+
+/**
+ * @brief The processors the process may run on and their nodes.
+ */
+struct numa_topology {
+    /** Number of nodes, at least 1. */
+    int node_count;
+    /** Number of entries of <cpus> and <nodes>, at least 1. */
+    int cpu_count;
+    /** The processors the process may run on, in increasing order. */
+    int* cpus;
+    /** The node of every processor of <cpus>, from 0 to node_count - 1. */
+    int* nodes;
+    /** The number sysfs gives every node. */
+    int* node_ids;
+};
+
+
+/**
+ * @brief The processors a thread may run on, saved to be restored after
+ * the thread has been pinned.
+ */
+struct numa_affinity {
+    /** Non-zero for every processor the thread may run on. */
+    uint8_t allowed[NUMA_MAX_CPUS];
+};
+
+
+/**
+ * @brief Reads the topology of the host.
+ *
+ * @return struct numa_topology* the topology, NULL if an error occurred.
+ * Must be freed with a call to numa_topology_free().
+ */
+struct numa_topology* numa_topology_detect();
+
+/**
+ * @brief Frees a topology.
+ *
+ * @param topology the topology to be freed.
+ */
+void numa_topology_free(struct numa_topology* topology);
+
+/**
+ * @brief Returns the node of a processor.
+ *
+ * @param topology the topology of the host.
+ * @param cpu the number of the processor.
+ * @return int the node of <cpu>, 0 if it is not known.
+ */
+int numa_node_of(const struct numa_topology* topology, int cpu);
+
+/**
+ * @brief Orders the processors of a topology so that consecutive ones
+ * alternate between the nodes, to spread threads evenly over them.
+ *
+ * @param topology the topology of the host.
+ * @param cpus filled with topology->cpu_count processors.
+ */
+void numa_spread_cpus(const struct numa_topology* topology, int* cpus);
+
+/**
+ * @brief Parses a list of processors in the format of sysfs and taskset,
+ * like "0-3,8,10-11".
+ *
+ * @param text the list to be parsed.
+ * @param cpus filled with the processors in the order listed.
+ * @param capacity the number of entries of <cpus>.
+ * @return int the number of processors, 0 if <text> is malformed, lists a
+ * processor beyond NUMA_MAX_CPUS or more than <capacity> processors.
+ */
+int numa_parse_cpu_list(const char* text, int* cpus, int capacity);
+
+/**
+ * @brief Restricts the calling thread to a single processor.
+ *
+ * @param cpu the processor to run on.
+ * @return int non-zero if an error occurred, zero otherwise.
+ */
+int numa_pin_thread(int cpu);
+
+/**
+ * @brief Saves the processors the calling thread may run on.
+ *
+ * @param affinity set to the processors of the calling thread.
+ * @return int non-zero if an error occurred, zero otherwise.
+ */
+int numa_save_affinity(struct numa_affinity* affinity);
+
+/**
+ * @brief Lets the calling thread run on the processors it was allowed to
+ * run on when they were saved, undoing numa_pin_thread().
+ *
+ * @param affinity the processors saved by numa_save_affinity().
+ * @return int non-zero if an error occurred, zero otherwise.
+ */
+int numa_restore_affinity(const struct numa_affinity* affinity);
+
+/**
+ * @brief Allocates memory whose pages are placed on a node as they are
+ * first written, wherever the writing thread runs.
+ *
+ * @param size the number of bytes to allocate.
+ * @param node the number sysfs gives the preferred node, -1 for none.
+ * @return void* the memory, NULL if an error occurred. Must be freed with a
+ * call to numa_free() with the same <size> and <node>.
+ */
+void* numa_alloc(size_t size, int node);
+
+/**
+ * @brief Frees memory allocated by numa_alloc().
+ *
+ * @param memory the memory to be freed, may be NULL.
+ * @param size the size passed to numa_alloc().
+ * @param node the node passed to numa_alloc().
+ */
+void numa_free(void* memory, size_t size, int node);
+
+
+#endif
@@ -0,0 +1,410 @@
+#include "scheduler.h"
+#include "frame_index.h"
+#include "trace.h"
+#include "numa.h"
+
+#include <string.h>
+
+
+/**
+ * @brief A block between being read and being written.
+ */
+struct _scheduler_slot {
+    /** The input, followed by the transformed bytes and the output. */
+    uint8_t* buffer;
+    uint8_t* transformed;
+    uint8_t* output;
+    uint8_t* header;
+    /** Number of bytes of the block, the input may hold more. */
+    size_t size;
+    size_t header_size;
+    const uint8_t* payload;
+    uint64_t payload_size;
+    uint32_t checksum;
+    /** The errno if compressing the block failed, zero otherwise. */
+    int error;
+    /** The node <buffer> is placed on as sysfs numbers it, -1 for none. */
+    int node;
+};
+
+/**
+ * @brief The slots placed on one node, claimed by its threads first.
+ */
+struct _scheduler_queue {
+    /** The numbers of the slots, in increasing order. */
+    size_t* slots;
+    size_t slot_count;
+    /** The next slot of the round not claimed by any thread. */
+    size_t next;
+};
+
+/**
+ * @brief The dicts of a thread compressing blocks.
+ */
+struct _scheduler_worker {
+    struct freq_dict* block_dict;
+    struct freq_dict* spare_dict;
+    /** The node the thread runs on, numbered like the queues. */
+    int queue;
+};
+
+/**
+ * @brief The state shared by all threads compressing the blocks of a stream.
+ */
+struct _scheduler_job {
+    const struct frame_params* params;
+    const struct frame_shared_code* shared;
+    struct _scheduler_slot* slots;
+    size_t slot_count;
+    struct _scheduler_worker* workers;
+    int worker_count;
+    /** The slots of every node; blocks of a round are claimed from them. */
+    struct _scheduler_queue* queues;
+    int queue_count;
+    /** The number of slots filled in the current round. */
+    size_t round_count;
+#ifdef HUF_HAVE_PTHREAD
+    pthread_mutex_t mutex;
+#endif
+};
+
+
+size_t scheduler_slot_memory(const struct frame_params* params) {
+    int transformed = params->transform.type != TRANSFORM_NONE;
+    return (transformed ? 3 : 2) * params->block_size + ANS_CODE_SLACK
+        + FRAME_BLOCK_HEADER_SIZE + CRC32C_SIZE + FRAME_TRANSFORM_SIZE
+        + (params->wide ? FRAME_MAX_CODE_SIZE : FRAME_MAX_TREE_SIZE);
+}
+
+size_t scheduler_thread_memory(const struct frame_params* params) {
+    /* Two dicts, and the code built for a block: about a word of lengths
+     * and codes per symbol for words, a pair table for large blocks of
+     * bytes. */
+    size_t alphabet_size = params->wide ? 65536 : 256;
+    size_t code_size = params->wide ? alphabet_size * sizeof(uint64_t)
+        : params->block_size >= MAPPING_DICT_PAIR_MIN_SIZE
+            ? 256 * 256 * sizeof(uint32_t) : 0;
+    return 2 * alphabet_size * sizeof(uint64_t) + code_size;
+}
+
+/* Claims the next slot of the round, from the node of the worker if it has
+ * any left, otherwise from the other nodes in turn. */
+struct _scheduler_slot* _scheduler_claim(struct _scheduler_job* job, int worker) {
+    struct _scheduler_slot* slot = NULL;
+#ifdef HUF_HAVE_PTHREAD
+    pthread_mutex_lock(&job->mutex);
+#endif
+    for (int i = 0; i < job->queue_count && !slot; i++) {
+        struct _scheduler_queue* queue
+            = &job->queues[(job->workers[worker].queue + i) % job->queue_count];
+        if (queue->next < queue->slot_count
+                && queue->slots[queue->next] < job->round_count) {
+            slot = &job->slots[queue->slots[queue->next++]];
+        }
+    }
+#ifdef HUF_HAVE_PTHREAD
+    pthread_mutex_unlock(&job->mutex);
+#endif
+
+    return slot;
+}
+
+void _scheduler_compress_block(void* context, size_t item, int worker) {
+    (void)item;
+    struct _scheduler_job* job = context;
+    const struct frame_params* params = job->params;
+    struct _scheduler_slot* slot = _scheduler_claim(job, worker);
+    struct _scheduler_worker* dicts = &job->workers[worker];
+
+    TRACE_BEGIN(histogram_start);
+    struct transform transform;
+    const uint8_t* symbols = frame_analyze_block(params, slot->buffer,
+        slot->size, slot->transformed, &dicts->block_dict, &dicts->spare_dict,
+        &transform);
+    TRACE_END(histogram_start, "histogram", slot->size);
+
+    TRACE_BEGIN(tree_start);
+    struct frame_block_plan plan;
+    int error_code = frame_plan_block(params, job->shared, dicts->block_dict,
+        slot->size, &plan);
+    TRACE_END(tree_start, "tree build", slot->size);
+    if (error_code) {
+        slot->error = errno ? errno : ERR_MEM_ERROR;
+        return;
+    }
+
+    TRACE_BEGIN(encode_start);
+    if (params->checksum) slot->checksum = crc32c_update(0, slot->buffer, slot->size);
+    slot->payload = frame_encode_block(params, &plan, symbols, slot->size,
+        slot->output);
+    frame_put_block_header(&plan, slot->size,
+        params->checksum ? &slot->checksum : NULL,
+        params->transform.type != TRANSFORM_NONE ? &transform : NULL,
+        slot->header);
+    slot->header_size = plan.header_size;
+    slot->payload_size = plan.payload_size;
+    frame_block_plan_free(&plan);
+    TRACE_END(encode_start, "encode", slot->size);
+}
+
+/* Chooses the number of slots and threads the memory limit allows. */
+int _scheduler_size(const struct frame_params* params, int thread_count,
+        size_t* slot_count, int* worker_count) {
+    size_t slot_memory = scheduler_slot_memory(params);
+    size_t thread_memory = scheduler_thread_memory(params);
+    *slot_count = (size_t)thread_count * SCHEDULER_SLOTS_PER_THREAD;
+    *worker_count = thread_count;
+    if (!params->memory_limit) return 0;
+
+    /* Fewer threads than slots are of no use, and every thread needs its
+     * state, so both shrink together. */
+    while (*slot_count > 0 && *slot_count * slot_memory
+            + (size_t)*worker_count * thread_memory > params->memory_limit) {
+        (*slot_count)--;
+        if ((size_t)*worker_count > *slot_count && *worker_count > 1) {
+            (*worker_count)--;
+        }
+    }
+    if (*slot_count == 0) {
+        errno = ERR_ILLEGAL_ARG;
+        return 1;
+    }
+
+    return 0;
+}
+
+void _scheduler_free(struct _scheduler_job* job) {
+    size_t slot_memory = scheduler_slot_memory(job->params);
+    if (job->slots) {
+        for (size_t i = 0; i < job->slot_count; i++) {
+            numa_free(job->slots[i].buffer, slot_memory, job->slots[i].node);
+        }
+        free(job->slots);
+    }
+    if (job->queues) {
+        for (int i = 0; i < job->queue_count; i++) free(job->queues[i].slots);
+        free(job->queues);
+    }
+    if (job->workers) {
+        for (int i = 0; i < job->worker_count; i++) {
+            if (job->workers[i].block_dict) freq_dict_free(job->workers[i].block_dict);
+            if (job->workers[i].spare_dict) freq_dict_free(job->workers[i].spare_dict);
+        }
+        free(job->workers);
+    }
+}
+
+/* Creates the slots and the state of the threads. Slot i belongs to the
+ * node of worker i modulo the number of workers, and its buffer is placed on
+ * that node if the threads are spread over several. */
+int _scheduler_create(struct _scheduler_job* job, int worker_count,
+        const struct numa_topology* topology, const int* worker_cpus) {
+    const struct frame_params* params = job->params;
+    int transformed = params->transform.type != TRANSFORM_NONE;
+    size_t slot_memory = scheduler_slot_memory(params);
+
+    job->queue_count = topology->node_count;
+    job->slots = calloc(job->slot_count, sizeof(struct _scheduler_slot));
+    job->workers = calloc((size_t)worker_count, sizeof(struct _scheduler_worker));
+    job->queues = calloc((size_t)job->queue_count, sizeof(struct _scheduler_queue));
+    job->worker_count = job->workers ? worker_count : 0;
+    int error_code = !job->slots || !job->workers || !job->queues;
+
+    for (int i = 0; i < job->worker_count; i++) {
+        job->workers[i].queue = worker_cpus
+            ? numa_node_of(topology, worker_cpus[i]) : 0;
+    }
+    for (int i = 0; i < job->queue_count && !error_code; i++) {
+        job->queues[i].slots = malloc(job->slot_count * sizeof(size_t));
+        error_code = !job->queues[i].slots;
+    }
+
+    for (size_t i = 0; i < job->slot_count && !error_code; i++) {
+        struct _scheduler_slot* slot = &job->slots[i];
+        int queue = job->workers[i % (size_t)worker_count].queue;
+        struct _scheduler_queue* node_queue = &job->queues[queue];
+        node_queue->slots[node_queue->slot_count++] = i;
+
+        slot->node = topology->node_count > 1 ? topology->node_ids[queue] : -1;
+        slot->buffer = numa_alloc(slot_memory, slot->node);
+        error_code = !slot->buffer;
+        if (error_code) break;
+
+        slot->transformed = slot->buffer + params->block_size;
+        slot->output = slot->transformed + (transformed ? params->block_size : 0);
+        slot->header = slot->output + params->block_size + ANS_CODE_SLACK;
+    }
+    for (int i = 0; i < job->worker_count && !error_code; i++) {
+        job->workers[i].block_dict = frame_create_dict(params);
+        job->workers[i].spare_dict = frame_create_dict(params);
+        error_code = !job->workers[i].block_dict || !job->workers[i].spare_dict;
+    }
+
+    if (error_code) {
+        _scheduler_free(job);
+        errno = ERR_MEM_ERROR;
+    }
+
+    return error_code;
+}
+
+/* Reads the blocks of the next round into the slots. Bytes behind the end of
+ * a block that was split are moved to the front of the next slot. */
+int _scheduler_read(struct _scheduler_job* job, struct async_reader* reader,
+        struct freq_dict* front_dict, struct freq_dict* all_dict,
+        struct _scheduler_slot** last, size_t* pending, size_t* count) {
+    const struct frame_params* params = job->params;
+    int split = params->split_size && !params->wide;
+
+    for (int i = 0; i < job->queue_count; i++) job->queues[i].next = 0;
+    for (*count = 0; *count < job->slot_count; (*count)++) {
+        struct _scheduler_slot* slot = &job->slots[*count];
+        if (*pending) {
+            memmove(slot->buffer, (*last)->buffer + (*last)->size, *pending);
+        }
+
+        TRACE_BEGIN(read_start);
+        size_t available = *pending + async_reader_read(reader,
+            slot->buffer + *pending, params->block_size - *pending);
+        TRACE_END(read_start, "read", available - *pending);
+        if (available == *pending && async_reader_error(reader)) {
+            errno = ERR_IO_ERROR;
+            return 1;
+        }
+        if (available == 0) break;
+
+        slot->size = split ? frame_split_block(params, job->shared,
+            slot->buffer, available, front_dict, all_dict) : available;
+        slot->error = 0;
+        *pending = available - slot->size;
+        *last = slot;
+    }
+    job->round_count = *count;
+
+    return 0;
+}
+
+int _scheduler_write(struct _scheduler_job* job, size_t count,
+        struct async_writer* writer, struct frame_index* index,
+        uint32_t* checksum) {
+    for (size_t i = 0; i < count; i++) {
+        struct _scheduler_slot* slot = &job->slots[i];
+        if (slot->error) {
+            errno = slot->error;
+            return 1;
+        }
+
+        if (job->params->checksum) {
+            *checksum = crc32c_combine(*checksum, slot->checksum, slot->size);
+        }
+
+        TRACE_BEGIN(write_start);
+        int error_code = (index && frame_index_add_block(index,
+                async_writer_position(writer), (uint32_t)slot->size))
+            || async_writer_write(writer, slot->header, slot->header_size)
+            || async_writer_write(writer, slot->payload, slot->payload_size);
+        TRACE_END(write_start, "write", slot->header_size + slot->payload_size);
+        if (error_code) return 1;
+    }
+
+    return 0;
+}
+
+/* Chooses the processor of every worker: those listed by the parameters,
+ * or the processors of the host spread over its nodes. Threads are left
+ * unpinned on a host with a single node. */
+int* _scheduler_worker_cpus(const struct frame_params* params,
+        const struct numa_topology* topology, int worker_count) {
+    if (!params->cpus && topology->node_count == 1) return NULL;
+
+    int* cpus = malloc((size_t)worker_count * sizeof(int));
+    int* spread = params->cpus ? NULL
+        : malloc((size_t)topology->cpu_count * sizeof(int));
+    if (!cpus || (!params->cpus && !spread)) {
+        free(cpus);
+        free(spread);
+        errno = ERR_MEM_ERROR;
+        return NULL;
+    }
+
+    if (spread) numa_spread_cpus(topology, spread);
+    for (int i = 0; i < worker_count; i++) {
+        cpus[i] = params->cpus ? params->cpus[(size_t)i % params->cpu_count]
+            : spread[i % topology->cpu_count];
+    }
+    free(spread);
+
+    return cpus;
+}
+
+int scheduler_compress_blocks(const struct frame_params* params,
+        const struct frame_shared_code* shared, struct async_reader* reader,
+        struct async_writer* writer, struct frame_index* index,
+        uint32_t* checksum) {
+    int thread_count = params->thread_count > 0 ? params->thread_count
+        : params->cpus ? (int)params->cpu_count : thread_pool_cpu_count();
+
+    struct _scheduler_job job;
+    memset(&job, 0, sizeof(struct _scheduler_job));
+    job.params = params;
+    job.shared = shared;
+
+    int worker_count;
+    if (_scheduler_size(params, thread_count, &job.slot_count, &worker_count)) {
+        return 1;
+    }
+
+    struct numa_topology* topology = numa_topology_detect();
+    if (!topology) return 1;
+    int* worker_cpus = _scheduler_worker_cpus(params, topology, worker_count);
+    int error_code = (params->cpus || topology->node_count > 1) && !worker_cpus;
+    if (!error_code) {
+        error_code = _scheduler_create(&job, worker_count, topology, worker_cpus);
+    }
+    numa_topology_free(topology);
+    if (error_code) {
+        free(worker_cpus);
+        return 1;
+    }
+#ifdef HUF_HAVE_PTHREAD
+    pthread_mutex_init(&job.mutex, NULL);
+#endif
+
+    int split = params->split_size && !params->wide;
+    struct freq_dict* front_dict = split ? freq_dict_create() : NULL;
+    struct freq_dict* all_dict = split ? freq_dict_create() : NULL;
+    struct thread_pool* pool = thread_pool_create_pinned(worker_count, worker_cpus);
+    error_code = !pool || (split && (!front_dict || !all_dict));
+    if (error_code) errno = ERR_MEM_ERROR;
+
+    /* The pool leaves worker 0, this thread, where it runs, but its slots
+     * are placed on the node of its processor, so it is pinned there until
+     * the blocks are done. */
+    struct numa_affinity affinity;
+    int pinned = !error_code && worker_cpus && !numa_save_affinity(&affinity)
+        && !numa_pin_thread(worker_cpus[0]);
+    free(worker_cpus);
+
+    struct _scheduler_slot* last = NULL;
+    size_t pending = 0;
+    size_t count = job.slot_count;
+    while (!error_code && count == job.slot_count) {
+        error_code = _scheduler_read(&job, reader, front_dict, all_dict,
+            &last, &pending, &count);
+        if (error_code || count == 0) break;
+
+        thread_pool_run(pool, _scheduler_compress_block, &job, count);
+        error_code = _scheduler_write(&job, count, writer, index, checksum);
+    }
+
+    if (pinned) numa_restore_affinity(&affinity);
+    if (pool) thread_pool_free(pool);
+    if (front_dict) freq_dict_free(front_dict);
+    if (all_dict) freq_dict_free(all_dict);
+#ifdef HUF_HAVE_PTHREAD
+    pthread_mutex_destroy(&job.mutex);
+#endif
+    _scheduler_free(&job);
+
+    return error_code;
+}
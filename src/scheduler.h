@@ -0,0 +1,70 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "error.h"
+#include "frame.h"
+#include "thread_pool.h"
+
+
+/*
+ * Blocks are compressed in parallel in rounds: the calling thread reads as
+ * many blocks as there are slots, the threads of a pool analyze, plan and
+ * encode them, and the calling thread writes them in order. The slots and
+ * their buffers are allocated once and reused for every round, so the input
+ * is only read as fast as blocks are written and the memory held does not
+ * grow with the input. The output is the same as that of compressing the
+ * blocks one after another.
+ *
+ * On a host with several memory nodes, or with params->cpus, every started
+ * thread is pinned to a processor and the slots are dealt out to the nodes
+ * of the threads, their buffers placed on those nodes. A thread compresses
+ * the blocks of its own node first and only then takes those of others.
+ */
+
+/** Number of slots per thread if the memory is not limited. */
+#define SCHEDULER_SLOTS_PER_THREAD 2
+
+
+/**
+ * @brief Returns the number of bytes a slot of a block holds.
+ *
+ * @param params the parameters of compression.
+ * @return size_t the bytes of the input, output and header buffers of a slot.
+ */
+size_t scheduler_slot_memory(const struct frame_params* params);
+
+/**
+ * @brief Returns the number of bytes a thread compressing blocks holds
+ * besides its slots: its dicts and the tables of the codes it builds.
+ *
+ * @param params the parameters of compression.
+ * @return size_t the bytes of the state of a thread.
+ */
+size_t scheduler_thread_memory(const struct frame_params* params);
+
+/**
+ * @brief Compresses the blocks of a stream on params->thread_count threads,
+ * holding at most params->memory_limit bytes of blocks and thread state.
+ * Behaves like frame_compress_blocks().
+ *
+ * @param params the parameters of compression.
+ * @param shared the code shared by the blocks.
+ * @param reader the reader the bytes are read from.
+ * @param writer the writer the blocks are written to.
+ * @param index the index the blocks are added to, may be NULL.
+ * @param checksum combined with the checksums of the blocks.
+ * @return int non-zero if an error occurred, zero otherwise. errno is set to
+ * ERR_ILLEGAL_ARG if the memory limit does not hold a single block.
+ */
+int scheduler_compress_blocks(const struct frame_params* params,
+    const struct frame_shared_code* shared, struct async_reader* reader,
+    struct async_writer* writer, struct frame_index* index,
+    uint32_t* checksum);
+
+
+#endif
@@ -0,0 +1,496 @@
+#include "search.h"
+
+#include <string.h>
+
+
+/* Number of blocks searched per thread before the matches found so far are
+ * reported, which bounds the number of matches held in memory. */
+#define _HUF_SEARCH_ROUND_BLOCKS 4
+
+
+/**
+ * @brief A match at an uncompressed offset.
+ */
+struct _huf_search_match {
+    uint64_t offset;
+    size_t pattern;
+};
+
+/**
+ * @brief A growing list of matches.
+ */
+struct _huf_search_list {
+    struct _huf_search_match* matches;
+    size_t count;
+    size_t capacity;
+};
+
+/**
+ * @brief An Aho-Corasick automaton of all patterns, whose transitions are
+ * resolved for every state and byte in advance.
+ */
+struct _huf_search_matcher {
+    /** The state following every state and byte, 256 entries per state. */
+    uint16_t* next;
+    /** Non-zero for every state at which at least one pattern ends. */
+    uint8_t* accepts;
+    /** The first pattern ending exactly at every state, or -1. */
+    int32_t* first_pattern;
+    /** The next pattern ending at the same state, or -1. */
+    int32_t* next_pattern;
+    /** The longest proper suffix of every state at which a pattern ends. */
+    uint16_t* output_link;
+    /** Non-zero for the first byte of every pattern. */
+    uint8_t starts[256];
+    const size_t* sizes;
+    size_t max_size;
+};
+
+/**
+ * @brief The outcome of searching one block of a round.
+ */
+struct _huf_search_block {
+    /** The matches lying within the block. */
+    struct _huf_search_list list;
+    /**
+     * The first and the last <edge_size> bytes of the block, the latter
+     * starting <max_size> - 1 bytes in.
+     */
+    uint8_t* edges;
+    size_t edge_size;
+    /** Non-zero if no match can touch the block, which was not decoded. */
+    int skipped;
+    /** The errno if the block failed, zero otherwise. */
+    int error;
+};
+
+/**
+ * @brief The buffers of a thread searching blocks.
+ */
+struct _huf_search_worker {
+    uint8_t* output;
+    size_t output_capacity;
+    uint8_t* scratch;
+    size_t scratch_capacity;
+};
+
+/**
+ * @brief The state shared by all threads searching the blocks of a file.
+ */
+struct _huf_search_job {
+    struct frame_index* index;
+    FILE* stream;
+    const uint8_t* const* patterns;
+    size_t pattern_count;
+    struct _huf_search_matcher* matcher;
+    struct _huf_search_worker* workers;
+    /** The blocks of the current round. */
+    struct _huf_search_block* blocks;
+    /** The position of the first block of the current round in the index. */
+    size_t first_block;
+};
+
+
+int _huf_search_list_add(struct _huf_search_list* list, uint64_t offset,
+        size_t pattern) {
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity ? list->capacity * 2 : 64;
+        struct _huf_search_match* matches = realloc(list->matches,
+            capacity * sizeof(struct _huf_search_match));
+        if (!matches) {
+            errno = ERR_MEM_ERROR;
+            return 1;
+        }
+        list->matches = matches;
+        list->capacity = capacity;
+    }
+
+    list->matches[list->count].offset = offset;
+    list->matches[list->count].pattern = pattern;
+    list->count++;
+
+    return 0;
+}
+
+int _huf_search_compare(const void* a, const void* b) {
+    const struct _huf_search_match* left = a;
+    const struct _huf_search_match* right = b;
+
+    if (left->offset != right->offset) return left->offset < right->offset ? -1 : 1;
+    if (left->pattern != right->pattern) return left->pattern < right->pattern ? -1 : 1;
+    return 0;
+}
+
+
+void _huf_search_matcher_free(struct _huf_search_matcher* matcher) {
+    free(matcher->next);
+    free(matcher->accepts);
+    free(matcher->first_pattern);
+    free(matcher->next_pattern);
+    free(matcher->output_link);
+    free(matcher);
+}
+
+struct _huf_search_matcher* _huf_search_matcher_create(
+        const uint8_t* const* patterns, const size_t* sizes, size_t count) {
+    size_t total_size = 0;
+    size_t max_size = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (sizes[i] == 0 || sizes[i] > HUF_SEARCH_MAX_PATTERN_SIZE) {
+            errno = ERR_ILLEGAL_ARG;
+            return NULL;
+        }
+        total_size += sizes[i];
+        if (sizes[i] > max_size) max_size = sizes[i];
+    }
+    if (count == 0 || total_size > HUF_SEARCH_MAX_TOTAL_SIZE) {
+        errno = ERR_ILLEGAL_ARG;
+        return NULL;
+    }
+
+    struct _huf_search_matcher* matcher = calloc(1, sizeof(struct _huf_search_matcher));
+    size_t capacity = total_size + 1;
+    uint16_t* fail = malloc(capacity * sizeof(uint16_t));
+    uint16_t* queue = malloc(capacity * sizeof(uint16_t));
+    if (matcher) {
+        matcher->next = calloc(capacity * 256, sizeof(uint16_t));
+        matcher->accepts = calloc(capacity, 1);
+        matcher->first_pattern = malloc(capacity * sizeof(int32_t));
+        matcher->next_pattern = malloc(count * sizeof(int32_t));
+        matcher->output_link = calloc(capacity, sizeof(uint16_t));
+    }
+    if (!matcher || !fail || !queue || !matcher->next || !matcher->accepts
+            || !matcher->first_pattern || !matcher->next_pattern
+            || !matcher->output_link) {
+        if (matcher) _huf_search_matcher_free(matcher);
+        free(fail);
+        free(queue);
+        errno = ERR_MEM_ERROR;
+        return NULL;
+    }
+    matcher->sizes = sizes;
+    matcher->max_size = max_size;
+
+    /* The trie of the patterns, in which no edge leads back to the root,
+     * so a transition of 0 means there is none yet. */
+    uint16_t* next = matcher->next;
+    size_t state_count = 1;
+    memset(matcher->first_pattern, 0xff, capacity * sizeof(int32_t));
+    for (size_t i = count; i-- > 0;) {
+        size_t state = 0;
+        for (size_t j = 0; j < sizes[i]; j++) {
+            uint16_t* edge = &next[state * 256 + patterns[i][j]];
+            if (!*edge) *edge = (uint16_t)state_count++;
+            state = *edge;
+        }
+        matcher->next_pattern[i] = matcher->first_pattern[state];
+        matcher->first_pattern[state] = (int32_t)i;
+        matcher->starts[patterns[i][0]] = 1;
+    }
+
+    /* In breadth first order, the failure state of every state is resolved
+     * before its children, so missing edges are copied from there. */
+    size_t head = 0;
+    size_t tail = 0;
+    for (int byte = 0; byte < 256; byte++) {
+        uint16_t child = next[byte];
+        if (child) {
+            fail[child] = 0;
+            queue[tail++] = child;
+        }
+    }
+    while (head < tail) {
+        uint16_t state = queue[head++];
+        uint16_t link = fail[state];
+        matcher->output_link[state] = matcher->first_pattern[link] >= 0
+            ? link : matcher->output_link[link];
+        matcher->accepts[state] = matcher->first_pattern[state] >= 0
+            || matcher->output_link[state];
+
+        for (int byte = 0; byte < 256; byte++) {
+            uint16_t* edge = &next[(size_t)state * 256 + byte];
+            if (*edge) {
+                fail[*edge] = next[(size_t)link * 256 + byte];
+                queue[tail++] = *edge;
+            } else {
+                *edge = next[(size_t)link * 256 + byte];
+            }
+        }
+    }
+
+    free(fail);
+    free(queue);
+
+    return matcher;
+}
+
+/**
+ * @brief Runs the automaton over a buffer, starting at the root, and adds
+ * the matches ending after <min_end> and starting before <max_start>.
+ */
+int _huf_search_scan(const struct _huf_search_matcher* matcher,
+        const uint8_t* data, size_t size, size_t min_end, size_t max_start,
+        uint64_t base, struct _huf_search_list* list) {
+    const uint16_t* next = matcher->next;
+    size_t state = 0;
+
+    for (size_t i = 0; i < size; i++) {
+        /* Bytes no pattern starts with keep the root at the root. */
+        if (state == 0) {
+            while (i < size && !matcher->starts[data[i]]) i++;
+            if (i == size) break;
+        }
+
+        state = next[state * 256 + data[i]];
+        if (!matcher->accepts[state] || i + 1 <= min_end) continue;
+
+        for (size_t s = state; s; s = matcher->output_link[s]) {
+            for (int32_t p = matcher->first_pattern[s]; p >= 0;
+                    p = matcher->next_pattern[p]) {
+                size_t start = i + 1 - matcher->sizes[p];
+                if (start < max_start
+                        && _huf_search_list_add(list, base + start, (size_t)p)) {
+                    return 1;
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+
+void _huf_search_block(void* context, size_t item, int worker) {
+    struct _huf_search_job* job = context;
+    struct _huf_search_worker* buffers = &job->workers[worker];
+    struct _huf_search_block* block = &job->blocks[item];
+    struct frame_index_entry* entry = &job->index->entries[job->first_block + item];
+    const size_t* sizes = job->matcher->sizes;
+
+    uint8_t present[256];
+    if (frame_index_block_symbols(job->index, job->stream, entry, present)) {
+        block->error = errno ? errno : ERR_PARSE_ERROR;
+        return;
+    }
+
+    /* A match touching the block begins or ends in it unless it covers
+     * the whole block, and lies in it only if all its bytes occur. */
+    int touched = 0;
+    int contained = 0;
+    for (size_t i = 0; i < job->pattern_count && !contained; i++) {
+        const uint8_t* pattern = job->patterns[i];
+        if (entry->raw_size < sizes[i] || present[pattern[0]]
+                || present[pattern[sizes[i] - 1]]) {
+            touched = 1;
+        }
+
+        size_t j = 0;
+        while (j < sizes[i] && present[pattern[j]]) j++;
+        contained = j == sizes[i];
+    }
+    if (!touched) {
+        block->skipped = 1;
+        return;
+    }
+
+    if (frame_reserve(&buffers->output, &buffers->output_capacity,
+                entry->raw_size)
+            || frame_index_decode_block(job->index, job->stream, entry,
+                buffers->output, &buffers->scratch, &buffers->scratch_capacity,
+                NULL)) {
+        block->error = errno ? errno : ERR_PARSE_ERROR;
+        return;
+    }
+
+    size_t keep = job->matcher->max_size - 1;
+    block->edge_size = entry->raw_size < keep ? entry->raw_size : keep;
+    memcpy(block->edges, buffers->output, block->edge_size);
+    memcpy(block->edges + keep,
+        buffers->output + entry->raw_size - block->edge_size, block->edge_size);
+
+    if (contained && _huf_search_scan(job->matcher, buffers->output,
+            entry->raw_size, 0, entry->raw_size, entry->raw_offset,
+            &block->list)) {
+        block->error = errno;
+    }
+}
+
+/**
+ * @brief Collects the matches of a round in the order of the blocks,
+ * including those crossing into a block from the bytes in front of it.
+ * <window> holds the last <*carry_size> bytes in front of the round.
+ */
+int _huf_search_collect(struct _huf_search_job* job, size_t block_count,
+        uint8_t* window, size_t* carry_size, struct _huf_search_list* pending,
+        struct huf_search_result* result) {
+    size_t keep = job->matcher->max_size - 1;
+
+    for (size_t i = 0; i < block_count; i++) {
+        struct _huf_search_block* block = &job->blocks[i];
+        struct frame_index_entry* entry = &job->index->entries[job->first_block + i];
+        if (block->error) {
+            errno = block->error;
+            return 1;
+        }
+
+        /* No match can reach across a block that none touches. */
+        if (block->skipped) {
+            result->skipped_blocks++;
+            *carry_size = 0;
+            continue;
+        }
+
+        size_t carry = *carry_size;
+        if (carry) {
+            memcpy(window + carry, block->edges, block->edge_size);
+            if (_huf_search_scan(job->matcher, window, carry + block->edge_size,
+                    carry, carry, entry->raw_offset - carry, pending)) {
+                return 1;
+            }
+        }
+
+        for (size_t j = 0; j < block->list.count; j++) {
+            if (_huf_search_list_add(pending, block->list.matches[j].offset,
+                    block->list.matches[j].pattern)) {
+                return 1;
+            }
+        }
+
+        /* The window keeps the last bytes of everything searched so far. */
+        const uint8_t* tail = block->edges + keep;
+        if (block->edge_size >= keep) {
+            memcpy(window, tail, keep);
+            *carry_size = keep;
+        } else {
+            size_t kept = carry + block->edge_size > keep
+                ? keep - block->edge_size : carry;
+            memmove(window, window + carry - kept, kept);
+            memcpy(window + kept, tail, block->edge_size);
+            *carry_size = kept + block->edge_size;
+        }
+    }
+
+    return 0;
+}
+
+int huf_search_index(struct frame_index* index, FILE* stream,
+        const uint8_t* const* patterns, const size_t* pattern_sizes,
+        size_t pattern_count, int thread_count, huf_search_callback callback,
+        void* context, struct huf_search_result* result) {
+    memset(result, 0, sizeof(struct huf_search_result));
+
+    struct _huf_search_matcher* matcher = _huf_search_matcher_create(patterns,
+        pattern_sizes, pattern_count);
+    if (!matcher) return 1;
+
+    result->raw_size = index->raw_size;
+    result->block_count = index->entry_count;
+
+    struct thread_pool* pool = thread_pool_create(thread_count);
+    size_t round_size = pool ? (size_t)pool->thread_count * _HUF_SEARCH_ROUND_BLOCKS : 0;
+    size_t keep = matcher->max_size - 1;
+
+    struct _huf_search_job job;
+    job.index = index;
+    job.stream = stream;
+    job.patterns = patterns;
+    job.pattern_count = pattern_count;
+    job.matcher = matcher;
+    job.workers = pool ? calloc((size_t)pool->thread_count,
+        sizeof(struct _huf_search_worker)) : NULL;
+    job.blocks = pool ? calloc(round_size, sizeof(struct _huf_search_block)) : NULL;
+    job.first_block = 0;
+    uint8_t* edges = pool ? malloc(round_size * 2 * keep + 1) : NULL;
+    uint8_t* window = malloc(2 * keep + 1);
+    struct _huf_search_list pending = { NULL, 0, 0 };
+
+    int error_code = !pool;
+    if (!error_code && (!job.workers || !job.blocks || !edges || !window)) {
+        errno = ERR_MEM_ERROR;
+        error_code = 1;
+    }
+
+    size_t carry_size = 0;
+    int stopped = 0;
+    while (!error_code && !stopped && job.first_block < index->entry_count) {
+        size_t block_count = index->entry_count - job.first_block;
+        if (block_count > round_size) block_count = round_size;
+
+        for (size_t i = 0; i < block_count; i++) {
+            job.blocks[i].list.count = 0;
+            job.blocks[i].edges = edges + i * 2 * keep;
+            job.blocks[i].edge_size = 0;
+            job.blocks[i].skipped = 0;
+            job.blocks[i].error = 0;
+        }
+        thread_pool_run(pool, _huf_search_block, &job, block_count);
+
+        error_code = _huf_search_collect(&job, block_count, window, &carry_size,
+            &pending, result);
+        if (error_code) break;
+        job.first_block += block_count;
+
+        /* Matches crossing into the next round start in the window, so
+         * those at or behind its start are held back until then. */
+        uint64_t limit = job.first_block < index->entry_count
+            ? index->entries[job.first_block].raw_offset - carry_size
+            : UINT64_MAX;
+        if (pending.count) {
+            qsort(pending.matches, pending.count,
+                sizeof(struct _huf_search_match), _huf_search_compare);
+        }
+
+        size_t reported = 0;
+        while (reported < pending.count && pending.matches[reported].offset < limit) {
+            result->match_count++;
+            if (callback(context, pending.matches[reported].offset,
+                    pending.matches[reported].pattern)) {
+                stopped = 1;
+                break;
+            }
+            reported++;
+        }
+        pending.count -= reported;
+        if (pending.count) {
+            memmove(pending.matches, pending.matches + reported,
+                pending.count * sizeof(struct _huf_search_match));
+        }
+    }
+
+    if (job.workers) {
+        for (int i = 0; i < pool->thread_count; i++) {
+            free(job.workers[i].output);
+            free(job.workers[i].scratch);
+        }
+        free(job.workers);
+    }
+    if (job.blocks) {
+        for (size_t i = 0; i < round_size; i++) {
+            free(job.blocks[i].list.matches);
+        }
+        free(job.blocks);
+    }
+    free(edges);
+    free(window);
+    free(pending.matches);
+    if (pool) thread_pool_free(pool);
+    _huf_search_matcher_free(matcher);
+
+    return error_code;
+}
+
+int huf_search(FILE* stream, const uint8_t* const* patterns,
+        const size_t* pattern_sizes, size_t pattern_count, int thread_count,
+        huf_search_callback callback, void* context,
+        struct huf_search_result* result) {
+    memset(result, 0, sizeof(struct huf_search_result));
+
+    struct frame_index* index = frame_index_load(stream);
+    if (!index) return 1;
+
+    int error_code = huf_search_index(index, stream, patterns, pattern_sizes,
+        pattern_count, thread_count, callback, context, result);
+    frame_index_free(index);
+
+    return error_code;
+}
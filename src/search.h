@@ -0,0 +1,107 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "error.h"
+#include "frame.h"
+#include "frame_index.h"
+#include "thread_pool.h"
+
+
+/*
+ * Patterns are searched for block by block, without writing the decoded
+ * bytes anywhere: every thread decodes one block at a time into a buffer of
+ * its own and runs an Aho-Corasick automaton of all patterns over it. Matches
+ * that cross the boundary between blocks are found from the last and first
+ * bytes of the blocks around it.
+ *
+ * The code of a block lists the bytes it can hold. A match touching a block
+ * either lies in it or begins or ends in it, so a block holding neither the
+ * first nor the last byte of any pattern is not decoded at all.
+ */
+
+/** Maximum number of bytes of a single pattern. */
+#define HUF_SEARCH_MAX_PATTERN_SIZE 1024
+
+/** Maximum number of bytes of all patterns together. */
+#define HUF_SEARCH_MAX_TOTAL_SIZE 4096
+
+
+/**
+ * @brief Called for every match found, in increasing order of the offsets.
+ *
+ * @param context the context passed to huf_search().
+ * @param offset the uncompressed offset of the first byte of the match.
+ * @param pattern the position of the matching pattern in the patterns.
+ * @return int non-zero to stop the search, zero to continue.
+ */
+typedef int (*huf_search_callback)(void* context, uint64_t offset,
+    size_t pattern);
+
+/**
+ * @brief The outcome of searching a compressed file.
+ */
+struct huf_search_result {
+    /** Number of bytes the file decodes to. */
+    uint64_t raw_size;
+    uint64_t block_count;
+    /** Number of blocks whose code shows that no match can touch them. */
+    uint64_t skipped_blocks;
+    /** Number of matches passed to the callback. */
+    uint64_t match_count;
+};
+
+
+/**
+ * @brief Finds every occurrence of a set of patterns in the uncompressed
+ * contents of a framed file, without writing them anywhere. The blocks are
+ * decoded and searched in parallel. Occurrences may overlap, and a pattern
+ * given twice is reported twice.
+ *
+ * @param stream the seekable stream of the compressed file.
+ * @param patterns the byte strings to search for.
+ * @param pattern_sizes the number of bytes of every pattern, at least 1
+ * and at most HUF_SEARCH_MAX_PATTERN_SIZE.
+ * @param pattern_count the number of patterns, at least 1.
+ * @param thread_count the number of threads to use, 0 for one per processor.
+ * @param callback called on the calling thread for every match.
+ * @param context passed to every call of <callback>.
+ * @param result the result to be filled.
+ * @return int non-zero if an error occurred, zero otherwise, also if the
+ * search was stopped by <callback>. errno is set to ERR_ILLEGAL_ARG if
+ * the patterns are empty or too long.
+ */
+int huf_search(FILE* stream, const uint8_t* const* patterns,
+    const size_t* pattern_sizes, size_t pattern_count, int thread_count,
+    huf_search_callback callback, void* context,
+    struct huf_search_result* result);
+
+/**
+ * @brief Finds every occurrence of a set of patterns like huf_search(), but
+ * in the blocks of an index already loaded, such as one of
+ * frame_index_load_prefix() that leaves out a frame cut short.
+ *
+ * @param index the index of <stream>.
+ * @param stream the seekable stream of the compressed file.
+ * @param patterns the byte strings to search for.
+ * @param pattern_sizes the number of bytes of every pattern, at least 1
+ * and at most HUF_SEARCH_MAX_PATTERN_SIZE.
+ * @param pattern_count the number of patterns, at least 1.
+ * @param thread_count the number of threads to use, 0 for one per processor.
+ * @param callback called on the calling thread for every match.
+ * @param context passed to every call of <callback>.
+ * @param result the result to be filled.
+ * @return int non-zero if an error occurred, zero otherwise, as with
+ * huf_search().
+ */
+int huf_search_index(struct frame_index* index, FILE* stream,
+    const uint8_t* const* patterns, const size_t* pattern_sizes,
+    size_t pattern_count, int thread_count, huf_search_callback callback,
+    void* context, struct huf_search_result* result);
+
+
+#endif
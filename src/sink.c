@@ -0,0 +1,213 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include "sink.h"
+
+#include <string.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#endif
+
+
+int _sink_stream_write(void* context, const uint8_t* data, size_t size) {
+    if (fwrite(data, 1, size, context) != size) {
+        errno = ERR_IO_ERROR;
+        return 1;
+    }
+
+    return 0;
+}
+
+void sink_stream_init(FILE* stream, struct sink* sink) {
+    sink->reserve = NULL;
+    sink->write = _sink_stream_write;
+    sink->context = stream;
+}
+
+/* Skips the buffers that are full or empty. */
+void _sink_buffers_skip(struct sink_buffers* buffers) {
+    while (buffers->index < buffers->count
+            && buffers->offset == buffers->vectors[buffers->index].length) {
+        buffers->index++;
+        buffers->offset = 0;
+    }
+}
+
+uint8_t* _sink_buffers_reserve(void* context, size_t size) {
+    struct sink_buffers* buffers = context;
+    _sink_buffers_skip(buffers);
+    if (buffers->index == buffers->count) return NULL;
+
+    const struct sink_iovec* vector = &buffers->vectors[buffers->index];
+    if (vector->length - buffers->offset < size) return NULL;
+
+    return (uint8_t*)vector->base + buffers->offset;
+}
+
+int _sink_buffers_write(void* context, const uint8_t* data, size_t size) {
+    struct sink_buffers* buffers = context;
+    while (size > 0) {
+        _sink_buffers_skip(buffers);
+        if (buffers->index == buffers->count) {
+            errno = ERR_ILLEGAL_ARG;
+            return 1;
+        }
+
+        /* Bytes decoded into the reserved memory are already in place. */
+        const struct sink_iovec* vector = &buffers->vectors[buffers->index];
+        uint8_t* target = (uint8_t*)vector->base + buffers->offset;
+        size_t chunk = vector->length - buffers->offset;
+        if (chunk > size) chunk = size;
+        if (target != data) memmove(target, data, chunk);
+
+        buffers->offset += chunk;
+        buffers->size += chunk;
+        data += chunk;
+        size -= chunk;
+    }
+
+    return 0;
+}
+
+void sink_buffers_init(struct sink_buffers* buffers,
+        const struct sink_iovec* vectors, size_t count, struct sink* sink) {
+    buffers->vectors = vectors;
+    buffers->count = count;
+    buffers->index = 0;
+    buffers->offset = 0;
+    buffers->size = 0;
+
+    sink->reserve = _sink_buffers_reserve;
+    sink->write = _sink_buffers_write;
+    sink->context = buffers;
+}
+
+#ifdef __linux__
+/* Waits until the pipe holds no byte spliced from a buffer anymore, that is
+ * until it holds no more than the bytes written after them, or until the
+ * reader has gone and nobody takes the bytes anymore. */
+void _sink_pipe_wait(struct sink_pipe* pipe, int buffer) {
+    uint64_t after = pipe->written - pipe->spliced[buffer];
+    struct timespec delay = {0, 50000};
+    int unread;
+    while (!ioctl(pipe->fd, FIONREAD, &unread) && (uint64_t)unread > after) {
+        struct pollfd events = {pipe->fd, POLLOUT, 0};
+        if (poll(&events, 1, 0) > 0 && (events.revents & POLLERR)) break;
+        nanosleep(&delay, NULL);
+    }
+}
+#endif
+
+uint8_t* _sink_pipe_reserve(void* context, size_t size) {
+    struct sink_pipe* pipe = context;
+    if (!pipe->splice) return NULL;
+
+    /* The buffers are used in turn, so that one can be filled while the
+     * reader still takes the pages of the other. */
+    int buffer = pipe->current == 0 ? 1 : 0;
+#ifdef __linux__
+    _sink_pipe_wait(pipe, buffer);
+#endif
+    if (size > pipe->capacities[buffer]) {
+        uint8_t* resized = realloc(pipe->buffers[buffer], size);
+        if (!resized) return NULL;
+        pipe->buffers[buffer] = resized;
+        pipe->capacities[buffer] = size;
+    }
+    pipe->current = buffer;
+
+    return pipe->buffers[buffer];
+}
+
+int _sink_pipe_write(void* context, const uint8_t* data, size_t size) {
+    struct sink_pipe* pipe = context;
+    int buffer = pipe->current;
+
+#ifdef __linux__
+    if (pipe->splice && buffer >= 0 && data == pipe->buffers[buffer]) {
+        while (size > 0) {
+            struct iovec vector = {(void*)data, size};
+            ssize_t spliced = vmsplice(pipe->fd, &vector, 1, 0);
+            if (spliced < 0 && errno == EINTR) continue;
+            if (spliced <= 0) {
+                errno = ERR_IO_ERROR;
+                return 1;
+            }
+            data += spliced;
+            size -= (size_t)spliced;
+            pipe->written += (uint64_t)spliced;
+        }
+        pipe->spliced[buffer] = pipe->written;
+
+        return 0;
+    }
+#else
+    (void)buffer;
+#endif
+
+    while (size > 0) {
+#ifdef _WIN32
+        int chunk = size > (1u << 30) ? 1 << 30 : (int)size;
+        int written = _write(pipe->fd, data, chunk);
+#else
+        ssize_t written = write(pipe->fd, data, size);
+        if (written < 0 && errno == EINTR) continue;
+#endif
+        if (written <= 0) {
+            errno = ERR_IO_ERROR;
+            return 1;
+        }
+        data += written;
+        size -= (size_t)written;
+        pipe->written += (uint64_t)written;
+    }
+
+    return 0;
+}
+
+struct sink_pipe* sink_pipe_create(int fd, struct sink* sink) {
+    struct sink_pipe* pipe = calloc(1, sizeof(struct sink_pipe));
+    if (!pipe) {
+        errno = ERR_MEM_ERROR;
+        return NULL;
+    }
+    pipe->fd = fd;
+    pipe->current = -1;
+
+#ifdef __linux__
+    struct stat info;
+    pipe->splice = !fstat(fd, &info) && S_ISFIFO(info.st_mode);
+#endif
+
+    sink->reserve = _sink_pipe_reserve;
+    sink->write = _sink_pipe_write;
+    sink->context = pipe;
+
+    return pipe;
+}
+
+void sink_pipe_free(struct sink_pipe* pipe) {
+    /* The pages of the buffers must stay as they were until the reader has
+     * taken them. */
+#ifdef __linux__
+    for (int i = 0; i < 2; i++) {
+        if (pipe->buffers[i]) _sink_pipe_wait(pipe, i);
+    }
+#endif
+    free(pipe->buffers[0]);
+    free(pipe->buffers[1]);
+    free(pipe);
+}
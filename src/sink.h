@@ -0,0 +1,124 @@
+#ifndef SINK_H
+#define SINK_H
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "error.h"
+
+
+/*
+ * A sink receives decoded bytes instead of a stream, so that callers can
+ * take them without a copy through the standard library. A sink may offer
+ * the memory the next bytes are to end up in, which decoders then decode
+ * into directly, and is handed every run of bytes once it is complete,
+ * whether it was decoded into memory of the sink or not. Sinks are provided
+ * for streams, for buffers given by the caller and, on Linux, for pipes,
+ * into which the decoded pages are spliced instead of copied.
+ */
+
+
+/**
+ * @brief Where decoded bytes are delivered.
+ */
+struct sink {
+    /**
+     * Returns the memory the next <size> bytes may be decoded into, or NULL
+     * if they should be decoded elsewhere. May be NULL itself. The memory
+     * is only filled, the bytes are still passed to write() afterwards.
+     */
+    uint8_t* (*reserve)(void* context, size_t size);
+    /**
+     * Takes the next <size> bytes, which are valid only during the call.
+     * Returns non-zero and sets errno if an error occurred.
+     */
+    int (*write)(void* context, const uint8_t* data, size_t size);
+    void* context;
+};
+
+/**
+ * @brief A buffer given by the caller, as in an iovec.
+ */
+struct sink_iovec {
+    void* base;
+    size_t length;
+};
+
+/**
+ * @brief The state of a sink filling buffers in order.
+ */
+struct sink_buffers {
+    const struct sink_iovec* vectors;
+    size_t count;
+    /** The buffer being filled and the bytes already written to it. */
+    size_t index;
+    size_t offset;
+    /** The number of bytes written to all buffers. */
+    uint64_t size;
+};
+
+/**
+ * @brief A sink splicing decoded bytes into a pipe.
+ */
+struct sink_pipe {
+    int fd;
+    /** Non-zero if bytes reserved in the buffers are spliced. */
+    int splice;
+    /** Two buffers, of which one is filled while the other is spliced. */
+    uint8_t* buffers[2];
+    size_t capacities[2];
+    /** The buffer handed out by the last reservation, -1 for none. */
+    int current;
+    /** The number of bytes written to the pipe so far, and the number
+     * written when each buffer was last spliced. */
+    uint64_t written;
+    uint64_t spliced[2];
+};
+
+
+/**
+ * @brief Makes a sink write to a stream.
+ *
+ * @param stream the stream the bytes are written to.
+ * @param sink set to the sink, valid as long as <stream> is open.
+ */
+void sink_stream_init(FILE* stream, struct sink* sink);
+
+/**
+ * @brief Makes a sink fill buffers of the caller in order. Runs of bytes
+ * that fit into what is left of the current buffer are decoded into it.
+ *
+ * @param buffers the state of the sink, set up by the call.
+ * @param vectors the buffers, which must outlive the sink.
+ * @param count the number of entries of <vectors>.
+ * @param sink set to the sink, which fails with ERR_ILLEGAL_ARG once the
+ * buffers cannot take the bytes written.
+ */
+void sink_buffers_init(struct sink_buffers* buffers,
+    const struct sink_iovec* vectors, size_t count, struct sink* sink);
+
+/**
+ * @brief Creates a sink writing to a file descriptor. If it is a pipe on
+ * Linux, bytes are decoded into buffers of the sink and spliced into the
+ * pipe with vmsplice(), and a buffer is only reused once the pipe holds none
+ * of its pages anymore. Other descriptors are written to with write().
+ *
+ * @param fd the descriptor the bytes are written to.
+ * @param sink set to the sink.
+ * @return struct sink_pipe* the state of the sink, NULL if an error
+ * occurred. Must be freed with a call to sink_pipe_free().
+ */
+struct sink_pipe* sink_pipe_create(int fd, struct sink* sink);
+
+/**
+ * @brief Waits until the reader of the pipe has taken all spliced bytes and
+ * frees a pipe sink.
+ *
+ * @param pipe the sink to be freed.
+ */
+void sink_pipe_free(struct sink_pipe* pipe);
+
+
+#endif
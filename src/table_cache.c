@@ -0,0 +1,216 @@
+#include "table_cache.h"
+
+#include <string.h>
+#include <math.h>
+
+
+struct table_cache* table_cache_create(size_t capacity, double tolerance) {
+    struct table_cache* cache = calloc(1, sizeof(struct table_cache));
+    if (!cache) {
+        errno = ERR_MEM_ERROR;
+        return NULL;
+    }
+
+    cache->entries = calloc(capacity ? capacity : 1, sizeof(struct table_cache_entry));
+    if (!cache->entries) {
+        free(cache);
+        errno = ERR_MEM_ERROR;
+        return NULL;
+    }
+    cache->capacity = capacity;
+    cache->tolerance = tolerance;
+
+#ifdef HUF_HAVE_PTHREAD
+    pthread_mutex_init(&cache->mutex, NULL);
+#endif
+
+    return cache;
+}
+
+void _table_cache_lock(struct table_cache* cache) {
+#ifdef HUF_HAVE_PTHREAD
+    pthread_mutex_lock(&cache->mutex);
+#else
+    (void)cache;
+#endif
+}
+
+void _table_cache_unlock(struct table_cache* cache) {
+#ifdef HUF_HAVE_PTHREAD
+    pthread_mutex_unlock(&cache->mutex);
+#else
+    (void)cache;
+#endif
+}
+
+void _table_cache_clear_entry(struct table_cache_entry* entry) {
+    if (entry->mapping) mapping_dict_free(entry->mapping);
+    if (entry->tree) huffman_tree_free(entry->tree);
+    memset(entry, 0, sizeof(struct table_cache_entry));
+}
+
+/* Rounds the ideal code length of every byte down to whole bits. */
+void _table_cache_signature(struct freq_dict* dict, uint8_t* signature) {
+    double total = (double)freq_dict_total(dict);
+    for (int i = 0; i < 256; i++) {
+        uint64_t frequency = dict->frequencies[i];
+        int length = frequency
+            ? 1 + (int)floor(log2(total / (double)frequency)) : 0;
+        signature[i] = (uint8_t)(length > TABLE_CACHE_MAX_LENGTH
+            ? TABLE_CACHE_MAX_LENGTH : length);
+    }
+}
+
+struct table_cache_entry* _table_cache_find(struct table_cache* cache,
+        uint32_t hash, const uint8_t* signature, int max_code_length) {
+    for (size_t i = 0; i < cache->capacity; i++) {
+        struct table_cache_entry* entry = &cache->entries[i];
+        if (entry->tree && entry->hash == hash
+                && entry->max_code_length == max_code_length
+                && !memcmp(entry->signature, signature, 256)) {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+/* Returns an unused entry, or the least recently used one nobody holds. */
+struct table_cache_entry* _table_cache_victim(struct table_cache* cache) {
+    struct table_cache_entry* victim = NULL;
+    for (size_t i = 0; i < cache->capacity; i++) {
+        struct table_cache_entry* entry = &cache->entries[i];
+        if (!entry->tree) return entry;
+        if (entry->references == 0
+                && (!victim || entry->last_use < victim->last_use)) {
+            victim = entry;
+        }
+    }
+
+    return victim;
+}
+
+int table_cache_lookup(struct table_cache* cache,
+        const struct frame_params* params, struct freq_dict* dict,
+        struct huffman_tree** tree, struct mapping_dict** mapping) {
+    uint8_t signature[256];
+    _table_cache_signature(dict, signature);
+    uint32_t hash = crc32c_update(0, signature, sizeof(signature));
+    uint64_t total = freq_dict_total(dict);
+    double entropy = freq_dict_entropy_bits(dict);
+    int pairs = total >= MAPPING_DICT_PAIR_MIN_SIZE;
+    *tree = NULL;
+    *mapping = NULL;
+
+    /* A tree of its own is expected to spend as many bits above the entropy
+     * per byte as the cached tree did on the bytes it was built from. Both
+     * are stored in the frame, which the tolerance applies to as well. Trees
+     * of the same signature code the same bytes and are of the same size. */
+    _table_cache_lock(cache);
+    struct table_cache_entry* entry = _table_cache_find(cache, hash, signature,
+        params->max_code_length);
+    if (entry) {
+        uint64_t bits = mapping_dict_encoded_bits(entry->mapping, dict);
+        double tree_bits = 8 * (double)huffman_tree_serialized_size(entry->tree);
+        double expected = entropy + entry->redundancy * (double)total;
+        if (bits != UINT64_MAX && (double)bits + tree_bits
+                <= (expected + tree_bits) * (1 + cache->tolerance)) {
+            /* Nobody reads the mapping while nobody holds it, so its pair
+             * table can be added. Without one it only codes slower. */
+            if (pairs && !entry->mapping->pairs && entry->references == 0) {
+                mapping_dict_create_pairs(entry->mapping);
+            }
+            entry->references++;
+            entry->last_use = ++cache->clock;
+            cache->hits++;
+            *tree = entry->tree;
+            *mapping = entry->mapping;
+            _table_cache_unlock(cache);
+            return 0;
+        }
+    }
+    cache->misses++;
+    _table_cache_unlock(cache);
+
+    return 0;
+}
+
+int table_cache_get(struct table_cache* cache, const struct frame_params* params,
+        struct freq_dict* dict, struct huffman_tree** tree,
+        struct mapping_dict** mapping) {
+    if (table_cache_lookup(cache, params, dict, tree, mapping)) return 1;
+    if (*tree) return 0;
+
+    uint8_t signature[256];
+    _table_cache_signature(dict, signature);
+    uint32_t hash = crc32c_update(0, signature, sizeof(signature));
+    uint64_t total = freq_dict_total(dict);
+    double entropy = freq_dict_entropy_bits(dict);
+    int pairs = total >= MAPPING_DICT_PAIR_MIN_SIZE;
+
+    /* Trees are built without holding the lock, so that other threads can
+     * use the cache meanwhile. */
+    *tree = frame_create_tree(params, dict);
+    *mapping = *tree ? mapping_dict_create_mapping(*tree) : NULL;
+    if (!*mapping || (pairs && mapping_dict_create_pairs(*mapping))) {
+        if (*mapping) mapping_dict_free(*mapping);
+        if (*tree) huffman_tree_free(*tree);
+        *tree = NULL;
+        *mapping = NULL;
+        return 1;
+    }
+    double redundancy = ((double)mapping_dict_encoded_bits(*mapping, dict)
+        - entropy) / (double)total;
+
+    /* A tree replaces the one under the same signature that did not code
+     * its bytes well enough, unless that one is still in use. */
+    _table_cache_lock(cache);
+    struct table_cache_entry* entry = _table_cache_find(cache, hash, signature,
+        params->max_code_length);
+    if (!entry) {
+        entry = _table_cache_victim(cache);
+    } else if (entry->references > 0) {
+        entry = NULL;
+    }
+    if (entry) {
+        _table_cache_clear_entry(entry);
+        memcpy(entry->signature, signature, sizeof(signature));
+        entry->hash = hash;
+        entry->max_code_length = params->max_code_length;
+        entry->tree = *tree;
+        entry->mapping = *mapping;
+        entry->redundancy = redundancy;
+        entry->references = 1;
+        entry->last_use = ++cache->clock;
+    }
+    _table_cache_unlock(cache);
+
+    return 0;
+}
+
+void table_cache_release(struct table_cache* cache, struct huffman_tree* tree,
+        struct mapping_dict* mapping) {
+    _table_cache_lock(cache);
+    struct table_cache_entry* entry = NULL;
+    for (size_t i = 0; i < cache->capacity && !entry; i++) {
+        if (cache->entries[i].tree == tree) entry = &cache->entries[i];
+    }
+    if (entry) entry->references--;
+    _table_cache_unlock(cache);
+
+    if (!entry) {
+        mapping_dict_free(mapping);
+        huffman_tree_free(tree);
+    }
+}
+
+void table_cache_free(struct table_cache* cache) {
+    for (size_t i = 0; i < cache->capacity; i++) {
+        _table_cache_clear_entry(&cache->entries[i]);
+    }
+#ifdef HUF_HAVE_PTHREAD
+    pthread_mutex_destroy(&cache->mutex);
+#endif
+    free(cache->entries);
+    free(cache);
+}
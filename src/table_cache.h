@@ -0,0 +1,141 @@
+#ifndef TABLE_CACHE_H
+#define TABLE_CACHE_H
+
+
+#include <stdlib.h>
+#include <inttypes.h>
+
+#include "error.h"
+#include "frame.h"
+
+#ifdef HUF_HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+
+/*
+ * A cache of the trees and mappings built to compress streams of bytes,
+ * keyed by a signature of the histogram they were built from: the length,
+ * rounded down, of the ideal code of every byte. Streams of similar
+ * contents, like the logs of the same service on different hosts, share a
+ * signature, and a stream finding a tree under its signature that codes it
+ * within the tolerance of what its own tree is estimated to achieve is
+ * coded with that tree instead of building one. The tree is still stored in
+ * every frame, so the frames decode on their own, and decoders caching
+ * codes by their bytes build it once. The cache may be shared by several
+ * threads, which only ever read the cached trees and mappings.
+ */
+
+#define TABLE_CACHE_DEFAULT_CAPACITY 64
+/** Default extra size, relative to that of its own tree, a cached tree may
+ * code a stream with. */
+#define TABLE_CACHE_DEFAULT_TOLERANCE 0.01
+/** Largest ideal code length a signature tells apart. */
+#define TABLE_CACHE_MAX_LENGTH 31
+
+
+/**
+ * @brief A cached tree with the signature of the bytes it was built from.
+ */
+struct table_cache_entry {
+    /** The rounded ideal code length of every byte, 0 for bytes that do
+     * not occur. */
+    uint8_t signature[256];
+    uint32_t hash;
+    /** The code length limit the tree was built with. */
+    int max_code_length;
+    /** The tree, NULL if the entry is unused. */
+    struct huffman_tree* tree;
+    struct mapping_dict* mapping;
+    /** The bits per byte the tree spent on its bytes above their entropy. */
+    double redundancy;
+    /** Number of callers that have not released the entry yet. */
+    int references;
+    /** Value of the clock of the cache when the entry was last used. */
+    uint64_t last_use;
+};
+
+/**
+ * @brief A fixed number of trees, of which the least recently used ones are
+ * replaced once the cache is full.
+ */
+struct table_cache {
+    struct table_cache_entry* entries;
+    size_t capacity;
+    double tolerance;
+    uint64_t clock;
+    uint64_t hits;
+    uint64_t misses;
+#ifdef HUF_HAVE_PTHREAD
+    pthread_mutex_t mutex;
+#endif
+};
+
+
+/**
+ * @brief Creates an empty cache.
+ *
+ * @param capacity the maximum number of trees held.
+ * @param tolerance the extra size, relative to the estimated size with a
+ * tree of their own, streams may be coded with by a cached tree.
+ * @return struct table_cache* the created cache.
+ * Must be freed with a call to table_cache_free().
+ */
+struct table_cache* table_cache_create(size_t capacity, double tolerance);
+
+/**
+ * @brief Looks up a cached tree that codes the bytes counted in a dict well
+ * enough, together with the tree stored in their frame, without building
+ * one if there is none.
+ *
+ * @param cache the cache to look the tree up in.
+ * @param params the parameters the tree would be built with.
+ * @param dict the frequencies of the bytes to be coded, not empty.
+ * @param tree set to the tree, NULL if none is cached.
+ * @param mapping set to the mapping of <tree>, NULL if none is cached.
+ * @return int non-zero if an error occurred, zero otherwise. A tree found
+ * must be released with table_cache_release().
+ */
+int table_cache_lookup(struct table_cache* cache,
+    const struct frame_params* params, struct freq_dict* dict,
+    struct huffman_tree** tree, struct mapping_dict** mapping);
+
+/**
+ * @brief Returns a tree and mapping for the bytes counted in a dict: a
+ * cached one if one codes them well enough, otherwise one built for them,
+ * which is cached in turn. The mapping has a pair table if the dict counts
+ * at least MAPPING_DICT_PAIR_MIN_SIZE bytes, unless other callers held the
+ * cached mapping at the time.
+ *
+ * @param cache the cache to look the tree up in.
+ * @param params the parameters the tree is built with.
+ * @param dict the frequencies of the bytes to be coded, not empty.
+ * @param tree set to the tree.
+ * @param mapping set to the mapping of <tree>.
+ * @return int non-zero if an error occurred, zero otherwise. On success,
+ * the tree must be released with table_cache_release().
+ */
+int table_cache_get(struct table_cache* cache, const struct frame_params* params,
+    struct freq_dict* dict, struct huffman_tree** tree,
+    struct mapping_dict** mapping);
+
+/**
+ * @brief Releases a tree returned by table_cache_get(). Trees that could
+ * not be cached are freed together with their mapping.
+ *
+ * @param cache the cache the tree was returned by.
+ * @param tree the tree returned.
+ * @param mapping the mapping returned.
+ */
+void table_cache_release(struct table_cache* cache, struct huffman_tree* tree,
+    struct mapping_dict* mapping);
+
+/**
+ * @brief Frees a cache and all trees in it. No tree may be in use.
+ *
+ * @param cache the cache to be freed.
+ */
+void table_cache_free(struct table_cache* cache);
+
+
+#endif
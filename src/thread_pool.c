@@ -0,0 +1,158 @@
+#include "thread_pool.h"
+#include "trace.h"
+#include "numa.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+
+int thread_pool_cpu_count() {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    long count = (long)info.dwNumberOfProcessors;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+
+    return count > 0 ? (int)count : 1;
+}
+
+
+#ifdef HUF_HAVE_PTHREAD
+/* Processes items of the current loop until none are left. Called and
+ * returns with the mutex held. */
+void _thread_pool_work(struct thread_pool* pool, int worker) {
+    while (pool->next_item < pool->item_count) {
+        size_t item = pool->next_item++;
+
+        pthread_mutex_unlock(&pool->mutex);
+        pool->task(pool->context, item, worker);
+        pthread_mutex_lock(&pool->mutex);
+    }
+}
+
+struct _thread_pool_start {
+    struct thread_pool* pool;
+    int worker;
+    /** The processor to pin the thread to, -1 for none. */
+    int cpu;
+};
+
+void* _thread_pool_thread(void* argument) {
+    struct thread_pool* pool = ((struct _thread_pool_start*)argument)->pool;
+    int worker = ((struct _thread_pool_start*)argument)->worker;
+    int cpu = ((struct _thread_pool_start*)argument)->cpu;
+    free(argument);
+    if (cpu >= 0) numa_pin_thread(cpu);
+
+    char name[TRACE_MAX_THREAD_NAME];
+    snprintf(name, sizeof(name), "worker %d", worker);
+    trace_set_thread_name(name);
+
+    uint64_t generation = 0;
+    pthread_mutex_lock(&pool->mutex);
+    for (;;) {
+        while (!pool->closing && pool->generation == generation) {
+            pthread_cond_wait(&pool->start, &pool->mutex);
+        }
+        if (pool->closing) break;
+
+        generation = pool->generation;
+        _thread_pool_work(pool, worker);
+        if (--pool->busy == 0) pthread_cond_signal(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    return NULL;
+}
+#endif
+
+struct thread_pool* thread_pool_create(int thread_count) {
+    return thread_pool_create_pinned(thread_count, NULL);
+}
+
+struct thread_pool* thread_pool_create_pinned(int thread_count, const int* cpus) {
+    struct thread_pool* pool = calloc(1, sizeof(struct thread_pool));
+    if (!pool) {
+        errno = ERR_MEM_ERROR;
+        return NULL;
+    }
+    if (thread_count <= 0) thread_count = thread_pool_cpu_count();
+
+#ifdef HUF_HAVE_PTHREAD
+    pool->threads = calloc((size_t)thread_count, sizeof(pthread_t));
+    if (!pool->threads) {
+        free(pool);
+        errno = ERR_MEM_ERROR;
+        return NULL;
+    }
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    /* Worker 0 is the thread calling thread_pool_run(). A pool gets by
+     * with fewer threads than requested if some cannot be started. */
+    pool->thread_count = 1;
+    for (int i = 1; i < thread_count; i++) {
+        struct _thread_pool_start* start = malloc(sizeof(struct _thread_pool_start));
+        if (!start) break;
+        start->pool = pool;
+        start->worker = i;
+        start->cpu = cpus ? cpus[i] : -1;
+        if (pthread_create(&pool->threads[i], NULL, _thread_pool_thread, start)) {
+            free(start);
+            break;
+        }
+        pool->thread_count++;
+    }
+#else
+    (void)thread_count;
+    (void)cpus;
+    pool->thread_count = 1;
+#endif
+
+    return pool;
+}
+
+void thread_pool_run(struct thread_pool* pool, thread_pool_task task,
+        void* context, size_t item_count) {
+#ifdef HUF_HAVE_PTHREAD
+    pthread_mutex_lock(&pool->mutex);
+    pool->task = task;
+    pool->context = context;
+    pool->item_count = item_count;
+    pool->next_item = 0;
+    pool->busy = pool->thread_count - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+
+    _thread_pool_work(pool, 0);
+    while (pool->busy > 0) pthread_cond_wait(&pool->done, &pool->mutex);
+    pthread_mutex_unlock(&pool->mutex);
+#else
+    for (size_t i = 0; i < item_count; i++) task(context, i, 0);
+#endif
+}
+
+void thread_pool_free(struct thread_pool* pool) {
+#ifdef HUF_HAVE_PTHREAD
+    pthread_mutex_lock(&pool->mutex);
+    pool->closing = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (int i = 1; i < pool->thread_count; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->start);
+    pthread_mutex_destroy(&pool->mutex);
+    free(pool->threads);
+#endif
+    free(pool);
+}
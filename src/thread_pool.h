@@ -0,0 +1,106 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+
+#include <stdlib.h>
+#include <inttypes.h>
+
+#include "error.h"
+
+#ifdef HUF_HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+
+/**
+ * @brief A function processing one item of a parallel loop.
+ *
+ * @param context the context passed to thread_pool_run().
+ * @param item the item to be processed.
+ * @param worker the number of the thread processing the item, smaller than
+ * the number of threads of the pool. Items processed by the same worker
+ * never run at the same time, so per-worker state needs no locking.
+ */
+typedef void (*thread_pool_task)(void* context, size_t item, int worker);
+
+/**
+ * @brief A fixed set of threads that process the items of parallel loops.
+ * Without thread support, the loops run on the calling thread.
+ */
+struct thread_pool {
+    int thread_count;
+
+    /* The loop currently running. */
+    thread_pool_task task;
+    void* context;
+    size_t item_count;
+    /** The next item that has not been claimed by any worker. */
+    size_t next_item;
+    /** The number of workers that have not finished the current loop. */
+    int busy;
+    /** Incremented for every loop, so workers can tell loops apart. */
+    uint64_t generation;
+
+#ifdef HUF_HAVE_PTHREAD
+    pthread_t* threads;
+    pthread_mutex_t mutex;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    int closing;
+#endif
+};
+
+
+/**
+ * @brief Returns the number of processors available to the process.
+ *
+ * @return int the number of online processors, at least 1.
+ */
+int thread_pool_cpu_count();
+
+/**
+ * @brief Creates a thread pool. The calling thread takes part in every
+ * loop, so <thread_count> - 1 threads are started.
+ *
+ * @param thread_count the number of threads processing items, 0 for
+ * one per processor.
+ * @return struct thread_pool* the created pool.
+ * Must be freed with a call to thread_pool_free().
+ */
+struct thread_pool* thread_pool_create(int thread_count);
+
+/**
+ * @brief Creates a thread pool whose started threads each run on a single
+ * processor. The calling thread, worker 0, is left where it runs, so a
+ * caller wanting it on <cpus[0]> has to pin it itself.
+ *
+ * @param thread_count the number of threads processing items, 0 for
+ * one per processor.
+ * @param cpus the processor of every worker, indexed by worker, NULL to
+ * leave all threads unpinned. A thread that cannot be pinned runs unpinned.
+ * @return struct thread_pool* the created pool.
+ * Must be freed with a call to thread_pool_free().
+ */
+struct thread_pool* thread_pool_create_pinned(int thread_count, const int* cpus);
+
+/**
+ * @brief Processes items in parallel and waits until all are done. Items
+ * are handed out in increasing order as workers become idle.
+ *
+ * @param pool the pool to run the loop on.
+ * @param task the function called for every item.
+ * @param context passed to every call of <task>.
+ * @param item_count the number of items, numbered from 0.
+ */
+void thread_pool_run(struct thread_pool* pool, thread_pool_task task,
+    void* context, size_t item_count);
+
+/**
+ * @brief Stops the threads of a pool and frees it.
+ *
+ * @param pool the pool to be freed.
+ */
+void thread_pool_free(struct thread_pool* pool);
+
+
+#endif
@@ -0,0 +1,190 @@
+#include "trace.h"
+
+#include <string.h>
+#include <time.h>
+
+#ifdef HUF_HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#ifdef _MSC_VER
+#define TRACE_THREAD_LOCAL __declspec(thread)
+#else
+#define TRACE_THREAD_LOCAL _Thread_local
+#endif
+
+
+atomic_int trace_enabled = 0;
+
+#ifdef HUF_TRACE
+/* All rings of the current session, newest first. */
+struct trace_ring* _trace_rings = NULL;
+int _trace_thread_count = 0;
+/* Incremented by trace_clear(), so threads register a new ring after it. */
+uint64_t _trace_session = 1;
+/* Events are exported relative to the first trace_start(). */
+uint64_t _trace_origin = 0;
+#ifdef HUF_HAVE_PTHREAD
+pthread_mutex_t _trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+TRACE_THREAD_LOCAL struct trace_ring* _trace_ring = NULL;
+TRACE_THREAD_LOCAL uint64_t _trace_ring_session = 0;
+TRACE_THREAD_LOCAL char _trace_thread_name[TRACE_MAX_THREAD_NAME];
+#endif
+
+
+uint64_t trace_now() {
+    struct timespec now;
+#ifdef _WIN32
+    timespec_get(&now, TIME_UTC);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &now);
+#endif
+    return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+
+#ifdef HUF_TRACE
+/* Registers a ring for the calling thread. The mutex is only taken once per
+ * thread and session, recording needs no locking. */
+struct trace_ring* _trace_register() {
+    struct trace_ring* ring = malloc(sizeof(struct trace_ring));
+    if (!ring) return NULL;
+    ring->count = 0;
+    strcpy(ring->name, _trace_thread_name[0] ? _trace_thread_name : "thread");
+
+#ifdef HUF_HAVE_PTHREAD
+    pthread_mutex_lock(&_trace_mutex);
+#endif
+    ring->tid = ++_trace_thread_count;
+    ring->next = _trace_rings;
+    _trace_rings = ring;
+    _trace_ring = ring;
+    _trace_ring_session = _trace_session;
+#ifdef HUF_HAVE_PTHREAD
+    pthread_mutex_unlock(&_trace_mutex);
+#endif
+
+    return ring;
+}
+#endif
+
+void trace_record(const char* name, uint64_t start, uint64_t bytes) {
+#ifdef HUF_TRACE
+    if (!atomic_load_explicit(&trace_enabled, memory_order_relaxed)) return;
+
+    struct trace_ring* ring = _trace_ring;
+    if (!ring || _trace_ring_session != _trace_session) {
+        ring = _trace_register();
+        if (!ring) return;
+    }
+
+    struct trace_event* event = ring->events
+        + (ring->count & (TRACE_RING_CAPACITY - 1));
+    event->name = name;
+    event->start = start;
+    event->end = trace_now();
+    event->bytes = bytes;
+    ring->count++;
+#else
+    (void)name;
+    (void)start;
+    (void)bytes;
+#endif
+}
+
+void trace_set_thread_name(const char* name) {
+#ifdef HUF_TRACE
+    strncpy(_trace_thread_name, name, TRACE_MAX_THREAD_NAME - 1);
+    _trace_thread_name[TRACE_MAX_THREAD_NAME - 1] = '\0';
+    if (_trace_ring && _trace_ring_session == _trace_session) {
+        strcpy(_trace_ring->name, _trace_thread_name);
+    }
+#else
+    (void)name;
+#endif
+}
+
+int trace_start() {
+#ifdef HUF_TRACE
+    if (!_trace_origin) _trace_origin = trace_now();
+    atomic_store(&trace_enabled, 1);
+    return 0;
+#else
+    errno = ERR_ILLEGAL_ARG;
+    return 1;
+#endif
+}
+
+void trace_stop() {
+    atomic_store(&trace_enabled, 0);
+}
+
+#ifdef HUF_TRACE
+/* Writes nanoseconds as the microseconds Chrome traces are given in. */
+int _trace_write_microseconds(FILE* stream, const char* key, uint64_t time) {
+    return fprintf(stream, ",\"%s\":%llu.%03u", key,
+        (unsigned long long)(time / 1000), (unsigned)(time % 1000)) < 0;
+}
+#endif
+
+int trace_write_json(FILE* stream) {
+    int error_code = fputs("{\"traceEvents\":[\n", stream) < 0;
+    uint64_t dropped = 0;
+
+#ifdef HUF_TRACE
+    const char* separator = "";
+    for (struct trace_ring* ring = _trace_rings; ring && !error_code;
+            ring = ring->next) {
+        error_code = fprintf(stream, "%s{\"name\":\"thread_name\",\"ph\":\"M\","
+            "\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+            separator, ring->tid, ring->name) < 0;
+        separator = ",\n";
+
+        uint64_t first = ring->count > TRACE_RING_CAPACITY
+            ? ring->count - TRACE_RING_CAPACITY : 0;
+        dropped += first;
+        for (uint64_t i = first; i < ring->count && !error_code; i++) {
+            const struct trace_event* event = ring->events
+                + (i & (TRACE_RING_CAPACITY - 1));
+            error_code = fprintf(stream, ",\n{\"name\":\"%s\",\"ph\":\"X\","
+                    "\"pid\":1,\"tid\":%d", event->name, ring->tid) < 0
+                || _trace_write_microseconds(stream, "ts",
+                    event->start > _trace_origin
+                        ? event->start - _trace_origin : 0)
+                || _trace_write_microseconds(stream, "dur",
+                    event->end - event->start)
+                || fprintf(stream, ",\"args\":{\"bytes\":%llu}}",
+                    (unsigned long long)event->bytes) < 0;
+        }
+    }
+#endif
+
+    if (!error_code) {
+        error_code = fprintf(stream, "\n],\"displayTimeUnit\":\"ns\","
+            "\"otherData\":{\"dropped_events\":%llu}}\n",
+            (unsigned long long)dropped) < 0;
+    }
+    if (error_code) errno = ERR_IO_ERROR;
+
+    return error_code;
+}
+
+void trace_clear() {
+#ifdef HUF_TRACE
+#ifdef HUF_HAVE_PTHREAD
+    pthread_mutex_lock(&_trace_mutex);
+#endif
+    while (_trace_rings) {
+        struct trace_ring* next = _trace_rings->next;
+        free(_trace_rings);
+        _trace_rings = next;
+    }
+    _trace_thread_count = 0;
+    _trace_session++;
+    _trace_origin = 0;
+#ifdef HUF_HAVE_PTHREAD
+    pthread_mutex_unlock(&_trace_mutex);
+#endif
+#endif
+}
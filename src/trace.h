@@ -0,0 +1,136 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+
+#include "error.h"
+
+
+/*
+ * A timeline of what every thread did while tracing was on: reading,
+ * analyzing, planning, encoding and writing blocks, and waiting for the
+ * queues between the threads. Every thread records its events into a ring
+ * of its own without any locking; a full ring overwrites its oldest events.
+ * The rings are exported as Chrome trace JSON, which Perfetto and
+ * chrome://tracing display.
+ *
+ * Without HUF_TRACE, TRACE_BEGIN() and TRACE_END() compile to nothing and
+ * trace_start() fails. With it, they cost a load and a branch while tracing
+ * is off.
+ */
+
+/** Number of events a thread keeps, a power of 2. */
+#define TRACE_RING_CAPACITY (1 << 16)
+
+/** Maximum number of bytes of the name of a thread, including the NUL. */
+#define TRACE_MAX_THREAD_NAME 32
+
+
+/**
+ * @brief An interval during which a thread did one thing.
+ */
+struct trace_event {
+    /** A static string naming what was done. */
+    const char* name;
+    /** Start and end in nanoseconds, see trace_now(). */
+    uint64_t start;
+    uint64_t end;
+    /** Number of bytes processed, 0 if none. */
+    uint64_t bytes;
+};
+
+/**
+ * @brief The events of one thread. Only its thread writes to it.
+ */
+struct trace_ring {
+    struct trace_event events[TRACE_RING_CAPACITY];
+    /** Number of events ever recorded, the newest is at count - 1. */
+    uint64_t count;
+    /** Number of the thread in the trace, from 1. */
+    int tid;
+    char name[TRACE_MAX_THREAD_NAME];
+    struct trace_ring* next;
+};
+
+
+/**
+ * Non-zero while events are recorded. Threads compressing or decoding read
+ * it while the thread calling trace_start() and trace_stop() writes it, so
+ * it is atomic; it is read without ordering, as it only gates recording
+ * into rings no other thread writes to.
+ */
+extern atomic_int trace_enabled;
+
+
+#ifdef HUF_TRACE
+/** Declares <start> as the start of an event, 0 if tracing is off. */
+#define TRACE_BEGIN(start) uint64_t start \
+    = atomic_load_explicit(&trace_enabled, memory_order_relaxed) ? trace_now() : 0
+/** Records the event begun by TRACE_BEGIN(<start>) as ending now. */
+#define TRACE_END(start, name, bytes) \
+    do { if (start) trace_record(name, start, bytes); } while (0)
+#else
+#define TRACE_BEGIN(start)
+#define TRACE_END(start, name, bytes) do { } while (0)
+#endif
+
+
+/**
+ * @brief Returns the current time of the clock events are measured with.
+ *
+ * @return uint64_t a monotonic time in nanoseconds.
+ */
+uint64_t trace_now();
+
+/**
+ * @brief Records an event of the calling thread that ends now. Does nothing
+ * while tracing is off.
+ *
+ * @param name a static string naming the event.
+ * @param start the start of the event, see trace_now().
+ * @param bytes the number of bytes processed, 0 if none.
+ */
+void trace_record(const char* name, uint64_t start, uint64_t bytes);
+
+/**
+ * @brief Names the calling thread in the trace. Threads without a name are
+ * called "thread".
+ *
+ * @param name the name, truncated to TRACE_MAX_THREAD_NAME - 1 bytes.
+ */
+void trace_set_thread_name(const char* name);
+
+/**
+ * @brief Starts recording events. Events recorded before are kept.
+ *
+ * @return int non-zero if an error occurred, zero otherwise. errno is set
+ * to ERR_ILLEGAL_ARG if the library was built without HUF_TRACE.
+ */
+int trace_start();
+
+/**
+ * @brief Stops recording events.
+ */
+void trace_stop();
+
+/**
+ * @brief Writes the recorded events as Chrome trace JSON. Threads must not
+ * record events meanwhile, so tracing must be stopped.
+ *
+ * @param stream the stream to write to.
+ * @return int non-zero if an error occurred, zero otherwise.
+ */
+int trace_write_json(FILE* stream);
+
+/**
+ * @brief Discards all recorded events and frees the rings. Tracing must be
+ * stopped.
+ */
+void trace_clear();
+
+
+#endif
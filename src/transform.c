@@ -0,0 +1,91 @@
+#include "transform.h"
+
+#include <string.h>
+
+
+int transform_from_name(const char* name, struct transform* transform) {
+    const char* parameter = NULL;
+
+    if (!strcmp(name, "none")) {
+        transform->type = TRANSFORM_NONE;
+        transform->parameter = 0;
+        return 0;
+    } else if (!strcmp(name, "delta")) {
+        transform->type = TRANSFORM_DELTA;
+        transform->parameter = 1;
+        return 0;
+    } else if (!strncmp(name, "delta:", 6)) {
+        transform->type = TRANSFORM_DELTA;
+        parameter = name + 6;
+    } else if (!strncmp(name, "xor:", 4)) {
+        transform->type = TRANSFORM_XOR;
+        parameter = name + 4;
+    } else {
+        return 1;
+    }
+
+    char* end;
+    long value = strtol(parameter, &end, 10);
+    if (end == parameter || *end != '\0'
+            || !transform_is_valid(transform->type, (int)value)) {
+        return 1;
+    }
+    transform->parameter = (int)value;
+
+    return 0;
+}
+
+int transform_is_valid(int type, int parameter) {
+    if (type == TRANSFORM_NONE) return parameter == 0;
+
+    return (type == TRANSFORM_DELTA || type == TRANSFORM_XOR)
+        && parameter >= 1 && parameter <= TRANSFORM_MAX_PARAMETER;
+}
+
+void transform_encode(const struct transform* transform,
+        const uint8_t* in_buffer, size_t size, uint8_t* out_buffer) {
+    size_t distance = (size_t)transform->parameter;
+    if (transform->type == TRANSFORM_NONE || distance >= size) {
+        memcpy(out_buffer, in_buffer, size);
+        return;
+    }
+
+    memcpy(out_buffer, in_buffer, distance);
+    if (transform->type == TRANSFORM_DELTA) {
+        for (size_t i = distance; i < size; i++) {
+            out_buffer[i] = (uint8_t)(in_buffer[i] - in_buffer[i - distance]);
+        }
+    } else {
+        for (size_t i = distance; i < size; i++) {
+            out_buffer[i] = in_buffer[i] ^ in_buffer[i - distance];
+        }
+    }
+}
+
+void transform_decode(const struct transform* transform,
+        const uint8_t* in_buffer, size_t size, uint8_t* out_buffer) {
+    size_t distance = (size_t)transform->parameter;
+    if (transform->type == TRANSFORM_NONE || distance >= size) {
+        if (out_buffer != in_buffer) memcpy(out_buffer, in_buffer, size);
+        return;
+    }
+
+    /* Every byte depends on the decoded byte <distance> positions before
+     * it, which has been written to <out_buffer> already. */
+    if (out_buffer != in_buffer) memcpy(out_buffer, in_buffer, distance);
+    if (transform->type == TRANSFORM_DELTA) {
+        for (size_t i = distance; i < size; i++) {
+            out_buffer[i] = (uint8_t)(in_buffer[i] + out_buffer[i - distance]);
+        }
+    } else {
+        for (size_t i = distance; i < size; i++) {
+            out_buffer[i] = in_buffer[i] ^ out_buffer[i - distance];
+        }
+    }
+}
+
+void transform_filter(const void* context,
+        const uint8_t* in_buffer, size_t size, uint8_t* out_buffer) {
+    transform_encode((const struct transform*)context, in_buffer, size,
+        out_buffer);
+}
@@ -0,0 +1,96 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+
+#include <stdlib.h>
+#include <inttypes.h>
+
+
+/*
+ * Reversible transforms applied to the bytes of a block before they are
+ * coded. Smooth numeric data turns into small differences, which are far
+ * fewer distinct symbols than the values themselves.
+ *
+ * TRANSFORM_DELTA replaces every byte by its difference to the byte
+ * <parameter> positions before it: 1 for plain byte-wise deltas, the record
+ * size for interleaved columns. TRANSFORM_XOR replaces every byte by its
+ * XOR with the byte <parameter> positions before it, which is the XOR of
+ * consecutive words of that size, e.g. 4 for floats and 8 for doubles.
+ * The first <parameter> bytes of a block are kept as they are, so every
+ * block can be reversed on its own.
+ */
+
+#define TRANSFORM_NONE 0
+#define TRANSFORM_DELTA 1
+#define TRANSFORM_XOR 2
+
+#define TRANSFORM_MAX_PARAMETER 255
+
+
+/**
+ * @brief A transform and its parameter.
+ */
+struct transform {
+    /** One of the TRANSFORM_* types. */
+    int type;
+    /** The distance in bytes a byte is combined with, 1 to 255. */
+    int parameter;
+};
+
+
+/**
+ * @brief Parses a transform given as "none", "delta", "delta:N" or "xor:N".
+ *
+ * @param name the name of the transform.
+ * @param transform set to the transform.
+ * @return int non-zero if <name> is invalid, zero otherwise.
+ */
+int transform_from_name(const char* name, struct transform* transform);
+
+/**
+ * @brief Checks whether a transform read from a file can be reversed.
+ *
+ * @param type the type of the transform.
+ * @param parameter the parameter of the transform.
+ * @return int non-zero if the transform is known, zero otherwise.
+ */
+int transform_is_valid(int type, int parameter);
+
+/**
+ * @brief Transforms a block.
+ *
+ * @param transform the transform to be applied.
+ * @param in_buffer the bytes of the block.
+ * @param size the number of bytes in <in_buffer>.
+ * @param out_buffer the buffer of <size> bytes the result is written to,
+ * must not overlap <in_buffer>.
+ */
+void transform_encode(const struct transform* transform,
+    const uint8_t* in_buffer, size_t size, uint8_t* out_buffer);
+
+/**
+ * @brief Reverses the transform of a block.
+ *
+ * @param transform the transform the block was encoded with.
+ * @param in_buffer the transformed bytes of the block.
+ * @param size the number of bytes in <in_buffer>.
+ * @param out_buffer the buffer of <size> bytes the original bytes are
+ * written to, may be <in_buffer> itself.
+ */
+void transform_decode(const struct transform* transform,
+    const uint8_t* in_buffer, size_t size, uint8_t* out_buffer);
+
+/**
+ * @brief Calls transform_encode() with a transform passed as untyped
+ * context, for use as a freq_dict_filter.
+ *
+ * @param context the struct transform to be applied.
+ * @param in_buffer the bytes to be transformed.
+ * @param size the number of bytes in <in_buffer>.
+ * @param out_buffer the buffer the result is written to.
+ */
+void transform_filter(const void* context,
+    const uint8_t* in_buffer, size_t size, uint8_t* out_buffer);
+
+
+#endif
@@ -0,0 +1,125 @@
+#include "verify.h"
+
+#include <string.h>
+
+
+/**
+ * @brief The buffers of a thread verifying blocks.
+ */
+struct _huf_verify_worker {
+    uint8_t* output;
+    size_t output_capacity;
+    uint8_t* scratch;
+    size_t scratch_capacity;
+};
+
+/**
+ * @brief The state shared by all threads verifying the blocks of a file.
+ */
+struct _huf_verify_job {
+    struct frame_index* index;
+    FILE* stream;
+    struct _huf_verify_worker* workers;
+    /** The checksum of every block, to verify the checksums of the frames. */
+    uint32_t* checksums;
+    /** The errno of every block that failed, zero for those that did not. */
+    int* errors;
+};
+
+void _huf_verify_block(void* context, size_t item, int worker) {
+    struct _huf_verify_job* job = context;
+    struct _huf_verify_worker* buffers = &job->workers[worker];
+    struct frame_index_entry* entry = &job->index->entries[item];
+
+    if (frame_reserve(&buffers->output, &buffers->output_capacity,
+                entry->raw_size)
+            || frame_index_decode_block(job->index, job->stream, entry,
+                buffers->output, &buffers->scratch, &buffers->scratch_capacity,
+                &job->checksums[item])) {
+        job->errors[item] = errno ? errno : ERR_PARSE_ERROR;
+    }
+}
+
+int _huf_verify_frames(struct _huf_verify_job* job,
+        struct huf_verify_result* result) {
+    struct frame_index* index = job->index;
+
+    for (size_t i = 0; i < index->entry_count; i++) {
+        if (job->errors[i]) {
+            result->failed_offset = index->entries[i].raw_offset;
+            errno = job->errors[i];
+            return 1;
+        }
+    }
+
+    /* The checksum of a frame is that of its blocks one after another. */
+    size_t first = 0;
+    for (size_t frame = 0; frame < index->frame_count; frame++) {
+        uint32_t checksum = 0;
+        size_t i = first;
+        for (; i < index->entry_count && index->entries[i].frame == frame; i++) {
+            checksum = crc32c_combine(checksum, job->checksums[i],
+                index->entries[i].raw_size);
+        }
+
+        if ((index->frames[frame].flags & FRAME_FLAG_CHECKSUM)) {
+            if (checksum != index->frames[frame].checksum) {
+                result->failed_offset = first < index->entry_count
+                    ? index->entries[first].raw_offset : index->raw_size;
+                errno = ERR_CHECKSUM_ERROR;
+                return 1;
+            }
+            result->checksummed_blocks += i - first;
+        }
+        first = i;
+    }
+
+    return 0;
+}
+
+int huf_verify(FILE* stream, int thread_count, struct huf_verify_result* result) {
+    memset(result, 0, sizeof(struct huf_verify_result));
+
+    /* The headers are walked rather than trusting the stored index, which
+     * also finds files that have been cut off. */
+    struct frame_index* index = frame_index_scan(stream);
+    if (!index) return 1;
+
+    result->raw_size = index->raw_size;
+    result->frame_count = index->frame_count;
+    result->block_count = index->entry_count;
+
+    struct thread_pool* pool = thread_pool_create(thread_count);
+    struct _huf_verify_job job;
+    job.index = index;
+    job.stream = stream;
+    job.workers = pool ? calloc((size_t)pool->thread_count,
+        sizeof(struct _huf_verify_worker)) : NULL;
+    job.checksums = calloc(index->entry_count + 1, sizeof(uint32_t));
+    job.errors = calloc(index->entry_count + 1, sizeof(int));
+
+    int error_code = !pool;
+    if (!error_code && (!job.workers || !job.checksums || !job.errors)) {
+        errno = ERR_MEM_ERROR;
+        error_code = 1;
+    }
+
+    if (!error_code) {
+        thread_pool_run(pool, _huf_verify_block, &job, index->entry_count);
+        error_code = _huf_verify_frames(&job, result);
+    }
+
+    if (job.workers) {
+        for (int i = 0; i < pool->thread_count; i++) {
+            free(job.workers[i].output);
+            free(job.workers[i].scratch);
+        }
+        free(job.workers);
+    }
+    free(job.checksums);
+    free(job.errors);
+    if (pool) thread_pool_free(pool);
+    frame_index_free(index);
+
+    return error_code;
+}
@@ -0,0 +1,49 @@
+#ifndef VERIFY_H
+#define VERIFY_H
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "error.h"
+#include "frame.h"
+#include "frame_index.h"
+#include "thread_pool.h"
+
+
+/**
+ * @brief The outcome of verifying a compressed file.
+ */
+struct huf_verify_result {
+    /** Number of bytes the file decodes to. */
+    uint64_t raw_size;
+    uint64_t frame_count;
+    uint64_t block_count;
+    /** Number of blocks whose checksum has been verified. */
+    uint64_t checksummed_blocks;
+    /**
+     * Uncompressed offset of the first block that failed to decode or did
+     * not match its checksum, only valid if the verification failed.
+     */
+    uint64_t failed_offset;
+};
+
+
+/**
+ * @brief Decodes every block of a framed file into scratch buffers and
+ * verifies the checksums of the blocks and frames, without writing any
+ * output. The blocks are decoded in parallel.
+ *
+ * @param stream the seekable stream of the compressed file.
+ * @param thread_count the number of threads to use, 0 for one per processor.
+ * @param result the result to be filled.
+ * @return int non-zero if the file is damaged or an error occurred, zero
+ * otherwise. errno is set to ERR_CHECKSUM_ERROR if a block decodes to bytes
+ * that do not match its checksum, and to ERR_PARSE_ERROR if the file is
+ * truncated or not in the framed format.
+ */
+int huf_verify(FILE* stream, int thread_count, struct huf_verify_result* result);
+
+
+#endif